@@ -4,6 +4,7 @@ CFLAGS  += -Wall -g -MMD -MP
 LDFLAGS += -lpthread
 SRC_DIR  = ./source
 OBJ_DIR  = ./build
+BENCH_DIR = ./bench
 SOURCES  = $(shell ls $(SRC_DIR)/*.cpp)
 OBJS     = $(subst $(SRC_DIR),$(OBJ_DIR), $(SOURCES:.cpp=.o))
 DEPENDS  = $(OBJS:.o=.d)
@@ -24,6 +25,19 @@ $(OBJ_DIR)/%.o: $(SRC_DIR)/%.cpp
 	fi
 	$(CC) $(CFLAGS) $(INCLUDE) -o $@ -c $<
 
+# benchmarks include OpenROBO.cpp directly to reach its static functions
+BENCHES = $(OBJ_DIR)/join_bench
+
+.PHONY: bench
+bench: $(BENCHES)
+	@for b in $(BENCHES); do echo "$$b"; $$b || exit $$?; done
+
+$(OBJ_DIR)/%_bench: $(BENCH_DIR)/%_bench.cpp $(SRC_DIR)/OpenROBO.cpp $(LIBS)
+	@if [ ! -d $(OBJ_DIR) ]; \
+		then echo "mkdir -p $(OBJ_DIR)"; mkdir -p $(OBJ_DIR); \
+	fi
+	$(CC) $(CFLAGS) -O2 $(INCLUDE) -o $@ $< $(LDFLAGS) $(LIBS)
+
 .PHONY: clean
 clean:
 	$(RM) $(TARGET)
@@ -70,6 +84,7 @@ runi: all
 help:
 	@echo "make run; execute once after make"
 	@echo "make runi; execute indefinitely(infinity) after make"
+	@echo "make bench; build and run the benchmarks in $(BENCH_DIR)"
 	@echo "make h; same as \"make help\""
 
 h: help
@@ -0,0 +1,109 @@
+/*
+   Wait/Return Messageの結合表(OpenROBO_joinThreadTable_t)のベンチマーク
+
+   Wait Messageをn件(既定は10000件)溜めた状態で、Return Messageごとに対応するWait Messageを探して外す時間と、
+   逆にReturn Messageをn件溜めた状態で、Wait Messageごとに探して外す時間を測る。
+   結合表は静的関数なので、OpenROBO.cppをそのまま取り込んでビルドする(make bench)
+
+   usage: join_bench [n] [rounds]
+*/
+#include "../source/OpenROBO.cpp"
+
+/*
+   subjectが"Op<i>"で、"#src"と"#seq"を付けたメッセージの複製をn件作る
+*/
+static char** makeMessages(int n, int wait)
+{
+  char **messages = (char **)OpenROBO_malloc(sizeof(char *)*n);
+  char subject[32];
+  int i;
+
+  for (i = 0; i < n; i++) {
+    OpenROBO_MessageBuilder_t builder = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+    snprintf(subject, sizeof(subject), "Op%d", i);
+    if (wait) {
+      OpenROBO_Message_MakeWaitMessage(&builder, subject);
+    } else {
+      OpenROBO_Message_MakeReturnMessage(&builder, subject);
+      OpenROBO_Message_SetReturnValue(&builder, 0);
+    }
+    OpenROBO_Message_setSourceID(&builder, "TP:Plan");
+    OpenROBO_Message_setSeq(&builder, (uint32_t)i + 1);
+    OpenROBO_Message_clone(builder.p, &messages[i]);
+    OpenROBO_MessageBuilder_Term(&builder);
+  }
+  return messages;
+}
+
+/*
+   storedをtableに溜めてから、matchのsubjectで1件ずつ探して外す
+   @return 探して外す1件あたりの時間[nsec]
+*/
+static double run(OpenROBO_joinThreadTable_t *table, char **stored, char **match, int n, double *appendNsec)
+{
+  OpenROBO_MessageView_t view;
+  const char *subject;
+  size_t subjectSize;
+  double start;
+  int i, found = 0;
+
+  start = OpenROBO_getMonotonicTime();
+  for (i = 0; i < n; i++) {
+    char *message;
+    OpenROBO_Message_clone(stored[i], &message);
+    OpenROBO_MessageView_Parse(&view, message);
+    OpenROBO_joinThreadQueue_append(table, message, &view);
+  }
+  *appendNsec = (OpenROBO_getMonotonicTime() - start) * 1e9 / n;
+
+  // 溜めた順と逆に探す(リストを先頭から辿る実装では最も遅い順)
+  start = OpenROBO_getMonotonicTime();
+  for (i = n - 1; i >= 0; i--) {
+    OpenROBO_joinThreadQueue_t *q;
+    OpenROBO_MessageView_Parse(&view, match[i]);
+    OpenROBO_MessageView_GetSubject(&view, &subject, &subjectSize);
+    q = OpenROBO_joinThreadQueue_findByFunctionName(table, subject, subjectSize);
+    if (q != NULL) {
+      OpenROBO_joinThreadQueue_delete(table, q);
+      found++;
+    }
+  }
+  if (found != n || table->size != 0) {
+    fprintf(stderr, "error: matched %d of %d\n", found, n);
+    exit(1);
+  }
+  return (OpenROBO_getMonotonicTime() - start) * 1e9 / n;
+}
+
+int main(int argc, char *argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 10000;
+  int rounds = argc > 2 ? atoi(argv[2]) : 5;
+  char **waits, **returns;
+  double appendNsec, matchNsec;
+  int i;
+
+  if (n <= 0 || rounds <= 0) {
+    fprintf(stderr, "usage: %s [n] [rounds]\n", argv[0]);
+    return 1;
+  }
+  OpenROBO_StartupMainThread("BENCH");
+  waits = makeMessages(n, 1);
+  returns = makeMessages(n, 0);
+
+  printf("outstanding joins: %d\n", n);
+  for (i = 0; i < rounds; i++) {
+    matchNsec = run(&OpenROBO_JoinThread_waitList, waits, returns, n, &appendNsec);
+    printf("wait first:   append %8.1f ns/op, match %8.1f ns/op\n", appendNsec, matchNsec);
+    matchNsec = run(&OpenROBO_JoinThread_returnMessageList, returns, waits, n, &appendNsec);
+    printf("return first: append %8.1f ns/op, match %8.1f ns/op\n", appendNsec, matchNsec);
+  }
+
+  for (i = 0; i < n; i++) {
+    OpenROBO_free(waits[i]);
+    OpenROBO_free(returns[i]);
+  }
+  OpenROBO_free(waits);
+  OpenROBO_free(returns);
+  return 0;
+}
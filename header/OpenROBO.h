@@ -2,6 +2,7 @@
 #define __OPENROBO_H__
 
 #include <stdint.h>
+#include <stddef.h>
 
 /**
 * The origin is TinyCThread
@@ -46,6 +47,13 @@ enum {
   OpenROBO_MessageType_Return,
   OpenROBO_MessageType_Read,
   OpenROBO_MessageType_Write,
+  OpenROBO_MessageType_Bind,
+  OpenROBO_MessageType_Subscribe,
+};
+
+enum {
+  OpenROBO_ParamEncoding_Text = 0,
+  OpenROBO_ParamEncoding_Binary,
 };
 
 // thread
@@ -62,6 +70,7 @@ typedef pthread_t OpenROBO_Thread_t;
 #endif
 
 #define OpenROBO_malloc malloc
+#define OpenROBO_realloc realloc
 #define OpenROBO_free free
 
 #define OPENROBO_DEFAULT_ACCEPT_PORT 50002
@@ -75,6 +84,7 @@ typedef pthread_t OpenROBO_Thread_t;
 #define OPENROBO_AGENTS_COMMECTION_MAX 16
 
 enum {
+  OpenROBO_Return_Timeout = -10,
   OpenROBO_Return_FailToInit = -9,
   OpenROBO_Return_NoValue = -8,
   OpenROBO_Return_NotUpdated = -7,
@@ -106,6 +116,83 @@ typedef struct {
   OpenROBO_InitFunction_t func;
 } OpenROBO_InitFunctionEntry_t;
 
+/**
+ * オペレーションスレッドのプールの状態
+ * 待ち時間はジョブがキューに入ってからworkerが取り出すまでの時間[sec]
+ */
+typedef struct {
+  size_t workers;
+  size_t idleWorkers;
+  size_t queuedJobs;
+  uint64_t jobs;
+  double queueWaitTotal;
+  double queueWaitMax;
+} OpenROBO_OperationPoolStats_t;
+
+#ifndef OPENROBO_MESSAGE_VIEW_ENTRY_MAX
+#define OPENROBO_MESSAGE_VIEW_ENTRY_MAX 64
+#endif
+
+/* 並べ替えた索引(order[])の型はOPENROBO_MESSAGE_VIEW_ENTRY_MAXが収まる大きさにする */
+#if OPENROBO_MESSAGE_VIEW_ENTRY_MAX <= 256
+typedef uint8_t OpenROBO_MessageViewIndex_t;
+#elif OPENROBO_MESSAGE_VIEW_ENTRY_MAX <= 65536
+typedef uint16_t OpenROBO_MessageViewIndex_t;
+#else
+#error "OPENROBO_MESSAGE_VIEW_ENTRY_MAX must be 65536 or less"
+#endif
+
+/**
+ * OpenROBO_MessageViewが保持するパラメータ1つ分の情報
+ * 位置はすべてメッセージ先頭からのオフセット
+ */
+typedef struct {
+  uint32_t nameOffset;
+  uint32_t nameSize;
+  uint32_t valueOffset;
+  uint32_t valueSize;
+  uint32_t count;
+  char type;
+} OpenROBO_MessageViewEntry_t;
+
+/**
+ * メッセージを1回だけ走査して作るパラメータの索引
+ * 元のメッセージを指しているので、メッセージより長く使わないこと
+ */
+typedef struct {
+  const char *message;
+  size_t size;
+  int type;
+  int subject;
+  int sourceID;
+  int destinationID;
+  int returnValue;
+  size_t entriesSize;
+  size_t truncatedOffset;
+  OpenROBO_MessageViewEntry_t entries[OPENROBO_MESSAGE_VIEW_ENTRY_MAX];
+  OpenROBO_MessageViewIndex_t order[OPENROBO_MESSAGE_VIEW_ENTRY_MAX];
+} OpenROBO_MessageView_t;
+
+/**
+ * メッセージを末尾の位置と確保済みのサイズを保持しながら作る
+ * 追記のたびにメッセージを先頭から辿らず、足りない場合は倍々に拡張する
+ * p: 作成中のメッセージ(終端'\0'付き), size: メッセージの長さ(終端'\0'を含まない), capacity: pの確保済みサイズ
+ */
+typedef struct {
+  char *p;
+  size_t size;
+  size_t capacity;
+  int owned;
+} OpenROBO_MessageBuilder_t;
+
+#define OPENROBO_MESSAGE_BUILDER_INITIALIZER {NULL, 0, 0, 0}
+
+/**
+ * 返答を待たずに送ったCommand Messageのhandle
+ * 送ったスレッドの中でのみ使用でき、OpenROBO_Async_Release()で解放する
+ */
+typedef struct _OpenROBO_asyncCommand *OpenROBO_AsyncHandle_t;
+
 #define OPENROBO_END_OF_MESSAGE_FUNCTION_ENTRY {NULL,""}
 #define OPENROBO_END_OF_SUBTHREAD_FUNCTION_ENTRY {NULL,""}
 #define OPENROBO_END_OF_INIT_FUNCTION_ENTRY {NULL}
@@ -138,9 +225,21 @@ int OpenROBO_StartupMainThread(const char* subsystemName);
  *    (1)へ戻る(ループ)
  *
  * @param[IN] operationEntry Operation Messageで呼び出される関数の名前と関数ポインタ(エントリ)のリスト
+ *            同じ名前が複数ある場合は先にあるものを使う。OpenROBO_AddOperationEntry()で先に足した名前は置き換えない
  */
 int OpenROBO_Main(OpenROBO_MessageFunctionEntry_t operationEntry[]);
 
+/**
+ * Operation Messageで呼び出されるロボット動作関数を追加する
+ * OpenROBO_StartupMainThread()の後ならどのスレッドからでも呼べる
+ * 同じ名前のエントリが既にあれば置き換える(OpenROBO_Main()に渡した表の前でも後でも、表より優先される)
+ *
+ * @param[IN] name 関数名(OPENROBO_FUNCTION_NAME_SIZE未満)
+ * @param[IN] func ロボット動作関数
+ * @return 成功: OpenROBO_Return_Success, 失敗: OpenROBO_Return_Error
+ */
+int OpenROBO_AddOperationEntry(const char* name, OpenROBO_MessageFunction_t func);
+
 /* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
    OpenROBO_Thread
    The origin is TinyCThread
@@ -166,6 +265,7 @@ int OpenROBO_Thread_CreateSubthread(int (*func)(int, char *[]), const char* func
 
 /**
  *  オペレーションスレッドにおいて、終了要求がきているかを調べる
+ *  OpenROBOが作ったスレッドではフラグを読むだけなので、制御周期ごとに呼んでもsystem callは発生しない
  *
  * @retval ==0 終了要求がきている
  * @retval !=0 終了要求がきていない
@@ -177,6 +277,15 @@ int OpenROBO_CheckWorking(void);
  */
 int OpenROBO_WaitForStopMessage(void);
 
+/**
+ *  オペレーションスレッドにおいて、終了要求が来るまで期限付きで待つ
+ *
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限)
+ * @param[out] waitSec 実際に待った時間[sec](遅いエージェントを調べるため)。NULLでもよい
+ * @retval OpenROBO_Return_Timeout 期限までに終了要求が来なかった
+ */
+int OpenROBO_WaitForStopMessage(int timeoutMsec, double *waitSec);
+
 /**
  * オペレーションスレッドを作る
  *
@@ -186,6 +295,43 @@ int OpenROBO_WaitForStopMessage(void);
  */
 int OpenROBO_Thread_CreateOperationThread(OpenROBO_MessageFunction_t func, char* message);
 
+/**
+ * オペレーションスレッドのプールの大きさを設定する
+ * Start Messageごとにスレッドを作らず、プールのworkerがキューからジョブとして取り出して実行する
+ * workerはメッセージのバッファと他のエージェントへの接続を次のジョブでも使い回す
+ * 空いているworkerがない場合はmaxWorkersまで増やし、idleTimeoutMsecの間ジョブがなければminWorkersまで減らす
+ * maxWorkersが0(既定)の場合はStart Messageごとにスレッドを作る(従来の動作)
+ * workerがmaxWorkersに達するとStart Messageはキューで待ち、受け付けの返答も遅れるので、
+ * 他のオペレーションの終了を待つオペレーションがある場合は同時に実行されうる数以上のmaxWorkersを指定する
+ * 返答を受け取っていないコマンドが残っている接続はジョブの終了時に切断するので、その返答が次のジョブに届くことはない
+ * メインスレッドで呼ぶ。OpenROBO_Main()の開始後に呼んだ場合もminWorkersまでworkerを増やす
+ *
+ * @param[in] minWorkers 常に待機させておくworkerの数
+ * @param[in] maxWorkers workerの最大数(同時に実行できるオペレーションの数)
+ * @param[in] idleTimeoutMsec minWorkersを超えるworkerが終了するまでの待機時間
+ */
+int OpenROBO_Thread_SetOperationPool(size_t minWorkers, size_t maxWorkers, unsigned int idleTimeoutMsec);
+
+/**
+ * オペレーションスレッドのプールの状態(worker数、キューの待ち時間)を取得する
+ *
+ * @param[out] stats プールの状態
+ */
+int OpenROBO_Thread_GetOperationPoolStats(OpenROBO_OperationPoolStats_t *stats);
+
+/**
+ * Read/Write Messageを処理するスレッドの数を設定する
+ * メインスレッドは返答先を決めて渡すだけになり、ReadWriteMemoryの読み書きと返答の送信はこれらのスレッドが並行して行う
+ * 0を指定するとメインスレッドで処理する(従来の動作)
+ * OpenROBO_Main()の前にメインスレッドで呼ぶ(スレッドはOpenROBO_Main()の開始時に作られる)
+ *
+ * 順序: 同じkeyへのRead/Write(バッチを含む)は、送り元に関わらず受信した順に処理される。
+ * 違うkeyへの要求は並行して処理されるため、返答は送った順とは限らない
+ *
+ * @param[in] workers Read/Write Messageを処理するスレッドの数
+ */
+int OpenROBO_Thread_SetReadWriteWorkers(size_t workers);
+
 /**
  * TODO: 名前変更予定
  *
@@ -207,6 +353,19 @@ int OpenROBO_RequestToExitThread(const char* destionationID, const char* functio
  */
 int OpenROBO_JoinThread(const char* destionationID, const char* functionName, char **returnMessage);
 
+/**
+ * スレッドの終了待ちのメッセージを送り、期限付きで返答を待つ
+ * 期限を過ぎた後に届いた返答は捨てられ、同じ送り先からの次の受信では受け取られない
+ *
+ * @param[IN] destionationID 送り先のサブシステム名
+ * @param[IN] functionName 終了を待つ関数名
+ * @param[OUT] returnMessage 返答メッセージ
+ * @param[IN] timeoutMsec 待つ時間の上限[msec](負の値は無期限)
+ * @param[OUT] waitSec 送ってから返答を受け取るまでに待った時間[sec]。NULLでもよい
+ * @retval OpenROBO_Return_Timeout 期限までに返答が届かなかった
+ */
+int OpenROBO_JoinThread(const char* destionationID, const char* functionName, char **returnMessage, int timeoutMsec, double *waitSec);
+
 /**
  * TODO: 名前変更予定
  *
@@ -217,6 +376,7 @@ int OpenROBO_JoinThread(const char* destionationID, const char* functionName, ch
  * @param[OUT] returnMessage 返答メッセージ
  */
 int OpenROBO_ExitThread(const char* destionationID, const char* functionName, char **returnMessage);
+int OpenROBO_ExitThread(const char* destionationID, const char* functionName, char **returnMessage, int timeoutMsec, double *waitSec);
 
 /* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
 
@@ -240,6 +400,34 @@ int OpenROBO_Socket_ReceiveMessage(char** message);
  */
 int OpenROBO_Socket_ReceiveReturnMessage(const char* sourceID, char** message);
 
+/**
+ * 返答メッセージ(Return Message)を期限付きで受信する
+ * 期限はメッセージの先頭が届くまでに適用し、届き始めたメッセージは最後まで受信する
+ * 期限までに届かなかった場合は最後に送ったCommand Messageの返答を待つのをやめ、後から届いても捨てる
+ * (返答に"#seq"を付けない古いエージェントでは、期限切れになった数だけ次に届いた返答を捨てる)
+ * 返答を受け取るまで何度も確かめる場合はOpenROBO_Socket_SendCommandMessageAsync()を使うこと
+ *
+ * @param[in] 受信元のサブシステム名
+ * @param[out] message 受信したメッセージ
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限、0は届いていなければすぐに戻る)
+ * @param[out] waitSec 実際に待った時間[sec](遅いエージェントを調べるため)。NULLでもよい
+ * @retval OpenROBO_Return_Timeout 期限までに届かなかった
+ */
+int OpenROBO_Socket_ReceiveReturnMessage(const char* sourceID, char** message, int timeoutMsec, double *waitSec);
+
+/**
+ * Subscribe Messageで購読した値(送り先が"#push"を付けて送ってくるもの)を届いた順に受信する
+ * 返答の受信中に届いた購読の値は接続ごとに溜めておき、ここで1つずつ返す
+ * 待っている間に届いた返答はOpenROBO_Socket_SendCommandMessageAsync()のhandleに渡す
+ *
+ * @param[in] sourceID 購読した送り先のサブシステム名
+ * @param[out] message 受信したメッセージ(共通バッファにあるので解放しない。次の受信で上書きされる)
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限、0は届いていなければすぐに戻る)
+ * @retval OpenROBO_Return_NotUpdated timeoutMsecが0で、届いていなかった
+ * @retval OpenROBO_Return_Timeout 期限までに届かなかった
+ */
+int OpenROBO_Socket_ReceivePushMessage(const char* sourceID, char** message, int timeoutMsec);
+
 /**
  * ロボット動作関数実行の指示を出すOperation Messageを送信する
  *
@@ -271,6 +459,8 @@ int OpenROBO_Socket_RecvMessage(const char *sourceID,char *message,int messageSi
  *
  * まず、タスクプランナへ接続して自身の接続情報を送り、
  * その後、タスクプランナから他のエージェントの接続情報を受け取る。
+ * 接続情報と一緒にcapabilitiesを交換し、双方が対応している場合はbinary frameで通信する。
+ * (対応していない古いエージェントとは従来の形式で通信する)
  *
  * @param[in] ip タスクプランナのIPアドレス
  * @param[in] port タスクプランナのポート番号
@@ -283,12 +473,26 @@ int OpenROBO_Socket_MakeConnection(const char *ip,uint16_t port);
  *
  * まず、タスクプランナ以外のエージェントからの接続を受け付けて、それぞれの接続情報を受け取り、
  * その後、タスクプランナは他のエージェントへの接続情報を送る。
+ * 各エージェントのcapabilitiesも合わせて配布する。
  *
  * @param[in] port 接続を受け付けるポート番号
  * @param[in] ids 接続を受け付けるエージェント一覧(const char* const ids[] = {"ARMCONTROLLER", "VISION", NULL};のように文字列の配列で、最後はNULLで終わるようなフォーマット)
   */
 int OpenROBO_Socket_AcceptConnection(uint16_t port, const char* const ids[]);
 
+/**
+ * 指定したサブシステムへ送るメッセージのパラメータの形式を設定する
+ * OpenROBO_ParamEncoding_Textを指定すると、binaryのパラメータは送信時にtextへ変換される(デバッグ用)
+ * OpenROBO_ParamEncoding_Binary(既定)は相手が対応している場合のみbinaryのまま送る
+ * 呼び出したスレッドの接続情報にのみ反映されるので、メインスレッドで呼ぶと以降に作られるオペレーションスレッドにも反映される
+ * MakeConnection()/AcceptConnection()の後に呼ぶ
+ *
+ * @param[in] subsystemID サブシステム名
+ * @param[in] encoding OpenROBO_ParamEncoding_TextまたはOpenROBO_ParamEncoding_Binary
+ * @retval OpenROBO_Return_NoValue 接続情報にないサブシステム
+ */
+int OpenROBO_Socket_SetParamEncoding(const char* subsystemID, int encoding);
+
 
 /* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
 
@@ -322,12 +526,23 @@ void OpenROBO_Message_GetSubject(const char* message, const char** subject);
 
 /**
  * Read/Write Messageの値の最終更新時間を取得
+ * 値を持つエージェントの単調増加する時刻[sec]で、時刻同士の差だけが意味を持つ
  *
  * @param[in] message メッセージ
  * @param[out] double 時間
  */
 void OpenROBO_Message_GetTime(const char* message, double* time);
 
+/**
+ * Read Messageへの返答から値のversionを取得する
+ * versionは値が書き込まれるたびに大きくなる(0は使わない)。
+ * OpenROBO_Message_MakeReadIfNewerMessage()に渡すと、変わっていない値を受け取らずに済む
+ *
+ * @param[in] message メッセージ
+ * @param[out] version version(含まれていない場合は0)
+ */
+void OpenROBO_Message_GetVersion(const char* message, unsigned int* version);
+
 /**
  * メッセージからパラメータの値(文字列)を取り出す
  * (メッセージから内部コードへ変換)
@@ -563,6 +778,314 @@ void OpenROBO_Message_MakeReadMessage(char *message, const char* subject);
  */
 void OpenROBO_Message_MakeWriteMessage(char *message, const char* subject);
 
+/**
+ *  渡されたバッファに、値がversionより新しい場合だけ値を返すRead Messageを作る
+ *  新しくなければ値を含まないOpenROBO_Return_NotUpdatedのReturn Message(現在のversionを含む)が返る
+ * @param[out] message メッセージのバッファ
+ * @param[in] subject 読み込む値の名称(構造体名)
+ * @param[in] version 前回受け取った値のversion(0の場合は常に値を返す)
+ */
+void OpenROBO_Message_MakeReadIfNewerMessage(char *message, const char* subject, unsigned int version);
+
+/**
+ *  渡されたバッファにSubscribe Messageを作る
+ *  送り先で値が書き込まれるたびに、Read Messageへの返答と同じ形式のReturn Message(subjectは値の名称)に
+ *  "#push"(購読のパターン)を付けた購読の値が送られてくる。購読の値は返答としては受信されず、OpenROBO_Socket_ReceivePushMessage()で受け取る。
+ *  最初にSubscribe Messageへの返答が届き、値が既に書き込まれていればその値が続く
+ * @param[out] message メッセージのバッファ
+ * @param[in] subject 購読する値の名称(構造体名)。末尾が'*'の場合は前方一致
+ * @param[in] intervalMsec 送る間隔の最小値[msec]。間隔内に書き込まれた値は最新のものだけを後で送る。0は書き込みのたびに送る。負の値は購読をやめる
+ */
+void OpenROBO_Message_MakeSubscribeMessage(char *message, const char* subject, int intervalMsec);
+
 int OpenROBO_Message_GetMessageType(const char *message);
 
+/**
+ * このスレッドでOpenROBO_Message_SetParam_*が使うパラメータの形式を設定する
+ * OpenROBO_ParamEncoding_Binaryの場合、T-Matrix、double型、double型配列、int型配列、byte列を
+ * IEEE-754/little endianのまま格納する(int型とstringはtextのまま)
+ * 既定はOpenROBO_ParamEncoding_Text。メインスレッドで設定した値はオペレーションスレッドに引き継がれる
+ * binaryのパラメータを含むメッセージは途中に'\0'を含むので、長さはstrlen()ではなくOpenROBO_Message_GetSize()で求める
+ * binaryで書くのはOpenROBO_MessageBuilder_tに追記する場合だけで、char*のメッセージに追記する場合と要素数0の配列は常にtextで書く
+ *
+ * @param[in] encoding OpenROBO_ParamEncoding_TextまたはOpenROBO_ParamEncoding_Binary
+ */
+void OpenROBO_Message_SetParamEncoding(int encoding);
+
+int OpenROBO_Message_GetParamEncoding(void);
+
+/**
+ * メッセージの長さ(終端'\0'を含まない)を求める
+ *
+ * @param[in] message メッセージ
+ */
+size_t OpenROBO_Message_GetSize(const char *message);
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_MessageBuilder
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+/**
+ * 指定したサイズのバッファを確保してbuilderを初期化する
+ * OPENROBO_MESSAGE_BUILDER_INITIALIZERで初期化した場合は最初の追記の際に確保される
+ *
+ * @param[out] builder builder
+ * @param[in] capacity 最初に確保するサイズ
+ */
+int OpenROBO_MessageBuilder_Init(OpenROBO_MessageBuilder_t *builder, size_t capacity);
+
+/**
+ * 渡されたバッファ(スタック上の配列など)を使ってbuilderを初期化する
+ * バッファに収まらなくなった時点でヒープへ移る(渡されたバッファは解放しない)
+ *
+ * @param[out] builder builder
+ * @param[in] buffer バッファ
+ * @param[in] bufferSize バッファのサイズ
+ */
+void OpenROBO_MessageBuilder_InitWithBuffer(OpenROBO_MessageBuilder_t *builder, char *buffer, size_t bufferSize);
+
+/**
+ * builderが確保したメモリを解放する
+ */
+void OpenROBO_MessageBuilder_Term(OpenROBO_MessageBuilder_t *builder);
+
+/**
+ * メッセージを空にする(確保済みのメモリはそのまま使う)
+ */
+void OpenROBO_MessageBuilder_Clear(OpenROBO_MessageBuilder_t *builder);
+
+/**
+ * 少なくともsize(終端'\0'を含まない)の長さのメッセージを格納できるように確保する
+ */
+int OpenROBO_MessageBuilder_Reserve(OpenROBO_MessageBuilder_t *builder, size_t size);
+
+/**
+ * OpenROBO_Message_SetParam_*, OpenROBO_Message_Make*Messageのbuilder版
+ * 引数と格納される形式はchar*版と同じ。メモリを確保できない場合はOpenROBO_Return_Errorを返す
+ */
+int OpenROBO_Message_SetParam_string(OpenROBO_MessageBuilder_t *builder, const char *name, const char *str);
+int OpenROBO_Message_SetParam_TMatrix(OpenROBO_MessageBuilder_t *builder, const char *name, const double TMatrix[4][4]);
+int OpenROBO_Message_SetParam_double(OpenROBO_MessageBuilder_t *builder, const char *name, const double *value);
+int OpenROBO_Message_SetParam_doubleArray(OpenROBO_MessageBuilder_t *builder, const char *name, const double *values, unsigned int n);
+int OpenROBO_Message_SetParam_int(OpenROBO_MessageBuilder_t *builder, const char *name, const int *value);
+int OpenROBO_Message_SetParam_intArray(OpenROBO_MessageBuilder_t *builder, const char *name, const int *values, unsigned int n);
+int OpenROBO_Message_SetParam_byteArray(OpenROBO_MessageBuilder_t *builder, const char *name, const unsigned char *values, unsigned int n);
+int OpenROBO_Message_SetReturnValue(OpenROBO_MessageBuilder_t *builder, int value);
+int OpenROBO_Message_SetSubject(OpenROBO_MessageBuilder_t *builder, const char* subject);
+
+/**
+ * builderの内容を消してから各メッセージを作る
+ */
+int OpenROBO_Message_MakeOperationMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeWaitMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeStopMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeReturnMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeReadMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeWriteMessage(OpenROBO_MessageBuilder_t *builder, const char* subject);
+int OpenROBO_Message_MakeReadIfNewerMessage(OpenROBO_MessageBuilder_t *builder, const char* subject, unsigned int version);
+int OpenROBO_Message_MakeSubscribeMessage(OpenROBO_MessageBuilder_t *builder, const char* subject, int intervalMsec);
+
+/**
+ * 複数の値を1回でまとめて読むRead Messageを作る(builderの内容は消える)
+ * 返答は1つのReturn Messageで、値ごとの内容はOpenROBO_Message_GetBatchEntry()で取り出す。
+ * 全ての値は同じ時点のもの(途中で書き込まれた値は混ざらない)
+ * @param[out] builder メッセージ
+ * @param[in] subjects 読み込む値の名称の配列
+ * @param[in] versions 前回受け取った値のversionの配列(NULLまたは0の要素は常に値を返す)
+ * @param[in] n 値の数
+ */
+int OpenROBO_Message_MakeBatchReadMessage(OpenROBO_MessageBuilder_t *builder, const char* const subjects[], const unsigned int versions[], size_t n);
+
+/**
+ * Write Messageへ次に書き込む値の名称を追加する
+ * OpenROBO_Message_MakeWriteMessage()と最初の値のパラメータの後に呼ぶと、以降のパラメータはsubjectの値になる。
+ * 全ての値は同時に書き込まれ、返答は最初の名称のReturn Messageが1つだけ返る(2つ目以降の名称への返答はない)。
+ * その戻り値は1つでも書き込めなかった値があればOpenROBO_Return_Errorになる
+ * @param[in,out] builder メッセージ
+ * @param[in] subject 書き込む値の名称(構造体名)
+ */
+int OpenROBO_Message_AppendBatchSubject(OpenROBO_MessageBuilder_t *builder, const char* subject);
+
+/**
+ * まとめて読んだRead Messageへの返答から1つの値を取り出す
+ * entryには1つの値のRead Messageへの返答と同じ形式のReturn Messageが入る
+ * @param[in] message 返答
+ * @param[in] subject 値の名称
+ * @param[out] entry 取り出した値
+ * @retval OpenROBO_Return_Success 値が含まれていた
+ * @retval OpenROBO_Return_NotUpdated 値がない、または指定したversionから変わっていない
+ * @retval OpenROBO_Return_NoValue subjectが返答に含まれていない
+ */
+int OpenROBO_Message_GetBatchEntry(const char *message, const char *subject, OpenROBO_MessageBuilder_t *entry);
+
+/**
+ * OpenROBO_Socket_SendCommandMessage()のbuilder版
+ * 送り元と送り先のパラメータはbuilderへ追記する(必要に応じて拡張される)
+ *
+ * @param[in] destionationID 送信先のエージェント名
+ * @param[in] builder メッセージ
+ */
+int OpenROBO_Socket_SendCommandMessage(const char* destinationID, OpenROBO_MessageBuilder_t *builder);
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Async
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+/**
+ * Command Messageを送り、返答を待たずにhandleを返す
+ * 返答はOpenROBO_Async_TryGet()/WaitAny()/WaitAll()で受け取る。
+ * 複数の送り先へ送ってからまとめて待てば、それぞれの処理は並行して進む。
+ * 返答は"#seq"で対応するhandleに渡す。"#seq"を返さない相手では、subjectが一致する一番古いhandleに渡す。
+ * Return Messageでないものや、どのhandleにも対応しない返答は読み捨てる。
+ * 同じ送り先にOpenROBO_Socket_ReceiveReturnMessage()を混ぜて使わないこと。
+ * オペレーション関数が終わると、解放していないhandleもすべて解放される。
+ *
+ * @param[in] destionationID 送信先のエージェント名
+ * @param[in] message メッセージ
+ * @param[out] handle 返答を受け取るhandle
+ */
+int OpenROBO_Socket_SendCommandMessageAsync(const char* destinationID, char* message, OpenROBO_AsyncHandle_t *handle);
+int OpenROBO_Socket_SendCommandMessageAsync(const char* destinationID, OpenROBO_MessageBuilder_t *builder, OpenROBO_AsyncHandle_t *handle);
+
+/**
+ * 返答が届いていれば受け取る(待たない)
+ *
+ * @param[in] handle handle
+ * @param[out] message 返答(OpenROBO_Async_Release()を呼ぶまで有効)。NULLでもよい
+ * @retval OpenROBO_Return_Success 返答を受け取った
+ * @retval OpenROBO_Return_NotUpdated まだ返答が届いていない
+ * @retval OpenROBO_Return_Disconnected 返答が届く前に接続が切れた
+ */
+int OpenROBO_Async_TryGet(OpenROBO_AsyncHandle_t handle, char **message);
+
+/**
+ * いずれかのhandleの返答が届くまで待つ
+ * 全ての送り先の接続を1回のpollでまとめて待つ
+ *
+ * @param[in] handles handleの配列(NULLの要素は無視する)
+ * @param[in] n 要素数
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限)
+ * @param[out] index 返答が届いた(または接続が切れた)handleの位置。NULLでもよい
+ * @retval OpenROBO_Return_Timeout 期限までにどの返答も届かなかった
+ */
+int OpenROBO_Async_WaitAny(const OpenROBO_AsyncHandle_t handles[], size_t n, int timeoutMsec, size_t *index);
+
+/**
+ * 全てのhandleの返答が届くまで待つ
+ *
+ * @param[in] handles handleの配列(NULLの要素は無視する)
+ * @param[in] n 要素数
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限)
+ * @retval OpenROBO_Return_Timeout 期限までに届かなかった返答がある(届いた返答はそのまま受け取れる)
+ */
+int OpenROBO_Async_WaitAll(const OpenROBO_AsyncHandle_t handles[], size_t n, int timeoutMsec);
+
+/**
+ * handleと受け取った返答を解放する
+ * 返答が届く前に解放した場合、後から届いた返答は読み捨てる
+ */
+void OpenROBO_Async_Release(OpenROBO_AsyncHandle_t handle);
+
+/**
+ * OpenROBO_Socket_FanOutStart()で何が揃ったら戻るか
+ */
+typedef enum {
+  OpenROBO_JoinMode_All = 0,    // 全ての送り先の返答が揃うまで待つ
+  OpenROBO_JoinMode_Any,        // いずれかのロボット動作関数が返答するまで待つ
+  OpenROBO_JoinMode_FirstError  // 全て成功するか、いずれかが失敗するまで待つ
+} OpenROBO_JoinMode_t;
+
+/**
+ * 同じStart Messageを複数の送り先へ送り、受け付けられたものにWait Messageを送って返答をまとめて待つ
+ * メッセージの共通部分は1回だけ組み立て、送り先ごとには#srcと#dstだけを付ける。
+ * 返答は全ての送り先の接続を1回の待ちでまとめて待つので、かかる時間は一番遅い送り先の分になる。
+ * OpenROBO_Asyncで送るので、同じ送り先にOpenROBO_Socket_ReceiveReturnMessage()を混ぜて使わないこと。
+ * Any/FirstErrorで先に戻った場合、残りの送り先のロボット動作関数は止めない(返答は後から届いても読み捨てる)。
+ *
+ * @param[in] destinationIDs 送信先のエージェント名の配列
+ * @param[in] n 要素数
+ * @param[in] builder OpenROBO_Message_MakeOperationMessage()で作ったメッセージ(#src,#dstは付けない)
+ * @param[in] mode 何が揃ったら戻るか
+ * @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限)
+ * @param[out] returnValues 送り先ごとの#return(n個)。
+ *   受け付けられなかった場合はStart Messageへの返答の#return、送れなかった場合や接続が切れた場合はそのエラー、
+ *   返答を待たずに戻った場合はOpenROBO_Return_NotUpdated
+ * @param[out] index Anyでは最初に返答した、FirstErrorでは最初に失敗した送り先の位置(なければn)。NULLでもよい
+ * @retval OpenROBO_Return_Success modeの条件が揃った(個々の結果はreturnValues)
+ * @retval OpenROBO_Return_Timeout 期限までに揃わなかった(届いた分はreturnValuesに入る)
+ * @retval OpenROBO_Return_Error 引数が正しくない、またはAnyでどのロボット動作関数も返答しなかった
+ */
+int OpenROBO_Socket_FanOutStart(const char *const destinationIDs[], size_t n, OpenROBO_MessageBuilder_t *builder, OpenROBO_JoinMode_t mode, int timeoutMsec, int returnValues[], size_t *index);
+int OpenROBO_Socket_FanOutStart(const char *const destinationIDs[], size_t n, char *message, OpenROBO_JoinMode_t mode, int timeoutMsec, int returnValues[], size_t *index);
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_MessageView
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+/**
+ * メッセージを走査してパラメータの索引を作る
+ * 以降のOpenROBO_MessageView_*はメッセージを再走査せず、ヒープも使わない
+ *
+ * @param[out] view 作成する索引
+ * @param[in] message メッセージ(viewを使い終わるまで保持すること)
+ */
+int OpenROBO_MessageView_Parse(OpenROBO_MessageView_t *view, const char *message);
+
+/**
+ * パラメータを探す(同名のパラメータが複数ある場合は先頭のもの)
+ *
+ * @param[in] view 索引
+ * @param[in] name パラメータ名
+ * @param[out] entry 見つかったパラメータの情報
+ * @retval OpenROBO_Return_Success 見つかった
+ * @retval OpenROBO_Return_NoValue 見つからなかった
+ */
+int OpenROBO_MessageView_Find(const OpenROBO_MessageView_t *view, const char *name, OpenROBO_MessageViewEntry_t *entry);
+
+/**
+ * 文字列のパラメータをメッセージ中の位置のまま取り出す(終端'\0'は付かない)
+ *
+ * @param[in] view 索引
+ * @param[in] name パラメータ名
+ * @param[out] str 文字列の先頭
+ * @param[out] size 文字列の長さ
+ */
+int OpenROBO_MessageView_GetString(const OpenROBO_MessageView_t *view, const char *name, const char **str, size_t *size);
+
+/**
+ * 文字列のパラメータを渡されたバッファへ取り出す
+ *
+ * @param[in] view 索引
+ * @param[in] name パラメータ名
+ * @param[out] str バッファ
+ * @param[in] strSize バッファのサイズ(足りない場合はOpenROBO_Return_BufferOver)
+ */
+int OpenROBO_MessageView_CopyString(const OpenROBO_MessageView_t *view, const char *name, char *str, size_t strSize);
+
+/**
+ * 送り元のエージェント名・送り先のエージェント名・Subjectを取り出す
+ * (メッセージ中の位置のまま返すので終端'\0'は付かない)
+ */
+int OpenROBO_MessageView_GetSourceID(const OpenROBO_MessageView_t *view, const char **sourceID, size_t *size);
+int OpenROBO_MessageView_GetDestinationID(const OpenROBO_MessageView_t *view, const char **destinationID, size_t *size);
+int OpenROBO_MessageView_GetSubject(const OpenROBO_MessageView_t *view, const char **subject, size_t *size);
+
+/**
+ * パラメータの値を取り出す
+ * 配列の場合はnとメッセージ中の要素数の小さい方だけ取り出す
+ */
+int OpenROBO_MessageView_GetParam_TMatrix(const OpenROBO_MessageView_t *view, const char *name, double TMatrix[4][4]);
+int OpenROBO_MessageView_GetParam_double(const OpenROBO_MessageView_t *view, const char *name, double *value);
+int OpenROBO_MessageView_GetParam_doubleArray(const OpenROBO_MessageView_t *view, const char *name, double *values, unsigned int n);
+int OpenROBO_MessageView_GetParam_int(const OpenROBO_MessageView_t *view, const char *name, int *value);
+int OpenROBO_MessageView_GetParam_intArray(const OpenROBO_MessageView_t *view, const char *name, int *values, unsigned int n);
+int OpenROBO_MessageView_GetParam_byteArray(const OpenROBO_MessageView_t *view, const char *name, unsigned char *values, unsigned int n);
+int OpenROBO_MessageView_GetReturnValue(const OpenROBO_MessageView_t *view, int *value);
+
 #endif // __OPENROBO_H__
@@ -0,0 +1,499 @@
+#ifndef __OPENROBO_COROUTINE_H__
+#define __OPENROBO_COROUTINE_H__
+
+/**
+ * タスクプランをC++20のコルーチンで書くための層(ヘッダのみ)
+ *
+ * co_await openrobo::start("ARM", "MoveTo", params) はスレッドを止めずにコルーチンだけを中断する。
+ * 中断したコルーチンは、openrobo::run()を呼んだスレッドのイベントループが
+ * OpenROBO_Async_WaitAny()で全ての送り先の接続をまとめて待ち、返答が届いたものから再開する。
+ * そのため並行に進めるプランの枝がいくつあってもスレッドは1つで、枝ごとのスタックも持たない。
+ *
+ * OpenROBO_Asyncと同じく、サブスレッドまたはオペレーションスレッドの中で使う(メインスレッドでは使えない)。
+ * コルーチンを再開するのはrun()を呼んだスレッドだけなので、枝の間で排他は要らない。
+ *
+ *   openrobo::task<> Plan()
+ *   {
+ *     openrobo::params p;
+ *     p.set("x", 0.1).set("y", 0.2);
+ *     openrobo::reply r = co_await openrobo::call("ARM", "MoveTo", p);
+ *     ...
+ *   }
+ *   int PlanThread(int argc, char *argv[]) { return openrobo::run(Plan()); }
+ */
+
+#include "OpenROBO.h"
+
+#if !defined(__cplusplus) || __cplusplus < 202002L
+#error "OpenROBO_Coroutine.h requires C++20"
+#else
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace openrobo {
+
+template <typename T = void> class task;
+
+/**
+ * コマンドへの返答
+ * 返答のメッセージはreplyを破棄するまで有効
+ */
+class reply {
+ public:
+  reply() : handle_(NULL), status_(OpenROBO_Return_Error), message_(NULL) {}
+  reply(OpenROBO_AsyncHandle_t handle, int status) : handle_(handle), status_(status), message_(NULL) {
+    if (status_ == OpenROBO_Return_Success) {
+      status_ = OpenROBO_Async_TryGet(handle_, &message_);
+    }
+  }
+  reply(reply&& other) noexcept
+    : handle_(std::exchange(other.handle_, nullptr)), status_(other.status_), message_(std::exchange(other.message_, nullptr)) {}
+  reply& operator=(reply&& other) noexcept {
+    if (this != &other) {
+      OpenROBO_Async_Release(handle_);
+      handle_ = std::exchange(other.handle_, nullptr);
+      status_ = other.status_;
+      message_ = std::exchange(other.message_, nullptr);
+    }
+    return *this;
+  }
+  reply(const reply&) = delete;
+  reply& operator=(const reply&) = delete;
+  ~reply() { OpenROBO_Async_Release(handle_); }
+
+  /** 返答を受け取れたか(OpenROBO_Return_*) */
+  int status() const { return status_; }
+  bool ok() const { return status_ == OpenROBO_Return_Success; }
+  /** 返答のメッセージ(受け取れなかった場合はNULL) */
+  const char* message() const { return message_; }
+  /** 返答の#return(受け取れなかった場合はstatus()) */
+  int return_value() const {
+    int value = status_;
+    if (message_ != NULL) {
+      OpenROBO_Message_GetReturnValue(message_, &value);
+    }
+    return value;
+  }
+
+ private:
+  OpenROBO_AsyncHandle_t handle_;
+  int status_;
+  char *message_;
+};
+
+/**
+ * コマンドに付けるパラメータ
+ * 値は複製して持つので、set()に渡した変数はすぐに変えてよい
+ */
+class params {
+ public:
+  params& set(const char* name, const char* value) {
+    std::string n(name), v(value);
+    setters_.push_back([n, v](OpenROBO_MessageBuilder_t* b) { return OpenROBO_Message_SetParam_string(b, n.c_str(), v.c_str()); });
+    return *this;
+  }
+  params& set(const char* name, double value) {
+    std::string n(name);
+    setters_.push_back([n, value](OpenROBO_MessageBuilder_t* b) { return OpenROBO_Message_SetParam_double(b, n.c_str(), &value); });
+    return *this;
+  }
+  params& set(const char* name, int value) {
+    std::string n(name);
+    setters_.push_back([n, value](OpenROBO_MessageBuilder_t* b) { return OpenROBO_Message_SetParam_int(b, n.c_str(), &value); });
+    return *this;
+  }
+  params& set(const char* name, const double* values, unsigned int n) {
+    std::string s(name);
+    std::vector<double> v(values, values + n);
+    setters_.push_back([s, v](OpenROBO_MessageBuilder_t* b) { return OpenROBO_Message_SetParam_doubleArray(b, s.c_str(), v.data(), (unsigned int)v.size()); });
+    return *this;
+  }
+  params& set(const char* name, const int* values, unsigned int n) {
+    std::string s(name);
+    std::vector<int> v(values, values + n);
+    setters_.push_back([s, v](OpenROBO_MessageBuilder_t* b) { return OpenROBO_Message_SetParam_intArray(b, s.c_str(), v.data(), (unsigned int)v.size()); });
+    return *this;
+  }
+  params& set(const char* name, const double TMatrix[4][4]) {
+    std::string s(name);
+    std::vector<double> v(&TMatrix[0][0], &TMatrix[0][0] + 16);
+    setters_.push_back([s, v](OpenROBO_MessageBuilder_t* b) {
+      double T[4][4];
+      for (int i = 0; i < 16; i++) {
+        T[i/4][i%4] = v[i];
+      }
+      return OpenROBO_Message_SetParam_TMatrix(b, s.c_str(), T);
+    });
+    return *this;
+  }
+
+  int apply(OpenROBO_MessageBuilder_t* builder) const {
+    for (const auto& setter : setters_) {
+      if (setter(builder) != OpenROBO_Return_Success) {
+        return OpenROBO_Return_Error;
+      }
+    }
+    return OpenROBO_Return_Success;
+  }
+
+ private:
+  std::vector<std::function<int(OpenROBO_MessageBuilder_t*)>> setters_;
+};
+
+namespace detail {
+
+/**
+ * run()を呼んだスレッドのイベントループ
+ * ready: 再開を待っているコルーチン, handles/waiters: 返答を待っているコルーチン(同じ位置が対応する)
+ */
+class loop {
+ public:
+  static loop& current() {
+    static thread_local loop l;
+    return l;
+  }
+
+  void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+  void watch(OpenROBO_AsyncHandle_t handle, std::coroutine_handle<> waiter, int* status) {
+    handles_.push_back(handle);
+    waiters_.push_back({waiter, status});
+  }
+
+  int run() {
+    int res = OpenROBO_Return_Success;
+    size_t i;
+    while (true) {
+      while (!ready_.empty()) {
+        std::coroutine_handle<> h = ready_.front();
+        ready_.pop_front();
+        h.resume();
+      }
+      if (handles_.empty()) {
+        return res;
+      }
+      int r = OpenROBO_Async_WaitAny(handles_.data(), handles_.size(), -1, &i);
+      if (r != OpenROBO_Return_Success) { // 待てなければ全ての待ちをエラーで終える
+        res = r;
+        while (!handles_.empty()) {
+          complete(handles_.size() - 1, r);
+        }
+        continue;
+      }
+      // 同じ待ちで届いた返答をまとめて再開に回す
+      do {
+        complete(i, OpenROBO_Async_TryGet(handles_[i], NULL));
+      } while (!handles_.empty() && OpenROBO_Async_WaitAny(handles_.data(), handles_.size(), 0, &i) == OpenROBO_Return_Success);
+    }
+  }
+
+ private:
+  struct waiter {
+    std::coroutine_handle<> h;
+    int *status;
+  };
+
+  void complete(size_t i, int status) {
+    *waiters_[i].status = status;
+    ready_.push_back(waiters_[i].h);
+    handles_[i] = handles_.back();
+    handles_.pop_back();
+    waiters_[i] = waiters_.back();
+    waiters_.pop_back();
+  }
+
+  std::deque<std::coroutine_handle<>> ready_;
+  std::vector<OpenROBO_AsyncHandle_t> handles_;
+  std::vector<waiter> waiters_;
+};
+
+struct promise_base {
+  std::coroutine_handle<> continuation;
+  bool detached = false;
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      promise_base& p = h.promise();
+      std::coroutine_handle<> next = p.continuation ? p.continuation : std::noop_coroutine();
+      if (p.detached) {
+        h.destroy();
+      }
+      return next;
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+  std::optional<T> value;
+  task<T> get_return_object();
+  void return_value(T v) { value = std::move(v); }
+};
+
+template <>
+struct promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+};
+
+} // namespace detail
+
+/**
+ * co_awaitされるまで開始しないコルーチン
+ * co_awaitしたコルーチンは、このコルーチンが終わると続きから再開する
+ */
+template <typename T>
+class task {
+ public:
+  using promise_type = detail::promise<T>;
+
+  explicit task(std::coroutine_handle<promise_type> h) : h_(h) {}
+  task(task&& other) noexcept : h_(std::exchange(other.h_, {})) {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (h_) {
+        h_.destroy();
+      }
+      h_ = std::exchange(other.h_, {});
+    }
+    return *this;
+  }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() {
+    if (h_) {
+      h_.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+    h_.promise().continuation = continuation;
+    return h_;
+  }
+  T await_resume() {
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*h_.promise().value);
+    }
+  }
+
+  /** 所有を手放す(spawn()用) */
+  std::coroutine_handle<promise_type> release() { return std::exchange(h_, {}); }
+
+ private:
+  std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <typename T>
+inline task<T> promise<T>::get_return_object() { return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this)); }
+
+inline task<void> promise<void>::get_return_object() { return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this)); }
+
+} // namespace detail
+
+/**
+ * コルーチンを切り離して開始する(終わると自動で破棄される)
+ * run()を呼んだスレッドで使う
+ */
+inline void spawn(task<void> t)
+{
+  std::coroutine_handle<detail::promise<void>> h = t.release();
+  h.promise().detached = true;
+  detail::loop::current().post(h);
+}
+
+/**
+ * mainを開始し、切り離したものも含めて全てのコルーチンが終わるまでイベントループを回す
+ * @retval OpenROBO_Return_Success 全て終わった
+ * それ以外は返答を待てなかった(待っていたコマンドはそのエラーで再開した)
+ */
+inline int run(task<void> main)
+{
+  spawn(std::move(main));
+  return detail::loop::current().run();
+}
+
+/**
+ * Command Messageを送って返答を待つ(co_awaitでreplyを返す)
+ * メッセージは作成時に組み立て、co_awaitしたときに送る
+ */
+class command {
+ public:
+  typedef int (*make_t)(OpenROBO_MessageBuilder_t *, const char *);
+
+  command(const char* destinationID, make_t make, const char* subject, const params* p)
+    : destinationID_(destinationID), handle_(NULL), status_(OpenROBO_Return_Success) {
+    if (OpenROBO_MessageBuilder_Init(&builder_, 256) != OpenROBO_Return_Success ||
+        make(&builder_, subject) != OpenROBO_Return_Success ||
+        (p != NULL && p->apply(&builder_) != OpenROBO_Return_Success)) {
+      status_ = OpenROBO_Return_Error;
+    }
+  }
+  command(command&& other) noexcept
+    : destinationID_(std::move(other.destinationID_)), builder_(other.builder_),
+      handle_(std::exchange(other.handle_, nullptr)), status_(other.status_) {
+    other.builder_ = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+  }
+  command(const command&) = delete;
+  command& operator=(const command&) = delete;
+  ~command() {
+    OpenROBO_MessageBuilder_Term(&builder_);
+    OpenROBO_Async_Release(handle_);
+  }
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    if (status_ != OpenROBO_Return_Success) {
+      return false;
+    }
+    status_ = OpenROBO_Socket_SendCommandMessageAsync(destinationID_.c_str(), &builder_, &handle_);
+    if (status_ != OpenROBO_Return_Success) {
+      return false;
+    }
+    detail::loop::current().watch(handle_, h, &status_);
+    return true;
+  }
+  reply await_resume() { return reply(std::exchange(handle_, nullptr), status_); }
+
+ private:
+  std::string destinationID_;
+  OpenROBO_MessageBuilder_t builder_;
+  OpenROBO_AsyncHandle_t handle_;
+  int status_;
+};
+
+/** Start Message(受け付けたかどうかの返答を返す) */
+inline command start(const char* destinationID, const char* subject, const params& p = params())
+{
+  return command(destinationID, OpenROBO_Message_MakeOperationMessage, subject, &p);
+}
+
+/** Wait Message(ロボット動作関数の返答を返す) */
+inline command wait(const char* destinationID, const char* subject)
+{
+  return command(destinationID, OpenROBO_Message_MakeWaitMessage, subject, NULL);
+}
+
+inline command read(const char* destinationID, const char* subject)
+{
+  return command(destinationID, OpenROBO_Message_MakeReadMessage, subject, NULL);
+}
+
+inline command write(const char* destinationID, const char* subject, const params& p)
+{
+  return command(destinationID, OpenROBO_Message_MakeWriteMessage, subject, &p);
+}
+
+/**
+ * Stop Messageを送る(返答はないので待たない)
+ */
+inline int stop(const char* destinationID, const char* subject)
+{
+  OpenROBO_MessageBuilder_t builder = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+  int res = OpenROBO_Message_MakeStopMessage(&builder, subject);
+  if (res == OpenROBO_Return_Success) {
+    res = OpenROBO_Socket_SendCommandMessage(destinationID, &builder);
+  }
+  OpenROBO_MessageBuilder_Term(&builder);
+  return res;
+}
+
+/**
+ * Startして受け付けられたらWaitし、ロボット動作関数の返答を返す
+ * 受け付けられなかった場合はStartへの返答を返す
+ */
+inline task<reply> call(std::string destinationID, std::string subject, params p = params())
+{
+  reply ack = co_await start(destinationID.c_str(), subject.c_str(), p);
+  if (!ack.ok() || ack.return_value() != OpenROBO_Return_Success) {
+    co_return ack;
+  }
+  co_return co_await wait(destinationID.c_str(), subject.c_str());
+}
+
+namespace detail {
+
+struct join {
+  size_t remaining;
+  std::coroutine_handle<> waiter;
+
+  bool await_ready() const noexcept { return remaining == 0; }
+  void await_suspend(std::coroutine_handle<> h) noexcept { waiter = h; }
+  void await_resume() const noexcept {}
+
+  void done() {
+    if (--remaining == 0 && waiter) {
+      loop::current().post(waiter);
+    }
+  }
+};
+
+inline task<void> joinOne(task<void> t, join* j)
+{
+  co_await t;
+  j->done();
+}
+
+template <typename T>
+inline task<void> joinOne(task<T> t, std::optional<T>* result, join* j)
+{
+  *result = co_await t;
+  j->done();
+}
+
+} // namespace detail
+
+/**
+ * 全てのコルーチンを並行に進め、全て終わるまで待つ
+ */
+inline task<void> when_all(std::vector<task<void>> tasks)
+{
+  detail::join j{tasks.size(), {}};
+  for (auto& t : tasks) {
+    spawn(detail::joinOne(std::move(t), &j));
+  }
+  co_await j;
+}
+
+/**
+ * 全てのコルーチンを並行に進め、全て終わったら結果を渡した順に返す
+ */
+template <typename T>
+inline task<std::vector<T>> when_all(std::vector<task<T>> tasks)
+{
+  std::vector<std::optional<T>> results(tasks.size());
+  std::vector<T> values;
+  detail::join j{tasks.size(), {}};
+  for (size_t i = 0; i < tasks.size(); i++) {
+    spawn(detail::joinOne(std::move(tasks[i]), &results[i], &j));
+  }
+  co_await j;
+  values.reserve(results.size());
+  for (auto& r : results) {
+    values.push_back(std::move(*r));
+  }
+  co_return values;
+}
+
+} // namespace openrobo
+
+#endif // C++20
+
+#endif // __OPENROBO_COROUTINE_H__
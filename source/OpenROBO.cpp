@@ -4,10 +4,18 @@
 #include <time.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "SocketCom.h"
 #include "OpenROBO.h"
 
+#if defined(_OPENROBO_POSIX_)
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
 #ifndef OPENROBO_MAKECONNECTION_TIMEOUT_MSEC
 #define OPENROBO_MAKECONNECTION_TIMEOUT_MSEC (3*1000)
 #endif
@@ -16,6 +24,14 @@
 #define OPENROBO_READWIRTEMEMORY_DEFAULT_SIZE (128)
 #endif
 
+#ifndef OPENROBO_READWRITEMEMORY_SHARDS
+#define OPENROBO_READWRITEMEMORY_SHARDS (16)
+#endif
+
+#ifndef OPENROBO_READWRITE_WORKERS
+#define OPENROBO_READWRITE_WORKERS (0)
+#endif
+
 #ifndef OPENROBO_MESSAGE_BUFFER_DEFAULT_SIZE
 #define OPENROBO_MESSAGE_BUFFER_DEFAULT_SIZE (1024)
 #endif
@@ -24,6 +40,158 @@
 #define OPENROBO_MESSAGE_BUFFER_SIZE_STEP (1024)
 #endif
 
+#ifndef OPENROBO_MESSAGE_BUILDER_DEFAULT_SIZE
+#define OPENROBO_MESSAGE_BUILDER_DEFAULT_SIZE (256)
+#endif
+
+#ifndef OPENROBO_OPERATION_POOL_MIN_WORKERS
+#define OPENROBO_OPERATION_POOL_MIN_WORKERS (0)
+#endif
+
+#ifndef OPENROBO_OPERATION_POOL_MAX_WORKERS
+#define OPENROBO_OPERATION_POOL_MAX_WORKERS (0)
+#endif
+
+#ifndef OPENROBO_OPERATION_POOL_IDLE_TIMEOUT_MSEC
+#define OPENROBO_OPERATION_POOL_IDLE_TIMEOUT_MSEC (30*1000)
+#endif
+
+#ifndef OPENROBO_EPOLL_ENABLE
+#if defined(__linux__)
+#define OPENROBO_EPOLL_ENABLE (1)
+#else
+#define OPENROBO_EPOLL_ENABLE (0)
+#endif
+#endif
+
+#ifndef OPENROBO_POLLER_MAX_EVENTS
+#define OPENROBO_POLLER_MAX_EVENTS (64)
+#endif
+
+#ifndef OPENROBO_SOCKLIST_INITIAL_CAPACITY
+#define OPENROBO_SOCKLIST_INITIAL_CAPACITY (16)
+#endif
+
+#ifndef OPENROBO_JOINTHREAD_INITIAL_BUCKETS
+#define OPENROBO_JOINTHREAD_INITIAL_BUCKETS (16)
+#endif
+
+#ifndef OPENROBO_DISPATCH_INITIAL_SLOTS
+#define OPENROBO_DISPATCH_INITIAL_SLOTS (64)
+#endif
+
+#ifndef OPENROBO_INTERN_INITIAL_SLOTS
+#define OPENROBO_INTERN_INITIAL_SLOTS (64)
+#endif
+
+#ifndef OPENROBO_INTERN_CACHE_SIZE
+#define OPENROBO_INTERN_CACHE_SIZE (32)
+#endif
+
+#ifndef OPENROBO_INTERN_CACHE_NAME_SIZE
+#define OPENROBO_INTERN_CACHE_NAME_SIZE (64)
+#endif
+
+#ifndef OPENROBO_INTERN_SHARDS
+#define OPENROBO_INTERN_SHARDS (16)
+#endif
+
+#ifndef OPENROBO_SHM_ENABLE
+#if defined(__linux__)
+#define OPENROBO_SHM_ENABLE (1)
+#else
+#define OPENROBO_SHM_ENABLE (0)
+#endif
+#endif
+
+#ifndef OPENROBO_SHM_RING_SIZE
+#define OPENROBO_SHM_RING_SIZE (512*1024)
+#endif
+
+#ifndef OPENROBO_SHM_DIR
+#define OPENROBO_SHM_DIR "/dev/shm"
+#endif
+
+/*
+   受け付けた接続の最初のメッセージと共有メモリの申し出を待つ時間[msec]
+   メインスレッドで受信するので、送ってこない相手でイベントループが止まらないように期限を付ける
+*/
+#ifndef OPENROBO_ACCEPT_TIMEOUT_MSEC
+#define OPENROBO_ACCEPT_TIMEOUT_MSEC (3000)
+#endif
+
+#ifndef OPENROBO_UNIX_ENABLE
+#if defined(__linux__)
+#define OPENROBO_UNIX_ENABLE (1)
+#else
+#define OPENROBO_UNIX_ENABLE (0)
+#endif
+#endif
+
+#ifndef OPENROBO_FUTEX_ENABLE
+#if defined(__linux__)
+#define OPENROBO_FUTEX_ENABLE (1)
+#else
+#define OPENROBO_FUTEX_ENABLE (0)
+#endif
+#endif
+
+#ifndef OPENROBO_LOCAL_ENABLE
+#define OPENROBO_LOCAL_ENABLE OPENROBO_EPOLL_ENABLE
+#endif
+
+#ifndef OPENROBO_ASYNC_POLL_ENABLE
+#if defined(__linux__)
+#define OPENROBO_ASYNC_POLL_ENABLE (1)
+#else
+#define OPENROBO_ASYNC_POLL_ENABLE (0)
+#endif
+#endif
+
+#ifndef OPENROBO_ASYNC_SLICE_MSEC
+#define OPENROBO_ASYNC_SLICE_MSEC (1)
+#endif
+
+#if OPENROBO_LOCAL_ENABLE && !OPENROBO_EPOLL_ENABLE
+#error "OPENROBO_LOCAL_ENABLE requires OPENROBO_EPOLL_ENABLE"
+#endif
+
+#if OPENROBO_EPOLL_ENABLE
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#if OPENROBO_LOCAL_ENABLE || OPENROBO_ASYNC_POLL_ENABLE
+#include <sys/eventfd.h>
+#endif
+
+#if OPENROBO_ASYNC_POLL_ENABLE
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#if OPENROBO_FUTEX_ENABLE
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if OPENROBO_UNIX_ENABLE
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if OPENROBO_SHM_ENABLE
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef OPENROBO_NDEBUG
 
 #define DBGPRINTF(...) do{}while(0)
@@ -54,6 +222,244 @@
 
 #define OPENROBO_MESSAGE_SIZE_STR_SIZE sizeof("00000000")
 
+/*
+   binary frame
+
+   OpenROBO_Socket_MakeConnection()/OpenROBO_Socket_AcceptConnection()で双方が
+   OPENROBO_CAPABILITY_BINARY_FRAMEを持つことを確認できた接続でのみ使用する。
+   それ以外の接続では従来の16進数文字列のサイズを前置する形式(text frame)を使用する。
+
+   +-------+------+-------+----------+------------------------------+
+   | magic | type | flags | reserved | length (uint32 little endian) |
+   +-------+------+-------+----------+------------------------------+
+   lengthはメッセージ本体+suffix+終端'\0'のサイズ。
+   magicは'\0'にならないので、先頭の'\0'は従来通り終了要求(stop signal)として扱える。
+*/
+#ifndef OPENROBO_BINARY_FRAME_ENABLE
+#define OPENROBO_BINARY_FRAME_ENABLE (1)
+#endif
+
+#define OPENROBO_FRAME_MAGIC (0xA5)
+#define OPENROBO_FRAME_VERSION (1)
+#define OPENROBO_FRAME_HEADER_SIZE (8)
+#define OPENROBO_FRAME_TYPE_UNKNOWN (0xFF)
+
+/*
+   channel
+
+   同じプロセスのスレッドは相手のエージェントごとに共有する接続(carrier)の上に
+   スレッドごとの論理的な接続(channel)を作って通信する。
+   carrierの最初のメッセージはthreadIDの代わりにOPENROBO_FRAME_MAGIC_CARRIERと自身のsubsystemIDを送る。
+   carrierのframeはflagsにOPENROBO_FRAME_FLAG_CHANNELを立て、headerの後ろにchannel ID(uint32 little endian)を置く。
+   OPENROBO_FRAME_FLAG_OPENのframeはthreadIDを運び、受信側はそのchannelをthreadIDの接続として扱う。
+   終了要求は'\0'の代わりにOPENROBO_FRAME_FLAG_STOPのframeで送る。
+*/
+#ifndef OPENROBO_CHANNEL_ENABLE
+#define OPENROBO_CHANNEL_ENABLE (1)
+#endif
+
+#ifndef OPENROBO_CHANNEL_CONNECTIONS_PER_PEER
+#define OPENROBO_CHANNEL_CONNECTIONS_PER_PEER (1)
+#endif
+
+#define OPENROBO_FRAME_MAGIC_CARRIER (0xA6)
+#define OPENROBO_FRAME_FLAG_CHANNEL (1u << 0)
+#define OPENROBO_FRAME_FLAG_OPEN (1u << 1)
+#define OPENROBO_FRAME_FLAG_CLOSE (1u << 2)
+#define OPENROBO_FRAME_FLAG_STOP (1u << 3)
+#define OPENROBO_FRAME_CHANNEL_ID_SIZE (4)
+#define OPENROBO_FRAME_CHANNEL_HEADER_SIZE (OPENROBO_FRAME_HEADER_SIZE + OPENROBO_FRAME_CHANNEL_ID_SIZE)
+
+/*
+   routing header
+
+   headerのtypeにはメッセージの種類(OpenROBO_MessageType_*)が入る。
+   OPENROBO_CAPABILITY_ROUTEを持つ相手へのframeはflagsにOPENROBO_FRAME_FLAG_ROUTEを立て、
+   header(channelのframeではchannel IDの後ろ)に"#subject", "#src", "#dst"の順で
+   最初に現れるパラメータの位置(先頭の';'の本体内のoffset, uint32 little endian)を置く。無いものはOPENROBO_FRAME_ROUTE_NONE。
+   受信側のメインスレッドはtypeで振り分け、転送や結合に必要なパラメータだけをその位置から読む(本体を先頭から辿らない)
+   OPENROBO_CAPABILITY_SIDを持つ相手へはさらにOPENROBO_FRAME_FLAG_SIDを立て、その後ろに
+   送り元と宛先のsubsystemのSID(uint16 little endian)を置く。受信側は宛先を自身のSIDと整数で比べる
+*/
+#ifndef OPENROBO_ROUTE_ENABLE
+#define OPENROBO_ROUTE_ENABLE (1)
+#endif
+
+#define OPENROBO_FRAME_FLAG_ROUTE (1u << 4)
+#define OPENROBO_FRAME_ROUTE_FIELDS (3)
+#define OPENROBO_FRAME_ROUTE_SIZE (OPENROBO_FRAME_ROUTE_FIELDS * 4)
+#define OPENROBO_FRAME_ROUTE_NONE (0xFFFFFFFFu)
+#define OPENROBO_FRAME_FLAG_SID (1u << 5)
+#define OPENROBO_FRAME_SID_SIZE (4)
+#define OPENROBO_FRAME_MAX_HEADER_SIZE (OPENROBO_FRAME_CHANNEL_HEADER_SIZE + OPENROBO_FRAME_ROUTE_SIZE + OPENROBO_FRAME_SID_SIZE)
+
+/*
+   SID
+
+   TaskPlannerがOpenROBO_Socket_AcceptConnection()で各subsystemに付ける番号(TaskPlannerは0)。
+   OPENROBO_CAPABILITY_SIDを持つ相手への接続情報ではcapabilitiesの後ろに".%x"で付ける("50002/1000001.3 VISION"など)
+   SIDは届いたframeの宛先の確認(誤配送の破棄)にだけ使う。返答や転送の送り先は従来どおり"#src"のthreadIDで決める
+*/
+#define OPENROBO_SID_NONE (0xFFFF)
+#define OPENROBO_SID_STR_LEN (5)
+
+enum {
+  OpenROBO_Framing_Text = 0,
+  OpenROBO_Framing_Binary,
+};
+
+enum {
+  OpenROBO_Route_Subject = 0,
+  OpenROBO_Route_SourceID,
+  OpenROBO_Route_DestinationID,
+};
+
+typedef struct {
+  int type;      // メッセージの種類(-1: routing headerなし)
+  size_t size;   // 本体の長さ(終端'\0'を含む)
+  uint32_t offset[OPENROBO_FRAME_ROUTE_FIELDS];
+  uint16_t sourceSID;      // OPENROBO_FRAME_FLAG_SIDがなければOPENROBO_SID_NONE
+  uint16_t destinationSID;
+} OpenROBO_route_t;
+
+/*
+   capabilities
+
+   接続情報のポート番号の後ろに"/%x"で付加して交換する("50002/1000001 VISION"など)。
+   古いエージェントの受信バッファはポート番号と名前の分しかなく、付加すると名前が長い場合にOpenROBO_Return_BufferOverになる。
+   そのため自分の情報にはOPENROBO_LEGACY_SELF_INFO_SIZEに収まる場合だけ付け、接続情報はcapabilitiesを送ってきた相手にだけ付ける
+   (名前が長くて付けられなかったエージェントは古いエージェントとして扱われる)
+   上位8bitはframeのバージョン
+   OPENROBO_CAPABILITY_REBINDは"bind;"で接続のthreadIDを付け直せること(プールのworkerが接続を使い回せる)を示す
+   OPENROBO_CAPABILITY_CHANNELはcarrierを受け付けられることを示す
+   OPENROBO_CAPABILITY_SUBSCRIBEは"Subscribe;"を処理できることを示す(持たない相手には送らない)
+   OPENROBO_CAPABILITY_BATCHは"#subject"を複数含むRead/Write Messageを処理できることを示す(持たない相手には送らない)
+   OPENROBO_CAPABILITY_SHMは最初のメッセージの後で共有メモリへの切り替え(OpenROBO_Shm)を受け付けることを示す
+   OPENROBO_CAPABILITY_UNIXは受け付けるポートと同じ番号のAF_UNIX socket(OpenROBO_Unix)でも接続を受け付けることを示す
+   OPENROBO_CAPABILITY_ROUTEはOPENROBO_FRAME_FLAG_ROUTEのframe(routing header)を受け付けることを示す
+   OPENROBO_CAPABILITY_SIDは接続情報に付けたSIDとOPENROBO_FRAME_FLAG_SIDのframeを受け付けることを示す
+   OPENROBO_CAPABILITY_SEQはCommand Messageの"#seq"を返答にそのまま付けて返すことを示す(持つ相手にだけ"#seq"を付けて送る)
+*/
+#define OPENROBO_CAPABILITY_BINARY_FRAME (1u << 0)
+#define OPENROBO_CAPABILITY_BINARY_PARAM (1u << 1)
+#define OPENROBO_CAPABILITY_REBIND (1u << 2)
+#define OPENROBO_CAPABILITY_CHANNEL (1u << 3)
+#define OPENROBO_CAPABILITY_SUBSCRIBE (1u << 4)
+#define OPENROBO_CAPABILITY_BATCH (1u << 5)
+#define OPENROBO_CAPABILITY_SHM (1u << 6)
+#define OPENROBO_CAPABILITY_UNIX (1u << 7)
+#define OPENROBO_CAPABILITY_ROUTE (1u << 8)
+#define OPENROBO_CAPABILITY_SID (1u << 9)
+#define OPENROBO_CAPABILITY_SEQ (1u << 10)
+#define OPENROBO_CAPABILITY_VERSION_SHIFT (24)
+#define OPENROBO_CAPABILITY_STR_LEN (9)
+#define OPENROBO_LEGACY_SELF_INFO_SIZE (OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_PORT_STR_LEN+2) // 古いTaskPlannerの受信バッファ
+
+/*
+   binary parameter
+
+   ";name=(D16),"の後ろにIEEE-754のdoubleをlittle endianでそのまま並べる(Iはint32, Bはbyte)。
+   値の長さは個数と型から決まるので、値の中の';'や'\0'は区切りとして扱わない。
+   OPENROBO_CAPABILITY_BINARY_PARAMを持たない相手に送る際は送信時にtextへ変換する。
+*/
+#ifndef OPENROBO_BINARY_PARAM_ENABLE
+#define OPENROBO_BINARY_PARAM_ENABLE (1)
+#endif
+
+#if OPENROBO_BINARY_FRAME_ENABLE
+#define OPENROBO_CAPABILITY_FRAME_BITS (OPENROBO_CAPABILITY_BINARY_FRAME)
+#else
+#define OPENROBO_CAPABILITY_FRAME_BITS (0)
+#endif
+
+#if OPENROBO_BINARY_PARAM_ENABLE
+#define OPENROBO_CAPABILITY_PARAM_BITS (OPENROBO_CAPABILITY_BINARY_PARAM)
+#else
+#define OPENROBO_CAPABILITY_PARAM_BITS (0)
+#endif
+
+#if OPENROBO_CHANNEL_ENABLE && OPENROBO_BINARY_FRAME_ENABLE
+#define OPENROBO_CAPABILITY_CHANNEL_BITS (OPENROBO_CAPABILITY_CHANNEL)
+#else
+#define OPENROBO_CAPABILITY_CHANNEL_BITS (0)
+#endif
+
+#if OPENROBO_SHM_ENABLE
+#define OPENROBO_CAPABILITY_SHM_BITS (OPENROBO_CAPABILITY_SHM)
+#else
+#define OPENROBO_CAPABILITY_SHM_BITS (0)
+#endif
+
+#if OPENROBO_UNIX_ENABLE
+#define OPENROBO_CAPABILITY_UNIX_BITS (OPENROBO_CAPABILITY_UNIX)
+#else
+#define OPENROBO_CAPABILITY_UNIX_BITS (0)
+#endif
+
+#if OPENROBO_ROUTE_ENABLE && OPENROBO_BINARY_FRAME_ENABLE
+#define OPENROBO_CAPABILITY_ROUTE_BITS (OPENROBO_CAPABILITY_ROUTE)
+#else
+#define OPENROBO_CAPABILITY_ROUTE_BITS (0)
+#endif
+
+#define OPENROBO_SELF_CAPABILITIES ((OPENROBO_FRAME_VERSION << OPENROBO_CAPABILITY_VERSION_SHIFT) | OPENROBO_CAPABILITY_FRAME_BITS | OPENROBO_CAPABILITY_PARAM_BITS | OPENROBO_CAPABILITY_REBIND | OPENROBO_CAPABILITY_CHANNEL_BITS | OPENROBO_CAPABILITY_SUBSCRIBE | OPENROBO_CAPABILITY_BATCH | OPENROBO_CAPABILITY_SHM_BITS | OPENROBO_CAPABILITY_UNIX_BITS | OPENROBO_CAPABILITY_ROUTE_BITS | OPENROBO_CAPABILITY_SID | OPENROBO_CAPABILITY_SEQ)
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define OPENROBO_BIG_ENDIAN_HOST (1)
+#endif
+
+#if defined(_OPENROBO_WIN32_)
+typedef CRITICAL_SECTION OpenROBO_Mutex_t;
+typedef CONDITION_VARIABLE OpenROBO_Cond_t;
+typedef SRWLOCK OpenROBO_RWLock_t;
+#else
+typedef pthread_mutex_t OpenROBO_Mutex_t;
+typedef pthread_cond_t OpenROBO_Cond_t;
+typedef pthread_rwlock_t OpenROBO_RWLock_t;
+#endif
+
+#if defined(_OPENROBO_POSIX_)
+typedef struct iovec OpenROBO_iovec_t;
+#else
+typedef struct {
+  void *iov_base;
+  size_t iov_len;
+} OpenROBO_iovec_t;
+#endif
+
+/*
+   SocketComが保持しているソケットのディスクリプタ。
+   scatter-gather送信(sendmsg)、poll/epoll、AF_UNIXや共有メモリのdoorbellのために使用する。
+
+   SocketComはディスクリプタを取り出す・渡すAPIを持たないので、次の前提でメンバを直接使う。
+   使うのはOpenROBO_SocketCom_getDescriptor()とOpenROBO_SocketCom_adoptDescriptor()だけにする
+   - ディスクリプタはint型のメンバsockにある(POSIX版のSocketCom)
+   - SocketCom_Init()はsockを無効な値にし、SocketCom_Dispose()は有効なsockをclose()する
+   - sockの他にソケットの状態を持たない(自分で作ったディスクリプタを入れてもSocketCom_Send/Recvが使える)
+   メンバ名が違うSocketComではOPENROBO_SOCKETCOM_DESCRIPTOR(s)を定義してコンパイルする
+   (int型の左辺値にならない場合はOpenROBO_SocketCom_adoptDescriptor()でコンパイルエラーになる)
+*/
+#ifndef OPENROBO_SOCKETCOM_DESCRIPTOR
+#define OPENROBO_SOCKETCOM_DESCRIPTOR(s) ((s)->sock)
+#endif
+
+static int OpenROBO_SocketCom_getDescriptor(const SocketCom *sock)
+{
+  return OPENROBO_SOCKETCOM_DESCRIPTOR(sock);
+}
+
+#if OPENROBO_UNIX_ENABLE
+/*
+   自分で作ったディスクリプタfdをsockに持たせる(以後はSocketCom_Dispose()で閉じる)
+*/
+static void OpenROBO_SocketCom_adoptDescriptor(SocketCom *sock, int fd)
+{
+  int *descriptor = &OPENROBO_SOCKETCOM_DESCRIPTOR(sock);
+  SocketCom_Init(sock);
+  *descriptor = fd;
+}
+#endif
+
 
 /**
 * The origin of following macro is TinyCThread
@@ -96,6 +502,8 @@ struct _OpenROBO_Message_buffer {
 static _Thread_local struct _OpenROBO_Message_buffer OpenROBO_Message_commonBuffer = {NULL, 0};
 
 static SocketCom OpenROBO_acceptSocket = SOCKETCOM_INITIALIZER;
+static SocketCom OpenROBO_unixAcceptSocket = SOCKETCOM_INITIALIZER; // 同じホストの相手からの接続を受け付ける(OpenROBO_Unix)
+static int OpenROBO_unixAccepting = 0;
 static uint16_t OpenROBO_acceptPort = OPENROBO_DEFAULT_ACCEPT_PORT;
 static _Thread_local int OpenROBO_isMainThread = 0;
 #define OpenROBO_selfSubsystemName OpenROBO_subsystemTable.infos[0].id
@@ -109,20 +517,107 @@ const char* const OpenROBO_MessageHeader_Wait  = "Wait;";
 const char* const OpenROBO_MessageHeader_Return   = "Return;";
 const char* const OpenROBO_MessageHeader_Read   = "read;";
 const char* const OpenROBO_MessageHeader_Write   = "write;";
+const char* const OpenROBO_MessageHeader_Bind   = "bind;";
+const char* const OpenROBO_MessageHeader_Subscribe = "Subscribe;"; // "Start;"とは2文字目で区別する
+
+static const char * const OpenROBO_Message_paramName_sourceID = "#src";
+static const char * const OpenROBO_Message_paramName_destinationID = "#dst";
+static const char * const OpenROBO_Message_paramName_subject = "#subject";
+static const char * const OpenROBO_Message_paramName_return = "#return";
+static const char * const OpenROBO_Message_paramName_time = "#time";
+static const char * const OpenROBO_Message_paramName_interval = "#interval";
+static const char * const OpenROBO_Message_paramName_version = "#version";
+static const char * const OpenROBO_Message_paramName_seq = "#seq";
+static const char * const OpenROBO_Message_paramName_push = "#push";
 
 static _Thread_local char OpenROBO_threadID[OPENROBO_THREAD_ID_SIZE];
 
 static void OpenROBO_Message_setDestinationID(char* message, const char* destinationID);
 static void OpenROBO_Message_setSourceID(char* message, const char* sourceID);
-static int OpenROBO_Socket_forwardReturnMessage(const char* originalMessage, const char *returnMessage);
+static int OpenROBO_Message_setDestinationID(OpenROBO_MessageBuilder_t *builder, const char* destinationID);
+static int OpenROBO_Message_setSourceID(OpenROBO_MessageBuilder_t *builder, const char* sourceID);
+static int OpenROBO_MessageBuilder_append(OpenROBO_MessageBuilder_t *builder, const void *data, size_t size);
+static void OpenROBO_MessageBuilder_wrap(OpenROBO_MessageBuilder_t *builder, char *message);
+static int OpenROBO_Socket_forwardReturnMessage(uint32_t sourceHandle, const char *sourceID, size_t sourceIDSize, const char *returnMessage, uint32_t seq);
+static int OpenROBO_Message_setSeq(OpenROBO_MessageBuilder_t *builder, uint32_t seq);
+static uint32_t OpenROBO_MessageView_getSeq(const OpenROBO_MessageView_t *view);
 static int OpenROBO_Socket_sendMessage(const char* destinationID, const char* message, const char* suffix);
-static int OpenROBO_Socket_recvMessage(SocketCom* sock, char **message);
-
-int OpenROBO_ReadWriteMemory_put(const char *key, const char *message);
-const char *OpenROBO_ReadWriteMemory_get(const char *key);
+static int OpenROBO_Socket_sendMessageTo(struct _OpenROBO_sockList* s, const char* message, const char* suffix);
+typedef struct _OpenROBO_shm OpenROBO_shm_t;
+static void OpenROBO_Shm_close(OpenROBO_shm_t *shm);
+static size_t OpenROBO_Shm_pending(OpenROBO_shm_t *shm);
+static int OpenROBO_Shm_rearm(OpenROBO_shm_t *shm);
+static void OpenROBO_Shm_peek(OpenROBO_shm_t *shm, char *c);
+static int OpenROBO_Shm_offer(SocketCom *sock, OpenROBO_shm_t **shm);
+static int OpenROBO_Shm_accept(SocketCom *sock, OpenROBO_shm_t **shm);
+static int OpenROBO_Socket_waitRecvable(SocketCom* sock, OpenROBO_shm_t* shm);
+static int OpenROBO_Socket_recvAll(SocketCom* sock, OpenROBO_shm_t* shm, void *buf, size_t size);
+static int OpenROBO_Socket_sendv(SocketCom* sock, OpenROBO_shm_t* shm, OpenROBO_iovec_t *iov, int iovcnt);
+static int OpenROBO_Socket_sendControlFrame(SocketCom* sock, OpenROBO_shm_t* shm, uint8_t flags, uint32_t channelID, const char* payload);
+static int OpenROBO_Socket_recvString(SocketCom* sock, char *str, size_t strSize);
+static int OpenROBO_Socket_reserveCommonBuffer(size_t size);
+static struct _OpenROBO_channel* OpenROBO_Channel_open(const struct _OpenROBO_subsystemTable_info* peer);
+static void OpenROBO_Channel_close(struct _OpenROBO_channel* ch);
+static int OpenROBO_Channel_hasPending(struct _OpenROBO_channel* ch);
+static int OpenROBO_Channel_checkWorking(struct _OpenROBO_channel* ch);
+static int OpenROBO_Channel_waitForStop(struct _OpenROBO_channel* ch);
+static int OpenROBO_Channel_recv(struct _OpenROBO_channel* ch, char **message);
+static void OpenROBO_Channel_startup(void);
+static void OpenROBO_Async_releaseAll(void);
+static void OpenROBO_Async_term(void);
+static void OpenROBO_StopFlag_startup(void);
+static void OpenROBO_Dispatch_startup(void);
+static void OpenROBO_Poller_remove(struct _OpenROBO_sockList *s);
+static int OpenROBO_ReadWritePool_deferDelete(struct _OpenROBO_sockList *s);
+static unsigned int OpenROBO_ReadWriteMemory_hash(const char *key);
+static void OpenROBO_Subscription_dropSubscriber(const char *subscriberID);
+static int OpenROBO_Subscription_flush(void);
+static void OpenROBO_Mutex_init(OpenROBO_Mutex_t *mutex);
+static void OpenROBO_Mutex_destroy(OpenROBO_Mutex_t *mutex);
+static void OpenROBO_Mutex_lock(OpenROBO_Mutex_t *mutex);
+static void OpenROBO_Mutex_unlock(OpenROBO_Mutex_t *mutex);
+static SocketCom* OpenROBO_Channel_getSocket(struct _OpenROBO_channel* ch, OpenROBO_Mutex_t** sendMutex, uint32_t* channelID, OpenROBO_shm_t** shm);
+
+// ReadWriteMemoryの値(参照カウント付き、書き換えない)
+typedef struct _OpenROBO_ReadWriteMemory_Value {
+  volatile long refs;
+  unsigned int version; // 書き込みの通し番号(0は使わない)
+  double time;          // 書き込まれた時刻(OpenROBO_getMonotonicTime())
+  size_t size;   // frameの長さ(終端'\0'を含まない)
+  int hasBinary;
+  char frame[1]; // Read Messageへの返答: "Return;#subject=...;#ret=...;" + 書き込まれたパラメータ + #time + #version
+} OpenROBO_ReadWriteMemory_Value_t;
+
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_makeValue(const char *key, const char *message);
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_makeValueFrom(const char *key, const char *params, size_t paramsSize);
+static size_t OpenROBO_Message_measureWithoutRoute(const char *message, size_t size);
+static int OpenROBO_ReadWriteMemory_put(const char *key, OpenROBO_ReadWriteMemory_Value_t *value);
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_acquire(const char *key);
+static void OpenROBO_ReadWriteMemory_release(OpenROBO_ReadWriteMemory_Value_t *value);
+static int OpenROBO_ReadWriteMemory_isNewer(unsigned int version, unsigned int than);
+static void OpenROBO_ReadWriteMemory_acquireAll(const char *const keys[], size_t n, unsigned int hashes[], OpenROBO_ReadWriteMemory_Value_t *values[]);
+static int OpenROBO_ReadWriteMemory_putAll(const char *const keys[], size_t n, unsigned int hashes[], OpenROBO_ReadWriteMemory_Value_t *values[]);
 int OpenROBO_ReadWriteMemory_init(int size);
 int OpenROBO_Message_buffer_realloc(struct _OpenROBO_Message_buffer* buf, size_t size);
-static int OpenROBO_Socket_sendReturnMessageBySystem(const char* originalMessage, const char *returnMessage);
+static int OpenROBO_Socket_sendReturnMessageBySystem(const OpenROBO_MessageView_t* originalView, const char *returnMessage);
+static int OpenROBO_Message_findParam(const char *message, size_t pos, const char *name, OpenROBO_MessageViewEntry_t *entry);
+static int OpenROBO_Message_nextSection(const char *message, size_t size, size_t *pos, OpenROBO_MessageViewEntry_t *subject, size_t *begin, size_t *end);
+static int OpenROBO_Message_findParamWithin(const char *message, size_t pos, size_t end, const char *name, OpenROBO_MessageViewEntry_t *entry);
+static int OpenROBO_Message_isBatch(const char *message);
+static unsigned int OpenROBO_Message_decodeInts(const char *message, const OpenROBO_MessageViewEntry_t *entry, int *values, unsigned int n);
+static unsigned int OpenROBO_Message_decodeDoubles(const char *message, const OpenROBO_MessageViewEntry_t *entry, double *values, unsigned int n);
+static unsigned int OpenROBO_Message_decodeBytes(const char *message, const OpenROBO_MessageViewEntry_t *entry, unsigned char *values, unsigned int n);
+static size_t OpenROBO_Message_binaryElementSize(char type);
+static int OpenROBO_Message_nextParam(const char *message, size_t *pos, OpenROBO_MessageViewEntry_t *entry);
+static int OpenROBO_Async_drain(struct _OpenROBO_sockList *s);
+static void OpenROBO_Async_block(struct _OpenROBO_sockList **conns, size_t connsSize, int waitMsec, void *fds);
+static size_t OpenROBO_Message_measure(const char *message, size_t size, int *hasBinary);
+static void OpenROBO_Route_make(OpenROBO_route_t *route, const char *message, size_t messageSize, const char *suffix, size_t suffixSize);
+static int OpenROBO_Route_field(const char *message, const OpenROBO_MessageViewEntry_t *entry);
+static int OpenROBO_Message_nextParamWithin(const char *message, size_t size, size_t *pos, OpenROBO_MessageViewEntry_t *entry);
+static int OpenROBO_MessageView_parseRoute(OpenROBO_MessageView_t *view, const char *message, const OpenROBO_route_t *route);
+static char* OpenROBO_Message_toText(const char *message, size_t size, size_t *textSize);
+static _Thread_local int OpenROBO_Message_paramEncoding = OpenROBO_ParamEncoding_Text;
 
 /*
     subsystemID format is "SubsystemName" such as "TASKPLANNER"
@@ -145,15 +640,28 @@ static char* OpenROBO_generateThreadID(const char *subsystemID, const char *func
   return threadID;
 }
 
-static char* OpenROBO_generateThreadIDFromMessage(const char *message, char *threadID)
+static char* OpenROBO_generateThreadIDFromView(const OpenROBO_MessageView_t *view, char *threadID)
 {
   const char *functionName;
   const char *subsystemID;
-  OpenROBO_Message_GetSubject(message, &functionName);
-  OpenROBO_Message_GetDestinationID(message, &subsystemID);
-  OpenROBO_generateThreadID(subsystemID, functionName, threadID);
-  OpenROBO_free((void*)subsystemID);
-  OpenROBO_free((void*)functionName);
+  size_t functionNameSize, subsystemIDSize;
+
+  threadID[0] = '\0';
+  if (OpenROBO_MessageView_GetSubject(view, &functionName, &functionNameSize) != OpenROBO_Return_Success) {
+    return NULL;
+  }
+  if (OpenROBO_MessageView_GetDestinationID(view, &subsystemID, &subsystemIDSize) != OpenROBO_Return_Success) {
+    return NULL;
+  }
+  if ((subsystemIDSize + functionNameSize + 2) > OPENROBO_THREAD_ID_SIZE) {
+    return NULL;
+  }
+
+  memcpy(&threadID[0], subsystemID, subsystemIDSize);
+  threadID[subsystemIDSize] = '@';
+  memcpy(&threadID[subsystemIDSize+1], functionName, functionNameSize);
+  threadID[subsystemIDSize+1+functionNameSize] = '\0';
+
   return threadID;
 }
 
@@ -166,15 +674,19 @@ static char* OpenROBO_generateThreadIDFromMessage(const char *message, char *thr
 
    _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
 
-typedef struct {
+typedef struct _OpenROBO_subsystemTable_info {
   char id[OPENROBO_SUBSYSTEM_ID_SIZE];
   char ip[OPENROBO_IP_STR_LEN+1];
   uint16_t port;
+  uint32_t capabilities;
+  int forceTextParam; // OpenROBO_Socket_SetParamEncoding()でtextを指定された
+  uint16_t sid;       // 分からなければOPENROBO_SID_NONE
 } OpenROBO_subsystemTable_info_t;
 
 typedef struct {
   OpenROBO_subsystemTable_info_t infos[OPENROBO_AGENTS_COMMECTION_MAX];
   size_t infosSize;
+  uint8_t indexBySID[OPENROBO_AGENTS_COMMECTION_MAX]; // SIDのinfosでの位置+1(0は無し)
 } OpenROBO_subsystemTable_t;
 
 // TaskPlannerの場合: OpenROBO_subsystemTable[0]はTaskPlanner(自身)の情報, それ以降はその他のエージェントの情報
@@ -184,6 +696,25 @@ static _Thread_local OpenROBO_subsystemTable_t OpenROBO_subsystemTable = {
   0
 };
 
+/*
+   infoにSIDを付けてSIDで引けるようにする
+*/
+static void OpenROBO_setSubsystemSID(OpenROBO_subsystemTable_info_t *info, uint16_t sid)
+{
+  info->sid = sid < OPENROBO_AGENTS_COMMECTION_MAX ? sid : OPENROBO_SID_NONE;
+  if (info->sid != OPENROBO_SID_NONE) {
+    OpenROBO_subsystemTable.indexBySID[sid] = (uint8_t)(info - OpenROBO_subsystemTable.infos + 1);
+  }
+}
+
+static OpenROBO_subsystemTable_info_t* OpenROBO_findSubsystemInfoBySID(uint16_t sid)
+{
+  if (sid >= OPENROBO_AGENTS_COMMECTION_MAX || OpenROBO_subsystemTable.indexBySID[sid] == 0) {
+    return NULL;
+  }
+  return &OpenROBO_subsystemTable.infos[OpenROBO_subsystemTable.indexBySID[sid] - 1];
+}
+
 static int OpenROBO_hasSubsystemInfo(const char* id)
 {
   size_t i;
@@ -195,6 +726,68 @@ static int OpenROBO_hasSubsystemInfo(const char* id)
   return 0;
 }
 
+/*
+   自身と相手のcapabilitiesから接続で使用するframeの形式を決める
+*/
+static int OpenROBO_negotiateFraming(uint32_t peerCapabilities)
+{
+  uint32_t selfCapabilities = OPENROBO_SELF_CAPABILITIES;
+  if ((selfCapabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT) != (peerCapabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT)) {
+    return OpenROBO_Framing_Text;
+  }
+  if ((selfCapabilities & peerCapabilities & OPENROBO_CAPABILITY_BINARY_FRAME) == 0) {
+    return OpenROBO_Framing_Text;
+  }
+  return OpenROBO_Framing_Binary;
+}
+
+/*
+   相手のsubsystemの情報から接続で使用するパラメータの形式を決める
+*/
+static int OpenROBO_negotiateParamEncoding(const OpenROBO_subsystemTable_info_t *peer)
+{
+  uint32_t selfCapabilities = OPENROBO_SELF_CAPABILITIES;
+  if (peer == NULL || peer->forceTextParam) {
+    return OpenROBO_ParamEncoding_Text;
+  }
+  if ((selfCapabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT) != (peer->capabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT)) {
+    return OpenROBO_ParamEncoding_Text;
+  }
+  if ((selfCapabilities & peer->capabilities & OPENROBO_CAPABILITY_BINARY_PARAM) == 0) {
+    return OpenROBO_ParamEncoding_Text;
+  }
+  return OpenROBO_ParamEncoding_Binary;
+}
+
+static int OpenROBO_hasCapability(const OpenROBO_subsystemTable_info_t *peer, uint32_t capability)
+{
+  uint32_t selfCapabilities = OPENROBO_SELF_CAPABILITIES;
+  if (peer == NULL) {
+    return 0;
+  }
+  if ((selfCapabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT) != (peer->capabilities >> OPENROBO_CAPABILITY_VERSION_SHIFT)) {
+    return 0;
+  }
+  return (selfCapabilities & peer->capabilities & capability) != 0;
+}
+
+/*
+   subsystemIDまたはthreadID("SubsystemName@FunctionName")からsubsystemの情報を探す
+*/
+static OpenROBO_subsystemTable_info_t* OpenROBO_findSubsystemInfoByThreadID(const char* id)
+{
+  size_t i;
+  const char *at = strchr(id, '@');
+  size_t idSize = at != NULL ? (size_t)(at - id) : strlen(id);
+  for (i = 0; i < OpenROBO_subsystemTable.infosSize; i++) {
+    const char *name = OpenROBO_subsystemTable.infos[i].id;
+    if (strncmp(name, id, idSize) == 0 && name[idSize] == '\0') {
+      return &OpenROBO_subsystemTable.infos[i];
+    }
+  }
+  return NULL;
+}
+
 static int OpenROBO_hasSubsystemInfos(const char* const ids[])
 {
   size_t i;
@@ -208,1653 +801,8453 @@ static int OpenROBO_hasSubsystemInfos(const char* const ids[])
 
 /* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
 
-   OpenROBO_sockList
-
+   OpenROBO_Unix
 
-   通信に使用するsocketのリスト
+   同じホストの相手にはTCPの代わりにAF_UNIXのstream socketで接続する。
+   メインスレッドはTCPで受け付けるポートと同じ番号の名前("openrobo-ポート番号"、Linuxのabstract namespace)でも受け付ける。
+   ホストの中でTCPのポートを使えるプロセスは1つなので、相手のIPアドレスが自分のホストのものであれば
+   ポート番号から相手の名前が決まり、接続情報に名前を加える必要はない。
+   接続できなければTCPで接続する。接続した後のやり取りはTCPと同じ。
 
    _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
 
-typedef struct _OpenROBO_sockList {
-  char id[OPENROBO_THREAD_ID_SIZE];
-  SocketCom sock;
-  struct _OpenROBO_sockList* next;
-} OpenROBO_sockList_t;
+#if OPENROBO_UNIX_ENABLE
 
-static _Thread_local OpenROBO_sockList_t* OpenROBO_sockList = NULL;
+static socklen_t OpenROBO_Unix_makeAddress(uint16_t port, struct sockaddr_un *addr)
+{
+  int n;
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  n = snprintf(&addr->sun_path[1], sizeof(addr->sun_path)-1, "openrobo-%u", (unsigned int)port); // sun_path[0]の'\0'はabstract namespace
+  return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + n);
+}
 
-static size_t OpenROBO_sockList_getLen()
+/*
+   メインスレッドの受け付けるsocketを作る。作れなかった場合はTCPだけで受け付ける
+*/
+static void OpenROBO_Unix_listen(uint16_t port)
 {
-  size_t c = 0;
-  OpenROBO_sockList_t *p = OpenROBO_sockList;
-  if (p == NULL) {
-    return c;
+  struct sockaddr_un addr;
+  socklen_t addrSize = OpenROBO_Unix_makeAddress(port, &addr);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return;
   }
-
-  while (1) {
-    c++;
-    if (p->next == NULL) {
-      break;
-    }
-    p = p->next;
+  if (bind(fd, (struct sockaddr *)&addr, addrSize) != 0 || listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return;
   }
+  OpenROBO_SocketCom_adoptDescriptor(&OpenROBO_unixAcceptSocket, fd);
+  OpenROBO_unixAccepting = 1;
+}
 
-  return c;
+static int OpenROBO_Unix_accept(SocketCom *acceptSock, SocketCom *sock)
+{
+  int fd;
+  do {
+    fd = accept4(OpenROBO_SocketCom_getDescriptor(acceptSock), NULL, NULL, SOCK_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_SocketCom_adoptDescriptor(sock, fd);
+  return OpenROBO_Return_Success;
 }
 
-static OpenROBO_sockList_t* OpenROBO_sockList_getLast()
+/*
+   ipが自分のホストのアドレスか
+*/
+static int OpenROBO_Unix_isLocalAddress(const char *ip)
 {
-  OpenROBO_sockList_t *p = OpenROBO_sockList;
-  if (p == NULL) {
-    return NULL;
+  struct in_addr target;
+  struct ifaddrs *list, *p;
+  int found = 0;
+
+  if (inet_pton(AF_INET, ip, &target) != 1) {
+    return 0;
   }
-  while (1) {
-    if (p->next == NULL) {
-      break;
+  if ((ntohl(target.s_addr) >> 24) == 127) {
+    return 1;
+  }
+  if (getifaddrs(&list) != 0) {
+    return 0;
+  }
+  for (p = list; p != NULL && !found; p = p->ifa_next) {
+    if (p->ifa_addr != NULL && p->ifa_addr->sa_family == AF_INET) {
+      found = ((struct sockaddr_in *)p->ifa_addr)->sin_addr.s_addr == target.s_addr;
     }
-    p = p->next;
   }
-  return p;
+  freeifaddrs(list);
+
+  return found;
 }
 
-static OpenROBO_sockList_t* OpenROBO_sockList_createNew()
+/*
+   相手が同じホストにあればAF_UNIXで接続する
+   @retval OpenROBO_Return_NonConnection 同じホストにない、または接続できなかった(TCPで接続する)
+*/
+static int OpenROBO_Unix_connect(SocketCom *sock, const OpenROBO_subsystemTable_info_t *peer)
 {
-  _OpenROBO_sockList *p, *n;
-  n = (OpenROBO_sockList_t*)OpenROBO_malloc(sizeof(OpenROBO_sockList_t));
-  if (n == NULL) {
-    return NULL;
-  }
+  struct sockaddr_un addr;
+  socklen_t addrSize;
+  int fd, res;
 
-  // init
-  SocketCom_Init(&n->sock);
-  n->next = NULL;
-
-  p = OpenROBO_sockList_getLast();
-  if (p == NULL) {
-    OpenROBO_sockList = n;
-  } else {
-    p->next = n;
+  if (!OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_UNIX) || !OpenROBO_Unix_isLocalAddress(peer->ip)) {
+    return OpenROBO_Return_NonConnection;
   }
-
-  return n;
-}
-
-static int OpenROBO_sockList_delete(OpenROBO_sockList_t* del)
-{
-  OpenROBO_sockList_t *p1, *p2;
-  p1 = OpenROBO_sockList;
-  p2 = NULL;
-  while (1) {
-    if (p1 == NULL) {
-      return OpenROBO_Return_Error;
-    }
-    if (p1 == del) {
-      break;
-    }
-    p2 = p1;
-    p1 = p1->next;
+  addrSize = OpenROBO_Unix_makeAddress(peer->port, &addr);
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return OpenROBO_Return_NonConnection;
   }
-
-  if (p2 == NULL) {
-    OpenROBO_sockList = p1->next;
-  } else {
-    p2->next = p1->next;
+  do {
+    res = connect(fd, (struct sockaddr *)&addr, addrSize);
+  } while (res != 0 && errno == EINTR);
+  if (res != 0) {
+    close(fd);
+    return OpenROBO_Return_NonConnection;
   }
-
-  SocketCom_Dispose(&p1->sock);
-  OpenROBO_free(p1);
+  OpenROBO_SocketCom_adoptDescriptor(sock, fd);
 
   return OpenROBO_Return_Success;
 }
 
-static void OpenROBO_sockList_deleteAll()
+#else
+
+static void OpenROBO_Unix_listen(uint16_t port)
 {
-  while (OpenROBO_sockList_delete(OpenROBO_sockList) == OpenROBO_Return_Success);
+  (void)port;
 }
 
-static OpenROBO_sockList_t* OpenROBO_sockList_findByID(const char* id)
+static int OpenROBO_Unix_accept(SocketCom *acceptSock, SocketCom *sock)
 {
-  OpenROBO_sockList_t *p;
-  p = OpenROBO_sockList;
-  while (1) {
-    if (p == NULL) {
-      break;
-    }
-    if (strcmp(p->id, id) == 0) {
-      break;
-    }
-    p = p->next;
-  }
+  (void)acceptSock;
+  (void)sock;
+  return OpenROBO_Return_Error;
+}
 
-  return p;
+static int OpenROBO_Unix_connect(SocketCom *sock, const OpenROBO_subsystemTable_info_t *peer)
+{
+  (void)sock;
+  (void)peer;
+  return OpenROBO_Return_NonConnection;
 }
 
-static OpenROBO_sockList_t* OpenROBO_sockList_findBySocketCom(SocketCom *sock)
+#endif
+
+/*
+   受信可能になった受け付けのsocket(Pollerではどちらもreadyのエントリは同じNULLになる)
+*/
+static SocketCom* OpenROBO_Unix_readyAcceptSocket(void)
 {
-  OpenROBO_sockList_t *p;
-  p = OpenROBO_sockList;
-  while (1) {
-    if (p == NULL) {
-      return NULL;
-    }
-    if (SocketCom_Equal(&p->sock, sock)) {
-      break;
-    }
-    p = p->next;
+  if (OpenROBO_unixAccepting && SocketCom_IsRecvable(&OpenROBO_unixAcceptSocket)) {
+    return &OpenROBO_unixAcceptSocket;
   }
-
-  return p;
+  return &OpenROBO_acceptSocket;
 }
 
-static SocketCom* OpenROBO_sockList_findSocketCom(const char *ID)
+/*
+   相手のsubsystemが受け付けるsocketに接続する(同じホストであればAF_UNIX、それ以外はTCP)
+*/
+static int OpenROBO_Socket_connectPeer(SocketCom *sock, const OpenROBO_subsystemTable_info_t *peer)
 {
-  OpenROBO_sockList_t *s = OpenROBO_sockList_findByID(ID);
-  if (s == NULL) {
-    return NULL;
+  if (OpenROBO_Unix_connect(sock, peer) == OpenROBO_Return_Success) {
+    return OpenROBO_Return_Success;
+  }
+  if (SocketCom_Create(sock) != SOCKETCOM_SUCCESS) {
+    return OpenROBO_Return_Error;
   }
-  return &s->sock;
+  if (SocketCom_ConnectTo(sock, peer->ip, peer->port) != SOCKETCOM_SUCCESS) {
+    SocketCom_Dispose(sock);
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Return_Success;
 }
 
-static void OpenROBO_sockList_deleteBySocketCom(SocketCom *sock)
+static uint32_t OpenROBO_hashBytes(const char* p, size_t size)
 {
-  OpenROBO_sockList_t *s = OpenROBO_sockList_findBySocketCom(sock);
-  if (s == NULL) {
-    return;
+  uint32_t h = 2166136261u; // FNV-1a
+  size_t i;
+  for (i = 0; i < size; i++) {
+    h = (h ^ (uint8_t)p[i]) * 16777619u;
   }
-
-  OpenROBO_sockList_delete(s);
+  return h;
 }
 
-static OpenROBO_sockList_t* OpenROBO_sockList_connect(const char* destinationID)
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Intern
+
+   subsystemIDとthreadIDをプロセスの中で一意な整数(handle)に置き換える表。
+   接続(OpenROBO_sockList)、終了要求のフラグ、結合待ちの転送先、非同期の送り先はhandleで引いて比べ、文字列はデバッグ表示にだけ使う。
+   OpenROBO_Intern_add()で得たhandleは参照を持ち、OpenROBO_Intern_release()で返す。
+   参照がなくなった名前は消し、entryは別の名前に使い回す(プールのworkerの付け直しで表が増え続けないように)。
+   handleには使い回した回数(世代)を含めるので、消した後に残っていた古いhandleは新しい名前と一致しない。
+   表はhashでOPENROBO_INTERN_SHARDS個に分け、見つからない場合もその分け先のmutexだけを取る。
+   見つかったhandleはスレッドごとのcacheに名前の複製と一緒に残し、同じ名前を続けて引く場合(送信先の解決など)はmutexを取らない。
+   分け先で名前を消すたびにepochを増やし、cacheはepochが変わっていなければ使う
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+#define OPENROBO_HANDLE_NONE (0)
+
+// handle: 世代(12bit) | entryのindex+1(16bit) | 分け先(4bit)
+#define OPENROBO_INTERN_SHARD_BITS (4)
+#define OPENROBO_INTERN_INDEX_BITS (16)
+#define OPENROBO_INTERN_INDEX_MAX ((1u << OPENROBO_INTERN_INDEX_BITS) - 1)
+#define OPENROBO_INTERN_GENERATION_SHIFT (OPENROBO_INTERN_SHARD_BITS + OPENROBO_INTERN_INDEX_BITS)
+
+#if OPENROBO_INTERN_SHARDS <= 0 || (OPENROBO_INTERN_SHARDS & (OPENROBO_INTERN_SHARDS - 1)) != 0 || OPENROBO_INTERN_SHARDS > (1 << OPENROBO_INTERN_SHARD_BITS)
+#error "OPENROBO_INTERN_SHARDS must be a power of 2 up to 16"
+#endif
+
+typedef struct {
+  uint32_t hash;
+  size_t nameSize;
+  char *name;        // '\0'で終わる(空いているentryではNULL)
+  uint32_t handle;   // 今のhandle(空いているentryでは最後に使ったhandle)
+  uint32_t refs;
+  uint32_t nextFree; // 次に空いているentryのindex+1(0は終わり)
+} OpenROBO_internEntry_t;
+
+typedef struct {
+  OpenROBO_Mutex_t mutex;
+  volatile long epoch;             // 名前を消すたびに増やす
+  OpenROBO_internEntry_t *entries; // handleのindexの位置
+  size_t size;                     // 使ったことのあるentryの数
+  size_t used;                     // 名前が入っているentryの数
+  size_t capacity;
+  uint32_t freeHead;               // 空いているentryのindex+1(0はなし)
+  uint32_t *slots;                 // open addressing(entryのindex+1、0は空き)
+  size_t slotsSize;                // 2のべき乗
+} OpenROBO_internShard_t;
+
+typedef struct {
+  int initialized;
+  OpenROBO_internShard_t shards[OPENROBO_INTERN_SHARDS];
+} OpenROBO_Intern_t;
+
+static OpenROBO_Intern_t OpenROBO_intern;
+
+typedef struct {
+  char name[OPENROBO_INTERN_CACHE_NAME_SIZE]; // これより長い名前はcacheしない
+  size_t nameSize;                            // 0は空き
+  uint32_t handle;
+  long epoch;                                 // handleを入れたときの分け先のepoch
+} OpenROBO_internCache_t;
+
+static _Thread_local OpenROBO_internCache_t OpenROBO_internCache[OPENROBO_INTERN_CACHE_SIZE];
+
+static void OpenROBO_Intern_startup(void)
 {
-  int res;
   size_t i;
-  OpenROBO_subsystemTable_t *table = &OpenROBO_subsystemTable;
-  for (i = 0; i < table->infosSize; i++) {
-    if (strcmp(destinationID, table->infos[i].id) == 0) {
-      break;
-    }
+  if (OpenROBO_intern.initialized) {
+    return;
   }
-  if (i >= table->infosSize) {
-    return NULL;
+  for (i = 0; i < OPENROBO_INTERN_SHARDS; i++) {
+    OpenROBO_Mutex_init(&OpenROBO_intern.shards[i].mutex);
   }
+  OpenROBO_intern.initialized = 1;
+}
 
-  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
-  if (s == NULL) {
-    return NULL;
-  }
+static OpenROBO_internShard_t* OpenROBO_Intern_shardOf(uint32_t handle)
+{
+  return &OpenROBO_intern.shards[handle & (OPENROBO_INTERN_SHARDS - 1)];
+}
 
-  res = SocketCom_Create(&s->sock);
-  if (res != SOCKETCOM_SUCCESS) {
-    return NULL;
-  }
-  res = SocketCom_ConnectTo(&s->sock, table->infos[i].ip, table->infos[i].port);
-  if (res != SOCKETCOM_SUCCESS) {
-    return NULL;
-  }
-  res = SocketCom_Send(&s->sock, OpenROBO_threadID, strlen(OpenROBO_threadID)+1);
-  if (res != SOCKETCOM_SUCCESS) {
+/*
+   handleのentryを返す(分け先のmutexを取ってから呼ぶ)
+   @return 消された名前の古いhandleならNULL
+*/
+static OpenROBO_internEntry_t* OpenROBO_Intern_entryOf(OpenROBO_internShard_t *shard, uint32_t handle)
+{
+  size_t index = ((handle >> OPENROBO_INTERN_SHARD_BITS) & OPENROBO_INTERN_INDEX_MAX) - 1;
+  if (index >= shard->size || shard->entries[index].handle != handle || shard->entries[index].name == NULL) {
     return NULL;
   }
-  strcpy(s->id, table->infos[i].id);
+  return &shard->entries[index];
+}
 
-  return s;
+/*
+   nameのslot(なければ入れる場所)を探す(分け先のmutexを取ってから呼ぶ)
+*/
+static uint32_t* OpenROBO_Intern_probe(const OpenROBO_internShard_t *shard, uint32_t *slots, size_t slotsSize, const char *name, size_t nameSize, uint32_t hash)
+{
+  size_t i = hash & (slotsSize - 1);
+  while (slots[i] != 0) {
+    const OpenROBO_internEntry_t *e = &shard->entries[slots[i] - 1];
+    if (e->hash == hash && e->nameSize == nameSize && memcmp(e->name, name, nameSize) == 0) {
+      break;
+    }
+    i = (i + 1) & (slotsSize - 1);
+  }
+  return &slots[i];
 }
 
-//TODO
-#if 0
-static int OpenROBO_cloneConnection(const OpenROBO_subsystemTable_t* src, OpenROBO_subsystemTable_t *dst, const char* firstMessage)
+/*
+   使用率が1/2を超えないようにslotsを広げ、entriesも足りるようにする(分け先のmutexを取ってから呼ぶ)
+*/
+static int OpenROBO_Intern_reserve(OpenROBO_internShard_t *shard)
 {
-  size_t firstMessageSize = strlen(firstMessage) + 1;
-  int res;
-  size_t i;
-  for (i = 0; i < src->infosSize; i++) {
-    OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
-    if (s == NULL) {
+  if (shard->freeHead == 0 && shard->size + 1 > shard->capacity) {
+    size_t capacity = shard->capacity == 0 ? OPENROBO_INTERN_INITIAL_SLOTS/2 : shard->capacity*2;
+    OpenROBO_internEntry_t *entries;
+    if (shard->size + 1 > OPENROBO_INTERN_INDEX_MAX) {
       return OpenROBO_Return_Error;
     }
-    res = SocketCom_Create(&s->sock);
-    if (res != SOCKETCOM_SUCCESS) {
+    entries = (OpenROBO_internEntry_t *)OpenROBO_realloc(shard->entries, sizeof(OpenROBO_internEntry_t)*capacity);
+    if (entries == NULL) {
       return OpenROBO_Return_Error;
     }
-    res = SocketCom_ConnectTo(&s->sock, src->infos[i].ip, src->infos[i].port);
-    if (res != SOCKETCOM_SUCCESS) {
+    shard->entries = entries;
+    shard->capacity = capacity;
+  }
+  if ((shard->used + 1)*2 > shard->slotsSize) {
+    size_t slotsSize = shard->slotsSize == 0 ? OPENROBO_INTERN_INITIAL_SLOTS : shard->slotsSize*2;
+    uint32_t *slots = (uint32_t *)OpenROBO_malloc(sizeof(uint32_t)*slotsSize);
+    size_t i;
+    if (slots == NULL) {
       return OpenROBO_Return_Error;
     }
-    res = SocketCom_Send(&s->sock, firstMessage, firstMessageSize);
-    if (res != SOCKETCOM_SUCCESS) {
-      return OpenROBO_Return_Error;
+    memset(slots, 0, sizeof(uint32_t)*slotsSize);
+    for (i = 0; i < shard->size; i++) {
+      const OpenROBO_internEntry_t *e = &shard->entries[i];
+      if (e->name != NULL) {
+        *OpenROBO_Intern_probe(shard, slots, slotsSize, e->name, e->nameSize, e->hash) = (uint32_t)(i + 1);
+      }
     }
-    strcpy(s->id, src->infos[i].id);
+    OpenROBO_free(shard->slots);
+    shard->slots = slots;
+    shard->slotsSize = slotsSize;
   }
-
   return OpenROBO_Return_Success;
 }
-#endif
-
-static int OpenROBO_Socket_createAcceptSocket(uint16_t *_port);
 
-int OpenROBO_Message_buffer_init()
+/*
+   slotを空け、後ろに続くslotを詰める(linear probingで途中が空いて見つからなくならないように)
+*/
+static void OpenROBO_Intern_removeSlot(OpenROBO_internShard_t *shard, uint32_t *slot)
 {
-  OpenROBO_Message_commonBuffer.size = OPENROBO_MESSAGE_BUFFER_DEFAULT_SIZE;
-  OpenROBO_Message_commonBuffer.p = (char *)OpenROBO_malloc(OpenROBO_Message_commonBuffer.size);
-  if (OpenROBO_Message_commonBuffer.p == NULL) {
-    return OpenROBO_Return_Error;
+  size_t mask = shard->slotsSize - 1;
+  size_t i = (size_t)(slot - shard->slots);
+  size_t j = i;
+  while (1) {
+    size_t k;
+    j = (j + 1) & mask;
+    if (shard->slots[j] == 0) {
+      break;
+    }
+    k = shard->entries[shard->slots[j] - 1].hash & mask;
+    // kが(i, j]にあればjのままで見つかる
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+      continue;
+    }
+    shard->slots[i] = shard->slots[j];
+    i = j;
   }
-  OpenROBO_Message_commonBuffer.p[0] = '\0';
-
-  return OpenROBO_Return_Success;
+  shard->slots[i] = 0;
 }
 
-void OpenROBO_Message_buffer_term()
+static void OpenROBO_Intern_cache(OpenROBO_internCache_t *cache, const OpenROBO_internShard_t *shard, const char *name, size_t nameSize, uint32_t handle)
 {
-  if (OpenROBO_Message_commonBuffer.p == NULL) {
+  if (nameSize >= sizeof(cache->name)) {
     return;
   }
-  OpenROBO_free(OpenROBO_Message_commonBuffer.p);
-  OpenROBO_Message_commonBuffer.p = NULL;
-  OpenROBO_Message_commonBuffer.size = 0;
+  memcpy(cache->name, name, nameSize);
+  cache->nameSize = nameSize;
+  cache->handle = handle;
+  cache->epoch = shard->epoch;
 }
 
-int OpenROBO_StartupMainThread(const char* subsystemName)
+/*
+   nameのhandleを返す(nameは'\0'で終わらなくてよい)
+   @param[in] add 0の場合は表に足さず、参照も持たない
+   @return 見つからない、または足せなかった場合はOPENROBO_HANDLE_NONE
+*/
+static uint32_t OpenROBO_Intern_get(const char *name, size_t nameSize, int add)
 {
-  int res;
-  if (strlen(subsystemName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
-    return OpenROBO_Return_Error;
+  uint32_t handle = OPENROBO_HANDLE_NONE;
+  uint32_t hash = OpenROBO_hashBytes(name, nameSize);
+  uint32_t *slot;
+  OpenROBO_internEntry_t *e = NULL;
+  OpenROBO_internShard_t *shard;
+  // FNV-1aの下位bitは偏るので上位bitを混ぜてcacheの位置と分け先にする
+  uint32_t mixed = hash ^ (hash >> 16);
+  OpenROBO_internCache_t *cache = &OpenROBO_internCache[mixed & (OPENROBO_INTERN_CACHE_SIZE - 1)];
+
+  if (nameSize == 0 || !OpenROBO_intern.initialized) {
+    return OPENROBO_HANDLE_NONE;
   }
-
-  OpenROBO_isMainThread = 1;
-
-  res = OpenROBO_ReadWriteMemory_init(OPENROBO_READWIRTEMEMORY_DEFAULT_SIZE);
-  if (res != OpenROBO_Return_Success) {
-    return res;
+  shard = &OpenROBO_intern.shards[(mixed >> 8) & (OPENROBO_INTERN_SHARDS - 1)];
+  if (!add && cache->nameSize == nameSize && memcmp(cache->name, name, nameSize) == 0 &&
+      cache->epoch == __atomic_load_n(&shard->epoch, __ATOMIC_ACQUIRE)) {
+    return cache->handle;
   }
-
-  SocketCom_Startup();
-
-  res = OpenROBO_Socket_createAcceptSocket(&OpenROBO_acceptPort);
-  if (res != OpenROBO_Return_Success) {
-    return res;
+  OpenROBO_Mutex_lock(&shard->mutex);
+  if (shard->used > 0) {
+    slot = OpenROBO_Intern_probe(shard, shard->slots, shard->slotsSize, name, nameSize, hash);
+    if (*slot != 0) {
+      e = &shard->entries[*slot - 1];
+    }
   }
-
-  res = OpenROBO_Message_buffer_init();
-  if (res != OpenROBO_Return_Success) {
-    return res;
+  if (e == NULL && add && OpenROBO_Intern_reserve(shard) == OpenROBO_Return_Success) {
+    char *copy = (char *)OpenROBO_malloc(nameSize + 1);
+    if (copy != NULL) {
+      size_t index;
+      uint32_t generation = 0;
+      if (shard->freeHead != 0) {
+        index = shard->freeHead - 1;
+        shard->freeHead = shard->entries[index].nextFree;
+        generation = (shard->entries[index].handle >> OPENROBO_INTERN_GENERATION_SHIFT) + 1;
+      } else {
+        index = shard->size++;
+      }
+      e = &shard->entries[index];
+      memcpy(copy, name, nameSize);
+      copy[nameSize] = '\0';
+      e->name = copy;
+      e->nameSize = nameSize;
+      e->hash = hash;
+      e->refs = 0;
+      e->nextFree = 0;
+      e->handle = (generation << OPENROBO_INTERN_GENERATION_SHIFT) | ((uint32_t)(index + 1) << OPENROBO_INTERN_SHARD_BITS) | (uint32_t)(shard - OpenROBO_intern.shards);
+      *OpenROBO_Intern_probe(shard, shard->slots, shard->slotsSize, name, nameSize, hash) = (uint32_t)(index + 1);
+      shard->used++;
+    }
   }
+  if (e != NULL) {
+    if (add) {
+      e->refs++;
+    }
+    handle = e->handle;
+    OpenROBO_Intern_cache(cache, shard, name, nameSize, handle);
+  }
+  OpenROBO_Mutex_unlock(&shard->mutex);
 
-  strcpy(OpenROBO_threadID, subsystemName);
-  strcpy(OpenROBO_subsystemTable.infos[0].id, subsystemName);
-  strcpy(OpenROBO_subsystemTable.infos[0].ip, "127.0.0.1");
-  OpenROBO_subsystemTable.infos[0].port = OpenROBO_acceptPort;
-  OpenROBO_subsystemTable.infosSize = 1;
+  return handle;
+}
 
-  return OpenROBO_Return_Success;
+/*
+   nameのhandleを参照を持って返す(なければ足す)。使い終えたらOpenROBO_Intern_release()に渡す
+*/
+static uint32_t OpenROBO_Intern_add(const char *name, size_t nameSize)
+{
+  return OpenROBO_Intern_get(name, nameSize, 1);
 }
 
+/*
+   nameのhandleを返す(参照は持たないので、比べるためだけに使う)
+*/
+static uint32_t OpenROBO_Intern_find(const char *name, size_t nameSize)
+{
+  return OpenROBO_Intern_get(name, nameSize, 0);
+}
 
+/*
+   OpenROBO_Intern_add()で得た参照を返す。参照がなくなれば名前を消し、entryを空ける
+*/
+static void OpenROBO_Intern_release(uint32_t handle)
+{
+  OpenROBO_internShard_t *shard;
+  OpenROBO_internEntry_t *e;
+  if (handle == OPENROBO_HANDLE_NONE || !OpenROBO_intern.initialized) {
+    return;
+  }
+  shard = OpenROBO_Intern_shardOf(handle);
+  OpenROBO_Mutex_lock(&shard->mutex);
+  e = OpenROBO_Intern_entryOf(shard, handle);
+  if (e != NULL && e->refs > 0 && --e->refs == 0) {
+    OpenROBO_Intern_removeSlot(shard, OpenROBO_Intern_probe(shard, shard->slots, shard->slotsSize, e->name, e->nameSize, e->hash));
+    OpenROBO_free(e->name);
+    e->name = NULL;
+    e->nameSize = 0;
+    e->nextFree = shard->freeHead;
+    shard->freeHead = (uint32_t)(e - shard->entries) + 1;
+    shard->used--;
+    __atomic_add_fetch(&shard->epoch, 1, __ATOMIC_RELEASE);
+  }
+  OpenROBO_Mutex_unlock(&shard->mutex);
+}
 
 /* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
-   OpenROBO_Thread
 
-   The origin is TinyCThread
+   OpenROBO_sockList
 
-   TinyCThread (https://tinycthread.github.io)
-   Copyright (c) 2012 Marcus Geelnard
-   Copyright (c) 2013-2016 Evan Nemerson
-   under the zlib/libpng license
 
------------------------------------------------------
-     License of TinyCThread
------------------------------------------------------
-Copyright (c) 2012 Marcus Geelnard
-Copyright (c) 2013-2016 Evan Nemerson
+   通信に使用するsocketのリスト
+   接続は連続した配列itemsに持ち、threadIDのhandle(OpenROBO_Intern)とsocketのhash indexで引く。
+   削除は末尾の接続を空いた位置に移すが、先頭(サブスレッドでは自身のメインスレッドへの接続)は削除されるまで先頭のまま
 
-This software is provided 'as-is', without any express or implied
-warranty. In no event will the authors be held liable for any damages
-arising from the use of this software.
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
 
-Permission is granted to anyone to use this software for any purpose,
-including commercial applications, and to alter it and redistribute it
-freely, subject to the following restrictions:
+#define OPENROBO_SOCKLIST_INDEX_ID (0)
+#define OPENROBO_SOCKLIST_INDEX_SOCKET (1)
+#define OPENROBO_SOCKLIST_INDEX_NUM (2)
 
-    1. The origin of this software must not be misrepresented; you must not
-    claim that you wrote the original software. If you use this software
-    in a product, an acknowledgment in the product documentation would be
-    appreciated but is not required.
+/*
+   接続に届いた購読の値("#push"付きのメッセージ)。OpenROBO_Socket_ReceivePushMessage()で受け取る
+*/
+typedef struct _OpenROBO_pushItem {
+  struct _OpenROBO_pushItem *next;
+  size_t size;
+  char message[1];
+} OpenROBO_pushItem_t;
 
-    2. Altered source versions must be plainly marked as such, and must not be
-    misrepresented as being the original software.
+/*
+   オペレーションスレッドがメインスレッドへの接続に送った返答を、メインスレッドが読んだか
+*/
+enum {
+  OpenROBO_LocalFence_None = 0, // 読まれていない返答はない(OpenROBO_localを使える)
+  OpenROBO_LocalFence_Sent,     // 接続に返答を送った
+  OpenROBO_LocalFence_Followed, // 返答の後にCommand Messageを送った(その返答が届けば読まれている)
+};
 
-    3. This notice may not be removed or altered from any source
-    distribution.
------------------------------------------------------
-   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
-struct _OpenROBO_Thread_startInfo
-{
-  int (*func)(int, char *[]);
-  OpenROBO_MessageFunction_t msgfunc;
-  OpenROBO_subsystemTable_t subsystemTable;
-  char *message;
-  int argc;
-  char** argv;
-};
+typedef struct _OpenROBO_sockList {
+  char id[OPENROBO_THREAD_ID_SIZE];
+  uint32_t handle;                    // idのhandle
+  uint16_t sid;                       // 相手のsubsystemのSID
+  SocketCom sock;
+  int framing;
+  int paramEncoding;
+  int routing;                        // routing headerに付けるOPENROBO_FRAME_FLAG_ROUTE/OPENROBO_FRAME_FLAG_SID
+  int seqEnabled;                     // 相手が返答に"#seq"を付けて返す(OPENROBO_CAPABILITY_SEQ)
+  uint32_t seq;                       // 最後に送ったCommand Messageの番号(seqEnabledなら"#seq"として付ける。0は使わない)
+  uint32_t staleSeq;                  // 期限切れで待つのをやめた返答のseq(seqEnabledならこれ以前の返答は捨てる。0はなし)
+  int staleCount;                     // "#seq"を返さない相手で、期限切れで待つのをやめた返答の数
+  int pending;                        // 送ったCommand Messageのうち返答をまだ受け取っていない数
+  int localFence;                     // メインスレッドへの接続に送った返答が読まれたか確かめられるまでOpenROBO_localを使わない(OpenROBO_LocalFence_*)
+  int subscribed;                     // Subscribe Messageを送った(届いたメッセージが購読の値か調べる)
+  OpenROBO_pushItem_t *pushHead;      // 届いた購読の値(届いた順)
+  OpenROBO_pushItem_t *pushTail;
+  int isCarrier;                      // 相手のプロセスのスレッドが共有する接続(受け付けた側)
+  struct _OpenROBO_sockList* carrier; // 受け付けた側のchannel: channelを運ぶcarrier
+  uint32_t channelID;
+  struct _OpenROBO_channel* channel;  // 接続した側のchannel
+  OpenROBO_shm_t* shm;                // 共有メモリに切り替えた接続(socketはdoorbellと切断の検知に使う)
+  OpenROBO_Mutex_t sendMutex;         // ReadWritePoolのworkerもメインスレッドの接続に返答を送る
+  int refs;                           // ReadWritePoolのジョブからの参照(ReadWritePoolのmutexで保護)
+  int deleted;                        // 参照が残っている間に削除された
+  size_t index;                       // OpenROBO_sockList.itemsでの位置
+  int indexed[OPENROBO_SOCKLIST_INDEX_NUM];
+  uint32_t hash[OPENROBO_SOCKLIST_INDEX_NUM];
+  struct _OpenROBO_sockList* hashNext[OPENROBO_SOCKLIST_INDEX_NUM];
+} OpenROBO_sockList_t;
 
-static _Thread_local int OpenROBO_Thread_workingFlag = 1;
+typedef struct {
+  OpenROBO_sockList_t **items;
+  size_t size;
+  size_t capacity;
+  OpenROBO_sockList_t **buckets[OPENROBO_SOCKLIST_INDEX_NUM];
+  size_t bucketsSize; // 2のべき乗
+} OpenROBO_sockListTable_t;
 
-static int OpenROBO_Thread_detach(OpenROBO_Thread_t thr)
+static _Thread_local OpenROBO_sockListTable_t OpenROBO_sockList = {NULL, 0, 0, {NULL, NULL}, 0};
+static OpenROBO_sockList_t* OpenROBO_receivedSocket = NULL; /* 最後にメッセージを受信した接続(メインスレッドのみ) */
+static _Thread_local OpenROBO_route_t OpenROBO_receivedRoute = {-1, 0, {0, 0, 0}, OPENROBO_SID_NONE, OPENROBO_SID_NONE}; /* 最後に受信したメッセージのrouting header */
+
+#if !OPENROBO_EPOLL_ENABLE
+static size_t OpenROBO_sockList_getLen()
 {
-#if defined(_OPENROBO_WIN32_)
-  /* https://stackoverflow.com/questions/12744324/how-to-detach-a-thread-on-windows-c#answer-12746081 */
-  return CloseHandle(thr) != 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
-#else
-  return pthread_detach(thr) == 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
-#endif
+  return OpenROBO_sockList.size;
 }
-
-/* Thread wrapper function. */
-#if defined(_OPENROBO_WIN32_)
-static DWORD WINAPI OpenROBO_Thread_start_wrapper(LPVOID aArg)
-#elif defined(_OPENROBO_POSIX_)
-static void * OpenROBO_Thread_start_wrapper(void * aArg)
 #endif
+
+static OpenROBO_sockList_t* OpenROBO_sockList_getFirst()
 {
-  int ret;
-  int (*func)(int, char *[]);
-  OpenROBO_MessageFunction_t msgfunc;
-  char *message;
-  int argc;
-  char **argv;
+  if (OpenROBO_sockList.size == 0) {
+    return NULL;
+  }
+  return OpenROBO_sockList.items[0];
+}
 
-  /* Get thread startup information */
-  _OpenROBO_Thread_startInfo *ti = (_OpenROBO_Thread_startInfo *) aArg;
-  func = ti->func;
-  msgfunc = ti->msgfunc;
-  message = ti->message;
-  argc = ti->argc;
-  argv = ti->argv;
+/*
+   socketを持つ接続か(channelはcarrierのsocketを使う)
+*/
+static int OpenROBO_sockList_hasSocket(const OpenROBO_sockList_t* s)
+{
+  return s->carrier == NULL && s->channel == NULL;
+}
 
-  ret = OpenROBO_Message_buffer_init();
+static uint32_t OpenROBO_sockList_hashHandle(uint32_t handle)
+{
+  return handle * 2654435761u;
+}
 
-  OpenROBO_generateThreadIDFromMessage(message, OpenROBO_threadID);
-  OpenROBO_subsystemTable = ti->subsystemTable;
+static uint32_t OpenROBO_sockList_hashSocket(const SocketCom* sock, uint32_t channelID)
+{
+  uint32_t h = (uint32_t)OpenROBO_SocketCom_getDescriptor(sock);
+  return (h ^ (channelID * 2654435761u)) * 2654435761u;
+}
 
-  /* The thread is responsible for freeing the startup information */
-  OpenROBO_free((void *)ti);
+static void OpenROBO_sockList_link(OpenROBO_sockList_t* s, int k, uint32_t hash)
+{
+  OpenROBO_sockList_t **bucket = &OpenROBO_sockList.buckets[k][hash & (OpenROBO_sockList.bucketsSize - 1)];
+  s->hash[k] = hash;
+  s->hashNext[k] = *bucket;
+  *bucket = s;
+  s->indexed[k] = 1;
+}
 
-  /* Call the actual client thread function */
-  if (func != NULL) {
-    /* Particular Subthread */
-    OpenROBO_free((void *)message);
-    func(argc, argv);
-  } else {
-    /* Message Subthread */
-    char returnMessage[1024] = "";
-    const char *subject;
-    OpenROBO_Message_GetSubject(message, &subject);
-    OpenROBO_Message_MakeReturnMessage(returnMessage, subject);
-    OpenROBO_Message_SetReturnValue(returnMessage, ret);
-    OpenROBO_Socket_sendReturnMessageBySystem(message, returnMessage);
-    OpenROBO_free((void *)subject);
-    if (ret == OpenROBO_Return_Success) { // TODO
-      msgfunc(message);
+static void OpenROBO_sockList_unlink(OpenROBO_sockList_t* s, int k)
+{
+  OpenROBO_sockList_t **p;
+  if (!s->indexed[k]) {
+    return;
+  }
+  for (p = &OpenROBO_sockList.buckets[k][s->hash[k] & (OpenROBO_sockList.bucketsSize - 1)]; *p != NULL; p = &(*p)->hashNext[k]) {
+    if (*p == s) {
+      *p = s->hashNext[k];
+      break;
     }
-    OpenROBO_free((void *)message);
   }
+  s->indexed[k] = 0;
+}
 
-  OpenROBO_Message_buffer_term();
-
-  OpenROBO_CheckWorking(); // for clear socket buffer
+/*
+   hash indexのbucketを作り直す
+*/
+static int OpenROBO_sockList_rehash(size_t bucketsSize)
+{
+  OpenROBO_sockList_t **buckets[OPENROBO_SOCKLIST_INDEX_NUM];
+  size_t i;
+  int k;
 
-  OpenROBO_sockList_deleteAll();
+  for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+    buckets[k] = (OpenROBO_sockList_t **)OpenROBO_malloc(sizeof(OpenROBO_sockList_t *)*bucketsSize);
+    if (buckets[k] == NULL) {
+      while (k-- > 0) {
+        OpenROBO_free(buckets[k]);
+      }
+      return OpenROBO_Return_Error;
+    }
+    memset(buckets[k], 0, sizeof(OpenROBO_sockList_t *)*bucketsSize);
+  }
 
-#if defined(_OPENROBO_WIN32_)
-  return 0;
-#else
-  return NULL;
-#endif
-}
+  for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+    OpenROBO_free(OpenROBO_sockList.buckets[k]);
+    OpenROBO_sockList.buckets[k] = buckets[k];
+  }
+  OpenROBO_sockList.bucketsSize = bucketsSize;
 
-static int OpenROBO_Message_clone(const char* originalMessage, char** clonedMessage)
-{
-  char *p;
-  size_t size;
-  size = strlen(originalMessage) + 1;
-  p = (char *)OpenROBO_malloc(size);
-  if (p == NULL) {
-    DBGABORT();
-    return OpenROBO_Return_Error;
+  for (i = 0; i < OpenROBO_sockList.size; i++) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList.items[i];
+    for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+      if (s->indexed[k]) {
+        OpenROBO_sockList_link(s, k, s->hash[k]);
+      }
+    }
   }
-  strcpy(p, originalMessage);
-  *clonedMessage = p;
 
   return OpenROBO_Return_Success;
 }
 
-static int OpenROBO_Thread_create_common(int (*func)(int, char *[]), OpenROBO_MessageFunction_t msgfunc, char* message, int argc, char *argv[])
+static OpenROBO_sockList_t* OpenROBO_sockList_createNew()
 {
-  OpenROBO_Thread_t thr;
-  _OpenROBO_Thread_startInfo* ti = (_OpenROBO_Thread_startInfo*)OpenROBO_malloc(sizeof(_OpenROBO_Thread_startInfo));
-  if (ti == NULL) {
-    return OpenROBO_Return_Error;
-  }
+  OpenROBO_sockList_t *n;
+  int k;
 
-  if (OpenROBO_Message_clone(message, &ti->message) != OpenROBO_Return_Success) {
-    return OpenROBO_Return_Error;
+  if (OpenROBO_sockList.size >= OpenROBO_sockList.capacity) {
+    size_t capacity = OpenROBO_sockList.capacity == 0 ? OPENROBO_SOCKLIST_INITIAL_CAPACITY : OpenROBO_sockList.capacity*2;
+    OpenROBO_sockList_t **items = (OpenROBO_sockList_t **)OpenROBO_realloc(OpenROBO_sockList.items, sizeof(OpenROBO_sockList_t *)*capacity);
+    if (items == NULL) {
+      return NULL;
+    }
+    OpenROBO_sockList.items = items;
+    OpenROBO_sockList.capacity = capacity;
+  }
+  if (OpenROBO_sockList.size >= OpenROBO_sockList.bucketsSize) {
+    if (OpenROBO_sockList_rehash(OpenROBO_sockList.capacity) != OpenROBO_Return_Success) {
+      return NULL;
+    }
   }
-  ti->func = func;
-  ti->msgfunc = msgfunc;
-  ti->argc = argc;
-  ti->argv = argv;
-  ti->subsystemTable = OpenROBO_subsystemTable;
 
-  /* Create the thread */
-#if defined(_OPENROBO_WIN32_)
-  thr = CreateThread(NULL, 0, OpenROBO_Thread_start_wrapper, (LPVOID) ti, 0, NULL);
-#elif defined(_OPENROBO_POSIX_)
-  if(pthread_create(&thr, NULL, OpenROBO_Thread_start_wrapper, (void *)ti) != 0)
-  {
-    thr = 0;
+  n = (OpenROBO_sockList_t*)OpenROBO_malloc(sizeof(OpenROBO_sockList_t));
+  if (n == NULL) {
+    return NULL;
   }
-#endif
 
-  /* Did we fail to create the thread? */
-  if(!thr)
-  {
-    OpenROBO_free(ti);
-    return OpenROBO_Return_Error;
+  // init
+  n->id[0] = '\0';
+  n->handle = OPENROBO_HANDLE_NONE;
+  n->sid = OPENROBO_SID_NONE;
+  SocketCom_Init(&n->sock);
+  n->framing = OpenROBO_Framing_Text;
+  n->paramEncoding = OpenROBO_ParamEncoding_Text;
+  n->routing = 0;
+  n->seqEnabled = 0;
+  n->seq = 0;
+  n->staleSeq = 0;
+  n->staleCount = 0;
+  n->pending = 0;
+  n->localFence = 0;
+  n->subscribed = 0;
+  n->pushHead = NULL;
+  n->pushTail = NULL;
+  n->isCarrier = 0;
+  n->carrier = NULL;
+  n->channelID = 0;
+  n->channel = NULL;
+  n->shm = NULL;
+  OpenROBO_Mutex_init(&n->sendMutex);
+  n->refs = 0;
+  n->deleted = 0;
+  for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+    n->indexed[k] = 0;
+    n->hash[k] = 0;
+    n->hashNext[k] = NULL;
   }
 
-  OpenROBO_Thread_detach(thr);
+  n->index = OpenROBO_sockList.size;
+  OpenROBO_sockList.items[OpenROBO_sockList.size] = n;
+  OpenROBO_sockList.size++;
 
-  return OpenROBO_Return_Success;
+  return n;
 }
 
-int OpenROBO_Thread_CreateSubthread(int (*func)(int, char *[]), const char* funcName, int argc, char *argv[])
+/*
+   接続を受信したsocketで引けるようにする(socketを作った後、channelはcarrierとchannel IDを設定した後に呼ぶ)
+*/
+static void OpenROBO_sockList_registerSocket(OpenROBO_sockList_t* s)
 {
-  char threadID[OPENROBO_THREAD_ID_SIZE];
-  OpenROBO_generateThreadID(OpenROBO_threadID, funcName, threadID);
-  if (OpenROBO_sockList_findByID(threadID) != NULL) {
-    return OpenROBO_Return_DoubleCreateSubthread;
+  OpenROBO_sockList_unlink(s, OPENROBO_SOCKLIST_INDEX_SOCKET);
+  if (s->carrier != NULL) {
+    OpenROBO_sockList_link(s, OPENROBO_SOCKLIST_INDEX_SOCKET, OpenROBO_sockList_hashSocket(&s->carrier->sock, s->channelID));
+  } else if (s->channel == NULL) {
+    OpenROBO_sockList_link(s, OPENROBO_SOCKLIST_INDEX_SOCKET, OpenROBO_sockList_hashSocket(&s->sock, 0));
   }
+}
 
-  char *message = (char *)malloc(sizeof(char)*1024);
-  if (message == NULL) {
-    return OpenROBO_Return_Error;
+/*
+   OpenROBO_sockListから外した接続を閉じて解放する
+*/
+static void OpenROBO_sockList_dispose(OpenROBO_sockList_t* s)
+{
+  if (s->channel != NULL) {
+    OpenROBO_Channel_close(s->channel);
+  } else if (s->carrier == NULL) {
+    SocketCom_Dispose(&s->sock);
+    OpenROBO_Shm_close(s->shm);
   }
-
-  OpenROBO_Message_MakeOperationMessage(message, funcName);
-  OpenROBO_Message_setSourceID(message, OpenROBO_threadID);
-  OpenROBO_Message_setDestinationID(message, OpenROBO_threadID);
-
-  return OpenROBO_Thread_create_common(func, NULL, message, argc, argv);
+  while (s->pushHead != NULL) {
+    OpenROBO_pushItem_t *item = s->pushHead;
+    s->pushHead = item->next;
+    OpenROBO_free(item);
+  }
+  OpenROBO_Intern_release(s->handle);
+  OpenROBO_Mutex_destroy(&s->sendMutex);
+  OpenROBO_free(s);
 }
 
-int OpenROBO_Thread_CreateOperationThread(OpenROBO_MessageFunction_t func, char* message)
+static int OpenROBO_sockList_delete(OpenROBO_sockList_t* del)
 {
-  int res;
-  char threadID[OPENROBO_THREAD_ID_SIZE];
+  size_t i;
+  int k;
+  if (del == NULL || del->index >= OpenROBO_sockList.size || OpenROBO_sockList.items[del->index] != del) {
+    return OpenROBO_Return_Error;
+  }
+  if (del->isCarrier) {
+    // carrierが運んでいるchannelも削除する
+    for (i = OpenROBO_sockList.size; i > 0; i--) {
+      if (OpenROBO_sockList.items[i-1]->carrier == del) {
+        OpenROBO_sockList_delete(OpenROBO_sockList.items[i-1]);
+      }
+    }
+  }
 
-  OpenROBO_generateThreadIDFromMessage(message, threadID);
-  if (OpenROBO_sockList_findByID(threadID) != NULL) {
-    res = OpenROBO_Return_DoubleCreateSubthread;
-  } else {
-    res = OpenROBO_Thread_create_common(NULL, func, message, 0, NULL);
+  if (del->id[0] != '\0') {
+    OpenROBO_Subscription_dropSubscriber(del->id);
+  }
+  for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+    OpenROBO_sockList_unlink(del, k);
+  }
+  i = del->index;
+  OpenROBO_sockList.size--;
+  if (i == 0) {
+    memmove(&OpenROBO_sockList.items[0], &OpenROBO_sockList.items[1], sizeof(OpenROBO_sockList_t *)*OpenROBO_sockList.size);
+    for (; i < OpenROBO_sockList.size; i++) {
+      OpenROBO_sockList.items[i]->index = i;
+    }
+  } else if (i < OpenROBO_sockList.size) {
+    OpenROBO_sockList.items[i] = OpenROBO_sockList.items[OpenROBO_sockList.size];
+    OpenROBO_sockList.items[i]->index = i;
   }
 
-  if (res != OpenROBO_Return_Success) {
-    char returnMessage[1024] = "";
-    const char *subject;
-    OpenROBO_Message_GetSubject(message, &subject);
-    OpenROBO_Message_MakeReturnMessage(returnMessage, subject);
-    OpenROBO_Message_SetReturnValue(returnMessage, res);
-    OpenROBO_Socket_sendReturnMessageBySystem(message, returnMessage);
-    OpenROBO_free((void*)subject);
+  // OpenROBO_receivedSocketはメインスレッドの接続しか指さない
+  if (OpenROBO_isMainThread && OpenROBO_receivedSocket == del) {
+    OpenROBO_receivedSocket = NULL;
   }
+  OpenROBO_Poller_remove(del);
 
-  return res;
-}
+  // ReadWritePoolのジョブが返答を送り終えるまで残し、最後のジョブが解放する
+  if (!OpenROBO_ReadWritePool_deferDelete(del)) {
+    OpenROBO_sockList_dispose(del);
+  }
 
-typedef struct _OpenROBO_joinThreadQueue {
-  const char* message;
-  struct _OpenROBO_joinThreadQueue *next;
-} OpenROBO_joinThreadQueue_t;
+  return OpenROBO_Return_Success;
+}
 
-static OpenROBO_joinThreadQueue_t *OpenROBO_JoinThread_returnMessageList = NULL;
+static void OpenROBO_sockList_deleteAll()
+{
+  int k;
+  while (OpenROBO_sockList.size > 0) {
+    OpenROBO_sockList_delete(OpenROBO_sockList.items[OpenROBO_sockList.size-1]);
+  }
 
-static OpenROBO_joinThreadQueue_t *OpenROBO_JoinThread_waitList = NULL;
+  OpenROBO_free(OpenROBO_sockList.items);
+  OpenROBO_sockList.items = NULL;
+  OpenROBO_sockList.capacity = 0;
+  for (k = 0; k < OPENROBO_SOCKLIST_INDEX_NUM; k++) {
+    OpenROBO_free(OpenROBO_sockList.buckets[k]);
+    OpenROBO_sockList.buckets[k] = NULL;
+  }
+  OpenROBO_sockList.bucketsSize = 0;
+}
 
-static const char* OpenROBO_joinThreadQueue_findByFunctionName(OpenROBO_joinThreadQueue_t** list, const char* functionName)
+static OpenROBO_sockList_t* OpenROBO_sockList_findByHandle(uint32_t handle)
 {
-  OpenROBO_joinThreadQueue_t *q;
-  const char *f;
-
-  q = *list;
+  OpenROBO_sockList_t *p;
+  uint32_t hash;
+  if (OpenROBO_sockList.bucketsSize == 0 || handle == OPENROBO_HANDLE_NONE) {
+    return NULL;
+  }
 
-  while (q != NULL) {
-    int res;
-    OpenROBO_Message_GetSubject(q->message, &f);
-    res = strcmp(f, functionName);
-    OpenROBO_free((void*)f);
-    if (res == 0) {
-      return q->message;
+  hash = OpenROBO_sockList_hashHandle(handle);
+  for (p = OpenROBO_sockList.buckets[OPENROBO_SOCKLIST_INDEX_ID][hash & (OpenROBO_sockList.bucketsSize - 1)]; p != NULL; p = p->hashNext[OPENROBO_SOCKLIST_INDEX_ID]) {
+    if (p->handle == handle) {
+      return p;
     }
-    q = q->next;
   }
 
   return NULL;
 }
 
-static int OpenROBO_joinThreadQueue_append(OpenROBO_joinThreadQueue_t** list, const char* message)
+static OpenROBO_sockList_t* OpenROBO_sockList_findByID(const char* id)
 {
-  OpenROBO_joinThreadQueue_t *p, *l;
+  if (OpenROBO_sockList.bucketsSize == 0) {
+    return NULL;
+  }
+  return OpenROBO_sockList_findByHandle(OpenROBO_Intern_find(id, strlen(id)));
+}
 
-  p = (OpenROBO_joinThreadQueue_t *)OpenROBO_malloc(sizeof(OpenROBO_joinThreadQueue_t));
-  if (p == NULL) {
-    return OpenROBO_Return_Error;
+/*
+   受け付けた側のchannelをcarrierとchannel IDから探す
+*/
+static OpenROBO_sockList_t* OpenROBO_sockList_findChannel(const OpenROBO_sockList_t* carrier, uint32_t channelID)
+{
+  OpenROBO_sockList_t *p;
+  uint32_t hash;
+  if (OpenROBO_sockList.bucketsSize == 0) {
+    return NULL;
   }
-  p->message = message;
-  p->next = NULL;
 
-  l = *list;
-  if (l == NULL) {
-    *list = p;
-  } else {
-    while (l->next != NULL) {
-      l = l->next;
+  hash = OpenROBO_sockList_hashSocket(&carrier->sock, channelID);
+  for (p = OpenROBO_sockList.buckets[OPENROBO_SOCKLIST_INDEX_SOCKET][hash & (OpenROBO_sockList.bucketsSize - 1)]; p != NULL; p = p->hashNext[OPENROBO_SOCKLIST_INDEX_SOCKET]) {
+    if (p->carrier == carrier && p->channelID == channelID) {
+      return p;
     }
-    l->next = p;
   }
-  return OpenROBO_Return_Success;
+  return NULL;
 }
 
-static int OpenROBO_joinThreadQueue_delete(OpenROBO_joinThreadQueue_t** list, const char* message)
+/*
+   まだ読んでいないメッセージがあるか
+*/
+static int OpenROBO_sockList_isRecvable(OpenROBO_sockList_t* s)
 {
-  OpenROBO_joinThreadQueue_t *q1, *q2;
-
-  q1 = *list;
-  q2 = NULL;
-  while (1) {
-    if (q1->message == message) {
-      break;
-    }
-    q2 = q1;
-    q1 = q1->next;
+  if (s->channel != NULL) {
+    return OpenROBO_Channel_hasPending(s->channel);
   }
-  if (q2 == NULL) {
-    *list = q1->next;
-  } else {
-    q2->next = q1->next;
+  if (s->shm != NULL) {
+    return OpenROBO_Shm_pending(s->shm) > 0;
   }
-  OpenROBO_free((void*)q1->message);
-  OpenROBO_free(q1);
-
-  return OpenROBO_Return_Success;
+  return SocketCom_IsRecvable(&s->sock);
 }
 
-static int OpenROBO_JoinThread_storeThreadReturnMessage(const char* message)
+static OpenROBO_sockList_t* OpenROBO_sockList_findBySocketCom(SocketCom *sock)
 {
-  if (!OpenROBO_isMainThread) {
-    return OpenROBO_Return_Error;
+  OpenROBO_sockList_t *p;
+  uint32_t hash;
+  if (OpenROBO_sockList.bucketsSize == 0) {
+    return NULL;
   }
-  const char *functionName;
-  const char *exitMessage;
-  int res;
 
-  OpenROBO_Message_GetSubject(message, &functionName);
-  exitMessage = OpenROBO_joinThreadQueue_findByFunctionName(&OpenROBO_JoinThread_waitList, functionName);
-  OpenROBO_free((void *)functionName);
-  if (exitMessage == NULL) {
-    char *_message;
-    res = OpenROBO_Message_clone(message, &_message);
-    if (res != OpenROBO_Return_Success) {
-      return res;
-    }
-    return OpenROBO_joinThreadQueue_append(&OpenROBO_JoinThread_returnMessageList, _message);
-  } else {
-    res = OpenROBO_Socket_forwardReturnMessage(exitMessage, message);
-    if (res != OpenROBO_Return_Success) {
-      return res;
+  hash = OpenROBO_sockList_hashSocket(sock, 0);
+  for (p = OpenROBO_sockList.buckets[OPENROBO_SOCKLIST_INDEX_SOCKET][hash & (OpenROBO_sockList.bucketsSize - 1)]; p != NULL; p = p->hashNext[OPENROBO_SOCKLIST_INDEX_SOCKET]) {
+    if (OpenROBO_sockList_hasSocket(p) && SocketCom_Equal(&p->sock, sock)) {
+      return p;
     }
-    OpenROBO_joinThreadQueue_delete(&OpenROBO_JoinThread_waitList, exitMessage);
-    return OpenROBO_Return_Success;
   }
+
+  return NULL;
 }
 
-int OpenROBO_JoinThread_JoinQueue(const char* message)
+/*
+   socketにthreadIDを付け直す。同じthreadIDが付いている他のsocketからは外す
+   (プールのworkerは接続を使い回すので、前のジョブのworkerのthreadIDが残っている場合がある)
+*/
+static void OpenROBO_sockList_bindID(OpenROBO_sockList_t* s, const char* id)
 {
-  if (!OpenROBO_isMainThread) {
-    return OpenROBO_Return_Error;
+  uint32_t handle = OpenROBO_Intern_add(id, strlen(id));
+  OpenROBO_sockList_t *p = OpenROBO_sockList_findByHandle(handle);
+  if (p != NULL && p != s) {
+    OpenROBO_sockList_unlink(p, OPENROBO_SOCKLIST_INDEX_ID);
+    p->id[0] = '\0';
+    OpenROBO_Intern_release(p->handle);
+    p->handle = OPENROBO_HANDLE_NONE;
   }
-
-
-  const char *functionName;
-  const char *returnMessage;
-
-  OpenROBO_Message_GetSubject(message, &functionName);
-  returnMessage = OpenROBO_joinThreadQueue_findByFunctionName(&OpenROBO_JoinThread_returnMessageList, functionName);
-  OpenROBO_free((void *)functionName);
-  if (returnMessage == NULL) {
-    int res;
-    char *_message;
-    res = OpenROBO_Message_clone(message, &_message);
-    if (res != OpenROBO_Return_Success) {
-      return res;
-    }
-    return OpenROBO_joinThreadQueue_append(&OpenROBO_JoinThread_waitList, _message);
-  } else {
-    int res;
-    res = OpenROBO_Socket_forwardReturnMessage(message, returnMessage);
-    if (res != OpenROBO_Return_Success) {
-      return res;
-    }
-    OpenROBO_joinThreadQueue_delete(&OpenROBO_JoinThread_returnMessageList, returnMessage);
-    return OpenROBO_Return_Success;
+  if (s->id[0] != '\0' && s->handle != handle) {
+    OpenROBO_Subscription_dropSubscriber(s->id);
+  }
+  OpenROBO_sockList_unlink(s, OPENROBO_SOCKLIST_INDEX_ID);
+  strcpy(s->id, id);
+  OpenROBO_Intern_release(s->handle); // 付け直す前の名前の参照を返す
+  s->handle = handle;
+  // carrierは相手のプロセスのスレッドが共有するので、threadIDでは引かない
+  if (handle != OPENROBO_HANDLE_NONE && !s->isCarrier) {
+    OpenROBO_sockList_link(s, OPENROBO_SOCKLIST_INDEX_ID, OpenROBO_sockList_hashHandle(handle));
   }
 }
 
-int OpenROBO_WaitForStopMessage(void)
+/*
+   相手のsubsystemの情報からrouting headerの項目と"#seq"を付けるかを決める(frameの形式を決めた後に呼ぶ)
+*/
+static void OpenROBO_sockList_negotiateRouting(OpenROBO_sockList_t* s, const OpenROBO_subsystemTable_info_t* peer)
 {
-  int res;
-  char buf[1];
-
-  if (OpenROBO_isMainThread) {
-    return 1;
-  }
-
-  if (!OpenROBO_Thread_workingFlag) {
-    return OpenROBO_Return_Success;
+  s->seqEnabled = OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_SEQ);
+  s->routing = 0;
+  s->sid = peer != NULL ? peer->sid : OPENROBO_SID_NONE;
+  if (s->framing != OpenROBO_Framing_Binary || !OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_ROUTE)) {
+    return;
   }
-
-  res = SocketCom_Recv(&OpenROBO_sockList->sock, buf, sizeof(buf), NULL);
-  if (res != SOCKETCOM_SUCCESS) { //fatal error
-    DBGABORT();
-    OpenROBO_Thread_workingFlag = 0;
-    return OpenROBO_Return_Error;
+  s->routing = OPENROBO_FRAME_FLAG_ROUTE;
+  if (OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_SID) && s->sid != OPENROBO_SID_NONE && OpenROBO_subsystemTable.infos[0].sid != OPENROBO_SID_NONE) {
+    s->routing |= OPENROBO_FRAME_FLAG_SID;
   }
+}
 
-  if (buf[0] != '\0') { // unknown condition
-    DBGABORT();
-    OpenROBO_Thread_workingFlag = 0;
-    return OpenROBO_Return_Error;
+static void OpenROBO_sockList_deleteBySocketCom(SocketCom *sock)
+{
+  OpenROBO_sockList_t *s = OpenROBO_sockList_findBySocketCom(sock);
+  if (s == NULL) {
+    return;
   }
 
-  OpenROBO_Thread_workingFlag = 0;
-
-  return OpenROBO_Return_Success;
+  OpenROBO_sockList_delete(s);
 }
 
-int OpenROBO_CheckWorking(void)
-{
-  int res;
-  char buf[1];
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
 
-  if (OpenROBO_isMainThread) {
-    return 1;
-  }
+   OpenROBO_Local
 
-  while (1) {
-    if (!SocketCom_IsRecvable(&OpenROBO_sockList->sock)) {
-      return OpenROBO_Thread_workingFlag;
-    }
+   オペレーションスレッドから自身のメインスレッドへの返答をsocketを通さずに渡すキュー。
+   送る側は返答をコピーした項目をlock-freeのスタック(top)に積むだけで、積む前にスタックが空だった場合だけeventfdに書く。
+   メインスレッドはeventfdをOpenROBO_Pollerで待ち、スタックをまとめて取り出して送られた順(head)に並べ直す。
+   取り出すのはメインスレッドだけなので、取り出した項目が再び積まれること(ABA)はない。
+   オペレーションスレッドは終了要求を受けるためにメインスレッドへの接続をこれまで通り作るが、返答はその接続に書かない。
+   Read/Write Messageなどはこれまで通り接続に送るので、接続にメインスレッドがまだ読んでいないかもしれないメッセージがある間は
+   返答も接続に送り、メインスレッドが受け取る順を送った順に保つ(OpenROBO_Socket_sendToMainThread())
 
-    res = SocketCom_RecvEx(&OpenROBO_sockList->sock, buf, sizeof(buf), NULL, MSG_PEEK);
-    if (res != SOCKETCOM_SUCCESS) { //fatal error
-      DBGABORT();
-      OpenROBO_Thread_workingFlag = 0;
-      return OpenROBO_Thread_workingFlag;
-    }
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
 
-    if (buf[0] != '\0') {
-      break;
-    }
+typedef struct _OpenROBO_localItem {
+  struct _OpenROBO_localItem *next;
+  OpenROBO_route_t route; // socketで受けたframeと同じく、送る側で求めておく
+  size_t size;     // messageの長さ(終端'\0'を含む)
+  char message[1];
+} OpenROBO_localItem_t;
 
-    OpenROBO_Thread_workingFlag = 0;
-    res = SocketCom_Recv(&OpenROBO_sockList->sock, buf, sizeof(buf), NULL);
-    if (res != SOCKETCOM_SUCCESS) {
-      DBGABORT();
-      return OpenROBO_Thread_workingFlag;
-    }
-  }
+typedef struct {
+  int fd;                            // eventfd(使えない場合は-1で、返答は接続に送る)
+  OpenROBO_localItem_t *volatile top; // 送る側が積んだ項目(新しい順)
+  OpenROBO_localItem_t *head;        // メインスレッドが取り出した項目(送られた順)
+} OpenROBO_Local_t;
 
-  return OpenROBO_Thread_workingFlag;
-}
+static OpenROBO_Local_t OpenROBO_local = {-1, NULL, NULL};
 
-int OpenROBO_sendExitThreadSignal(const char* message)
+/*
+   取り出したがまだ渡していない項目があるか
+*/
+static int OpenROBO_Local_pending(void)
 {
-  char destionationID[OPENROBO_THREAD_ID_SIZE];
-  OpenROBO_generateThreadIDFromMessage(message, destionationID);
+  return OpenROBO_local.head != NULL;
+}
 
-  OpenROBO_sockList_t *s;
-  int res;
-  char signal[1] = {'\0'};
-  s = OpenROBO_sockList_findByID(destionationID);
-  if (s == NULL) {
-    return OpenROBO_Return_NonConnection;
-  }
+#if OPENROBO_LOCAL_ENABLE
+static int OpenROBO_Local_init(void)
+{
+  OpenROBO_local.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return OpenROBO_local.fd >= 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+}
 
-  res = SocketCom_Send(&s->sock, signal, sizeof(signal));
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
+static void OpenROBO_Local_close(void)
+{
+  if (OpenROBO_local.fd >= 0) {
+    close(OpenROBO_local.fd);
+    OpenROBO_local.fd = -1;
   }
-
-  return OpenROBO_Return_Success;
 }
 
-/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
-
-   OpenROBO_Socket
-
-   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
-
-static int OpenROBO_Socket_recvMessage(SocketCom* sock, char **message)
+/*
+   メッセージ(message + suffix)をメインスレッドへ渡す(オペレーションスレッドから呼ぶ)
+*/
+static int OpenROBO_Local_send(const char *message, const char *suffix)
 {
-  int res;
-  size_t size;
-  char *str;
-  char sizeStr[OPENROBO_MESSAGE_SIZE_STR_SIZE];
-
-  res = SocketCom_RecvAll(sock, sizeStr, sizeof(sizeStr));
-  if (res != SOCKETCOM_SUCCESS) { //error
-    if (res == SOCKETCOM_ERROR_DISCONNECTED) {
-      return OpenROBO_Return_Disconnected;
-    }
-    return OpenROBO_Return_Error;
-  }
-  if (sizeStr[0] == '\0') {
-    OpenROBO_Thread_workingFlag = 0;
-    memmove(&sizeStr[0], &sizeStr[1], sizeof(sizeStr)-1);
-    res = SocketCom_RecvAll(sock, &sizeStr[sizeof(sizeStr)-1], 1);
-    if (res != SOCKETCOM_SUCCESS) { //error
-      if (res == SOCKETCOM_ERROR_DISCONNECTED) {
-        return OpenROBO_Return_Disconnected;
-      }
-      return OpenROBO_Return_Error;
-    }
-  }
-  sscanf(sizeStr, "%lx", &size);
+  OpenROBO_localItem_t *item, *top;
+  size_t messageSize, suffixSize = 0;
 
-  str = OpenROBO_Message_commonBuffer.p;
-  if (size > OpenROBO_Message_commonBuffer.size) {
-    OpenROBO_Message_commonBuffer.p[0] = '\0';
-    res = OpenROBO_Message_buffer_realloc(&OpenROBO_Message_commonBuffer, size);
-    if (res != OpenROBO_Return_Success) {
-      return res;
-    }
-    OpenROBO_Message_commonBuffer.p = str;
+  messageSize = OpenROBO_Message_measure(message, SIZE_MAX, NULL);
+  if (suffix != NULL) {
+    suffixSize = OpenROBO_Message_measure(suffix, SIZE_MAX, NULL);
   }
-
-  res = SocketCom_RecvAll(sock, str, size);
-  if (res != SOCKETCOM_SUCCESS) { //error
-    OpenROBO_free(str);
-    if (res == SOCKETCOM_ERROR_DISCONNECTED) {
-      return OpenROBO_Return_Disconnected;
-    }
+  item = (OpenROBO_localItem_t *)OpenROBO_malloc(offsetof(OpenROBO_localItem_t, message) + messageSize + suffixSize + 1);
+  if (item == NULL) {
     return OpenROBO_Return_Error;
   }
-
-  if (str[size-1] != '\0') { //check //TODO is need?
-    OpenROBO_free(str);
-    return OpenROBO_Return_Error;
+  memcpy(item->message, message, messageSize);
+  if (suffix != NULL) {
+    memcpy(&item->message[messageSize], suffix, suffixSize);
   }
+  item->size = messageSize + suffixSize + 1;
+  item->message[item->size - 1] = '\0';
+  OpenROBO_Route_make(&item->route, message, messageSize, suffix, suffixSize);
 
-  TRACE_PRINTF("<<< [ <%s> has received \"", OpenROBO_isMainThread ? "MainThread" : OpenROBO_threadID);
-  TRACE_MESSAGE(str, size);
-  TRACE_PRINTF("\" ] <<<");
+  TRACE_PRINTF(">>> [ <%s> will send \"", OpenROBO_threadID);
+  TRACE_MESSAGE(item->message, item->size - 1);
+  TRACE_PRINTF("\" ] >>>");
   TRACE_END();
 
-  *message = str;
+  top = __atomic_load_n(&OpenROBO_local.top, __ATOMIC_RELAXED);
+  do {
+    item->next = top;
+  } while (!__atomic_compare_exchange_n(&OpenROBO_local.top, &top, item, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+  // メインスレッドは空になるまで取り出すので、空でなかった場合は通知済み
+  if (top == NULL) {
+    uint64_t one = 1;
+    ssize_t n;
+    do {
+      n = write(OpenROBO_local.fd, &one, sizeof(one));
+    } while (n < 0 && errno == EINTR);
+  }
+
   return OpenROBO_Return_Success;
 }
 
-static int OpenROBO_Socket_sendMessage(const char* destinationID, const char* message, const char* suffix)
+/*
+   メッセージを1つ共通バッファに受け取る(メインスレッドから呼ぶ)
+   通知の後で積まれた項目は前回まとめて取り出しているので、何もなければOpenROBO_Return_NotUpdatedを返す
+*/
+static int OpenROBO_Local_recv(char **message)
 {
-  size_t totalSize;
-  size_t messageSize;
-  size_t suffixSize = 0;
-  char sizeStr[OPENROBO_MESSAGE_SIZE_STR_SIZE];
-  char endOfMessage[1]= {'\0'};
+  OpenROBO_localItem_t *item;
   int res;
 
-  SocketCom *sock = OpenROBO_sockList_findSocketCom(destinationID);
-  if (sock == NULL) { //not connected
-    if (OpenROBO_isMainThread) {
-      return OpenROBO_Return_Error;
+  if (OpenROBO_local.head == NULL) {
+    uint64_t count;
+    // 通知を消してから取り出すので、この後で空のスタックに積まれた場合は改めて通知される
+    while (read(OpenROBO_local.fd, &count, sizeof(count)) < 0 && errno == EINTR) {
     }
-    OpenROBO_sockList_t* sockList;
-    sockList = OpenROBO_sockList_connect(destinationID);
-    if (sockList == NULL) {
-      return OpenROBO_Return_Error;
+    item = __atomic_exchange_n(&OpenROBO_local.top, (OpenROBO_localItem_t *)NULL, __ATOMIC_SEQ_CST);
+    while (item != NULL) {
+      OpenROBO_localItem_t *next = item->next;
+      item->next = OpenROBO_local.head;
+      OpenROBO_local.head = item;
+      item = next;
+    }
+    if (OpenROBO_local.head == NULL) {
+      return OpenROBO_Return_NotUpdated;
     }
-    sock = &sockList->sock;
   }
-
-  messageSize = strlen(message);
-  if (suffix != NULL) {
-    suffixSize = strlen(suffix);
+  item = OpenROBO_local.head;
+  OpenROBO_local.head = item->next;
+
+  res = OpenROBO_Socket_reserveCommonBuffer(item->size);
+  if (res == OpenROBO_Return_Success) {
+    memcpy(OpenROBO_Message_commonBuffer.p, item->message, item->size);
+    *message = OpenROBO_Message_commonBuffer.p;
+    OpenROBO_receivedRoute = item->route;
+
+    TRACE_PRINTF("<<< [ <MainThread> has received \"");
+    TRACE_MESSAGE(item->message, item->size);
+    TRACE_PRINTF("\" ] <<<");
+    TRACE_END();
   }
-  totalSize = messageSize + suffixSize + 1;
+  OpenROBO_free(item);
 
+  return res;
+}
+#endif
 
-  TRACE_PRINTF(">>> [ <%s> will send \"", OpenROBO_isMainThread ? "MainThread" : OpenROBO_threadID);
-  TRACE_MESSAGE(message, messageSize);
-  if (suffix != NULL) {
-    TRACE_MESSAGE(suffix, suffixSize);
-  }
-  TRACE_PRINTF("\" ] >>>");
-  TRACE_END();
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
 
-  sprintf(sizeStr, "%lx", totalSize);
-  res = SocketCom_Send(sock, sizeStr, sizeof(sizeStr));
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
-  }
+   OpenROBO_Poller
 
-  res = SocketCom_Send(sock, message, messageSize);
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
-  }
-  if (suffix != NULL) {
-    res = SocketCom_Send(sock, suffix, suffixSize);
-    if (res != SOCKETCOM_SUCCESS) {
-      return OpenROBO_Return_Error;
-    }
+   メインスレッドの受信待ち。
+   OPENROBO_EPOLL_ENABLEの場合はsocketを接続時に一度だけepollに登録し、OpenROBO_sockList_delete()で外す。
+   1回の待ちで受信可能になった接続はすべてreadyに入れ、それを処理し終えるまで次の待ちに入らない。
+   それ以外の環境では待つたびにOpenROBO_sockListからSocketCom_WaitForRecvables()の配列を作る。
+   readyのNULLはOpenROBO_acceptSocketまたはOpenROBO_unixAcceptSocketを、OPENROBO_POLLER_LOCALはOpenROBO_localのeventfdを表す
+   購読(OpenROBO_Subscription)の送信を間隔の経過まで保留している間は、その時刻を待ちの期限にする
+   共有メモリの接続とOpenROBO_localは読み残しがあっても通知が来ないので、最後に渡したものにまだデータがあればreadyの末尾に戻す
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct {
+  int fd;
+  OpenROBO_sockList_t **ready;
+  size_t readySize;
+  size_t readyCapacity;
+  size_t readyHead;
+  OpenROBO_sockList_t *last; // 最後に渡した共有メモリの接続またはOPENROBO_POLLER_LOCAL
+} OpenROBO_Poller_t;
+
+// 接続として参照はしない(比較するだけ)
+#define OPENROBO_POLLER_LOCAL ((OpenROBO_sockList_t *)&OpenROBO_local)
+
+static OpenROBO_Poller_t OpenROBO_poller = {-1, NULL, 0, 0, 0, NULL};
+
+static int OpenROBO_Poller_reserve(size_t capacity)
+{
+  OpenROBO_sockList_t **p;
+  if (capacity <= OpenROBO_poller.readyCapacity) {
+    return OpenROBO_Return_Success;
   }
-  res = SocketCom_Send(sock, endOfMessage, sizeof(endOfMessage));
-  if (res != SOCKETCOM_SUCCESS) {
+  p = (OpenROBO_sockList_t **)OpenROBO_realloc(OpenROBO_poller.ready, sizeof(OpenROBO_sockList_t *)*capacity);
+  if (p == NULL) {
     return OpenROBO_Return_Error;
   }
-
+  OpenROBO_poller.ready = p;
+  OpenROBO_poller.readyCapacity = capacity;
   return OpenROBO_Return_Success;
 }
 
-int OpenROBO_Socket_SendCommandMessage(const char* destinationID, char* message)
+#if OPENROBO_EPOLL_ENABLE
+static int OpenROBO_Poller_ctlDescriptor(int op, int fd, OpenROBO_sockList_t *s)
 {
-  if (OpenROBO_isMainThread) {
-    return OpenROBO_Return_Error;
-  }
-
-  OpenROBO_Message_setSourceID(message, OpenROBO_threadID);
-  OpenROBO_Message_setDestinationID(message, destinationID);
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = s;
+  return epoll_ctl(OpenROBO_poller.fd, op, fd, &event) == 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+}
 
-  return OpenROBO_Socket_sendMessage(destinationID, message, NULL);
+static int OpenROBO_Poller_ctl(int op, SocketCom *sock, OpenROBO_sockList_t *s)
+{
+  return OpenROBO_Poller_ctlDescriptor(op, OpenROBO_SocketCom_getDescriptor(sock), s);
 }
+#endif
 
-static int OpenROBO_Socket_forwardReturnMessage(const char* originalMessage, const char *returnMessage)
+static int OpenROBO_Poller_init(void)
 {
-  int res;
-  if (!OpenROBO_isMainThread) {
-    DBGABORT();
+  if (OpenROBO_Poller_reserve(OPENROBO_POLLER_MAX_EVENTS) != OpenROBO_Return_Success) {
     return OpenROBO_Return_Error;
   }
-
-  const char *originalSourceID;
-  OpenROBO_Message_GetSourceID(originalMessage, &originalSourceID);
-  res = OpenROBO_Socket_sendMessage(originalSourceID, returnMessage, NULL);
-  OpenROBO_free((void*)originalSourceID);
-  return res;
+#if OPENROBO_EPOLL_ENABLE
+  OpenROBO_poller.fd = epoll_create1(EPOLL_CLOEXEC);
+  if (OpenROBO_poller.fd < 0) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_unixAccepting && OpenROBO_Poller_ctl(EPOLL_CTL_ADD, &OpenROBO_unixAcceptSocket, NULL) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+#if OPENROBO_LOCAL_ENABLE
+  // 使えなければ返答はこれまで通り接続に送る
+  if (OpenROBO_Local_init() == OpenROBO_Return_Success &&
+      OpenROBO_Poller_ctlDescriptor(EPOLL_CTL_ADD, OpenROBO_local.fd, OPENROBO_POLLER_LOCAL) != OpenROBO_Return_Success) {
+    OpenROBO_Local_close();
+  }
+#endif
+  return OpenROBO_Poller_ctl(EPOLL_CTL_ADD, &OpenROBO_acceptSocket, NULL);
+#else
+  return OpenROBO_Return_Success;
+#endif
 }
 
-static int OpenROBO_Socket_sendReturnMessageBySystem(const char* originalMessage, const char *returnMessage)
+/*
+   メインスレッドの接続のsocketを受信待ちに登録する
+*/
+static int OpenROBO_Poller_add(OpenROBO_sockList_t *s)
 {
-  char additionalMessage[1024] = "";
-  const char *functionName;
-  const char *originalSourceID;
-  OpenROBO_Message_GetSourceID(originalMessage, &originalSourceID);
-  OpenROBO_Message_setSourceID(additionalMessage, OpenROBO_threadID);
-  OpenROBO_Message_setDestinationID(additionalMessage, originalSourceID);
-  OpenROBO_Message_GetSubject(originalMessage, &functionName);
-  OpenROBO_Message_SetSubject(additionalMessage, functionName);
-  OpenROBO_free((void*)functionName);
-
-  if (OpenROBO_isMainThread) {
-    int res;
-    res = OpenROBO_Socket_sendMessage(originalSourceID, returnMessage, additionalMessage);
-    OpenROBO_free((void*)originalSourceID);
-    return res;
-  } else {
-    OpenROBO_free((void*)originalSourceID);
-    return OpenROBO_Socket_sendMessage(OpenROBO_selfSubsystemName, returnMessage, additionalMessage);
+  if (!OpenROBO_isMainThread || !OpenROBO_sockList_hasSocket(s)) {
+    return OpenROBO_Return_Success;
+  }
+#if OPENROBO_EPOLL_ENABLE
+  if (OpenROBO_poller.fd >= 0) {
+    return OpenROBO_Poller_ctl(EPOLL_CTL_ADD, &s->sock, s);
   }
+#endif
+  return OpenROBO_Return_Success;
 }
 
-int OpenROBO_Socket_SendReturnMessage(const char *returnMessage)
+static void OpenROBO_Poller_remove(OpenROBO_sockList_t *s)
 {
-  if (OpenROBO_isMainThread) {
-    DBGABORT();
-    return OpenROBO_Return_Error;
+  size_t i, n;
+  if (!OpenROBO_isMainThread) {
+    return;
   }
-  char additionalMessage[1024] = "";
-
-  OpenROBO_Message_setSourceID(additionalMessage, OpenROBO_threadID);
-
-  return OpenROBO_Socket_sendMessage(OpenROBO_selfSubsystemName, returnMessage, additionalMessage);
+  if (OpenROBO_poller.last == s) {
+    OpenROBO_poller.last = NULL;
+  }
+  // まだ処理していないreadyからも外す
+  for (i = n = OpenROBO_poller.readyHead; i < OpenROBO_poller.readySize; i++) {
+    if (OpenROBO_poller.ready[i] != s) {
+      OpenROBO_poller.ready[n++] = OpenROBO_poller.ready[i];
+    }
+  }
+  OpenROBO_poller.readySize = n;
+#if OPENROBO_EPOLL_ENABLE
+  if (OpenROBO_poller.fd >= 0 && OpenROBO_sockList_hasSocket(s)) {
+    OpenROBO_Poller_ctl(EPOLL_CTL_DEL, &s->sock, s);
+  }
+#endif
 }
 
-int OpenROBO_Socket_ReceiveReturnMessage(const char* sourceID, char** message)
+/*
+   @param[in] timeoutMsec 待つ時間の上限[msec](負の値は無期限)。期限までに受信可能な接続がなければreadyは空のまま返る
+*/
+static int OpenROBO_Poller_fill(int timeoutMsec)
 {
-  if (OpenROBO_isMainThread) {
+#if OPENROBO_EPOLL_ENABLE
+  struct epoll_event events[OPENROBO_POLLER_MAX_EVENTS];
+  int i, n;
+  do {
+    n = epoll_wait(OpenROBO_poller.fd, events, OPENROBO_POLLER_MAX_EVENTS, timeoutMsec);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
     return OpenROBO_Return_Error;
   }
+  for (i = 0; i < n; i++) {
+    OpenROBO_poller.ready[i] = (OpenROBO_sockList_t *)events[i].data.ptr;
+  }
+  OpenROBO_poller.readySize = n;
+#else
+  static SocketCom **socks = NULL;
+  static size_t socksCapacity = 0;
+  int i, socksLen;
+  size_t j, n = OpenROBO_sockList_getLen() + 2;
 
-  SocketCom *sock;
-  sock = OpenROBO_sockList_findSocketCom(sourceID);
-  if (sock == NULL) { //not connected
+  if (n > socksCapacity) {
+    SocketCom **newSocks = (SocketCom **)OpenROBO_realloc(socks, sizeof(SocketCom *)*n);
+    if (newSocks == NULL) {
+      return OpenROBO_Return_Error;
+    }
+    socks = newSocks;
+    socksCapacity = n;
+  }
+  if (OpenROBO_Poller_reserve(n) != OpenROBO_Return_Success) {
     return OpenROBO_Return_Error;
   }
 
-  char *_message;
-  int res = OpenROBO_Socket_recvMessage(sock, &_message);
-  if (message == NULL) { //TODO
-    OpenROBO_free(_message);
-  } else {
-    *message = _message;
+  i = 0;
+  for (j = 0; j < OpenROBO_sockList.size; j++) {
+    OpenROBO_sockList_t *p = OpenROBO_sockList.items[j];
+    if (OpenROBO_sockList_hasSocket(p)) {
+      socks[i] = &p->sock;
+      i++;
+    }
   }
+  socks[i] = &OpenROBO_acceptSocket;
+  i++;
+  if (OpenROBO_unixAccepting) {
+    socks[i] = &OpenROBO_unixAcceptSocket;
+    i++;
+  }
+  socksLen = i;
+  (void)timeoutMsec; // SocketCom_WaitForRecvables()は期限を持たないので、保留した送信は次に受信したときに送る
+
+  SocketCom_WaitForRecvables(socks, &socksLen);
+  for (i = 0; i < socksLen; i++) {
+    if (SocketCom_Equal(socks[i], &OpenROBO_acceptSocket) || (OpenROBO_unixAccepting && SocketCom_Equal(socks[i], &OpenROBO_unixAcceptSocket))) {
+      OpenROBO_poller.ready[i] = NULL;
+    } else {
+      OpenROBO_poller.ready[i] = OpenROBO_sockList_findBySocketCom(socks[i]);
+    }
+  }
+  OpenROBO_poller.readySize = socksLen;
+#endif
+  OpenROBO_poller.readyHead = 0;
 
-  return res;
+  return OpenROBO_Return_Success;
 }
 
-static int OpenROBO_Socket_recvString(SocketCom* sock, char *str, size_t strSize)
+/*
+   受信可能な接続を1つ取り出す(*sがNULLの場合は受け付けのsocket)
+   前回の待ちで受信可能になった接続が残っている間は待たない
+*/
+static int OpenROBO_Poller_wait(OpenROBO_sockList_t **s)
 {
   int res;
-  unsigned int totalSize = 0;
-  while (1) {
-    res = SocketCom_Recv(sock, &str[totalSize], 1, NULL);
-    if (res != SOCKETCOM_SUCCESS) { //error
-      if (res == SOCKETCOM_ERROR_DISCONNECTED) {
-        return OpenROBO_Return_Disconnected;
+  if (OpenROBO_poller.last != NULL) {
+    OpenROBO_sockList_t *last = OpenROBO_poller.last;
+    OpenROBO_poller.last = NULL;
+    if (last == OPENROBO_POLLER_LOCAL ? OpenROBO_Local_pending() : OpenROBO_Shm_rearm(last->shm)) {
+      res = OpenROBO_Poller_reserve(OpenROBO_poller.readySize + 1);
+      if (res != OpenROBO_Return_Success) {
+        return res;
       }
-      return OpenROBO_Return_Error;
+      OpenROBO_poller.ready[OpenROBO_poller.readySize] = last;
+      OpenROBO_poller.readySize++;
     }
-    totalSize++;
-
-    if (str[totalSize-1] == '\0') {
-      break;
-    }
-    if (totalSize >= strSize) { // size over
-      return OpenROBO_Return_BufferOver;
+  }
+  while (OpenROBO_poller.readyHead >= OpenROBO_poller.readySize) {
+    res = OpenROBO_Poller_fill(OpenROBO_Subscription_flush());
+    if (res != OpenROBO_Return_Success) {
+      return res;
     }
   }
+  *s = OpenROBO_poller.ready[OpenROBO_poller.readyHead];
+  OpenROBO_poller.readyHead++;
+  if (*s == OPENROBO_POLLER_LOCAL || (*s != NULL && (*s)->shm != NULL)) {
+    OpenROBO_poller.last = *s;
+  }
 
   return OpenROBO_Return_Success;
 }
 
-static int OpenROBO_Socket_recvConnectionInfos(SocketCom* sock)
+static OpenROBO_sockList_t* OpenROBO_sockList_connect(const char* destinationID)
 {
   int res;
-  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_IP_STR_LEN+OPENROBO_PORT_STR_LEN+3];
-
-  while (1) {
-    res = OpenROBO_Socket_recvString(sock, buf, sizeof(buf));
-    if (res != OpenROBO_Return_Success) {
-      return res;
-    }
-    if (buf[0] == '\0') {
+  size_t i;
+  char firstMessage[OPENROBO_THREAD_ID_SIZE+1];
+  OpenROBO_subsystemTable_t *table = &OpenROBO_subsystemTable;
+  for (i = 0; i < table->infosSize; i++) {
+    if (strcmp(destinationID, table->infos[i].id) == 0) {
       break;
     }
+  }
+  if (i >= table->infosSize) {
+    return NULL;
+  }
 
-    uint32_t port;
-    char *ip_str, *port_str, *agentName;
-    ip_str = buf;
-    port_str = strchr(buf, ':');
-    if (port_str == NULL) {
-      return OpenROBO_Return_Error;
-    }
-    *port_str = '\0';
-    port_str++;
-    agentName = strchr(port_str, ' ');
-    if (agentName == NULL) {
-      return OpenROBO_Return_Error;
-    }
-    *agentName = '\0';
-    agentName++;
+  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
+  if (s == NULL) {
+    return NULL;
+  }
 
-    if (strlen(ip_str) > OPENROBO_IP_STR_LEN) {
-      return OpenROBO_Return_Error;
-    }
-    // TODO error check ip format
-    port = atoi(port_str);
-    if (!(port > 0 && port <= 65535)) {
-      return OpenROBO_Return_Error;
-    }
-    if (strlen(agentName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
-      return OpenROBO_Return_Error;
+  // channelに対応している相手にはプロセスで共有している接続の上にchannelを作る
+  if (OpenROBO_hasCapability(&table->infos[i], OPENROBO_CAPABILITY_CHANNEL)) {
+    s->channel = OpenROBO_Channel_open(&table->infos[i]);
+    if (s->channel == NULL) {
+      OpenROBO_sockList_delete(s);
+      return NULL;
     }
+    s->framing = OpenROBO_Framing_Binary;
+    s->paramEncoding = OpenROBO_negotiateParamEncoding(&table->infos[i]);
+    OpenROBO_sockList_negotiateRouting(s, &table->infos[i]);
+    OpenROBO_sockList_bindID(s, table->infos[i].id);
+    return s;
+  }
 
-    if (strcmp(agentName, OpenROBO_selfSubsystemName) == 0) {
-      continue;
+  res = OpenROBO_Socket_connectPeer(&s->sock, &table->infos[i]);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_sockList_delete(s);
+    return NULL;
+  }
+  OpenROBO_sockList_registerSocket(s);
+
+  // binary frameを使用する場合はthreadIDの前にOPENROBO_FRAME_MAGICを付けて相手に知らせる
+  s->framing = OpenROBO_negotiateFraming(table->infos[i].capabilities);
+  s->paramEncoding = OpenROBO_negotiateParamEncoding(&table->infos[i]);
+  OpenROBO_sockList_negotiateRouting(s, &table->infos[i]);
+  if (s->framing == OpenROBO_Framing_Binary) {
+    firstMessage[0] = (char)OPENROBO_FRAME_MAGIC;
+    strcpy(&firstMessage[1], OpenROBO_threadID);
+  } else {
+    strcpy(firstMessage, OpenROBO_threadID);
+  }
+  res = SocketCom_Send(&s->sock, firstMessage, strlen(firstMessage)+1);
+  if (res != SOCKETCOM_SUCCESS) {
+    OpenROBO_sockList_delete(s);
+    return NULL;
+  }
+  if (OpenROBO_hasCapability(&table->infos[i], OPENROBO_CAPABILITY_SHM)) {
+    res = OpenROBO_Shm_offer(&s->sock, &s->shm);
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_sockList_delete(s);
+      return NULL;
     }
-
-    size_t n = OpenROBO_subsystemTable.infosSize;
-    strcpy(OpenROBO_subsystemTable.infos[n].ip, ip_str);
-    OpenROBO_subsystemTable.infos[n].port = port;
-    strcpy(OpenROBO_subsystemTable.infos[n].id, agentName);
-    OpenROBO_subsystemTable.infosSize++;
   }
+  OpenROBO_sockList_bindID(s, table->infos[i].id);
 
-  return OpenROBO_Return_Success;
+  return s;
 }
 
-static int OpenROBO_Socket_sendConnectionInfos(SocketCom* sock)
+//TODO
+#if 0
+static int OpenROBO_cloneConnection(const OpenROBO_subsystemTable_t* src, OpenROBO_subsystemTable_t *dst, const char* firstMessage)
 {
+  size_t firstMessageSize = strlen(firstMessage) + 1;
   int res;
   size_t i;
-  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_IP_STR_LEN+OPENROBO_PORT_STR_LEN+3];
-
-  for (i = 0; i < OpenROBO_subsystemTable.infosSize; i++) {
-    char *name = OpenROBO_subsystemTable.infos[i].id;
-    char *ip = OpenROBO_subsystemTable.infos[i].ip;
-    uint16_t port = OpenROBO_subsystemTable.infos[i].port;
-
-    sprintf(buf, "%s:%d %s", ip, port, name);
-    res = SocketCom_Send(sock, buf, strlen(buf)+1);
-    if (res != SOCKETCOM_SUCCESS) { //error
+  for (i = 0; i < src->infosSize; i++) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
+    if (s == NULL) {
       return OpenROBO_Return_Error;
     }
-  }
-
-  char endMessage[] = {'\0'};
-  res = SocketCom_Send(sock, endMessage, sizeof(endMessage));
-  if (res != SOCKETCOM_SUCCESS) { //error
-    return OpenROBO_Return_Error;
+    res = SocketCom_Create(&s->sock);
+    if (res != SOCKETCOM_SUCCESS) {
+      return OpenROBO_Return_Error;
+    }
+    res = SocketCom_ConnectTo(&s->sock, src->infos[i].ip, src->infos[i].port);
+    if (res != SOCKETCOM_SUCCESS) {
+      return OpenROBO_Return_Error;
+    }
+    res = SocketCom_Send(&s->sock, firstMessage, firstMessageSize);
+    if (res != SOCKETCOM_SUCCESS) {
+      return OpenROBO_Return_Error;
+    }
+    OpenROBO_sockList_bindID(s, src->infos[i].id);
   }
 
   return OpenROBO_Return_Success;
 }
+#endif
 
-static int OpenROBO_Socket_recvSelfInfo(SocketCom* sock, OpenROBO_subsystemTable_info_t* info)
-{
-  uint16_t port;
-  char *port_str, *agentName;
-  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_PORT_STR_LEN+2];
-  int res = OpenROBO_Socket_recvString(sock, buf, sizeof(buf));
-  if (res != OpenROBO_Return_Success) {
-    return res;
-  }
-
-  port_str = buf;
-  agentName = strchr(buf, ' ');
-  if (agentName == NULL) {
-    return OpenROBO_Return_Error;
-  }
-  *agentName = '\0';
-  agentName++;
+static int OpenROBO_Socket_createAcceptSocket(uint16_t *_port);
 
-  port = atoi(port_str);
-  if (!(port > 0 && port <= 65535)) {
-    return OpenROBO_Return_Error;
-  }
-  if (strlen(agentName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
+int OpenROBO_Message_buffer_init()
+{
+  OpenROBO_Message_commonBuffer.size = OPENROBO_MESSAGE_BUFFER_DEFAULT_SIZE;
+  OpenROBO_Message_commonBuffer.p = (char *)OpenROBO_malloc(OpenROBO_Message_commonBuffer.size);
+  if (OpenROBO_Message_commonBuffer.p == NULL) {
     return OpenROBO_Return_Error;
   }
-
-  SocketCom_GetIpStr(sock, info->ip);
-  info->port = port;
-  strcpy(info->id, agentName);
+  OpenROBO_Message_commonBuffer.p[0] = '\0';
 
   return OpenROBO_Return_Success;
 }
 
-static int OpenROBO_Socket_sendSelfInfo(SocketCom* sock)
+void OpenROBO_Message_buffer_term()
 {
-  int res;
-  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_PORT_STR_LEN+2];
-
-  sprintf(buf, "%d %s", OpenROBO_acceptPort, OpenROBO_selfSubsystemName);
-  res = SocketCom_Send(sock, buf, strlen(buf)+1);
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
+  if (OpenROBO_Message_commonBuffer.p == NULL) {
+    return;
   }
-
-  return OpenROBO_Return_Success;
+  OpenROBO_free(OpenROBO_Message_commonBuffer.p);
+  OpenROBO_Message_commonBuffer.p = NULL;
+  OpenROBO_Message_commonBuffer.size = 0;
 }
 
-static int OpenROBO_Socket_acceptNewThread(SocketCom* acceptSock)
+int OpenROBO_StartupMainThread(const char* subsystemName)
 {
   int res;
-  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
-  if (s == NULL) {
+  if (strlen(subsystemName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
     return OpenROBO_Return_Error;
   }
 
-  res = SocketCom_Accept(acceptSock, &s->sock);
-  if (res != SOCKETCOM_SUCCESS) {
-    OpenROBO_sockList_delete(s);
-    return OpenROBO_Return_Error;
-  }
+  OpenROBO_isMainThread = 1;
 
-  res = OpenROBO_Socket_recvString(&s->sock, s->id, sizeof(s->id));
+  res = OpenROBO_ReadWriteMemory_init(OPENROBO_READWIRTEMEMORY_DEFAULT_SIZE);
   if (res != OpenROBO_Return_Success) {
-    SocketCom_Dispose(&s->sock);
-    OpenROBO_sockList_delete(s);
-    //return OpenROBO_Return_Error; //TODO
+    return res;
   }
 
-  return OpenROBO_Return_Success;
-}
+  SocketCom_Startup();
+  OpenROBO_Channel_startup();
+  OpenROBO_StopFlag_startup();
+  OpenROBO_Dispatch_startup();
+  OpenROBO_Intern_startup();
 
-int OpenROBO_Socket_ReceiveMessage(char** message)
-{
-  int res;
-  if (!OpenROBO_isMainThread) {
-    DBGABORT();
-    return OpenROBO_Return_Error;
+  res = OpenROBO_Socket_createAcceptSocket(&OpenROBO_acceptPort);
+  if (res != OpenROBO_Return_Success) {
+    return res;
   }
 
-  static SocketCom **socks = NULL;
-  static int socksLen = 0;
-
-  while (1) {
-    int newSocksLen = OpenROBO_sockList_getLen() + 1;
-    if (newSocksLen > socksLen) {
-      if (socks != NULL) {
-        OpenROBO_free(socks);
-      }
-      socksLen = newSocksLen;
-      socks = (SocketCom **)OpenROBO_malloc(sizeof(SocketCom *)*socksLen);
-      if (socks == NULL) {
-        return OpenROBO_Return_Error;
-      }
-    }
-
-    int i = 0;
-    OpenROBO_sockList_t *p = OpenROBO_sockList;
-    while (p != NULL) {
-      socks[i] = &p->sock;
-      i++;
-      p = p->next;
-    }
-    socks[i] = &OpenROBO_acceptSocket;
-
-    SocketCom_WaitForRecvables(socks, &socksLen);
-    for (i = 0; i < socksLen; i++) {
-      if (SocketCom_Equal(socks[i], &OpenROBO_acceptSocket)) {
-        res = OpenROBO_Socket_acceptNewThread(&OpenROBO_acceptSocket);
-        if (res != OpenROBO_Return_Success) {
-          return res;
-        }
-        continue;
-      }
-
-      res = OpenROBO_Socket_recvMessage(socks[i], message);
-      if (res == OpenROBO_Return_Disconnected) {
-        OpenROBO_sockList_t *s = OpenROBO_sockList_findBySocketCom(socks[i]);
-        if (OpenROBO_hasSubsystemInfo(s->id)) {
-          strcpy(OpenROBO_Message_commonBuffer.p, s->id);
-          *message = OpenROBO_Message_commonBuffer.p;
-          OpenROBO_sockList_deleteBySocketCom(socks[i]);
-          return res;
-        }
-        OpenROBO_sockList_deleteBySocketCom(socks[i]);
-        continue;
-      }
-
-      return res;
-    }
+  res = OpenROBO_Poller_init();
+  if (res != OpenROBO_Return_Success) {
+    return res;
   }
 
-}
-
-OpenROBO_MessageFunctionEntry_t* OpenROBO_MessageFunctionEntry_Find(OpenROBO_MessageFunctionEntry_t *entry, const char *functionName)
-{
-  while (entry->func != NULL) {
-    if (strcmp(functionName, entry->name) == 0) {
-      return entry;
-    }
-    entry++;
+  res = OpenROBO_Message_buffer_init();
+  if (res != OpenROBO_Return_Success) {
+    return res;
   }
 
-  return NULL;
+  strcpy(OpenROBO_threadID, subsystemName);
+  strcpy(OpenROBO_subsystemTable.infos[0].id, subsystemName);
+  strcpy(OpenROBO_subsystemTable.infos[0].ip, "127.0.0.1");
+  OpenROBO_subsystemTable.infos[0].port = OpenROBO_acceptPort;
+  OpenROBO_subsystemTable.infos[0].capabilities = OPENROBO_SELF_CAPABILITIES;
+  OpenROBO_subsystemTable.infos[0].sid = OPENROBO_SID_NONE;
+  OpenROBO_subsystemTable.infosSize = 1;
+
+  return OpenROBO_Return_Success;
 }
 
-int OpenROBO_ReturnForReadMessage(const char *message)
-{
-  int res;
-  int ret;
-  const char *subject;
-  const char *memoryMessage;
-  const char *originalSourceID;
-  char *returnMessage;
 
-  OpenROBO_Message_GetSourceID(message, &originalSourceID);
 
-  OpenROBO_Message_GetSubject(message, &subject);
-  memoryMessage = OpenROBO_ReadWriteMemory_get(subject);
-  if (memoryMessage == NULL) {
-    ret = OpenROBO_Return_NotUpdated;
-  } else {
-    ret = OpenROBO_Return_Success;
-  }
-  OpenROBO_Message_GetBuffer(&returnMessage);
-  OpenROBO_Message_MakeReturnMessage(returnMessage, subject);
-  OpenROBO_Message_SetReturnValue(returnMessage, ret);
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+   OpenROBO_Thread
 
-  res = OpenROBO_Socket_sendMessage(originalSourceID, returnMessage, memoryMessage);
-  if (res != OpenROBO_Return_Success) {
-    ret = res;
-  }
+   The origin is TinyCThread
 
-  OpenROBO_free((void *)originalSourceID);
-  OpenROBO_free((void *)subject);
+   TinyCThread (https://tinycthread.github.io)
+   Copyright (c) 2012 Marcus Geelnard
+   Copyright (c) 2013-2016 Evan Nemerson
+   under the zlib/libpng license
 
-  return res;
-}
+-----------------------------------------------------
+     License of TinyCThread
+-----------------------------------------------------
+Copyright (c) 2012 Marcus Geelnard
+Copyright (c) 2013-2016 Evan Nemerson
 
-int OpenROBO_StoreWriteMessage(const char *message)
-{
-  int res;
-  const char *subject;
-  char returnMessage[1024] = "";
-  OpenROBO_Message_GetSubject(message, &subject);
-  res = OpenROBO_ReadWriteMemory_put(subject, message);
-  res = res < 0 ? OpenROBO_Return_Error : OpenROBO_Return_Success;
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
 
-  OpenROBO_Message_MakeReturnMessage(returnMessage, subject);
-  OpenROBO_Message_SetReturnValue(returnMessage, res);
-  OpenROBO_Socket_sendReturnMessageBySystem(message, returnMessage);
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+-----------------------------------------------------
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+struct _OpenROBO_Thread_startInfo
+{
+  int (*func)(int, char *[]);
+  OpenROBO_MessageFunction_t msgfunc;
+  OpenROBO_subsystemTable_t subsystemTable;
+  char *message;
+  int argc;
+  char** argv;
+  int paramEncoding;
+  struct _OpenROBO_stopFlag *stopFlag;
+};
+
+static _Thread_local int OpenROBO_Thread_workingFlag = 1;
+
+static int OpenROBO_Thread_detach(OpenROBO_Thread_t thr)
+{
+#if defined(_OPENROBO_WIN32_)
+  /* https://stackoverflow.com/questions/12744324/how-to-detach-a-thread-on-windows-c#answer-12746081 */
+  return CloseHandle(thr) != 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+#else
+  return pthread_detach(thr) == 0 ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+#endif
+}
+
+#if defined(_OPENROBO_WIN32_)
+typedef LPTHREAD_START_ROUTINE OpenROBO_Thread_wrapper_t;
+#else
+typedef void *(*OpenROBO_Thread_wrapper_t)(void *);
+#endif
+
+static int OpenROBO_Thread_createDetached(OpenROBO_Thread_wrapper_t wrapper, void *arg)
+{
+  OpenROBO_Thread_t thr;
+
+  /* Create the thread */
+#if defined(_OPENROBO_WIN32_)
+  thr = CreateThread(NULL, 0, wrapper, (LPVOID) arg, 0, NULL);
+#elif defined(_OPENROBO_POSIX_)
+  if(pthread_create(&thr, NULL, wrapper, arg) != 0)
+  {
+    thr = 0;
+  }
+#endif
+
+  /* Did we fail to create the thread? */
+  if(!thr)
+  {
+    return OpenROBO_Return_Error;
+  }
+
+  OpenROBO_Thread_detach(thr);
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   mutex / condition variable
+*/
+static void OpenROBO_Mutex_init(OpenROBO_Mutex_t *mutex)
+{
+#if defined(_OPENROBO_WIN32_)
+  InitializeCriticalSection(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void OpenROBO_Mutex_lock(OpenROBO_Mutex_t *mutex)
+{
+#if defined(_OPENROBO_WIN32_)
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+static void OpenROBO_Mutex_unlock(OpenROBO_Mutex_t *mutex)
+{
+#if defined(_OPENROBO_WIN32_)
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+static void OpenROBO_Mutex_destroy(OpenROBO_Mutex_t *mutex)
+{
+#if defined(_OPENROBO_WIN32_)
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void OpenROBO_Cond_init(OpenROBO_Cond_t *cond)
+{
+#if defined(_OPENROBO_WIN32_)
+  InitializeConditionVariable(cond);
+#else
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+#endif
+}
+
+static void OpenROBO_Cond_signal(OpenROBO_Cond_t *cond)
+{
+#if defined(_OPENROBO_WIN32_)
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+static void OpenROBO_Cond_broadcast(OpenROBO_Cond_t *cond)
+{
+#if defined(_OPENROBO_WIN32_)
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+static void OpenROBO_Cond_wait(OpenROBO_Cond_t *cond, OpenROBO_Mutex_t *mutex)
+{
+#if defined(_OPENROBO_WIN32_)
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+/*
+   @retval 0 通知された(またはspurious wakeup)
+   @retval !=0 タイムアウト
+*/
+static int OpenROBO_Cond_timedwait(OpenROBO_Cond_t *cond, OpenROBO_Mutex_t *mutex, unsigned int msec)
+{
+#if defined(_OPENROBO_WIN32_)
+  return SleepConditionVariableCS(cond, mutex, msec) ? 0 : 1;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  ts.tv_sec += msec / 1000;
+  ts.tv_nsec += (long)(msec % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT;
+#endif
+}
+
+/*
+   参照カウント
+*/
+static long OpenROBO_Atomic_increment(volatile long *p)
+{
+#if defined(_OPENROBO_WIN32_)
+  return InterlockedIncrement(p);
+#else
+  return __atomic_add_fetch(p, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static long OpenROBO_Atomic_decrement(volatile long *p)
+{
+#if defined(_OPENROBO_WIN32_)
+  return InterlockedDecrement(p);
+#else
+  return __atomic_sub_fetch(p, 1, __ATOMIC_ACQ_REL);
+#endif
+}
+
+/*
+   reader-writer lock(読み込み同士は並行し、書き込みは排他)
+*/
+static void OpenROBO_RWLock_init(OpenROBO_RWLock_t *lock)
+{
+#if defined(_OPENROBO_WIN32_)
+  InitializeSRWLock(lock);
+#else
+  pthread_rwlock_init(lock, NULL);
+#endif
+}
+
+static void OpenROBO_RWLock_readLock(OpenROBO_RWLock_t *lock)
+{
+#if defined(_OPENROBO_WIN32_)
+  AcquireSRWLockShared(lock);
+#else
+  pthread_rwlock_rdlock(lock);
+#endif
+}
+
+static void OpenROBO_RWLock_readUnlock(OpenROBO_RWLock_t *lock)
+{
+#if defined(_OPENROBO_WIN32_)
+  ReleaseSRWLockShared(lock);
+#else
+  pthread_rwlock_unlock(lock);
+#endif
+}
+
+static void OpenROBO_RWLock_writeLock(OpenROBO_RWLock_t *lock)
+{
+#if defined(_OPENROBO_WIN32_)
+  AcquireSRWLockExclusive(lock);
+#else
+  pthread_rwlock_wrlock(lock);
+#endif
+}
+
+static void OpenROBO_RWLock_writeUnlock(OpenROBO_RWLock_t *lock)
+{
+#if defined(_OPENROBO_WIN32_)
+  ReleaseSRWLockExclusive(lock);
+#else
+  pthread_rwlock_unlock(lock);
+#endif
+}
+
+/*
+   単調増加する時刻[sec](時間の差を測るためだけに使う)
+*/
+static double OpenROBO_getMonotonicTime(void)
+{
+#if defined(_OPENROBO_WIN32_)
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/*
+   スレッドの受信の期限(OpenROBO_getMonotonicTime()の時刻、0は期限なし)
+   期限付きの受信関数が設定し、受信を待つところ(socket、共有メモリ、channel、終了要求のフラグ)が参照する
+*/
+static _Thread_local double OpenROBO_Socket_recvDeadline = 0.0;
+
+/*
+   期限までの残り時間[msec](期限がなければ-1、過ぎていれば0)
+*/
+static int OpenROBO_Deadline_remainingMsec(double deadline)
+{
+  double rest;
+  if (deadline <= 0.0) {
+    return -1;
+  }
+  rest = deadline - OpenROBO_getMonotonicTime();
+  if (rest <= 0.0) {
+    return 0;
+  }
+  return rest >= (double)(INT_MAX / 1000) ? INT_MAX : (int)(rest * 1000.0) + 1;
+}
+
+/*
+   期限付きの受信を始める(timeoutMsecが負なら期限なし)
+   @return 開始時刻(OpenROBO_Deadline_end()に渡す)
+*/
+static double OpenROBO_Deadline_begin(int timeoutMsec)
+{
+  double start = OpenROBO_getMonotonicTime();
+  OpenROBO_Socket_recvDeadline = timeoutMsec >= 0 ? start + (double)timeoutMsec / 1000.0 : 0.0;
+  return start;
+}
+
+/*
+   期限付きの受信を終え、待った時間[sec]をwaitSecに返す(NULLでもよい)
+*/
+static void OpenROBO_Deadline_end(double start, double *waitSec)
+{
+  OpenROBO_Socket_recvDeadline = 0.0;
+  if (waitSec != NULL) {
+    *waitSec = OpenROBO_getMonotonicTime() - start;
+  }
+}
+
+/*
+   期限があればそれまで、なければ通知されるまでcondで待つ(呼び出し元は条件を確かめ直す)
+   @retval OpenROBO_Return_Timeout 期限を過ぎている
+*/
+static int OpenROBO_Cond_waitUntil(OpenROBO_Cond_t *cond, OpenROBO_Mutex_t *mutex, double deadline)
+{
+  int waitMsec = OpenROBO_Deadline_remainingMsec(deadline);
+  if (waitMsec < 0) {
+    OpenROBO_Cond_wait(cond, mutex);
+    return OpenROBO_Return_Success;
+  }
+  if (waitMsec == 0) {
+    return OpenROBO_Return_Timeout;
+  }
+  OpenROBO_Cond_timedwait(cond, mutex, (unsigned int)waitMsec);
+  return OpenROBO_Return_Success;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_StopFlag
+
+   オペレーションスレッドへの終了要求。
+   スレッドを作る側がthreadIDごとのフラグを登録し、メインスレッドはStop Messageを受けたらフラグを立てる。
+   OpenROBO_CheckWorking()はフラグを読むだけで、OpenROBO_WaitForStopMessage()はフラグが立つまでfutex(それ以外の環境では条件変数)で待つ。
+   フラグはスレッドを作るときに登録するので、スレッドが動き出す前に届いた終了要求も失われない。
+   フラグの解放とメインスレッドが立てるのはどちらもmutexを取って行う
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_stopFlag {
+  volatile int stopped;
+  uint32_t handle; // threadIDのhandle
+  struct _OpenROBO_stopFlag *next;
+} OpenROBO_stopFlag_t;
+
+static OpenROBO_Mutex_t OpenROBO_stopFlagsMutex;
+#if !OPENROBO_FUTEX_ENABLE
+static OpenROBO_Cond_t OpenROBO_stopFlagsCond;
+#endif
+static OpenROBO_stopFlag_t *OpenROBO_stopFlags = NULL;
+static _Thread_local OpenROBO_stopFlag_t *OpenROBO_Thread_stopFlag = NULL; // 実行中の動作の終了要求
+
+static void OpenROBO_StopFlag_startup(void)
+{
+  static int initialized = 0;
+  if (initialized) {
+    return;
+  }
+  OpenROBO_Mutex_init(&OpenROBO_stopFlagsMutex);
+#if !OPENROBO_FUTEX_ENABLE
+  OpenROBO_Cond_init(&OpenROBO_stopFlagsCond);
+#endif
+  initialized = 1;
+}
+
+static OpenROBO_stopFlag_t* OpenROBO_StopFlag_create(const char *threadID)
+{
+  OpenROBO_stopFlag_t *flag = (OpenROBO_stopFlag_t *)OpenROBO_malloc(sizeof(OpenROBO_stopFlag_t));
+  if (flag == NULL) {
+    return NULL;
+  }
+  flag->stopped = 0;
+  flag->handle = OpenROBO_Intern_add(threadID, strlen(threadID));
+  if (flag->handle == OPENROBO_HANDLE_NONE) {
+    OpenROBO_free(flag);
+    return NULL;
+  }
+
+  OpenROBO_Mutex_lock(&OpenROBO_stopFlagsMutex);
+  flag->next = OpenROBO_stopFlags;
+  OpenROBO_stopFlags = flag;
+  OpenROBO_Mutex_unlock(&OpenROBO_stopFlagsMutex);
+
+  return flag;
+}
+
+static void OpenROBO_StopFlag_release(OpenROBO_stopFlag_t *flag)
+{
+  OpenROBO_stopFlag_t **p;
+  if (flag == NULL) {
+    return;
+  }
+  OpenROBO_Mutex_lock(&OpenROBO_stopFlagsMutex);
+  for (p = &OpenROBO_stopFlags; *p != NULL; p = &(*p)->next) {
+    if (*p == flag) {
+      *p = flag->next;
+      break;
+    }
+  }
+  OpenROBO_Mutex_unlock(&OpenROBO_stopFlagsMutex);
+  OpenROBO_Intern_release(flag->handle);
+  OpenROBO_free(flag);
+}
+
+static int OpenROBO_StopFlag_isSet(OpenROBO_stopFlag_t *flag)
+{
+#if defined(_OPENROBO_WIN32_)
+  return flag->stopped;
+#else
+  return __atomic_load_n(&flag->stopped, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+   threadIDのフラグを立てて、終了要求を待っているスレッドを起こす
+   @retval 0 threadIDのフラグがない
+*/
+static int OpenROBO_StopFlag_set(const char *threadID)
+{
+  OpenROBO_stopFlag_t *flag;
+  int found = 0;
+  uint32_t handle = OpenROBO_Intern_find(threadID, strlen(threadID));
+
+  if (handle == OPENROBO_HANDLE_NONE) {
+    return 0;
+  }
+  OpenROBO_Mutex_lock(&OpenROBO_stopFlagsMutex);
+  for (flag = OpenROBO_stopFlags; flag != NULL; flag = flag->next) {
+    if (flag->handle != handle) {
+      continue;
+    }
+#if defined(_OPENROBO_WIN32_)
+    InterlockedExchange((volatile LONG *)&flag->stopped, 1);
+#else
+    __atomic_store_n(&flag->stopped, 1, __ATOMIC_RELEASE);
+#endif
+#if OPENROBO_FUTEX_ENABLE
+    syscall(SYS_futex, &flag->stopped, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+    found = 1;
+  }
+#if !OPENROBO_FUTEX_ENABLE
+  if (found) {
+    OpenROBO_Cond_broadcast(&OpenROBO_stopFlagsCond);
+  }
+#endif
+  OpenROBO_Mutex_unlock(&OpenROBO_stopFlagsMutex);
+
+  return found;
+}
+
+/*
+   フラグが立つまで待つ(deadlineが0でなければその時刻まで)
+   @retval OpenROBO_Return_Timeout 期限までに立たなかった
+*/
+static int OpenROBO_StopFlag_wait(OpenROBO_stopFlag_t *flag, double deadline)
+{
+  int res = OpenROBO_Return_Success;
+#if OPENROBO_FUTEX_ENABLE
+  while (!__atomic_load_n(&flag->stopped, __ATOMIC_ACQUIRE)) {
+    struct timespec ts, *timeout = NULL;
+    int waitMsec = OpenROBO_Deadline_remainingMsec(deadline);
+    if (waitMsec == 0) {
+      res = OpenROBO_Return_Timeout;
+      break;
+    }
+    if (waitMsec > 0) {
+      ts.tv_sec = waitMsec / 1000;
+      ts.tv_nsec = (long)(waitMsec % 1000) * 1000000;
+      timeout = &ts;
+    }
+    syscall(SYS_futex, &flag->stopped, FUTEX_WAIT_PRIVATE, 0, timeout, NULL, 0);
+  }
+#else
+  OpenROBO_Mutex_lock(&OpenROBO_stopFlagsMutex);
+  while (!flag->stopped && res == OpenROBO_Return_Success) {
+    res = OpenROBO_Cond_waitUntil(&OpenROBO_stopFlagsCond, &OpenROBO_stopFlagsMutex, deadline);
+  }
+  OpenROBO_Mutex_unlock(&OpenROBO_stopFlagsMutex);
+#endif
+  return res;
+}
+
+/*
+   Start Messageに対応するロボット動作関数を実行する
+   (受け付けたことを返答してから実行する)
+*/
+static void OpenROBO_Thread_runOperation(OpenROBO_MessageFunction_t msgfunc, const char *message, const OpenROBO_MessageView_t *view, int ret)
+{
+  char returnMessageBuffer[1024];
+  OpenROBO_MessageBuilder_t returnMessage;
+  char subject[OPENROBO_FUNCTION_NAME_SIZE];
+  OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+  OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_subject, subject, sizeof(subject));
+  OpenROBO_Message_MakeReturnMessage(&returnMessage, subject);
+  OpenROBO_Message_SetReturnValue(&returnMessage, ret);
+  OpenROBO_Socket_sendReturnMessageBySystem(view, returnMessage.p);
+  OpenROBO_MessageBuilder_Term(&returnMessage);
+  if (ret == OpenROBO_Return_Success) { // TODO
+    msgfunc(message);
+  }
+}
+
+/* Thread wrapper function. */
+#if defined(_OPENROBO_WIN32_)
+static DWORD WINAPI OpenROBO_Thread_start_wrapper(LPVOID aArg)
+#elif defined(_OPENROBO_POSIX_)
+static void * OpenROBO_Thread_start_wrapper(void * aArg)
+#endif
+{
+  int ret;
+  int (*func)(int, char *[]);
+  OpenROBO_MessageFunction_t msgfunc;
+  char *message;
+  int argc;
+  char **argv;
+
+  /* Get thread startup information */
+  _OpenROBO_Thread_startInfo *ti = (_OpenROBO_Thread_startInfo *) aArg;
+  func = ti->func;
+  msgfunc = ti->msgfunc;
+  message = ti->message;
+  argc = ti->argc;
+  argv = ti->argv;
+
+  ret = OpenROBO_Message_buffer_init();
+
+  OpenROBO_MessageView_t view;
+  OpenROBO_MessageView_Parse(&view, message);
+  OpenROBO_generateThreadIDFromView(&view, OpenROBO_threadID);
+  OpenROBO_subsystemTable = ti->subsystemTable;
+  OpenROBO_Message_paramEncoding = ti->paramEncoding;
+  OpenROBO_Thread_stopFlag = ti->stopFlag;
+
+  /* The thread is responsible for freeing the startup information */
+  OpenROBO_free((void *)ti);
+
+  /* Call the actual client thread function */
+  if (func != NULL) {
+    /* Particular Subthread */
+    OpenROBO_free((void *)message);
+    func(argc, argv);
+  } else {
+    /* Message Subthread */
+    OpenROBO_Thread_runOperation(msgfunc, message, &view, ret);
+    OpenROBO_free((void *)message);
+  }
+
+  OpenROBO_Async_term();
+  OpenROBO_Message_buffer_term();
+
+  OpenROBO_StopFlag_release(OpenROBO_Thread_stopFlag);
+  OpenROBO_Thread_stopFlag = NULL;
+
+  OpenROBO_CheckWorking(); // for clear socket buffer
+
+  OpenROBO_sockList_deleteAll();
+
+#if defined(_OPENROBO_WIN32_)
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static int OpenROBO_Message_clone(const char* originalMessage, char** clonedMessage)
+{
+  char *p;
+  size_t size;
+  size = OpenROBO_Message_measure(originalMessage, SIZE_MAX, NULL) + 1;
+  p = (char *)OpenROBO_malloc(size);
+  if (p == NULL) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+  memcpy(p, originalMessage, size);
+  *clonedMessage = p;
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Thread_create_common(int (*func)(int, char *[]), OpenROBO_MessageFunction_t msgfunc, char* message, int argc, char *argv[])
+{
+  OpenROBO_MessageView_t view;
+  char threadID[OPENROBO_THREAD_ID_SIZE];
+  _OpenROBO_Thread_startInfo* ti = (_OpenROBO_Thread_startInfo*)OpenROBO_malloc(sizeof(_OpenROBO_Thread_startInfo));
+  if (ti == NULL) {
+    return OpenROBO_Return_Error;
+  }
+
+  if (OpenROBO_Message_clone(message, &ti->message) != OpenROBO_Return_Success) {
+    OpenROBO_free(ti);
+    return OpenROBO_Return_Error;
+  }
+  // スレッドが動き出す前に届いた終了要求も受けられるように、作る側で登録する
+  OpenROBO_MessageView_Parse(&view, ti->message);
+  OpenROBO_generateThreadIDFromView(&view, threadID);
+  ti->stopFlag = OpenROBO_StopFlag_create(threadID);
+  if (ti->stopFlag == NULL) {
+    OpenROBO_free(ti->message);
+    OpenROBO_free(ti);
+    return OpenROBO_Return_Error;
+  }
+  ti->func = func;
+  ti->msgfunc = msgfunc;
+  ti->argc = argc;
+  ti->argv = argv;
+  ti->subsystemTable = OpenROBO_subsystemTable;
+  ti->paramEncoding = OpenROBO_Message_paramEncoding;
+
+  if (OpenROBO_Thread_createDetached(OpenROBO_Thread_start_wrapper, ti) != OpenROBO_Return_Success) {
+    OpenROBO_StopFlag_release(ti->stopFlag);
+    OpenROBO_free(ti->message);
+    OpenROBO_free(ti);
+    return OpenROBO_Return_Error;
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_OperationPool
+
+   オペレーションスレッドのプール。
+   メインスレッドはStart Messageをジョブとしてキューに入れ、待機しているworkerが取り出して実行する。
+   workerはメッセージのバッファと接続をジョブの間で使い回し、
+   ジョブの開始時と終了時に"bind;"を送って接続先に自身のthreadIDを付け直してもらう。
+   OPENROBO_CAPABILITY_REBINDを持たない相手への接続と、返答を受け取っていないCommand Messageが残っている接続は
+   ジョブの終了時に切断し、前のジョブへの返答が次のジョブに届かないようにする。
+   workerがmaxWorkersに達するとStart Messageはキューで待ち、workerが取り出すまで受け付けの返答を返さない。
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_OperationPool_job {
+  OpenROBO_MessageFunction_t msgfunc;
+  char *message;
+  char threadID[OPENROBO_THREAD_ID_SIZE];
+  OpenROBO_subsystemTable_t subsystemTable;
+  int paramEncoding;
+  OpenROBO_stopFlag_t *stopFlag;
+  double enqueuedTime;
+  struct _OpenROBO_OperationPool_job *next;
+} OpenROBO_OperationPool_job_t;
+
+typedef struct {
+  OpenROBO_Mutex_t mutex;
+  OpenROBO_Cond_t cond;
+  int initialized;
+  size_t minWorkers;
+  size_t maxWorkers;
+  unsigned int idleTimeoutMsec;
+  size_t workers;
+  size_t idleWorkers;
+  size_t queuedJobs;
+  OpenROBO_OperationPool_job_t *queueHead;
+  OpenROBO_OperationPool_job_t *queueTail;
+  OpenROBO_OperationPool_job_t *running;
+  uint64_t jobs;
+  double queueWaitTotal;
+  double queueWaitMax;
+} OpenROBO_OperationPool_t;
+
+static OpenROBO_OperationPool_t OpenROBO_OperationPool = {
+  OpenROBO_Mutex_t(), OpenROBO_Cond_t(), 0,
+  OPENROBO_OPERATION_POOL_MIN_WORKERS, OPENROBO_OPERATION_POOL_MAX_WORKERS, OPENROBO_OPERATION_POOL_IDLE_TIMEOUT_MSEC,
+  0, 0, 0, NULL, NULL, NULL, 0, 0.0, 0.0
+};
+
+static int OpenROBO_OperationPool_spawn(OpenROBO_OperationPool_t *pool);
+
+static void OpenROBO_OperationPool_init(OpenROBO_OperationPool_t *pool)
+{
+  if (pool->initialized) {
+    return;
+  }
+  OpenROBO_Mutex_init(&pool->mutex);
+  OpenROBO_Cond_init(&pool->cond);
+  pool->initialized = 1;
+
+  OpenROBO_Mutex_lock(&pool->mutex);
+  while (pool->workers < pool->minWorkers && pool->workers < pool->maxWorkers) {
+    if (OpenROBO_OperationPool_spawn(pool) != OpenROBO_Return_Success) {
+      break;
+    }
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+}
+
+int OpenROBO_Thread_SetOperationPool(size_t minWorkers, size_t maxWorkers, unsigned int idleTimeoutMsec)
+{
+  OpenROBO_OperationPool_t *pool = &OpenROBO_OperationPool;
+  if (!OpenROBO_isMainThread || minWorkers > maxWorkers) {
+    return OpenROBO_Return_Error;
+  }
+  if (!pool->initialized) {
+    pool->minWorkers = minWorkers;
+    pool->maxWorkers = maxWorkers;
+    pool->idleTimeoutMsec = idleTimeoutMsec;
+    return OpenROBO_Return_Success;
+  }
+
+  // 初期化の後はminWorkersまで増やし、maxWorkersを超える待機中のworkerを終了させる
+  OpenROBO_Mutex_lock(&pool->mutex);
+  pool->minWorkers = minWorkers;
+  pool->maxWorkers = maxWorkers;
+  pool->idleTimeoutMsec = idleTimeoutMsec;
+  while (pool->workers < pool->minWorkers) {
+    if (OpenROBO_OperationPool_spawn(pool) != OpenROBO_Return_Success) {
+      break;
+    }
+  }
+  OpenROBO_Cond_broadcast(&pool->cond);
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Thread_GetOperationPoolStats(OpenROBO_OperationPoolStats_t *stats)
+{
+  OpenROBO_OperationPool_t *pool = &OpenROBO_OperationPool;
+  if (!pool->initialized) {
+    memset(stats, 0, sizeof(*stats));
+    return OpenROBO_Return_Success;
+  }
+  OpenROBO_Mutex_lock(&pool->mutex);
+  stats->workers = pool->workers;
+  stats->idleWorkers = pool->idleWorkers;
+  stats->queuedJobs = pool->queuedJobs;
+  stats->jobs = pool->jobs;
+  stats->queueWaitTotal = pool->queueWaitTotal;
+  stats->queueWaitMax = pool->queueWaitMax;
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  return OpenROBO_Return_Success;
+}
+
+static void OpenROBO_OperationPool_freeJob(OpenROBO_OperationPool_job_t *job)
+{
+  OpenROBO_StopFlag_release(job->stopFlag);
+  OpenROBO_free(job->message);
+  OpenROBO_free(job);
+}
+
+/*
+   キューに入っているか実行中のジョブにthreadIDのものがあるか(mutexを取ってから呼ぶ)
+*/
+static int OpenROBO_OperationPool_hasJob(OpenROBO_OperationPool_t *pool, const char *threadID)
+{
+  OpenROBO_OperationPool_job_t *job;
+  for (job = pool->queueHead; job != NULL; job = job->next) {
+    if (strcmp(job->threadID, threadID) == 0) {
+      return 1;
+    }
+  }
+  for (job = pool->running; job != NULL; job = job->next) {
+    if (strcmp(job->threadID, threadID) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+   次のジョブを取り出す。idleTimeoutMsecの間ジョブがなく、workerがminWorkersより多い場合はNULLを返す
+*/
+static OpenROBO_OperationPool_job_t* OpenROBO_OperationPool_take(OpenROBO_OperationPool_t *pool)
+{
+  OpenROBO_OperationPool_job_t *job;
+  double waitTime;
+
+  OpenROBO_Mutex_lock(&pool->mutex);
+  pool->idleWorkers++;
+  while (pool->queueHead == NULL) {
+    int timeout;
+    if (pool->workers > pool->maxWorkers) { // OpenROBO_Thread_SetOperationPool()で減らされた
+      pool->idleWorkers--;
+      pool->workers--;
+      OpenROBO_Mutex_unlock(&pool->mutex);
+      return NULL;
+    }
+    timeout = OpenROBO_Cond_timedwait(&pool->cond, &pool->mutex, pool->idleTimeoutMsec);
+    if (timeout && pool->queueHead == NULL && pool->workers > pool->minWorkers) {
+      pool->idleWorkers--;
+      pool->workers--;
+      OpenROBO_Mutex_unlock(&pool->mutex);
+      return NULL;
+    }
+  }
+  pool->idleWorkers--;
+
+  job = pool->queueHead;
+  pool->queueHead = job->next;
+  if (pool->queueHead == NULL) {
+    pool->queueTail = NULL;
+  }
+  pool->queuedJobs--;
+  job->next = pool->running;
+  pool->running = job;
+
+  waitTime = OpenROBO_getMonotonicTime() - job->enqueuedTime;
+  pool->jobs++;
+  pool->queueWaitTotal += waitTime;
+  if (waitTime > pool->queueWaitMax) {
+    pool->queueWaitMax = waitTime;
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+
+  return job;
+}
+
+static void OpenROBO_OperationPool_finish(OpenROBO_OperationPool_t *pool, OpenROBO_OperationPool_job_t *job)
+{
+  OpenROBO_OperationPool_job_t **p;
+  OpenROBO_Mutex_lock(&pool->mutex);
+  for (p = &pool->running; *p != NULL; p = &(*p)->next) {
+    if (*p == job) {
+      *p = job->next;
+      break;
+    }
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  OpenROBO_OperationPool_freeJob(job);
+}
+
+/*
+   接続しているすべての相手に"bind;"を送り、この接続のthreadIDを付け直してもらう
+*/
+static void OpenROBO_OperationPool_bindConnections(const char *threadID)
+{
+  char messageBuffer[OPENROBO_THREAD_ID_SIZE+32];
+  OpenROBO_MessageBuilder_t message;
+  size_t i;
+
+  if (OpenROBO_sockList.size == 0) {
+    return;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&message, messageBuffer, sizeof(messageBuffer));
+  OpenROBO_MessageBuilder_append(&message, OpenROBO_MessageHeader_Bind, strlen(OpenROBO_MessageHeader_Bind));
+  OpenROBO_Message_setSourceID(&message, threadID);
+  for (i = OpenROBO_sockList.size; i > 0; i--) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList.items[i-1];
+    if (OpenROBO_Socket_sendMessageTo(s, message.p, NULL) != OpenROBO_Return_Success) {
+      OpenROBO_sockList_delete(s);
+    }
+  }
+  OpenROBO_MessageBuilder_Term(&message);
+}
+
+/*
+   ジョブの終了時に次のジョブで使えない接続を切断し、残りの接続からthreadIDを外してもらう
+   自身のメインスレッドへの接続(先頭)を切断する場合は、終了要求を受ける接続が変わらないようにすべて切断する
+*/
+static void OpenROBO_OperationPool_releaseConnections(void)
+{
+  size_t i;
+
+  OpenROBO_CheckWorking(); // 終了要求の残りを読み捨てる
+
+  for (i = OpenROBO_sockList.size; i > 0; i--) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList.items[i-1];
+    OpenROBO_subsystemTable_info_t *info = OpenROBO_findSubsystemInfoByThreadID(s->id);
+    if (info != NULL && OpenROBO_hasCapability(info, OPENROBO_CAPABILITY_REBIND) && s->pending == 0 && !s->subscribed && !OpenROBO_sockList_isRecvable(s)) {
+      s->paramEncoding = OpenROBO_negotiateParamEncoding(info);
+      continue;
+    }
+    if (i == 1) {
+      OpenROBO_sockList_deleteAll();
+      return;
+    }
+    OpenROBO_sockList_delete(s);
+  }
+
+  OpenROBO_OperationPool_bindConnections("");
+}
+
+/* Worker wrapper function. */
+#if defined(_OPENROBO_WIN32_)
+static DWORD WINAPI OpenROBO_OperationPool_worker(LPVOID aArg)
+#elif defined(_OPENROBO_POSIX_)
+static void * OpenROBO_OperationPool_worker(void * aArg)
+#endif
+{
+  OpenROBO_OperationPool_t *pool = (OpenROBO_OperationPool_t *)aArg;
+  OpenROBO_OperationPool_job_t *job;
+  int ret;
+
+  ret = OpenROBO_Message_buffer_init();
+
+  while ((job = OpenROBO_OperationPool_take(pool)) != NULL) {
+    OpenROBO_MessageView_t view;
+    OpenROBO_MessageView_Parse(&view, job->message);
+    strcpy(OpenROBO_threadID, job->threadID);
+    OpenROBO_subsystemTable = job->subsystemTable;
+    OpenROBO_Message_paramEncoding = job->paramEncoding;
+    OpenROBO_Thread_workingFlag = 1;
+    OpenROBO_Thread_stopFlag = job->stopFlag;
+
+    OpenROBO_OperationPool_bindConnections(OpenROBO_threadID);
+    OpenROBO_Thread_runOperation(job->msgfunc, job->message, &view, ret);
+    OpenROBO_Async_releaseAll();
+
+    OpenROBO_Thread_stopFlag = NULL;
+    OpenROBO_OperationPool_finish(pool, job);
+    OpenROBO_OperationPool_releaseConnections();
+  }
+
+  OpenROBO_Async_term();
+  OpenROBO_Message_buffer_term();
+  OpenROBO_sockList_deleteAll();
+
+#if defined(_OPENROBO_WIN32_)
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+/*
+   workerを1つ増やす(mutexを取ってから呼ぶ)
+*/
+static int OpenROBO_OperationPool_spawn(OpenROBO_OperationPool_t *pool)
+{
+  if (OpenROBO_Thread_createDetached(OpenROBO_OperationPool_worker, pool) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  pool->workers++;
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_OperationPool_submit(OpenROBO_OperationPool_t *pool, OpenROBO_MessageFunction_t msgfunc, const char *message, const char *threadID)
+{
+  OpenROBO_OperationPool_job_t *job = (OpenROBO_OperationPool_job_t *)OpenROBO_malloc(sizeof(OpenROBO_OperationPool_job_t));
+  if (job == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_Message_clone(message, &job->message) != OpenROBO_Return_Success) {
+    OpenROBO_free(job);
+    return OpenROBO_Return_Error;
+  }
+  job->stopFlag = OpenROBO_StopFlag_create(threadID);
+  if (job->stopFlag == NULL) {
+    OpenROBO_free(job->message);
+    OpenROBO_free(job);
+    return OpenROBO_Return_Error;
+  }
+  job->msgfunc = msgfunc;
+  strcpy(job->threadID, threadID);
+  job->subsystemTable = OpenROBO_subsystemTable;
+  job->paramEncoding = OpenROBO_Message_paramEncoding;
+  job->enqueuedTime = OpenROBO_getMonotonicTime();
+  job->next = NULL;
+
+  OpenROBO_OperationPool_init(pool);
+
+  OpenROBO_Mutex_lock(&pool->mutex);
+  if (OpenROBO_OperationPool_hasJob(pool, threadID)) {
+    OpenROBO_Mutex_unlock(&pool->mutex);
+    OpenROBO_OperationPool_freeJob(job);
+    return OpenROBO_Return_DoubleCreateSubthread;
+  }
+  if (pool->queueTail == NULL) {
+    pool->queueHead = job;
+  } else {
+    pool->queueTail->next = job;
+  }
+  pool->queueTail = job;
+  pool->queuedJobs++;
+
+  if (pool->idleWorkers < pool->queuedJobs && pool->workers < pool->maxWorkers) {
+    if (OpenROBO_OperationPool_spawn(pool) != OpenROBO_Return_Success && pool->workers == 0) {
+      pool->queueHead = pool->queueTail = NULL;
+      pool->queuedJobs = 0;
+      OpenROBO_Mutex_unlock(&pool->mutex);
+      OpenROBO_OperationPool_freeJob(job);
+      return OpenROBO_Return_Error;
+    }
+  }
+  OpenROBO_Cond_signal(&pool->cond);
+  OpenROBO_Mutex_unlock(&pool->mutex);
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Thread_CreateSubthread(int (*func)(int, char *[]), const char* funcName, int argc, char *argv[])
+{
+  char threadID[OPENROBO_THREAD_ID_SIZE];
+  OpenROBO_generateThreadID(OpenROBO_threadID, funcName, threadID);
+  if (OpenROBO_sockList_findByID(threadID) != NULL) {
+    return OpenROBO_Return_DoubleCreateSubthread;
+  }
+
+  int res;
+  OpenROBO_MessageBuilder_t message = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+  if (OpenROBO_Message_MakeOperationMessage(&message, funcName) != OpenROBO_Return_Success ||
+      OpenROBO_Message_setSourceID(&message, OpenROBO_threadID) != OpenROBO_Return_Success ||
+      OpenROBO_Message_setDestinationID(&message, OpenROBO_threadID) != OpenROBO_Return_Success) {
+    OpenROBO_MessageBuilder_Term(&message);
+    return OpenROBO_Return_Error;
+  }
+
+  res = OpenROBO_Thread_create_common(func, NULL, message.p, argc, argv);
+  OpenROBO_MessageBuilder_Term(&message);
+  return res;
+}
+
+static int OpenROBO_Thread_createOperationThread(OpenROBO_MessageFunction_t func, const OpenROBO_MessageView_t* view)
+{
+  int res;
+  char threadID[OPENROBO_THREAD_ID_SIZE];
+
+  OpenROBO_generateThreadIDFromView(view, threadID);
+  if (OpenROBO_OperationPool.maxWorkers > 0) {
+    /* 終了したジョブの接続のthreadIDは"bind;"が届くまで残っているので、プールのジョブだけを見る */
+    res = OpenROBO_OperationPool_submit(&OpenROBO_OperationPool, func, view->message, threadID);
+  } else if (OpenROBO_sockList_findByID(threadID) != NULL) {
+    res = OpenROBO_Return_DoubleCreateSubthread;
+  } else {
+    res = OpenROBO_Thread_create_common(NULL, func, (char *)view->message, 0, NULL);
+  }
+
+  if (res != OpenROBO_Return_Success) {
+    char returnMessageBuffer[1024];
+    OpenROBO_MessageBuilder_t returnMessage;
+    char subject[OPENROBO_FUNCTION_NAME_SIZE];
+    OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+    OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_subject, subject, sizeof(subject));
+    OpenROBO_Message_MakeReturnMessage(&returnMessage, subject);
+    OpenROBO_Message_SetReturnValue(&returnMessage, res);
+    OpenROBO_Socket_sendReturnMessageBySystem(view, returnMessage.p);
+    OpenROBO_MessageBuilder_Term(&returnMessage);
+  }
+
+  return res;
+}
+
+int OpenROBO_Thread_CreateOperationThread(OpenROBO_MessageFunction_t func, char* message)
+{
+  OpenROBO_MessageView_t view;
+  OpenROBO_MessageView_Parse(&view, message);
+  return OpenROBO_Thread_createOperationThread(func, &view);
+}
+
+/*
+   Wait/Start Message(waitList)とまだ受け取られていないReturn Message(returnMessageList)の表
+   subjectで引くchain hashで、同じsubjectのものは入れた順に取り出す(bucketの末尾に足す)
+   subjectは入れるときに一度だけ探し、cloneしたメッセージの中を指しておく
+*/
+typedef struct _OpenROBO_joinThreadQueue {
+  const char* message;
+  const char* functionName; // messageのsubject('\0'で終わらない)
+  size_t functionNameSize;
+  uint32_t sourceHandle;    // messageの"#src"のhandle(返答の転送先)
+  uint32_t seq;             // messageの"#seq"(転送する返答に付ける)
+  uint32_t hash;
+  struct _OpenROBO_joinThreadQueue *next; // 同じbucketの次
+} OpenROBO_joinThreadQueue_t;
+
+typedef struct {
+  OpenROBO_joinThreadQueue_t **buckets;
+  size_t bucketsSize; // 2のべき乗
+  size_t size;
+} OpenROBO_joinThreadTable_t;
+
+static OpenROBO_joinThreadTable_t OpenROBO_JoinThread_returnMessageList = {NULL, 0, 0};
+
+static OpenROBO_joinThreadTable_t OpenROBO_JoinThread_waitList = {NULL, 0, 0};
+
+/*
+   qをbucketの末尾に足す
+*/
+static void OpenROBO_joinThreadQueue_link(OpenROBO_joinThreadTable_t* table, OpenROBO_joinThreadQueue_t* q)
+{
+  OpenROBO_joinThreadQueue_t **p = &table->buckets[q->hash & (table->bucketsSize - 1)];
+  while (*p != NULL) {
+    p = &(*p)->next;
+  }
+  q->next = NULL;
+  *p = q;
+}
+
+static int OpenROBO_joinThreadQueue_rehash(OpenROBO_joinThreadTable_t* table, size_t bucketsSize)
+{
+  OpenROBO_joinThreadQueue_t **old = table->buckets;
+  size_t oldSize = table->bucketsSize;
+  size_t i;
+
+  table->buckets = (OpenROBO_joinThreadQueue_t **)OpenROBO_malloc(sizeof(OpenROBO_joinThreadQueue_t *)*bucketsSize);
+  if (table->buckets == NULL) {
+    table->buckets = old;
+    return OpenROBO_Return_Error;
+  }
+  memset(table->buckets, 0, sizeof(OpenROBO_joinThreadQueue_t *)*bucketsSize);
+  table->bucketsSize = bucketsSize;
+
+  // bucketの順に移すので、同じsubjectのものの順番は変わらない
+  for (i = 0; i < oldSize; i++) {
+    OpenROBO_joinThreadQueue_t *q = old[i];
+    while (q != NULL) {
+      OpenROBO_joinThreadQueue_t *next = q->next;
+      OpenROBO_joinThreadQueue_link(table, q);
+      q = next;
+    }
+  }
+  OpenROBO_free(old);
+
+  return OpenROBO_Return_Success;
+}
+
+static OpenROBO_joinThreadQueue_t* OpenROBO_joinThreadQueue_findByFunctionName(OpenROBO_joinThreadTable_t* table, const char* functionName, size_t functionNameSize)
+{
+  OpenROBO_joinThreadQueue_t *q;
+  uint32_t hash;
+
+  if (table->size == 0) {
+    return NULL;
+  }
+
+  hash = OpenROBO_hashBytes(functionName, functionNameSize);
+  for (q = table->buckets[hash & (table->bucketsSize - 1)]; q != NULL; q = q->next) {
+    if (q->hash == hash && q->functionNameSize == functionNameSize && memcmp(q->functionName, functionName, functionNameSize) == 0) {
+      return q;
+    }
+  }
+
+  return NULL;
+}
+
+/*
+   messageの所有権を引き取る
+   messageはviewのメッセージの複製で、subjectの位置はviewから求める
+*/
+static int OpenROBO_joinThreadQueue_append(OpenROBO_joinThreadTable_t* table, const char* message, const OpenROBO_MessageView_t* view)
+{
+  OpenROBO_joinThreadQueue_t *p;
+  const char *functionName, *sourceID;
+  size_t functionNameSize, sourceIDSize;
+
+  OpenROBO_MessageView_GetSubject(view, &functionName, &functionNameSize);
+  OpenROBO_MessageView_GetSourceID(view, &sourceID, &sourceIDSize);
+  if (table->size >= table->bucketsSize) {
+    if (OpenROBO_joinThreadQueue_rehash(table, table->bucketsSize == 0 ? OPENROBO_JOINTHREAD_INITIAL_BUCKETS : table->bucketsSize*2) != OpenROBO_Return_Success) {
+      return OpenROBO_Return_Error;
+    }
+  }
+
+  p = (OpenROBO_joinThreadQueue_t *)OpenROBO_malloc(sizeof(OpenROBO_joinThreadQueue_t));
+  if (p == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  p->message = message;
+  p->functionName = functionName != NULL ? &message[functionName - view->message] : message;
+  p->functionNameSize = functionNameSize;
+  p->sourceHandle = OpenROBO_Intern_add(sourceID, sourceIDSize);
+  p->seq = OpenROBO_MessageView_getSeq(view);
+  p->hash = OpenROBO_hashBytes(p->functionName, p->functionNameSize);
+  OpenROBO_joinThreadQueue_link(table, p);
+  table->size++;
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_joinThreadQueue_delete(OpenROBO_joinThreadTable_t* table, OpenROBO_joinThreadQueue_t* q)
+{
+  OpenROBO_joinThreadQueue_t **p;
+
+  for (p = &table->buckets[q->hash & (table->bucketsSize - 1)]; *p != NULL; p = &(*p)->next) {
+    if (*p == q) {
+      *p = q->next;
+      break;
+    }
+  }
+  table->size--;
+  OpenROBO_Intern_release(q->sourceHandle);
+  OpenROBO_free((void*)q->message);
+  OpenROBO_free(q);
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_JoinThread_storeThreadReturnMessage(const OpenROBO_MessageView_t* view)
+{
+  if (!OpenROBO_isMainThread) {
+    return OpenROBO_Return_Error;
+  }
+  const char *message = view->message;
+  const char *functionName;
+  size_t functionNameSize;
+  OpenROBO_joinThreadQueue_t *exitEntry;
+  int res;
+
+  OpenROBO_MessageView_GetSubject(view, &functionName, &functionNameSize);
+  exitEntry = OpenROBO_joinThreadQueue_findByFunctionName(&OpenROBO_JoinThread_waitList, functionName, functionNameSize);
+  if (exitEntry == NULL) {
+    char *_message;
+    res = OpenROBO_Message_clone(message, &_message);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    res = OpenROBO_joinThreadQueue_append(&OpenROBO_JoinThread_returnMessageList, _message, view);
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_free(_message);
+    }
+    return res;
+  } else {
+    // handleで見つからない場合に備えて、待っているWait Messageの"#src"も渡す
+    OpenROBO_MessageView_t waitView;
+    const char *sourceID = NULL;
+    size_t sourceIDSize = 0;
+    if (OpenROBO_MessageView_Parse(&waitView, exitEntry->message) != OpenROBO_Return_Success ||
+        OpenROBO_MessageView_GetSourceID(&waitView, &sourceID, &sourceIDSize) != OpenROBO_Return_Success) {
+      sourceID = NULL;
+      sourceIDSize = 0;
+    }
+    res = OpenROBO_Socket_forwardReturnMessage(exitEntry->sourceHandle, sourceID, sourceIDSize, message, exitEntry->seq);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    OpenROBO_joinThreadQueue_delete(&OpenROBO_JoinThread_waitList, exitEntry);
+    return OpenROBO_Return_Success;
+  }
+}
+
+int OpenROBO_JoinThread_JoinQueue(const OpenROBO_MessageView_t* view)
+{
+  if (!OpenROBO_isMainThread) {
+    return OpenROBO_Return_Error;
+  }
+
+
+  const char *message = view->message;
+  const char *functionName;
+  size_t functionNameSize;
+  OpenROBO_joinThreadQueue_t *returnEntry;
+
+  OpenROBO_MessageView_GetSubject(view, &functionName, &functionNameSize);
+  returnEntry = OpenROBO_joinThreadQueue_findByFunctionName(&OpenROBO_JoinThread_returnMessageList, functionName, functionNameSize);
+  if (returnEntry == NULL) {
+    int res;
+    char *_message;
+    res = OpenROBO_Message_clone(message, &_message);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    res = OpenROBO_joinThreadQueue_append(&OpenROBO_JoinThread_waitList, _message, view);
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_free(_message);
+    }
+    return res;
+  } else {
+    int res;
+    const char *sourceID;
+    size_t sourceIDSize;
+    if (OpenROBO_MessageView_GetSourceID(view, &sourceID, &sourceIDSize) != OpenROBO_Return_Success) {
+      sourceID = NULL;
+      sourceIDSize = 0;
+    }
+    res = OpenROBO_Socket_forwardReturnMessage(sourceID != NULL ? OpenROBO_Intern_find(sourceID, sourceIDSize) : OPENROBO_HANDLE_NONE, sourceID, sourceIDSize, returnEntry->message, OpenROBO_MessageView_getSeq(view));
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    OpenROBO_joinThreadQueue_delete(&OpenROBO_JoinThread_returnMessageList, returnEntry);
+    return OpenROBO_Return_Success;
+  }
+}
+
+/*
+   終了要求が来るまで待つ(OpenROBO_Socket_recvDeadlineがあればその時刻まで)
+*/
+static int OpenROBO_waitForStopMessage(void)
+{
+  int res;
+  char buf[1];
+  OpenROBO_sockList_t *s;
+
+  if (OpenROBO_Thread_stopFlag != NULL) {
+    return OpenROBO_StopFlag_wait(OpenROBO_Thread_stopFlag, OpenROBO_Socket_recvDeadline);
+  }
+
+  if (OpenROBO_isMainThread) {
+    return 1;
+  }
+
+  if (!OpenROBO_Thread_workingFlag) {
+    return OpenROBO_Return_Success;
+  }
+
+  s = OpenROBO_sockList_getFirst();
+  if (s->channel != NULL) {
+    return OpenROBO_Channel_waitForStop(s->channel);
+  }
+
+  res = OpenROBO_Socket_waitRecvable(&s->sock, s->shm);
+  if (res == OpenROBO_Return_Timeout) {
+    return res;
+  }
+  if (res == OpenROBO_Return_Success) {
+    res = OpenROBO_Socket_recvAll(&s->sock, s->shm, buf, sizeof(buf));
+  }
+  if (res != OpenROBO_Return_Success) { //fatal error
+    DBGABORT();
+    OpenROBO_Thread_workingFlag = 0;
+    return OpenROBO_Return_Error;
+  }
+
+  if (buf[0] != '\0') { // unknown condition
+    DBGABORT();
+    OpenROBO_Thread_workingFlag = 0;
+    return OpenROBO_Return_Error;
+  }
+
+  OpenROBO_Thread_workingFlag = 0;
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_WaitForStopMessage(void)
+{
+  return OpenROBO_waitForStopMessage();
+}
+
+int OpenROBO_WaitForStopMessage(int timeoutMsec, double *waitSec)
+{
+  int res;
+  double start = OpenROBO_Deadline_begin(timeoutMsec);
+  res = OpenROBO_waitForStopMessage();
+  OpenROBO_Deadline_end(start, waitSec);
+  return res;
+}
+
+int OpenROBO_CheckWorking(void)
+{
+  int res;
+  char buf[1];
+  OpenROBO_sockList_t *s;
+
+  // OpenROBOが作ったスレッドでは終了要求はフラグで届く
+  if (OpenROBO_Thread_stopFlag != NULL) {
+    return !OpenROBO_StopFlag_isSet(OpenROBO_Thread_stopFlag);
+  }
+
+  if (OpenROBO_isMainThread) {
+    return 1;
+  }
+
+  s = OpenROBO_sockList_getFirst();
+  if (s->channel != NULL) {
+    return OpenROBO_Channel_checkWorking(s->channel);
+  }
+
+  while (1) {
+    if (!OpenROBO_sockList_isRecvable(s)) {
+      return OpenROBO_Thread_workingFlag;
+    }
+
+    if (s->shm != NULL) {
+      OpenROBO_Shm_peek(s->shm, buf);
+    } else {
+      res = SocketCom_RecvEx(&s->sock, buf, sizeof(buf), NULL, MSG_PEEK);
+      if (res != SOCKETCOM_SUCCESS) { //fatal error
+        DBGABORT();
+        OpenROBO_Thread_workingFlag = 0;
+        return OpenROBO_Thread_workingFlag;
+      }
+    }
+
+    if (buf[0] != '\0') {
+      break;
+    }
+
+    OpenROBO_Thread_workingFlag = 0;
+    res = OpenROBO_Socket_recvAll(&s->sock, s->shm, buf, sizeof(buf));
+    if (res != OpenROBO_Return_Success) {
+      DBGABORT();
+      return OpenROBO_Thread_workingFlag;
+    }
+  }
+
+  return OpenROBO_Thread_workingFlag;
+}
+
+int OpenROBO_sendExitThreadSignal(const OpenROBO_MessageView_t* view)
+{
+  char destionationID[OPENROBO_THREAD_ID_SIZE];
+  OpenROBO_generateThreadIDFromView(view, destionationID);
+
+  OpenROBO_sockList_t *s;
+  int res;
+  char signal[1] = {'\0'};
+  OpenROBO_iovec_t iov[1];
+  if (OpenROBO_StopFlag_set(destionationID)) {
+    return OpenROBO_Return_Success;
+  }
+  s = OpenROBO_sockList_findByID(destionationID);
+  if (s == NULL) {
+    return OpenROBO_Return_NonConnection;
+  }
+
+  if (s->carrier != NULL) {
+    OpenROBO_Mutex_lock(&s->carrier->sendMutex);
+    res = OpenROBO_Socket_sendControlFrame(&s->carrier->sock, s->carrier->shm, OPENROBO_FRAME_FLAG_STOP, s->channelID, NULL);
+    OpenROBO_Mutex_unlock(&s->carrier->sendMutex);
+    return res;
+  }
+
+  iov[0].iov_base = signal;
+  iov[0].iov_len = sizeof(signal);
+  OpenROBO_Mutex_lock(&s->sendMutex);
+  res = OpenROBO_Socket_sendv(&s->sock, s->shm, iov, 1);
+  OpenROBO_Mutex_unlock(&s->sendMutex);
+
+  return res;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Shm
+
+   同じホストの相手との接続では、最初のメッセージの後でframeの送受信を共有メモリのリングバッファに切り替える。
+   接続した側がOPENROBO_SHM_DIRにファイルを作ってmmapし、"パス nonce"を送る(作れなければ空の文字列)。
+   受け付けた側はそのファイルをmmapしてnonceが一致すれば"1"、それ以外は"0"を返す(別のホストでは一致しない)。
+   リングは方向ごとに1つで、読むのも書くのも同時には1スレッドだけ(書く側は接続の送信のmutexで直列化される)。
+   socketはそのまま残し、読む側が空のリングを待っているときだけ書く側が1byteの通知(doorbell)を送る。
+   メインスレッドはこれまで通りsocketを待ち、相手の切断もsocketで知る。
+   リングに空きがなければ書く側は読む側が進むのを待つので、リングより大きいメッセージも送れる。
+   読む側がwakesWriterを立てていれば、書く側はspaceWaitingを立ててspaceFreedのfutex(プロセス間で共有)で眠り、
+   読む側はtailを進めたときにspaceWaitingが立っていれば起こす(立てていない古い相手には短く眠って確かめ直す)。
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+#if OPENROBO_SHM_ENABLE
+
+#define OPENROBO_SHM_MAGIC (0x4D485352u) // "RSHM"
+#define OPENROBO_SHM_OFFER_SIZE (128)
+#define OPENROBO_SHM_DOORBELL_BUFFER_SIZE (64)
+#define OPENROBO_SHM_SPIN_COUNT (64)
+#define OPENROBO_SHM_BACKOFF_USEC (50)
+#define OPENROBO_SHM_SPACE_WAIT_MSEC (100) // 空きを待つ間に相手の切断を確かめる間隔
+
+typedef struct {
+  volatile uint64_t head;    // 書いた位置(書く側だけが進める)
+  uint8_t headPadding[56];
+  volatile uint64_t tail;    // 読んだ位置(読む側だけが進める)
+  volatile uint32_t waiting; // 読む側が空のリングでdoorbellを待っている
+  volatile uint32_t spaceWaiting; // 書く側が満杯のリングでspaceFreedを待っている
+  volatile uint32_t spaceFreed;   // 読む側が書く側を起こすたびに増やす(futex)
+  volatile uint32_t wakesWriter;  // 読む側がspaceWaitingを見て書く側を起こす
+  uint8_t tailPadding[40];
+} OpenROBO_shmRing_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t ringSize;
+  uint64_t nonce;
+  uint8_t padding[48];
+  OpenROBO_shmRing_t rings[2]; // rings[0]は接続した側から受け付けた側へ。その後ろに各リングのデータを置く
+} OpenROBO_shmHeader_t;
+
+struct _OpenROBO_shm {
+  void *map;
+  size_t mapSize;
+  uint32_t ringSize; // 相手も書き換えられるheaderではなく確認した値を使う
+  OpenROBO_shmRing_t *tx;
+  OpenROBO_shmRing_t *rx;
+  uint8_t *txData;
+  uint8_t *rxData;
+};
+
+static size_t OpenROBO_Shm_mapSize(uint32_t ringSize)
+{
+  return sizeof(OpenROBO_shmHeader_t) + (size_t)ringSize*2;
+}
+
+static void OpenROBO_Shm_attach(OpenROBO_shm_t *shm, void *map, size_t mapSize, int accepted)
+{
+  OpenROBO_shmHeader_t *header = (OpenROBO_shmHeader_t *)map;
+  uint8_t *data = (uint8_t *)map + sizeof(OpenROBO_shmHeader_t);
+  shm->map = map;
+  shm->mapSize = mapSize;
+  shm->ringSize = header->ringSize;
+  shm->tx = &header->rings[accepted ? 1 : 0];
+  shm->rx = &header->rings[accepted ? 0 : 1];
+  shm->txData = &data[accepted ? shm->ringSize : 0];
+  shm->rxData = &data[accepted ? 0 : shm->ringSize];
+#if OPENROBO_FUTEX_ENABLE
+  __atomic_store_n(&shm->rx->wakesWriter, 1, __ATOMIC_RELEASE);
+#endif
+}
+
+static void OpenROBO_Shm_close(OpenROBO_shm_t *shm)
+{
+  if (shm == NULL) {
+    return;
+  }
+  munmap(shm->map, shm->mapSize);
+  OpenROBO_free(shm);
+}
+
+/*
+   リングに届いていてまだ読んでいないbyte数
+*/
+static size_t OpenROBO_Shm_pending(OpenROBO_shm_t *shm)
+{
+  return (size_t)(__atomic_load_n(&shm->rx->head, __ATOMIC_ACQUIRE) - shm->rx->tail);
+}
+
+static void OpenROBO_Shm_peek(OpenROBO_shm_t *shm, char *c)
+{
+  *c = (char)shm->rxData[shm->rx->tail % shm->ringSize];
+}
+
+static int OpenROBO_Shm_isDisconnected(ssize_t n)
+{
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/*
+   書いた位置を公開し、読む側が待っていればdoorbellを送る
+*/
+static int OpenROBO_Shm_publish(OpenROBO_shm_t *shm, SocketCom *sock, uint64_t head)
+{
+  char doorbell[1] = {'\0'};
+  ssize_t n;
+
+  __atomic_store_n(&shm->tx->head, head, __ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&shm->tx->waiting, 0, __ATOMIC_SEQ_CST) == 0) {
+    return OpenROBO_Return_Success;
+  }
+  do {
+    n = send(OpenROBO_SocketCom_getDescriptor(sock), doorbell, sizeof(doorbell), MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+
+  return n == (ssize_t)sizeof(doorbell) ? OpenROBO_Return_Success : OpenROBO_Return_Disconnected;
+}
+
+/*
+   読む側がリングを空けるのを待つ
+   少し譲っても空かなければ、読む側が起こしてくれる場合はfutexで眠り、そうでなければ短く眠って確かめ直す
+*/
+static int OpenROBO_Shm_waitForSpace(OpenROBO_shm_t *shm, SocketCom *sock, uint64_t head)
+{
+  unsigned int spins;
+  char c;
+  for (spins = 0; head - __atomic_load_n(&shm->tx->tail, __ATOMIC_ACQUIRE) >= shm->ringSize; spins++) {
+    if (spins < OPENROBO_SHM_SPIN_COUNT) {
+      sched_yield();
+      continue;
+    }
+    if (OpenROBO_Shm_isDisconnected(recv(OpenROBO_SocketCom_getDescriptor(sock), &c, 1, MSG_PEEK | MSG_DONTWAIT))) {
+      return OpenROBO_Return_Disconnected;
+    }
+#if OPENROBO_FUTEX_ENABLE
+    if (__atomic_load_n(&shm->tx->wakesWriter, __ATOMIC_ACQUIRE)) {
+      struct timespec ts = {OPENROBO_SHM_SPACE_WAIT_MSEC / 1000, (long)(OPENROBO_SHM_SPACE_WAIT_MSEC % 1000) * 1000000};
+      uint32_t freed = __atomic_load_n(&shm->tx->spaceFreed, __ATOMIC_ACQUIRE);
+      __atomic_store_n(&shm->tx->spaceWaiting, 1, __ATOMIC_SEQ_CST);
+      if (head - __atomic_load_n(&shm->tx->tail, __ATOMIC_SEQ_CST) < shm->ringSize) {
+        __atomic_store_n(&shm->tx->spaceWaiting, 0, __ATOMIC_RELAXED);
+        break;
+      }
+      // 相手のプロセスが起こすのでFUTEX_WAIT_PRIVATEではなくFUTEX_WAITを使う
+      syscall(SYS_futex, &shm->tx->spaceFreed, FUTEX_WAIT, freed, &ts, NULL, 0);
+      continue;
+    }
+#endif
+    usleep(OPENROBO_SHM_BACKOFF_USEC);
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   tailを進めた後に呼び、書く側が空きを待っていれば起こす
+*/
+static void OpenROBO_Shm_wakeWriter(OpenROBO_shm_t *shm)
+{
+#if OPENROBO_FUTEX_ENABLE
+  if (__atomic_load_n(&shm->rx->spaceWaiting, __ATOMIC_SEQ_CST) == 0 || __atomic_exchange_n(&shm->rx->spaceWaiting, 0, __ATOMIC_SEQ_CST) == 0) {
+    return;
+  }
+  __atomic_add_fetch(&shm->rx->spaceFreed, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &shm->rx->spaceFreed, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+  (void)shm;
+#endif
+}
+
+/*
+   リングが空の間doorbellを待つ
+*/
+static int OpenROBO_Shm_waitForData(OpenROBO_shm_t *shm, SocketCom *sock)
+{
+  char doorbells[OPENROBO_SHM_DOORBELL_BUFFER_SIZE];
+  ssize_t n;
+
+  __atomic_store_n(&shm->rx->waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shm->rx->head, __ATOMIC_SEQ_CST) != shm->rx->tail) {
+    __atomic_store_n(&shm->rx->waiting, 0, __ATOMIC_RELAXED);
+    return OpenROBO_Return_Success;
+  }
+  do {
+    n = recv(OpenROBO_SocketCom_getDescriptor(sock), doorbells, sizeof(doorbells), 0);
+  } while (n < 0 && errno == EINTR);
+  if (OpenROBO_Shm_isDisconnected(n)) {
+    return OpenROBO_Return_Disconnected;
+  }
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Shm_sendv(OpenROBO_shm_t *shm, SocketCom *sock, const OpenROBO_iovec_t *iov, int iovcnt)
+{
+  uint64_t head = shm->tx->head;
+  int i, res;
+
+  for (i = 0; i < iovcnt; i++) {
+    const uint8_t *p = (const uint8_t *)iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+    while (len > 0) {
+      uint64_t used = head - __atomic_load_n(&shm->tx->tail, __ATOMIC_ACQUIRE);
+      size_t offset = (size_t)(head % shm->ringSize);
+      size_t n;
+      if (used >= shm->ringSize) {
+        // 書いた分を読めるようにしてから空くのを待つ
+        res = OpenROBO_Shm_publish(shm, sock, head);
+        if (res == OpenROBO_Return_Success) {
+          res = OpenROBO_Shm_waitForSpace(shm, sock, head);
+        }
+        if (res != OpenROBO_Return_Success) {
+          return res;
+        }
+        continue;
+      }
+      n = shm->ringSize - (size_t)used;
+      if (n > shm->ringSize - offset) {
+        n = shm->ringSize - offset;
+      }
+      if (n > len) {
+        n = len;
+      }
+      memcpy(&shm->txData[offset], p, n);
+      head += n;
+      p += n;
+      len -= n;
+    }
+  }
+
+  return OpenROBO_Shm_publish(shm, sock, head);
+}
+
+static int OpenROBO_Shm_recvAll(OpenROBO_shm_t *shm, SocketCom *sock, void *buf, size_t size)
+{
+  uint8_t *p = (uint8_t *)buf;
+  uint64_t tail = shm->rx->tail;
+  int res;
+
+  while (size > 0) {
+    uint64_t available = __atomic_load_n(&shm->rx->head, __ATOMIC_ACQUIRE) - tail;
+    size_t offset = (size_t)(tail % shm->ringSize);
+    size_t n;
+    if (available == 0) {
+      res = OpenROBO_Shm_waitForData(shm, sock);
+      if (res != OpenROBO_Return_Success) {
+        return res;
+      }
+      continue;
+    }
+    n = shm->ringSize - offset;
+    if (n > available) {
+      n = (size_t)available;
+    }
+    if (n > size) {
+      n = size;
+    }
+    memcpy(p, &shm->rxData[offset], n);
+    tail += n;
+    p += n;
+    size -= n;
+    // 書く側のspaceWaitingとの順序を保つためSEQ_CSTで進める
+    __atomic_store_n(&shm->rx->tail, tail, __ATOMIC_SEQ_CST);
+    OpenROBO_Shm_wakeWriter(shm);
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   メインスレッドでsocketが受信可能になったときに呼び、届いているdoorbellを読み捨てる
+   @retval OpenROBO_Return_Success リングに読むデータがある
+   @retval OpenROBO_Return_NotUpdated 読むデータがない(既に読んだデータのdoorbell)
+   @retval OpenROBO_Return_Disconnected 相手が切断し、リングも空
+*/
+static int OpenROBO_Shm_poll(OpenROBO_shm_t *shm, SocketCom *sock)
+{
+  char doorbells[OPENROBO_SHM_DOORBELL_BUFFER_SIZE];
+  ssize_t n;
+  int disconnected;
+
+  do {
+    n = recv(OpenROBO_SocketCom_getDescriptor(sock), doorbells, sizeof(doorbells), MSG_DONTWAIT);
+  } while (n == (ssize_t)sizeof(doorbells) || (n < 0 && errno == EINTR));
+  disconnected = OpenROBO_Shm_isDisconnected(n);
+
+  if (OpenROBO_Shm_pending(shm) > 0) {
+    return OpenROBO_Return_Success;
+  }
+  return disconnected ? OpenROBO_Return_Disconnected : OpenROBO_Return_NotUpdated;
+}
+
+/*
+   メインスレッドで次にsocketを待つ前に呼び、リングが空ならdoorbellを頼む
+   @retval 1 リングにまだ読むデータがある(doorbellは来ないので続けて読む)
+*/
+static int OpenROBO_Shm_rearm(OpenROBO_shm_t *shm)
+{
+  if (OpenROBO_Shm_pending(shm) > 0) {
+    return 1;
+  }
+  __atomic_store_n(&shm->rx->waiting, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&shm->rx->head, __ATOMIC_SEQ_CST) != shm->rx->tail) {
+    __atomic_store_n(&shm->rx->waiting, 0, __ATOMIC_RELAXED);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+   他のホストのファイルとは一致しない値。秘密である必要はない
+*/
+static uint64_t OpenROBO_Shm_makeNonce(const void *map)
+{
+  struct timespec ts;
+  uint64_t x;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  x = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 20) ^ (uint64_t)(uintptr_t)map;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull; // splitmix64
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+/*
+   AF_UNIXの接続か(共有メモリをファイルの名前ではなくディスクリプタで渡せる)
+*/
+static int OpenROBO_Shm_canPassDescriptor(SocketCom *sock)
+{
+#if defined(SO_DOMAIN) && defined(MFD_CLOEXEC)
+  int domain = 0;
+  socklen_t size = sizeof(domain);
+  if (getsockopt(OpenROBO_SocketCom_getDescriptor(sock), SOL_SOCKET, SO_DOMAIN, &domain, &size) != 0) {
+    return 0;
+  }
+  return domain == AF_UNIX;
+#else
+  (void)sock;
+  return 0;
+#endif
+}
+
+/*
+   申し出の文字列を送る。fdが0以上ならSCM_RIGHTSで添える
+*/
+static int OpenROBO_Shm_sendOffer(SocketCom *sock, const char *offer, int fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr header;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  size_t size = strlen(offer)+1;
+  ssize_t n;
+
+  if (fd < 0) {
+    return SocketCom_Send(sock, offer, size) == SOCKETCOM_SUCCESS ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+  }
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = (void *)offer;
+  iov.iov_len = size;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  do {
+    n = sendmsg(OpenROBO_SocketCom_getDescriptor(sock), &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return OpenROBO_Return_Error;
+  }
+  // 続きは添えるものがないので普通に送る
+  if ((size_t)n < size && SocketCom_Send(sock, &offer[n], size - n) != SOCKETCOM_SUCCESS) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   申し出の文字列を受信する。AF_UNIXの接続ではSCM_RIGHTSで添えられたディスクリプタを*fdに返す
+*/
+static int OpenROBO_Shm_recvOffer(SocketCom *sock, char *offer, size_t offerSize, int *fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    struct cmsghdr header;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  ssize_t n;
+  int res;
+
+  *fd = -1;
+  if (!OpenROBO_Shm_canPassDescriptor(sock)) {
+    return OpenROBO_Socket_recvString(sock, offer, offerSize);
+  }
+  // ディスクリプタは最初のbyteに付いてくるので、最初の1byteだけrecvmsg()で読む
+  res = OpenROBO_Socket_waitRecvable(sock, NULL);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = offer;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  do {
+    n = recvmsg(OpenROBO_SocketCom_getDescriptor(sock), &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n == 0) {
+    return OpenROBO_Return_Disconnected;
+  }
+  if (n < 0) {
+    return OpenROBO_Return_Error;
+  }
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+      memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+  }
+  if (offer[0] == '\0') {
+    return OpenROBO_Return_Success;
+  }
+  return OpenROBO_Socket_recvString(sock, &offer[1], offerSize-1);
+}
+
+/*
+   接続した側: 最初のメッセージの後で共有メモリを作って相手に渡す
+   AF_UNIXの接続ではmemfdのディスクリプタを渡し、それ以外はOPENROBO_SHM_DIRのファイルの名前を渡す
+   相手が受け付けなかった場合は*shmをNULLのまま返し、socketをそのまま使う
+*/
+static int OpenROBO_Shm_offer(SocketCom *sock, OpenROBO_shm_t **shm)
+{
+  static volatile long counter = 0;
+  char path[OPENROBO_SHM_OFFER_SIZE - sizeof(" 0123456789abcdef")] = "";
+  char offer[OPENROBO_SHM_OFFER_SIZE] = "";
+  char reply[2] = "";
+  size_t mapSize = OpenROBO_Shm_mapSize(OPENROBO_SHM_RING_SIZE);
+  void *map = MAP_FAILED;
+  int passDescriptor = OpenROBO_Shm_canPassDescriptor(sock);
+  int fd = -1, res;
+  OpenROBO_shm_t *p = (OpenROBO_shm_t *)OpenROBO_malloc(sizeof(OpenROBO_shm_t));
+
+  *shm = NULL;
+  if (p != NULL) {
+    if (passDescriptor) {
+#if defined(MFD_CLOEXEC)
+      fd = memfd_create("openrobo", MFD_CLOEXEC);
+#endif
+    } else {
+      snprintf(path, sizeof(path), "%s/openrobo-%ld-%ld", OPENROBO_SHM_DIR, (long)getpid(), OpenROBO_Atomic_increment(&counter));
+      fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+      if (fd < 0) {
+        path[0] = '\0';
+      }
+    }
+  }
+  if (fd >= 0) {
+    if (ftruncate(fd, (off_t)mapSize) == 0) {
+      map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED || !passDescriptor) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (map != MAP_FAILED) {
+    OpenROBO_shmHeader_t *header = (OpenROBO_shmHeader_t *)map;
+    header->magic = OPENROBO_SHM_MAGIC;
+    header->ringSize = OPENROBO_SHM_RING_SIZE;
+    header->nonce = OpenROBO_Shm_makeNonce(map);
+    header->rings[0].waiting = 1;
+    header->rings[1].waiting = 1;
+    if (passDescriptor) {
+      strcpy(offer, "memfd");
+    } else {
+      snprintf(offer, sizeof(offer), "%s %llx", path, (unsigned long long)header->nonce);
+    }
+  }
+
+  res = OpenROBO_Shm_sendOffer(sock, offer, fd);
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (res == OpenROBO_Return_Success && map != MAP_FAILED) {
+    res = OpenROBO_Socket_recvString(sock, reply, sizeof(reply));
+  }
+  if (path[0] != '\0') {
+    unlink(path); // 相手がmmapし終えたので名前は要らない
+  }
+  if (map != MAP_FAILED) {
+    if (res == OpenROBO_Return_Success && strcmp(reply, "1") == 0) {
+      OpenROBO_Shm_attach(p, map, mapSize, 0);
+      *shm = p;
+      return OpenROBO_Return_Success;
+    }
+    munmap(map, mapSize);
+  }
+  OpenROBO_free(p);
+
+  return res;
+}
+
+/*
+   受け付けた側: 最初のメッセージの後に届く共有メモリの申し出に答える
+*/
+static int OpenROBO_Shm_accept(SocketCom *sock, OpenROBO_shm_t **shm)
+{
+  static const char prefix[] = OPENROBO_SHM_DIR "/openrobo-";
+  char offer[OPENROBO_SHM_OFFER_SIZE];
+  const char *reply = "0";
+  char *separator;
+  struct stat st;
+  size_t mapSize = 0;
+  void *map = MAP_FAILED;
+  uint64_t nonce = 0;
+  int checkNonce = 0;
+  int fd, res;
+  OpenROBO_shm_t *p;
+
+  *shm = NULL;
+  res = OpenROBO_Shm_recvOffer(sock, offer, sizeof(offer), &fd);
+  if (res != OpenROBO_Return_Success || offer[0] == '\0') {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return res;
+  }
+
+  p = (OpenROBO_shm_t *)OpenROBO_malloc(sizeof(OpenROBO_shm_t));
+  separator = strrchr(offer, ' ');
+  if (fd >= 0) {
+    if (strcmp(offer, "memfd") != 0) {
+      close(fd);
+      fd = -1;
+    }
+  } else if (separator != NULL && strncmp(offer, prefix, sizeof(prefix)-1) == 0 && strchr(&offer[sizeof(prefix)-1], '/') == NULL) {
+    // OPENROBO_SHM_DIRの下のOpenROBOのファイル以外は開かない
+    nonce = strtoull(separator+1, NULL, 16);
+    checkNonce = 1;
+    *separator = '\0';
+    fd = open(offer, O_RDWR | O_CLOEXEC | O_NOFOLLOW);
+  }
+  if (fd >= 0) {
+    if (p != NULL && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size > sizeof(OpenROBO_shmHeader_t)) {
+      mapSize = (size_t)st.st_size;
+      map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+  }
+  if (map != MAP_FAILED) {
+    const OpenROBO_shmHeader_t *header = (const OpenROBO_shmHeader_t *)map;
+    if (header->magic == OPENROBO_SHM_MAGIC && (!checkNonce || header->nonce == nonce) && header->ringSize > 0 && OpenROBO_Shm_mapSize(header->ringSize) == mapSize) {
+      reply = "1";
+    } else {
+      munmap(map, mapSize);
+      map = MAP_FAILED;
+    }
+  }
+
+  res = SocketCom_Send(sock, reply, strlen(reply)+1) == SOCKETCOM_SUCCESS ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+  if (res == OpenROBO_Return_Success && map != MAP_FAILED) {
+    OpenROBO_Shm_attach(p, map, mapSize, 1);
+    *shm = p;
+    return OpenROBO_Return_Success;
+  }
+  if (map != MAP_FAILED) {
+    munmap(map, mapSize);
+  }
+  OpenROBO_free(p);
+
+  return res;
+}
+
+#else
+
+struct _OpenROBO_shm {
+  int unused;
+};
+
+static void OpenROBO_Shm_close(OpenROBO_shm_t *shm) { (void)shm; }
+static size_t OpenROBO_Shm_pending(OpenROBO_shm_t *shm) { (void)shm; return 0; }
+static void OpenROBO_Shm_peek(OpenROBO_shm_t *shm, char *c) { (void)shm; *c = '\0'; }
+static int OpenROBO_Shm_sendv(OpenROBO_shm_t *shm, SocketCom *sock, const OpenROBO_iovec_t *iov, int iovcnt) { (void)shm; (void)sock; (void)iov; (void)iovcnt; return OpenROBO_Return_Error; }
+static int OpenROBO_Shm_recvAll(OpenROBO_shm_t *shm, SocketCom *sock, void *buf, size_t size) { (void)shm; (void)sock; (void)buf; (void)size; return OpenROBO_Return_Error; }
+static int OpenROBO_Shm_poll(OpenROBO_shm_t *shm, SocketCom *sock) { (void)shm; (void)sock; return OpenROBO_Return_Error; }
+static int OpenROBO_Shm_rearm(OpenROBO_shm_t *shm) { (void)shm; return 0; }
+static int OpenROBO_Shm_offer(SocketCom *sock, OpenROBO_shm_t **shm) { (void)sock; *shm = NULL; return OpenROBO_Return_Success; }
+static int OpenROBO_Shm_accept(SocketCom *sock, OpenROBO_shm_t **shm) { (void)sock; *shm = NULL; return OpenROBO_Return_Success; }
+
+#endif
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Socket
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+/*
+   受信の期限があれば、メッセージの先頭が届くまで期限まで待つ
+   メッセージの途中で期限が来てストリームがずれないように、期限を見るのは先頭を待つときだけにする
+   @retval OpenROBO_Return_Timeout 期限までに届かなかった
+*/
+static int OpenROBO_Socket_waitRecvable(SocketCom* sock, OpenROBO_shm_t* shm)
+{
+  double deadline = OpenROBO_Socket_recvDeadline;
+
+  if (deadline <= 0.0) {
+    return OpenROBO_Return_Success;
+  }
+  while (1) {
+    int waitMsec;
+    if (shm != NULL && OpenROBO_Shm_rearm(shm)) {
+      return OpenROBO_Return_Success;
+    }
+    waitMsec = OpenROBO_Deadline_remainingMsec(deadline);
+#if OPENROBO_ASYNC_POLL_ENABLE
+    struct pollfd pfd;
+    int n, res;
+    pfd.fd = OpenROBO_SocketCom_getDescriptor(sock);
+    pfd.events = POLLIN;
+    do {
+      n = poll(&pfd, 1, waitMsec);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      return OpenROBO_Return_Error;
+    }
+    if (n == 0) {
+      if (waitMsec == 0) {
+        return OpenROBO_Return_Timeout;
+      }
+      continue;
+    }
+    if (shm == NULL) {
+      return OpenROBO_Return_Success;
+    }
+    // 共有メモリではdoorbellを読み捨て、リングにデータがあるかを見る
+    res = OpenROBO_Shm_poll(shm, sock);
+    if (res != OpenROBO_Return_NotUpdated) {
+      return res;
+    }
+#else
+    if (shm != NULL ? OpenROBO_Shm_pending(shm) > 0 : SocketCom_IsRecvable(sock)) {
+      return OpenROBO_Return_Success;
+    }
+    if (waitMsec == 0) {
+      return OpenROBO_Return_Timeout;
+    }
+    if (waitMsec > OPENROBO_ASYNC_SLICE_MSEC) {
+      waitMsec = OPENROBO_ASYNC_SLICE_MSEC;
+    }
+#if defined(_OPENROBO_WIN32_)
+    Sleep((DWORD)waitMsec);
+#else
+    usleep((useconds_t)waitMsec * 1000);
+#endif
+#endif
+  }
+}
+
+/*
+   shmがNULLでない場合は共有メモリのリングから受信する
+*/
+static int OpenROBO_Socket_recvAll(SocketCom* sock, OpenROBO_shm_t* shm, void *buf, size_t size)
+{
+  int res;
+  if (shm != NULL) {
+    return OpenROBO_Shm_recvAll(shm, sock, buf, size);
+  }
+  res = SocketCom_RecvAll(sock, buf, size);
+  if (res != SOCKETCOM_SUCCESS) { //error
+    if (res == SOCKETCOM_ERROR_DISCONNECTED) {
+      return OpenROBO_Return_Disconnected;
+    }
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   メッセージの前に置かれたサイズ情報を受信する。
+   サイズ情報の前に終了要求('\0')が来ている場合は読み飛ばしてOpenROBO_Thread_workingFlagを落とす。
+*/
+static int OpenROBO_Socket_recvPrefix(SocketCom* sock, OpenROBO_shm_t* shm, char *prefix, size_t prefixSize)
+{
+  int res;
+  // 受信の期限があれば、終了要求の後も期限まで待てるように先頭の1byteだけを先に読む
+  size_t head = OpenROBO_Socket_recvDeadline > 0.0 ? 1 : prefixSize;
+
+  res = OpenROBO_Socket_recvAll(sock, shm, prefix, head);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  while (prefix[0] == '\0') {
+    OpenROBO_Thread_workingFlag = 0;
+    memmove(&prefix[0], &prefix[1], head-1);
+    if (head == 1) {
+      res = OpenROBO_Socket_waitRecvable(sock, shm);
+      if (res != OpenROBO_Return_Success) {
+        return res;
+      }
+    }
+    res = OpenROBO_Socket_recvAll(sock, shm, &prefix[head-1], 1);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+  }
+  if (head < prefixSize) {
+    res = OpenROBO_Socket_recvAll(sock, shm, &prefix[head], prefixSize - head);
+  }
+  return res;
+}
+
+static uint32_t OpenROBO_Socket_getUint32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void OpenROBO_Socket_putUint32(uint8_t *p, uint32_t value)
+{
+  p[0] = (uint8_t)(value);
+  p[1] = (uint8_t)(value >> 8);
+  p[2] = (uint8_t)(value >> 16);
+  p[3] = (uint8_t)(value >> 24);
+}
+
+/*
+   frameの境界がわからなくなった接続を切断する
+   sockListは呼び出し側が使っているので削除せず、ソケットをshutdownして以降の送受信をOpenROBO_Return_Disconnectedにする
+*/
+static int OpenROBO_Socket_protocolError(SocketCom* sock)
+{
+#if defined(_OPENROBO_POSIX_)
+  shutdown(OpenROBO_SocketCom_getDescriptor(sock), SHUT_RDWR);
+#else
+  (void)sock;
+#endif
+  return OpenROBO_Return_Disconnected;
+}
+
+/*
+   binary frameのheaderを受信する。
+   flags/channelIDがNULLの場合はchannelのframeをエラーとする(carrier以外の接続)
+   routing headerはrouteに入れる(routeがNULLの場合は読み捨てる)
+   headerが不正な場合は以降のframeの境界がわからないので、接続を切ってOpenROBO_Return_Disconnectedを返す
+*/
+static int OpenROBO_Socket_recvFrameHeader(SocketCom* sock, OpenROBO_shm_t* shm, size_t *size, uint8_t *flags, uint32_t *channelID, OpenROBO_route_t *route)
+{
+  int res;
+  uint8_t header[OPENROBO_FRAME_MAX_HEADER_SIZE];
+
+  res = OpenROBO_Socket_recvPrefix(sock, shm, (char *)header, OPENROBO_FRAME_HEADER_SIZE);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  if (header[0] != OPENROBO_FRAME_MAGIC) {
+    DBGPRINTF("warning: invalid frame magic 0x%02x\n", (unsigned int)header[0]);
+    return OpenROBO_Socket_protocolError(sock);
+  }
+  *size = OpenROBO_Socket_getUint32(&header[4]);
+
+  if (header[2] & OPENROBO_FRAME_FLAG_CHANNEL) {
+    if (flags == NULL) {
+      DBGPRINTF("warning: unexpected channel frame\n");
+      return OpenROBO_Socket_protocolError(sock);
+    }
+    res = OpenROBO_Socket_recvAll(sock, shm, &header[OPENROBO_FRAME_HEADER_SIZE], OPENROBO_FRAME_CHANNEL_ID_SIZE);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    *channelID = OpenROBO_Socket_getUint32(&header[OPENROBO_FRAME_HEADER_SIZE]);
+  }
+  if (route != NULL) {
+    route->type = -1;
+    route->sourceSID = OPENROBO_SID_NONE;
+    route->destinationSID = OPENROBO_SID_NONE;
+  }
+  if (header[2] & OPENROBO_FRAME_FLAG_ROUTE) {
+    uint8_t *p = &header[OPENROBO_FRAME_CHANNEL_HEADER_SIZE];
+    size_t routeSize = (header[2] & OPENROBO_FRAME_FLAG_SID) ? OPENROBO_FRAME_ROUTE_SIZE + OPENROBO_FRAME_SID_SIZE : OPENROBO_FRAME_ROUTE_SIZE;
+    int i;
+    res = OpenROBO_Socket_recvAll(sock, shm, p, routeSize);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    if (route != NULL && (header[2] & OPENROBO_FRAME_FLAG_SID)) {
+      route->sourceSID = (uint16_t)(p[OPENROBO_FRAME_ROUTE_SIZE] | (p[OPENROBO_FRAME_ROUTE_SIZE+1] << 8));
+      route->destinationSID = (uint16_t)(p[OPENROBO_FRAME_ROUTE_SIZE+2] | (p[OPENROBO_FRAME_ROUTE_SIZE+3] << 8));
+    }
+    if (route != NULL && header[1] != OPENROBO_FRAME_TYPE_UNKNOWN) {
+      route->type = header[1];
+      route->size = *size;
+      for (i = 0; i < OPENROBO_FRAME_ROUTE_FIELDS; i++) {
+        route->offset[i] = OpenROBO_Socket_getUint32(&p[i*4]);
+        if (route->offset[i] != OPENROBO_FRAME_ROUTE_NONE && route->offset[i] >= *size) {
+          DBGPRINTF("warning: route offset %u out of frame size %lu\n", (unsigned int)route->offset[i], (unsigned long)*size);
+          route->type = -1;
+          return OpenROBO_Socket_protocolError(sock);
+        }
+      }
+    }
+  }
+  if (flags != NULL) {
+    *flags = header[2];
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   受信したメッセージ本体(終端の'\0'まで)を確認する
+*/
+static int OpenROBO_Socket_checkBody(char *str, size_t size)
+{
+  if (str[size-1] != '\0') { //check //TODO is need?
+    str[0] = '\0';
+    return OpenROBO_Return_Error;
+  }
+  // binaryのパラメータの長さがframeに収まっているか確認する(以降はパラメータを辿っても範囲外を読まない)
+  if (OpenROBO_Message_measure(str, size-1, NULL) != size-1) {
+    str[0] = '\0';
+    return OpenROBO_Return_Error;
+  }
+
+  TRACE_PRINTF("<<< [ <%s> has received \"", OpenROBO_isMainThread ? "MainThread" : OpenROBO_threadID);
+  TRACE_MESSAGE(str, size);
+  TRACE_PRINTF("\" ] <<<");
+  TRACE_END();
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   メッセージ本体(終端の'\0'まで)を受信して確認する
+*/
+static int OpenROBO_Socket_recvBody(SocketCom* sock, OpenROBO_shm_t* shm, char *str, size_t size)
+{
+  int res = OpenROBO_Socket_recvAll(sock, shm, str, size);
+  if (res != OpenROBO_Return_Success) {
+    str[0] = '\0';
+    return res;
+  }
+  return OpenROBO_Socket_checkBody(str, size);
+}
+
+/*
+   処理しないframeの本体を読み捨てて、後に続くframeの位置に合わせる
+*/
+static int OpenROBO_Socket_skipBody(SocketCom* sock, OpenROBO_shm_t* shm, size_t size)
+{
+  char buffer[256];
+  while (size > 0) {
+    size_t n = size < sizeof(buffer) ? size : sizeof(buffer);
+    int res = OpenROBO_Socket_recvAll(sock, shm, buffer, n);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    size -= n;
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   共通バッファにsizeのメッセージが入るようにする
+*/
+static int OpenROBO_Socket_reserveCommonBuffer(size_t size)
+{
+  if (size > OpenROBO_Message_commonBuffer.size) {
+    OpenROBO_Message_commonBuffer.p[0] = '\0';
+    return OpenROBO_Message_buffer_realloc(&OpenROBO_Message_commonBuffer, size);
+  }
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Socket_recvMessage(OpenROBO_sockList_t* s, char **message)
+{
+  int res;
+  size_t size;
+  SocketCom *sock = &s->sock;
+
+  res = OpenROBO_Socket_waitRecvable(sock, s->shm);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  if (s->framing == OpenROBO_Framing_Binary) {
+    res = OpenROBO_Socket_recvFrameHeader(sock, s->shm, &size, NULL, NULL, &OpenROBO_receivedRoute);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+  } else {
+    char sizeStr[OPENROBO_MESSAGE_SIZE_STR_SIZE];
+    res = OpenROBO_Socket_recvPrefix(sock, s->shm, sizeStr, sizeof(sizeStr));
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    sscanf(sizeStr, "%lx", &size);
+  }
+  if (size == 0) {
+    return OpenROBO_Return_Error;
+  }
+
+  res = OpenROBO_Socket_reserveCommonBuffer(size);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+
+  res = OpenROBO_Socket_recvBody(sock, s->shm, OpenROBO_Message_commonBuffer.p, size);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+
+  *message = OpenROBO_Message_commonBuffer.p;
+  return OpenROBO_Return_Success;
+}
+
+/*
+   carrierからメッセージを受信して、channelを*sに返す。
+   channelの開始と終了のframeはここで処理してOpenROBO_Return_NotUpdatedを返す
+   相手から届いた不正なframeは本体を読み捨ててOpenROBO_Return_NotUpdatedを返し、他のchannelのframeとずれないようにする
+   読み捨てられない(frameの境界がわからなくなった)場合はOpenROBO_Return_Disconnectedを返してcarrierごと切断させる
+*/
+static int OpenROBO_Socket_recvCarrierMessage(OpenROBO_sockList_t* carrier, OpenROBO_sockList_t** s, char **message)
+{
+  int res;
+  size_t size;
+  uint8_t flags = 0;
+  uint32_t channelID = 0;
+  OpenROBO_sockList_t *ch;
+  SocketCom *sock = &carrier->sock;
+
+  res = OpenROBO_Socket_recvFrameHeader(sock, carrier->shm, &size, &flags, &channelID, &OpenROBO_receivedRoute);
+  if (res != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Disconnected;
+  }
+  if (!(flags & OPENROBO_FRAME_FLAG_CHANNEL)) {
+    DBGPRINTF("warning: frame without channel from <%s>\n", carrier->id);
+    res = OpenROBO_Socket_skipBody(sock, carrier->shm, size);
+    return res == OpenROBO_Return_Success ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Disconnected;
+  }
+
+  ch = OpenROBO_sockList_findChannel(carrier, channelID);
+  if (flags & OPENROBO_FRAME_FLAG_OPEN) {
+    char threadID[OPENROBO_THREAD_ID_SIZE];
+    if (ch != NULL || size == 0 || size > sizeof(threadID)) {
+      DBGPRINTF("warning: invalid channel open %u from <%s>\n", (unsigned int)channelID, carrier->id);
+      res = OpenROBO_Socket_skipBody(sock, carrier->shm, size);
+      return res == OpenROBO_Return_Success ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Disconnected;
+    }
+    res = OpenROBO_Socket_recvAll(sock, carrier->shm, threadID, size);
+    if (res != OpenROBO_Return_Success) {
+      return OpenROBO_Return_Disconnected;
+    }
+    if (threadID[size-1] != '\0') {
+      DBGPRINTF("warning: invalid channel open %u from <%s>\n", (unsigned int)channelID, carrier->id);
+      return OpenROBO_Return_NotUpdated;
+    }
+    ch = OpenROBO_sockList_createNew();
+    if (ch == NULL) {
+      // 開けなかったchannelのframeは届いても読み捨てる
+      return OpenROBO_Return_NotUpdated;
+    }
+    ch->carrier = carrier;
+    ch->channelID = channelID;
+    ch->framing = OpenROBO_Framing_Binary;
+    OpenROBO_sockList_registerSocket(ch);
+    OpenROBO_sockList_bindID(ch, threadID);
+    ch->paramEncoding = OpenROBO_negotiateParamEncoding(OpenROBO_findSubsystemInfoByThreadID(ch->id));
+    OpenROBO_sockList_negotiateRouting(ch, OpenROBO_findSubsystemInfoByThreadID(ch->id));
+    return OpenROBO_Return_NotUpdated;
+  }
+  if (ch == NULL) {
+    DBGPRINTF("warning: frame for unknown channel %u from <%s>\n", (unsigned int)channelID, carrier->id);
+    res = OpenROBO_Socket_skipBody(sock, carrier->shm, size);
+    return res == OpenROBO_Return_Success ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Disconnected;
+  }
+  if (flags & OPENROBO_FRAME_FLAG_CLOSE) {
+    OpenROBO_sockList_delete(ch);
+    res = OpenROBO_Socket_skipBody(sock, carrier->shm, size);
+    return res == OpenROBO_Return_Success ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Disconnected;
+  }
+  if (size == 0) {
+    return OpenROBO_Return_NotUpdated;
+  }
+
+  res = OpenROBO_Socket_reserveCommonBuffer(size);
+  if (res != OpenROBO_Return_Success) {
+    res = OpenROBO_Socket_skipBody(sock, carrier->shm, size);
+    return res == OpenROBO_Return_Success ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Disconnected;
+  }
+  res = OpenROBO_Socket_recvAll(sock, carrier->shm, OpenROBO_Message_commonBuffer.p, size);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_Message_commonBuffer.p[0] = '\0';
+    return OpenROBO_Return_Disconnected;
+  }
+  if (OpenROBO_Socket_checkBody(OpenROBO_Message_commonBuffer.p, size) != OpenROBO_Return_Success) {
+    DBGPRINTF("warning: invalid message on channel %u from <%s>\n", (unsigned int)channelID, carrier->id);
+    return OpenROBO_Return_NotUpdated;
+  }
+
+  *s = ch;
+  *message = OpenROBO_Message_commonBuffer.p;
+  return OpenROBO_Return_Success;
+}
+
+/*
+   iovをまとめて1回のシステムコールで送信する(途中までしか送れなかった場合は残りを送る)
+   shmがNULLでない場合は共有メモリのリングに書く
+*/
+static int OpenROBO_Socket_sendv(SocketCom* sock, OpenROBO_shm_t* shm, OpenROBO_iovec_t *iov, int iovcnt)
+{
+#if defined(_OPENROBO_POSIX_)
+  struct msghdr msg;
+  int flags = 0;
+#ifdef MSG_NOSIGNAL
+  flags |= MSG_NOSIGNAL;
+#endif
+  if (shm != NULL) {
+    return OpenROBO_Shm_sendv(shm, sock, iov, iovcnt);
+  }
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = sendmsg(OpenROBO_SocketCom_getDescriptor(sock), &msg, flags);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return OpenROBO_Return_Error;
+    }
+    while (n > 0) {
+      if ((size_t)n >= msg.msg_iov->iov_len) {
+        n -= msg.msg_iov->iov_len;
+        msg.msg_iov++;
+        msg.msg_iovlen--;
+      } else {
+        msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+        msg.msg_iov->iov_len -= n;
+        n = 0;
+      }
+    }
+    while (msg.msg_iovlen > 0 && msg.msg_iov->iov_len == 0) {
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+  }
+#else
+  int i;
+  if (shm != NULL) {
+    return OpenROBO_Shm_sendv(shm, sock, iov, iovcnt);
+  }
+  for (i = 0; i < iovcnt; i++) {
+    if (SocketCom_Send(sock, iov[i].iov_base, iov[i].iov_len) != SOCKETCOM_SUCCESS) {
+      return OpenROBO_Return_Error;
+    }
+  }
+#endif
+
+  return OpenROBO_Return_Success;
+}
+
+static void OpenROBO_Socket_makeFrameHeader(uint8_t header[OPENROBO_FRAME_HEADER_SIZE], const char* message, uint8_t flags, size_t size)
+{
+  int type = message != NULL ? OpenROBO_Message_GetMessageType(message) : -1;
+  header[0] = OPENROBO_FRAME_MAGIC;
+  header[1] = type < 0 ? OPENROBO_FRAME_TYPE_UNKNOWN : (uint8_t)type;
+  header[2] = flags;
+  header[3] = 0;
+  OpenROBO_Socket_putUint32(&header[4], (uint32_t)size);
+}
+
+/*
+   パラメータがrouting headerのどの項目にあたるか(あたらなければ-1)
+*/
+static int OpenROBO_Route_field(const char *message, const OpenROBO_MessageViewEntry_t *entry)
+{
+  const char *name = &message[entry->nameOffset];
+  if (entry->nameSize == 8 && memcmp(name, OpenROBO_Message_paramName_subject, 8) == 0) {
+    return OpenROBO_Route_Subject;
+  } else if (entry->nameSize == 4 && memcmp(name, OpenROBO_Message_paramName_sourceID, 4) == 0) {
+    return OpenROBO_Route_SourceID;
+  } else if (entry->nameSize == 4 && memcmp(name, OpenROBO_Message_paramName_destinationID, 4) == 0) {
+    return OpenROBO_Route_DestinationID;
+  }
+  return -1;
+}
+
+/*
+   messageの後ろにsuffixを続けた本体のrouting headerを求める
+   3つとも見つかった所で辿るのをやめる
+*/
+static void OpenROBO_Route_make(OpenROBO_route_t *route, const char *message, size_t messageSize, const char *suffix, size_t suffixSize)
+{
+  const char *parts[2] = {message, suffix};
+  size_t partSizes[2] = {messageSize, suffixSize};
+  size_t base = 0;
+  int found = 0;
+  int i;
+
+  route->type = OpenROBO_Message_GetMessageType(message);
+  route->size = messageSize + suffixSize + 1;
+  route->sourceSID = OPENROBO_SID_NONE;
+  route->destinationSID = OPENROBO_SID_NONE;
+  for (i = 0; i < OPENROBO_FRAME_ROUTE_FIELDS; i++) {
+    route->offset[i] = OPENROBO_FRAME_ROUTE_NONE;
+  }
+  for (i = 0; i < 2 && found < OPENROBO_FRAME_ROUTE_FIELDS; i++) {
+    size_t pos = 0;
+    OpenROBO_MessageViewEntry_t entry;
+    if (parts[i] == NULL) {
+      continue;
+    }
+    while (found < OPENROBO_FRAME_ROUTE_FIELDS && OpenROBO_Message_nextParamWithin(parts[i], partSizes[i], &pos, &entry)) {
+      int field = OpenROBO_Route_field(parts[i], &entry);
+      if (field >= 0 && route->offset[field] == OPENROBO_FRAME_ROUTE_NONE) {
+        route->offset[field] = (uint32_t)(base + entry.nameOffset - 1);
+        found++;
+      }
+    }
+    base += partSizes[i];
+  }
+}
+
+/*
+   headerの後ろにrouting headerを書き、書いた長さを返す
+*/
+static size_t OpenROBO_Route_put(uint8_t *p, const OpenROBO_route_t *route, uint8_t flags)
+{
+  int i;
+  for (i = 0; i < OPENROBO_FRAME_ROUTE_FIELDS; i++) {
+    OpenROBO_Socket_putUint32(&p[i*4], route->offset[i]);
+  }
+  if (!(flags & OPENROBO_FRAME_FLAG_SID)) {
+    return OPENROBO_FRAME_ROUTE_SIZE;
+  }
+  p += OPENROBO_FRAME_ROUTE_SIZE;
+  p[0] = (uint8_t)route->sourceSID;
+  p[1] = (uint8_t)(route->sourceSID >> 8);
+  p[2] = (uint8_t)route->destinationSID;
+  p[3] = (uint8_t)(route->destinationSID >> 8);
+  return OPENROBO_FRAME_ROUTE_SIZE + OPENROBO_FRAME_SID_SIZE;
+}
+
+/*
+   channelの開始(threadIDをpayloadに入れる)、終了、終了要求のframeをcarrierに送る
+   (接続した側では呼び出し元がcarrierの送信のmutexを取る)
+*/
+static int OpenROBO_Socket_sendControlFrame(SocketCom* sock, OpenROBO_shm_t* shm, uint8_t flags, uint32_t channelID, const char* payload)
+{
+  uint8_t header[OPENROBO_FRAME_CHANNEL_HEADER_SIZE];
+  OpenROBO_iovec_t iov[2];
+  int iovcnt = 0;
+  size_t size = payload != NULL ? strlen(payload) + 1 : 0;
+
+  OpenROBO_Socket_makeFrameHeader(header, NULL, OPENROBO_FRAME_FLAG_CHANNEL | flags, size);
+  OpenROBO_Socket_putUint32(&header[OPENROBO_FRAME_HEADER_SIZE], channelID);
+  iov[iovcnt].iov_base = header;
+  iov[iovcnt].iov_len = sizeof(header);
+  iovcnt++;
+  if (payload != NULL) {
+    iov[iovcnt].iov_base = (void *)payload;
+    iov[iovcnt].iov_len = size;
+    iovcnt++;
+  }
+
+  return OpenROBO_Socket_sendv(sock, shm, iov, iovcnt);
+}
+
+/*
+   長さとbinaryのパラメータの有無を測り終えたメッセージを送る
+*/
+static int OpenROBO_Socket_sendMeasuredTo(OpenROBO_sockList_t *s, const char* message, size_t messageSize, int messageHasBinary, const char* suffix, size_t suffixSize, int suffixHasBinary)
+{
+  size_t totalSize;
+  char sizeStr[OPENROBO_MESSAGE_SIZE_STR_SIZE] = "";
+  uint8_t header[OPENROBO_FRAME_MAX_HEADER_SIZE];
+  uint8_t routeFlags = (uint8_t)s->routing;
+  char endOfMessage[1]= {'\0'};
+  SocketCom *sock = &s->sock;
+  OpenROBO_shm_t *shm = s->shm;
+  OpenROBO_Mutex_t *sendMutex = NULL;
+  OpenROBO_iovec_t iov[4];
+  int iovcnt = 0;
+  int res;
+  char *textMessage = NULL, *textSuffix = NULL;
+
+  // binaryのパラメータに対応していない相手にはtextに直して送る
+  if (s->paramEncoding != OpenROBO_ParamEncoding_Binary) {
+    if (messageHasBinary) {
+      textMessage = OpenROBO_Message_toText(message, messageSize, &messageSize);
+      if (textMessage == NULL) {
+        return OpenROBO_Return_Error;
+      }
+      message = textMessage;
+    }
+    if (suffixHasBinary) {
+      textSuffix = OpenROBO_Message_toText(suffix, suffixSize, &suffixSize);
+      if (textSuffix == NULL) {
+        OpenROBO_free(textMessage);
+        return OpenROBO_Return_Error;
+      }
+      suffix = textSuffix;
+    }
+  }
+  totalSize = messageSize + suffixSize + 1;
+  if (totalSize > UINT32_MAX) {
+    OpenROBO_free(textMessage);
+    OpenROBO_free(textSuffix);
+    return OpenROBO_Return_BufferOver;
+  }
+
+
+  TRACE_PRINTF(">>> [ <%s> will send \"", OpenROBO_isMainThread ? "MainThread" : OpenROBO_threadID);
+  TRACE_MESSAGE(message, messageSize);
+  if (suffix != NULL) {
+    TRACE_MESSAGE(suffix, suffixSize);
+  }
+  TRACE_PRINTF("\" ] >>>");
+  TRACE_END();
+
+  if (s->channel != NULL || s->carrier != NULL) {
+    uint32_t channelID;
+    if (s->channel != NULL) {
+      sock = OpenROBO_Channel_getSocket(s->channel, &sendMutex, &channelID, &shm);
+    } else {
+      sock = &s->carrier->sock;
+      shm = s->carrier->shm;
+      sendMutex = &s->carrier->sendMutex;
+      channelID = s->channelID;
+    }
+    OpenROBO_Socket_makeFrameHeader(header, message, OPENROBO_FRAME_FLAG_CHANNEL | routeFlags, totalSize);
+    OpenROBO_Socket_putUint32(&header[OPENROBO_FRAME_HEADER_SIZE], channelID);
+    iov[iovcnt].iov_base = header;
+    iov[iovcnt].iov_len = OPENROBO_FRAME_CHANNEL_HEADER_SIZE;
+  } else if (s->framing == OpenROBO_Framing_Binary) {
+    OpenROBO_Socket_makeFrameHeader(header, message, routeFlags, totalSize);
+    iov[iovcnt].iov_base = header;
+    iov[iovcnt].iov_len = OPENROBO_FRAME_HEADER_SIZE;
+    sendMutex = &s->sendMutex;
+  } else {
+    snprintf(sizeStr, sizeof(sizeStr), "%lx", totalSize);
+    iov[iovcnt].iov_base = sizeStr;
+    iov[iovcnt].iov_len = sizeof(sizeStr);
+    sendMutex = &s->sendMutex;
+    routeFlags = 0;
+  }
+  if (routeFlags & OPENROBO_FRAME_FLAG_ROUTE) {
+    OpenROBO_route_t route;
+    OpenROBO_Route_make(&route, message, messageSize, suffix, suffixSize);
+    if (routeFlags & OPENROBO_FRAME_FLAG_SID) {
+      route.sourceSID = OpenROBO_subsystemTable.infos[0].sid;
+      route.destinationSID = s->sid;
+    }
+    iov[iovcnt].iov_len += OpenROBO_Route_put((uint8_t *)iov[iovcnt].iov_base + iov[iovcnt].iov_len, &route, routeFlags);
+  }
+  iovcnt++;
+
+  iov[iovcnt].iov_base = (void *)message;
+  iov[iovcnt].iov_len = messageSize;
+  iovcnt++;
+  if (suffix != NULL) {
+    iov[iovcnt].iov_base = (void *)suffix;
+    iov[iovcnt].iov_len = suffixSize;
+    iovcnt++;
+  }
+  iov[iovcnt].iov_base = endOfMessage;
+  iov[iovcnt].iov_len = sizeof(endOfMessage);
+  iovcnt++;
+
+  if (sendMutex != NULL) {
+    OpenROBO_Mutex_lock(sendMutex);
+  }
+  res = OpenROBO_Socket_sendv(sock, shm, iov, iovcnt);
+  if (sendMutex != NULL) {
+    OpenROBO_Mutex_unlock(sendMutex);
+  }
+  OpenROBO_free(textMessage);
+  OpenROBO_free(textSuffix);
+  return res;
+}
+
+static int OpenROBO_Socket_sendMessageTo(OpenROBO_sockList_t *s, const char* message, const char* suffix)
+{
+  size_t messageSize;
+  size_t suffixSize = 0;
+  int messageHasBinary = 0, suffixHasBinary = 0;
+
+  messageSize = OpenROBO_Message_measure(message, SIZE_MAX, &messageHasBinary);
+  if (suffix != NULL) {
+    suffixSize = OpenROBO_Message_measure(suffix, SIZE_MAX, &suffixHasBinary);
+  }
+  return OpenROBO_Socket_sendMeasuredTo(s, message, messageSize, messageHasBinary, suffix, suffixSize, suffixHasBinary);
+}
+
+/*
+   送り先が処理できない種類のCommand Messageを送らない
+*/
+static int OpenROBO_Socket_canSendCommand(const char* destinationID, const char* message)
+{
+  int type = OpenROBO_Message_GetMessageType(message);
+  if (type == OpenROBO_MessageType_Subscribe) {
+    return OpenROBO_hasCapability(OpenROBO_findSubsystemInfoByThreadID(destinationID), OPENROBO_CAPABILITY_SUBSCRIBE);
+  }
+  if ((type == OpenROBO_MessageType_Read || type == OpenROBO_MessageType_Write) && OpenROBO_Message_isBatch(message)) {
+    return OpenROBO_hasCapability(OpenROBO_findSubsystemInfoByThreadID(destinationID), OPENROBO_CAPABILITY_BATCH);
+  }
+  return 1;
+}
+
+static int OpenROBO_Socket_sendMessage(const char* destinationID, const char* message, const char* suffix)
+{
+  OpenROBO_sockList_t *s = OpenROBO_sockList_findByID(destinationID);
+  if (s == NULL) { //not connected
+    if (OpenROBO_isMainThread) {
+      return OpenROBO_Return_Error;
+    }
+    s = OpenROBO_sockList_connect(destinationID);
+    if (s == NULL) {
+      return OpenROBO_Return_Error;
+    }
+  }
+
+  return OpenROBO_Socket_sendMessageTo(s, message, suffix);
+}
+
+/*
+   接続のsに送るCommand Messageの"#seq"を決めてsuffixに付ける(相手が返答に付けて返さない場合は0)
+*/
+static uint32_t OpenROBO_Socket_nextSeq(OpenROBO_sockList_t *s, OpenROBO_MessageBuilder_t *suffix)
+{
+  if (++s->seq == 0) {
+    s->seq = 1;
+  }
+  // 十分古くなった期限切れの"#seq"は、一周して新しい返答を捨てないように忘れる
+  if (s->staleSeq != 0 && s->seq - s->staleSeq >= 0x40000000u) {
+    s->staleSeq = 0;
+  }
+  if (!s->seqEnabled) {
+    return 0;
+  }
+  if (OpenROBO_Message_setSeq(suffix, s->seq) != OpenROBO_Return_Success) {
+    return 0;
+  }
+  return s->seq;
+}
+
+/*
+   sにCommand Messageを送ったので、返答を待っている数を増やす
+*/
+static void OpenROBO_Socket_sentCommand(OpenROBO_sockList_t *s)
+{
+  s->pending++;
+  if (s->localFence == OpenROBO_LocalFence_Sent) {
+    s->localFence = OpenROBO_LocalFence_Followed;
+  }
+}
+
+/*
+   "#src"と"#dst"を付けたCommand Messageに"#seq"を付けて送る
+   @param[out] seq 付けた"#seq"(付けなかった場合は0)
+*/
+static int OpenROBO_Socket_sendCommand(const char* destinationID, const char* message, uint32_t *seq)
+{
+  char suffixBuffer[32];
+  OpenROBO_MessageBuilder_t suffix;
+  int res;
+  OpenROBO_sockList_t *s = OpenROBO_sockList_findByID(destinationID);
+  if (s == NULL) { //not connected
+    s = OpenROBO_sockList_connect(destinationID);
+    if (s == NULL) {
+      return OpenROBO_Return_Error;
+    }
+  }
+
+  if (OpenROBO_Message_GetMessageType(message) == OpenROBO_MessageType_Subscribe) {
+    // 以後この接続に届くメッセージは購読の値か調べる
+    s->subscribed = 1;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+  *seq = OpenROBO_Socket_nextSeq(s, &suffix);
+  res = OpenROBO_Socket_sendMessageTo(s, message, suffix.size > 0 ? suffix.p : NULL);
+  if (res == OpenROBO_Return_Success) {
+    OpenROBO_Socket_sentCommand(s);
+  }
+  OpenROBO_MessageBuilder_Term(&suffix);
+  return res;
+}
+
+static int OpenROBO_Socket_sendCommandMessage(const char* destinationID, char* message, uint32_t *seq)
+{
+  if (OpenROBO_isMainThread || !OpenROBO_Socket_canSendCommand(destinationID, message)) {
+    return OpenROBO_Return_Error;
+  }
+
+  OpenROBO_Message_setSourceID(message, OpenROBO_threadID);
+  OpenROBO_Message_setDestinationID(message, destinationID);
+
+  return OpenROBO_Socket_sendCommand(destinationID, message, seq);
+}
+
+static int OpenROBO_Socket_sendCommandMessage(const char* destinationID, OpenROBO_MessageBuilder_t *builder, uint32_t *seq)
+{
+  if (OpenROBO_isMainThread || !OpenROBO_Socket_canSendCommand(destinationID, builder->p)) {
+    return OpenROBO_Return_Error;
+  }
+
+  if (OpenROBO_Message_setSourceID(builder, OpenROBO_threadID) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_Message_setDestinationID(builder, destinationID) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+
+  return OpenROBO_Socket_sendCommand(destinationID, builder->p, seq);
+}
+
+int OpenROBO_Socket_SendCommandMessage(const char* destinationID, char* message)
+{
+  uint32_t seq;
+  return OpenROBO_Socket_sendCommandMessage(destinationID, message, &seq);
+}
+
+int OpenROBO_Socket_SendCommandMessage(const char* destinationID, OpenROBO_MessageBuilder_t *builder)
+{
+  uint32_t seq;
+  return OpenROBO_Socket_sendCommandMessage(destinationID, builder, &seq);
+}
+
+/*
+   sourceHandleは元のメッセージの"#src"のhandle、sourceIDはその文字列、seqは元のメッセージの"#seq"
+   handleで見つからなければthreadIDの文字列で探し、それでも接続していなければ(メインスレッドからは接続しない)
+   返答を捨てる。送れなかった場合も捨てて、メインスレッドの受信を続けられるようにOpenROBO_Return_Successを返す
+*/
+static int OpenROBO_Socket_forwardReturnMessage(uint32_t sourceHandle, const char *sourceID, size_t sourceIDSize, const char *returnMessage, uint32_t seq)
+{
+  char suffixBuffer[32];
+  OpenROBO_MessageBuilder_t suffix;
+  OpenROBO_sockList_t *s;
+  int res;
+  if (!OpenROBO_isMainThread) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+
+  s = OpenROBO_sockList_findByHandle(sourceHandle);
+  if (s == NULL && sourceID != NULL && sourceIDSize < OPENROBO_THREAD_ID_SIZE) {
+    char threadID[OPENROBO_THREAD_ID_SIZE];
+    memcpy(threadID, sourceID, sourceIDSize);
+    threadID[sourceIDSize] = '\0';
+    s = OpenROBO_sockList_findByID(threadID);
+  }
+  if (s == NULL) {
+    DBGPRINTF("warning: drop return message for <%.*s> (not connected)\n", sourceID != NULL ? (int)sourceIDSize : 0, sourceID != NULL ? sourceID : "");
+    return OpenROBO_Return_Success;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+  OpenROBO_Message_setSeq(&suffix, seq);
+  res = OpenROBO_Socket_sendMessageTo(s, returnMessage, suffix.size > 0 ? suffix.p : NULL);
+  OpenROBO_MessageBuilder_Term(&suffix);
+  if (res != OpenROBO_Return_Success) {
+    // 送れなかった返答は捨てる(切断は次の受信で検知する)
+    DBGPRINTF("warning: failed to forward return message to <%s>\n", s->id);
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   返答を照合するための"#seq"を付ける(0は付けない)
+   intに変換せずに符号なしの10進数の文字列として付ける
+*/
+static int OpenROBO_Message_setSeq(OpenROBO_MessageBuilder_t *builder, uint32_t seq)
+{
+  char value[16];
+  if (seq == 0) {
+    return OpenROBO_Return_Success;
+  }
+  snprintf(value, sizeof(value), "%lu", (unsigned long)seq);
+  return OpenROBO_Message_SetParam_string(builder, OpenROBO_Message_paramName_seq, value);
+}
+
+/*
+   メッセージの"#seq"(なければ0。32bitの符号なし整数でなければ0)
+*/
+static uint32_t OpenROBO_MessageView_getSeq(const OpenROBO_MessageView_t *view)
+{
+  const char *value;
+  size_t size, i;
+  uint64_t seq = 0;
+  if (OpenROBO_MessageView_GetString(view, OpenROBO_Message_paramName_seq, &value, &size) != OpenROBO_Return_Success || size == 0) {
+    return 0;
+  }
+  for (i = 0; i < size; i++) {
+    if (value[i] < '0' || value[i] > '9') {
+      return 0;
+    }
+    seq = seq * 10 + (uint64_t)(value[i] - '0');
+    if (seq > UINT32_MAX) {
+      return 0;
+    }
+  }
+  return (uint32_t)seq;
+}
+
+/*
+   システムが返す返答に付ける送信元・宛先・subjectと、元のメッセージの"#seq"
+*/
+static int OpenROBO_Message_makeSystemReturnInfo(OpenROBO_MessageBuilder_t *info, const char *sourceID, const char *destinationID, const char *subject, uint32_t seq)
+{
+  if (OpenROBO_Message_setSourceID(info, sourceID) != OpenROBO_Return_Success ||
+      OpenROBO_Message_setDestinationID(info, destinationID) != OpenROBO_Return_Success ||
+      OpenROBO_Message_SetSubject(info, subject) != OpenROBO_Return_Success ||
+      OpenROBO_Message_setSeq(info, seq) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Return_Success;
+}
+
+/*
+   オペレーションスレッドから自身のメインスレッドへ返答を送る
+   終了要求を受けるための接続は作るが、返答はOpenROBO_localに入れる
+   接続に返答を待っているCommand Messageや読まれたか確かめられていない返答がある場合は、
+   OpenROBO_localに入れるとそれらを追い越すので接続に送る
+*/
+static int OpenROBO_Socket_sendToMainThread(const char* message, const char* suffix)
+{
+#if OPENROBO_LOCAL_ENABLE
+  if (OpenROBO_local.fd >= 0) {
+    int res;
+    OpenROBO_sockList_t *s = OpenROBO_sockList_findByID(OpenROBO_selfSubsystemName);
+    if (s == NULL) {
+      s = OpenROBO_sockList_connect(OpenROBO_selfSubsystemName);
+      if (s == NULL) {
+        return OpenROBO_Return_Error;
+      }
+    }
+    if (s->pending == 0 && s->localFence == OpenROBO_LocalFence_None) {
+      return OpenROBO_Local_send(message, suffix);
+    }
+    res = OpenROBO_Socket_sendMessageTo(s, message, suffix);
+    if (res == OpenROBO_Return_Success) {
+      s->localFence = OpenROBO_LocalFence_Sent;
+    }
+    return res;
+  }
+#endif
+  return OpenROBO_Socket_sendMessage(OpenROBO_selfSubsystemName, message, suffix);
+}
+
+static int OpenROBO_Socket_sendReturnMessageBySystem(const OpenROBO_MessageView_t* originalView, const char *returnMessage)
+{
+  int res;
+  char additionalMessageBuffer[1024];
+  OpenROBO_MessageBuilder_t additionalMessage;
+  char functionName[OPENROBO_FUNCTION_NAME_SIZE];
+  char originalSourceID[OPENROBO_THREAD_ID_SIZE];
+  if (OpenROBO_MessageView_CopyString(originalView, OpenROBO_Message_paramName_sourceID, originalSourceID, sizeof(originalSourceID)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_MessageView_CopyString(originalView, OpenROBO_Message_paramName_subject, functionName, sizeof(functionName)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&additionalMessage, additionalMessageBuffer, sizeof(additionalMessageBuffer));
+  // オペレーションスレッドからの返答はメインスレッドがStart/Wait Messageの"#seq"を付けて転送する
+  if (OpenROBO_Message_makeSystemReturnInfo(&additionalMessage, OpenROBO_threadID, originalSourceID, functionName, OpenROBO_isMainThread ? OpenROBO_MessageView_getSeq(originalView) : 0) != OpenROBO_Return_Success) {
+    OpenROBO_MessageBuilder_Term(&additionalMessage);
+    return OpenROBO_Return_Error;
+  }
+
+  if (OpenROBO_isMainThread) {
+    res = OpenROBO_Socket_sendMessage(originalSourceID, returnMessage, additionalMessage.p);
+  } else {
+    res = OpenROBO_Socket_sendToMainThread(returnMessage, additionalMessage.p);
+  }
+  OpenROBO_MessageBuilder_Term(&additionalMessage);
+  return res;
+}
+
+int OpenROBO_Socket_SendReturnMessage(const char *returnMessage)
+{
+  if (OpenROBO_isMainThread) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+  int res;
+  char additionalMessageBuffer[1024];
+  OpenROBO_MessageBuilder_t additionalMessage;
+
+  OpenROBO_MessageBuilder_InitWithBuffer(&additionalMessage, additionalMessageBuffer, sizeof(additionalMessageBuffer));
+  if (OpenROBO_Message_setSourceID(&additionalMessage, OpenROBO_threadID) != OpenROBO_Return_Success) {
+    OpenROBO_MessageBuilder_Term(&additionalMessage);
+    return OpenROBO_Return_Error;
+  }
+
+  res = OpenROBO_Socket_sendToMainThread(returnMessage, additionalMessage.p);
+  OpenROBO_MessageBuilder_Term(&additionalMessage);
+  return res;
+}
+
+/*
+   期限切れで待つのをやめた返答か調べる
+   "#seq"を返す相手はstaleSeq以前の"#seq"の返答、返さない相手は期限切れになった数だけ先に届いた返答
+*/
+static int OpenROBO_Socket_isStaleReturn(OpenROBO_sockList_t *s, const char *message)
+{
+  if (s->seqEnabled) {
+    if (s->staleSeq == 0) {
+      return 0;
+    }
+    OpenROBO_MessageView_t view;
+    if (OpenROBO_MessageView_Parse(&view, message) != OpenROBO_Return_Success) {
+      return 0;
+    }
+    uint32_t seq = OpenROBO_MessageView_getSeq(&view);
+    return seq != 0 && (int32_t)(seq - s->staleSeq) <= 0;
+  }
+  if (s->staleCount > 0) {
+    s->staleCount--;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+   sから返答を1つ受け取ったので、返答を待っているCommand Messageの数を減らす(常に1を返す)
+*/
+static int OpenROBO_Socket_receivedReturn(OpenROBO_sockList_t *s)
+{
+  if (s->pending > 0) {
+    s->pending--;
+  }
+  // 返答の後に送ったCommand Messageまで返答が揃ったので、メインスレッドは接続に送った返答も読んでいる
+  if (s->pending == 0 && s->localFence == OpenROBO_LocalFence_Followed) {
+    s->localFence = OpenROBO_LocalFence_None;
+  }
+  return 1;
+}
+
+/*
+   sに届いたメッセージが購読の値("#push"付き)なら、複製してsの購読の値の待ち行列に入れる
+   @retval 1 購読の値だった(返答として扱わない。複製できなかった場合は捨てる)
+*/
+static int OpenROBO_Socket_queuePush(OpenROBO_sockList_t *s, const char *message)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  OpenROBO_pushItem_t *item;
+  size_t size;
+  if (!s->subscribed || OpenROBO_Message_findParam(message, 0, OpenROBO_Message_paramName_push, &entry) != OpenROBO_Return_Success) {
+    return 0;
+  }
+  size = OpenROBO_Message_measure(message, SIZE_MAX, NULL) + 1;
+  item = (OpenROBO_pushItem_t *)OpenROBO_malloc(offsetof(OpenROBO_pushItem_t, message) + size);
+  if (item == NULL) {
+    DBGPRINTF("warning: drop subscribed value from <%s>\n", s->id);
+    return 1;
+  }
+  item->next = NULL;
+  item->size = size;
+  memcpy(item->message, message, size);
+  if (s->pushTail == NULL) {
+    s->pushHead = item;
+  } else {
+    s->pushTail->next = item;
+  }
+  s->pushTail = item;
+  return 1;
+}
+
+static int OpenROBO_Socket_receiveReturnMessage(const char* sourceID, char** message)
+{
+  if (OpenROBO_isMainThread) {
+    return OpenROBO_Return_Error;
+  }
+
+  OpenROBO_sockList_t *s;
+  s = OpenROBO_sockList_findByID(sourceID);
+  if (s == NULL) { //not connected
+    return OpenROBO_Return_Error;
+  }
+
+  char *_message = NULL;
+  int res;
+  // 捨てた返答は共通バッファにあるので、次の受信で上書きされる。購読の値は待ち行列に入れて受信を続ける
+  do {
+    if (s->channel != NULL) {
+      res = OpenROBO_Channel_recv(s->channel, &_message);
+    } else {
+      res = OpenROBO_Socket_recvMessage(s, &_message);
+    }
+  } while (res == OpenROBO_Return_Success && (OpenROBO_Socket_queuePush(s, _message) || (OpenROBO_Socket_receivedReturn(s) && OpenROBO_Socket_isStaleReturn(s, _message))));
+  if (res == OpenROBO_Return_Timeout) {
+    // 待つのをやめた返答が後から届いても、次の受信で別の呼び出しの返答として受け取らない
+    if (s->staleSeq != s->seq) {
+      s->staleSeq = s->seq;
+      if (!s->seqEnabled) {
+        s->staleCount++;
+      }
+    }
+  }
+  if (message == NULL) { //TODO
+    OpenROBO_free(_message);
+  } else {
+    *message = _message;
+  }
+
+  return res;
+}
+
+int OpenROBO_Socket_ReceiveReturnMessage(const char* sourceID, char** message)
+{
+  return OpenROBO_Socket_receiveReturnMessage(sourceID, message);
+}
+
+int OpenROBO_Socket_ReceiveReturnMessage(const char* sourceID, char** message, int timeoutMsec, double *waitSec)
+{
+  int res;
+  double start = OpenROBO_Deadline_begin(timeoutMsec);
+  res = OpenROBO_Socket_receiveReturnMessage(sourceID, message);
+  OpenROBO_Deadline_end(start, waitSec);
+  return res;
+}
+
+int OpenROBO_Socket_ReceivePushMessage(const char* sourceID, char** message, int timeoutMsec)
+{
+  double deadline = OpenROBO_getMonotonicTime() + (double)timeoutMsec / 1000.0;
+#if OPENROBO_ASYNC_POLL_ENABLE
+  struct pollfd fds[2];
+#else
+  char fds[1];
+#endif
+  OpenROBO_sockList_t *s;
+  OpenROBO_pushItem_t *item;
+  int res;
+
+  if (OpenROBO_isMainThread || message == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  s = OpenROBO_sockList_findByID(sourceID);
+  if (s == NULL) { //not connected
+    return OpenROBO_Return_Error;
+  }
+
+  // 待っている間に届いた返答はOpenROBO_Asyncのhandleに渡す
+  while (s->pushHead == NULL) {
+    int waitMsec = -1;
+    res = OpenROBO_Async_drain(s);
+    if (s->pushHead != NULL) {
+      break;
+    }
+    if (res != OpenROBO_Return_NotUpdated) {
+      return res;
+    }
+    if (timeoutMsec >= 0) {
+      double rest = deadline - OpenROBO_getMonotonicTime();
+      if (rest <= 0.0) {
+        return timeoutMsec == 0 ? OpenROBO_Return_NotUpdated : OpenROBO_Return_Timeout;
+      }
+      waitMsec = (int)(rest * 1000.0) + 1;
+    }
+    OpenROBO_Async_block(&s, 1, waitMsec, fds);
+  }
+
+  item = s->pushHead;
+  s->pushHead = item->next;
+  if (s->pushHead == NULL) {
+    s->pushTail = NULL;
+  }
+  res = OpenROBO_Socket_reserveCommonBuffer(item->size);
+  if (res == OpenROBO_Return_Success) {
+    memcpy(OpenROBO_Message_commonBuffer.p, item->message, item->size);
+    *message = OpenROBO_Message_commonBuffer.p;
+  }
+  OpenROBO_free(item);
+  return res;
+}
+
+/*
+   Command Messageを送って返答を受信する(OpenROBO_Socket_recvDeadlineがあればその時刻まで待つ)
+*/
+static int OpenROBO_Socket_call(const char* destinationID, OpenROBO_MessageBuilder_t *builder, char **returnMessage)
+{
+  int res = OpenROBO_Socket_SendCommandMessage(destinationID, builder);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  return OpenROBO_Socket_receiveReturnMessage(destinationID, returnMessage);
+}
+
+int OpenROBO_RequestToExitThread(const char* destinationID, const char* functionName)
+{
+  int res;
+  OpenROBO_MessageBuilder_t builder = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+  res = OpenROBO_Message_MakeStopMessage(&builder, functionName);
+  if (res == OpenROBO_Return_Success) {
+    res = OpenROBO_Socket_SendCommandMessage(destinationID, &builder);
+  }
+  OpenROBO_MessageBuilder_Term(&builder);
+  return res;
+}
+
+int OpenROBO_JoinThread(const char* destinationID, const char* functionName, char **returnMessage, int timeoutMsec, double *waitSec)
+{
+  int res;
+  double start;
+  OpenROBO_MessageBuilder_t builder = OPENROBO_MESSAGE_BUILDER_INITIALIZER;
+
+  res = OpenROBO_Message_MakeWaitMessage(&builder, functionName);
+  if (res == OpenROBO_Return_Success) {
+    start = OpenROBO_Deadline_begin(timeoutMsec);
+    res = OpenROBO_Socket_call(destinationID, &builder, returnMessage);
+    OpenROBO_Deadline_end(start, waitSec);
+  }
+  OpenROBO_MessageBuilder_Term(&builder);
+  return res;
+}
+
+int OpenROBO_JoinThread(const char* destinationID, const char* functionName, char **returnMessage)
+{
+  return OpenROBO_JoinThread(destinationID, functionName, returnMessage, -1, NULL);
+}
+
+int OpenROBO_ExitThread(const char* destinationID, const char* functionName, char **returnMessage, int timeoutMsec, double *waitSec)
+{
+  int res = OpenROBO_RequestToExitThread(destinationID, functionName);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  return OpenROBO_JoinThread(destinationID, functionName, returnMessage, timeoutMsec, waitSec);
+}
+
+int OpenROBO_ExitThread(const char* destinationID, const char* functionName, char **returnMessage)
+{
+  return OpenROBO_ExitThread(destinationID, functionName, returnMessage, -1, NULL);
+}
+
+/*
+   '\0'までの文字列を受信する(OpenROBO_Socket_recvDeadlineがあれば1byteごとに期限まで待つ)
+*/
+static int OpenROBO_Socket_recvString(SocketCom* sock, char *str, size_t strSize)
+{
+  int res;
+  unsigned int totalSize = 0;
+  while (1) {
+    res = OpenROBO_Socket_waitRecvable(sock, NULL);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    res = SocketCom_Recv(sock, &str[totalSize], 1, NULL);
+    if (res != SOCKETCOM_SUCCESS) { //error
+      if (res == SOCKETCOM_ERROR_DISCONNECTED) {
+        return OpenROBO_Return_Disconnected;
+      }
+      return OpenROBO_Return_Error;
+    }
+    totalSize++;
+
+    if (str[totalSize-1] == '\0') {
+      break;
+    }
+    if (totalSize >= strSize) { // size over
+      return OpenROBO_Return_BufferOver;
+    }
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   "50002"や"50002/1000001"のようなポート番号とcapabilitiesの文字列を読む
+*/
+static uint32_t OpenROBO_Socket_parseCapabilities(const char* portStr)
+{
+  const char *p = strchr(portStr, '/');
+  if (p == NULL) {
+    return 0;
+  }
+  return (uint32_t)strtoul(p+1, NULL, 16);
+}
+
+/*
+   capabilitiesの後ろに".%x"で付いたSIDを読む
+*/
+static uint16_t OpenROBO_Socket_parseSID(const char* portStr)
+{
+  const char *p = strchr(portStr, '/');
+  char *end;
+  unsigned long sid;
+  if (p == NULL) {
+    return OPENROBO_SID_NONE;
+  }
+  strtoul(p+1, &end, 16);
+  if (*end != '.') {
+    return OPENROBO_SID_NONE;
+  }
+  sid = strtoul(end+1, NULL, 16);
+  return sid < OPENROBO_SID_NONE ? (uint16_t)sid : OPENROBO_SID_NONE;
+}
+
+static int OpenROBO_Socket_recvConnectionInfos(SocketCom* sock)
+{
+  int res;
+  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_IP_STR_LEN+OPENROBO_PORT_STR_LEN+OPENROBO_CAPABILITY_STR_LEN+OPENROBO_SID_STR_LEN+3];
+
+  while (1) {
+    res = OpenROBO_Socket_recvString(sock, buf, sizeof(buf));
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    if (buf[0] == '\0') {
+      break;
+    }
+
+    uint32_t port;
+    char *ip_str, *port_str, *agentName;
+    ip_str = buf;
+    port_str = strchr(buf, ':');
+    if (port_str == NULL) {
+      return OpenROBO_Return_Error;
+    }
+    *port_str = '\0';
+    port_str++;
+    agentName = strchr(port_str, ' ');
+    if (agentName == NULL) {
+      return OpenROBO_Return_Error;
+    }
+    *agentName = '\0';
+    agentName++;
+
+    if (strlen(ip_str) > OPENROBO_IP_STR_LEN) {
+      return OpenROBO_Return_Error;
+    }
+    // TODO error check ip format
+    port = atoi(port_str);
+    if (!(port > 0 && port <= 65535)) {
+      return OpenROBO_Return_Error;
+    }
+    if (strlen(agentName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
+      return OpenROBO_Return_Error;
+    }
+
+    if (strcmp(agentName, OpenROBO_selfSubsystemName) == 0) {
+      OpenROBO_setSubsystemSID(&OpenROBO_subsystemTable.infos[0], OpenROBO_Socket_parseSID(port_str));
+      continue;
+    }
+
+    size_t n = OpenROBO_subsystemTable.infosSize;
+    strcpy(OpenROBO_subsystemTable.infos[n].ip, ip_str);
+    OpenROBO_subsystemTable.infos[n].port = port;
+    OpenROBO_subsystemTable.infos[n].capabilities = OpenROBO_Socket_parseCapabilities(port_str);
+    OpenROBO_subsystemTable.infos[n].forceTextParam = 0;
+    OpenROBO_setSubsystemSID(&OpenROBO_subsystemTable.infos[n], OpenROBO_Socket_parseSID(port_str));
+    strcpy(OpenROBO_subsystemTable.infos[n].id, agentName);
+    OpenROBO_subsystemTable.infosSize++;
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   capabilitiesとSIDは受信バッファにその分を用意している相手にだけ送る
+   capabilitiesはcapabilitiesを送ってきた相手、SIDはOPENROBO_CAPABILITY_SIDを持つ相手にだけ付ける
+*/
+static int OpenROBO_Socket_sendConnectionInfos(SocketCom* sock, const OpenROBO_subsystemTable_info_t* peer)
+{
+  int res;
+  size_t i;
+  int withCapabilities = peer != NULL && peer->capabilities != 0;
+  int withSID = OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_SID);
+  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_IP_STR_LEN+OPENROBO_PORT_STR_LEN+OPENROBO_CAPABILITY_STR_LEN+OPENROBO_SID_STR_LEN+3];
+
+  for (i = 0; i < OpenROBO_subsystemTable.infosSize; i++) {
+    char *name = OpenROBO_subsystemTable.infos[i].id;
+    char *ip = OpenROBO_subsystemTable.infos[i].ip;
+    uint16_t port = OpenROBO_subsystemTable.infos[i].port;
+    uint32_t capabilities = OpenROBO_subsystemTable.infos[i].capabilities;
+    uint16_t sid = OpenROBO_subsystemTable.infos[i].sid;
+
+    if (!withCapabilities) {
+      sprintf(buf, "%s:%d %s", ip, port, name);
+    } else if (withSID && sid != OPENROBO_SID_NONE) {
+      sprintf(buf, "%s:%d/%x.%x %s", ip, port, capabilities, sid, name);
+    } else {
+      sprintf(buf, "%s:%d/%x %s", ip, port, capabilities, name);
+    }
+    res = SocketCom_Send(sock, buf, strlen(buf)+1);
+    if (res != SOCKETCOM_SUCCESS) { //error
+      return OpenROBO_Return_Error;
+    }
+  }
+
+  char endMessage[] = {'\0'};
+  res = SocketCom_Send(sock, endMessage, sizeof(endMessage));
+  if (res != SOCKETCOM_SUCCESS) { //error
+    return OpenROBO_Return_Error;
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Socket_recvSelfInfo(SocketCom* sock, OpenROBO_subsystemTable_info_t* info)
+{
+  uint16_t port;
+  char *port_str, *agentName;
+  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_PORT_STR_LEN+OPENROBO_CAPABILITY_STR_LEN+2];
+  int res = OpenROBO_Socket_recvString(sock, buf, sizeof(buf));
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+
+  port_str = buf;
+  agentName = strchr(buf, ' ');
+  if (agentName == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  *agentName = '\0';
+  agentName++;
+
+  port = atoi(port_str);
+  if (!(port > 0 && port <= 65535)) {
+    return OpenROBO_Return_Error;
+  }
+  if (strlen(agentName) >= OPENROBO_SUBSYSTEM_ID_SIZE) {
+    return OpenROBO_Return_Error;
+  }
+
+  SocketCom_GetIpStr(sock, info->ip);
+  info->port = port;
+  info->capabilities = OpenROBO_Socket_parseCapabilities(port_str);
+  info->forceTextParam = 0;
+  info->sid = OPENROBO_SID_NONE;
+  strcpy(info->id, agentName);
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Socket_sendSelfInfo(SocketCom* sock)
+{
+  int res;
+  char buf[OPENROBO_SUBSYSTEM_ID_SIZE+OPENROBO_PORT_STR_LEN+OPENROBO_CAPABILITY_STR_LEN+2];
+
+  // 相手が古いTaskPlannerかはまだ分からないので、その受信バッファに入らない場合はcapabilitiesを付けない
+  if (snprintf(buf, sizeof(buf), "%d/%x %s", OpenROBO_acceptPort, OPENROBO_SELF_CAPABILITIES, OpenROBO_selfSubsystemName) >= OPENROBO_LEGACY_SELF_INFO_SIZE) {
+    sprintf(buf, "%d %s", OpenROBO_acceptPort, OpenROBO_selfSubsystemName);
+  }
+  res = SocketCom_Send(sock, buf, strlen(buf)+1);
+  if (res != SOCKETCOM_SUCCESS) {
+    return OpenROBO_Return_Error;
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Socket_acceptNewThread(SocketCom* acceptSock)
+{
+  int res;
+  OpenROBO_subsystemTable_info_t *info;
+  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
+  if (s == NULL) {
+    return OpenROBO_Return_Error;
+  }
+
+  if (acceptSock == &OpenROBO_unixAcceptSocket) {
+    res = OpenROBO_Unix_accept(acceptSock, &s->sock);
+  } else {
+    res = SocketCom_Accept(acceptSock, &s->sock) == SOCKETCOM_SUCCESS ? OpenROBO_Return_Success : OpenROBO_Return_Error;
+  }
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_sockList_delete(s);
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_sockList_registerSocket(s);
+  if (OpenROBO_Poller_add(s) != OpenROBO_Return_Success) {
+    OpenROBO_sockList_delete(s);
+    return OpenROBO_Return_Error;
+  }
+
+  char firstMessage[OPENROBO_THREAD_ID_SIZE+1];
+  double deadline = OpenROBO_Socket_recvDeadline;
+  OpenROBO_Deadline_begin(OPENROBO_ACCEPT_TIMEOUT_MSEC);
+  res = OpenROBO_Socket_recvString(&s->sock, firstMessage, sizeof(firstMessage));
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_Socket_recvDeadline = deadline;
+    DBGPRINTF("warning: drop accepted connection (no first message: %d)\n", res);
+    OpenROBO_sockList_delete(s);
+    return OpenROBO_Return_Error;
+  }
+
+  if (firstMessage[0] == (char)OPENROBO_FRAME_MAGIC_CARRIER) {
+    // 相手のプロセスのスレッドが共有する接続。threadIDはchannelごとに受け取る
+    s->framing = OpenROBO_Framing_Binary;
+    s->isCarrier = 1;
+    info = OpenROBO_findSubsystemInfoByThreadID(&firstMessage[1]);
+  } else {
+    if (firstMessage[0] == (char)OPENROBO_FRAME_MAGIC) {
+      s->framing = OpenROBO_Framing_Binary;
+      OpenROBO_sockList_bindID(s, &firstMessage[1]);
+    } else {
+      OpenROBO_sockList_bindID(s, firstMessage);
+    }
+    info = OpenROBO_findSubsystemInfoByThreadID(s->id);
+    s->paramEncoding = OpenROBO_negotiateParamEncoding(info);
+    OpenROBO_sockList_negotiateRouting(s, info);
+  }
+
+  if (OpenROBO_hasCapability(info, OPENROBO_CAPABILITY_SHM)) {
+    res = OpenROBO_Shm_accept(&s->sock, &s->shm);
+  }
+  OpenROBO_Socket_recvDeadline = deadline;
+  if (res != OpenROBO_Return_Success) {
+    DBGPRINTF("warning: drop accepted connection <%s> (no shared memory offer: %d)\n", s->id, res);
+    OpenROBO_sockList_delete(s);
+    return OpenROBO_Return_Error;
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Socket_ReceiveMessage(char** message)
+{
+  int res;
+  if (!OpenROBO_isMainThread) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+
+  while (1) {
+    OpenROBO_sockList_t *s;
+    OpenROBO_receivedRoute.type = -1;
+    OpenROBO_receivedRoute.destinationSID = OPENROBO_SID_NONE;
+    res = OpenROBO_Poller_wait(&s);
+    if (res != OpenROBO_Return_Success) {
+      return res;
+    }
+    if (s == NULL) {
+      // 受け付けに失敗した接続は閉じてあるので、他の接続の受信を続ける
+      OpenROBO_Socket_acceptNewThread(OpenROBO_Unix_readyAcceptSocket());
+      continue;
+    }
+#if OPENROBO_LOCAL_ENABLE
+    if (s == OPENROBO_POLLER_LOCAL) {
+      res = OpenROBO_Local_recv(message);
+      if (res == OpenROBO_Return_NotUpdated) {
+        continue;
+      }
+      OpenROBO_receivedSocket = NULL;
+      return res;
+    }
+#endif
+
+    // 共有メモリの接続ではsocketに届くのはdoorbellだけなので、リングに読むものがあるか確かめる
+    res = OpenROBO_Return_Success;
+    if (s->shm != NULL) {
+      res = OpenROBO_Shm_poll(s->shm, &s->sock);
+      if (res == OpenROBO_Return_NotUpdated) {
+        continue;
+      }
+    }
+
+    if (s->isCarrier) {
+      OpenROBO_sockList_t *ch = NULL;
+      if (res == OpenROBO_Return_Success) {
+        res = OpenROBO_Socket_recvCarrierMessage(s, &ch, message);
+      }
+      if (res == OpenROBO_Return_NotUpdated) {
+        continue;
+      }
+      if (res == OpenROBO_Return_Disconnected) {
+        OpenROBO_sockList_delete(s);
+        continue;
+      }
+      OpenROBO_receivedSocket = ch;
+      return res;
+    }
+    if (res == OpenROBO_Return_Success) {
+      res = OpenROBO_Socket_recvMessage(s, message);
+    }
+    OpenROBO_receivedSocket = s;
+    if (res == OpenROBO_Return_Disconnected) {
+      if (OpenROBO_hasSubsystemInfo(s->id)) {
+        strcpy(OpenROBO_Message_commonBuffer.p, s->id);
+        *message = OpenROBO_Message_commonBuffer.p;
+        OpenROBO_sockList_delete(s);
+        return res;
+      }
+      OpenROBO_sockList_delete(s);
+      continue;
+    }
+
+    return res;
+  }
+}
+
+OpenROBO_MessageFunctionEntry_t* OpenROBO_MessageFunctionEntry_Find(OpenROBO_MessageFunctionEntry_t *entry, const char *functionName)
+{
+  while (entry->func != NULL) {
+    if (strcmp(functionName, entry->name) == 0) {
+      return entry;
+    }
+    entry++;
+  }
+
+  return NULL;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Dispatch
+
+   Start Messageのsubjectからロボット動作関数を引く表(open addressing)。
+   OpenROBO_Main()が渡された表から一度だけ作り、OpenROBO_AddOperationEntry()で後から足せる。
+   引くのはメインスレッドだけで、Start Messageごとにmutexを取らないように表は書き換えない。
+   足す側はmutexを取って表を複製したものに足し、ポインタを差し替えて公開する(copy-on-write)。
+   差し替えた古い表は、メインスレッドなら直ちに、他のスレッドならretiredに積んでメインスレッドが次に引くときに解放する
+   同じ名前を足した場合、OpenROBO_AddOperationEntry()は置き換え(後勝ち)、OpenROBO_Main()の表は既にある名前を残す(先勝ち)。
+   そのためOpenROBO_Main()より前に足したものは表より優先され、表の中では先にあるものが使われる
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct {
+  uint32_t hash;
+  size_t nameSize;
+  OpenROBO_MessageFunctionEntry_t entry; // entry.funcがNULLなら空き
+} OpenROBO_dispatchSlot_t;
+
+typedef struct _OpenROBO_dispatchTable {
+  OpenROBO_dispatchSlot_t *slots; // この構造体の直後に確保する
+  size_t slotsSize; // 2のべき乗
+  size_t size;
+  struct _OpenROBO_dispatchTable *retiredNext;
+} OpenROBO_dispatchTable_t;
+
+typedef struct {
+  OpenROBO_Mutex_t mutex;             // 足す側だけが取る
+  int initialized;
+  OpenROBO_dispatchTable_t *table;    // 公開中の表(書き換えない)
+  OpenROBO_dispatchTable_t *retired;  // 他のスレッドが差し替えた古い表
+} OpenROBO_Dispatch_t;
+
+static OpenROBO_Dispatch_t OpenROBO_dispatch;
+
+static void OpenROBO_Dispatch_startup(void)
+{
+  if (OpenROBO_dispatch.initialized) {
+    return;
+  }
+  OpenROBO_Mutex_init(&OpenROBO_dispatch.mutex);
+  OpenROBO_dispatch.initialized = 1;
+}
+
+/*
+   nameのslot(なければ入れる場所)を探す
+*/
+static OpenROBO_dispatchSlot_t* OpenROBO_Dispatch_probe(OpenROBO_dispatchSlot_t *slots, size_t slotsSize, const char *name, size_t nameSize, uint32_t hash)
+{
+  size_t i = hash & (slotsSize - 1);
+  while (slots[i].entry.func != NULL) {
+    if (slots[i].hash == hash && slots[i].nameSize == nameSize && memcmp(slots[i].entry.name, name, nameSize) == 0) {
+      break;
+    }
+    i = (i + 1) & (slotsSize - 1);
+  }
+  return &slots[i];
+}
+
+/*
+   srcを複製した、size個まで使用率が1/2を超えない表を作る(mutexを取ってから呼ぶ)
+   @param[in] src 複製元(NULLなら空の表)
+*/
+static OpenROBO_dispatchTable_t* OpenROBO_Dispatch_copy(const OpenROBO_dispatchTable_t *src, size_t size)
+{
+  OpenROBO_dispatchTable_t *table;
+  size_t slotsSize = OPENROBO_DISPATCH_INITIAL_SLOTS;
+  size_t i;
+
+  while (size*2 > slotsSize) {
+    slotsSize *= 2;
+  }
+  table = (OpenROBO_dispatchTable_t *)OpenROBO_malloc(sizeof(OpenROBO_dispatchTable_t) + sizeof(OpenROBO_dispatchSlot_t)*slotsSize);
+  if (table == NULL) {
+    return NULL;
+  }
+  table->slots = (OpenROBO_dispatchSlot_t *)(table + 1);
+  table->slotsSize = slotsSize;
+  table->size = 0;
+  table->retiredNext = NULL;
+  memset(table->slots, 0, sizeof(OpenROBO_dispatchSlot_t)*slotsSize);
+  if (src != NULL) {
+    for (i = 0; i < src->slotsSize; i++) {
+      const OpenROBO_dispatchSlot_t *slot = &src->slots[i];
+      if (slot->entry.func != NULL) {
+        *OpenROBO_Dispatch_probe(table->slots, slotsSize, slot->entry.name, slot->nameSize, slot->hash) = *slot;
+      }
+    }
+    table->size = src->size;
+  }
+  return table;
+}
+
+/*
+   公開する前の表に足す(OpenROBO_Dispatch_copy()で足す分の空きを作ってから呼ぶ)
+   @param[in] replace 0の場合、同じ名前が既にあれば何もしない
+*/
+static int OpenROBO_Dispatch_put(OpenROBO_dispatchTable_t *table, const char *name, OpenROBO_MessageFunction_t func, int replace)
+{
+  OpenROBO_dispatchSlot_t *slot;
+  size_t nameSize = strlen(name);
+  uint32_t hash;
+
+  if (func == NULL || nameSize >= OPENROBO_FUNCTION_NAME_SIZE) {
+    return OpenROBO_Return_Error;
+  }
+  hash = OpenROBO_hashBytes(name, nameSize);
+  slot = OpenROBO_Dispatch_probe(table->slots, table->slotsSize, name, nameSize, hash);
+  if (slot->entry.func == NULL) {
+    slot->hash = hash;
+    slot->nameSize = nameSize;
+    memcpy(slot->entry.name, name, nameSize + 1);
+    table->size++;
+  } else if (!replace) {
+    return OpenROBO_Return_Success;
+  }
+  slot->entry.func = func;
+  return OpenROBO_Return_Success;
+}
+
+/*
+   tableを公開し、古い表を解放する(mutexを取ってから呼ぶ)
+   メインスレッドが古い表を引いている最中かもしれないので、他のスレッドはretiredに積むだけにする
+*/
+static void OpenROBO_Dispatch_publish(OpenROBO_dispatchTable_t *table)
+{
+  OpenROBO_dispatchTable_t *old = OpenROBO_dispatch.table;
+  __atomic_store_n(&OpenROBO_dispatch.table, table, __ATOMIC_RELEASE);
+  if (old == NULL) {
+    return;
+  }
+  if (OpenROBO_isMainThread) {
+    OpenROBO_free(old);
+    return;
+  }
+  old->retiredNext = __atomic_load_n(&OpenROBO_dispatch.retired, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&OpenROBO_dispatch.retired, &old->retiredNext, old, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+}
+
+/*
+   OpenROBO_Main()に渡された表を入れる(OpenROBO_AddOperationEntry()で先に足されたものを優先し、表の中では先にあるものを使う)
+*/
+static int OpenROBO_Dispatch_addTable(const OpenROBO_MessageFunctionEntry_t *entry)
+{
+  int res = OpenROBO_Return_Success;
+  const OpenROBO_MessageFunctionEntry_t *p;
+  OpenROBO_dispatchTable_t *table;
+  size_t n = 0;
+
+  for (p = entry; p->func != NULL; p++) {
+    n++;
+  }
+  OpenROBO_Mutex_lock(&OpenROBO_dispatch.mutex);
+  table = OpenROBO_Dispatch_copy(OpenROBO_dispatch.table, (OpenROBO_dispatch.table != NULL ? OpenROBO_dispatch.table->size : 0) + n);
+  if (table == NULL) {
+    res = OpenROBO_Return_Error;
+  }
+  for (p = entry; p->func != NULL && res == OpenROBO_Return_Success; p++) {
+    res = OpenROBO_Dispatch_put(table, p->name, p->func, 0);
+  }
+  if (res == OpenROBO_Return_Success) {
+    OpenROBO_Dispatch_publish(table);
+  } else {
+    OpenROBO_free(table);
+  }
+  OpenROBO_Mutex_unlock(&OpenROBO_dispatch.mutex);
+  return res;
+}
+
+/*
+   メインスレッドから呼ぶ(mutexを取らない)
+*/
+static OpenROBO_MessageFunction_t OpenROBO_Dispatch_find(const char *name, size_t nameSize)
+{
+  OpenROBO_dispatchTable_t *table;
+  // 他のスレッドが差し替えた古い表は、前回引き終えているので解放してよい
+  if (__atomic_load_n(&OpenROBO_dispatch.retired, __ATOMIC_RELAXED) != NULL) {
+    table = __atomic_exchange_n(&OpenROBO_dispatch.retired, (OpenROBO_dispatchTable_t *)NULL, __ATOMIC_ACQUIRE);
+    while (table != NULL) {
+      OpenROBO_dispatchTable_t *next = table->retiredNext;
+      OpenROBO_free(table);
+      table = next;
+    }
+  }
+  table = __atomic_load_n(&OpenROBO_dispatch.table, __ATOMIC_ACQUIRE);
+  if (table == NULL || table->size == 0) {
+    return NULL;
+  }
+  return OpenROBO_Dispatch_probe(table->slots, table->slotsSize, name, nameSize, OpenROBO_hashBytes(name, nameSize))->entry.func;
+}
+
+int OpenROBO_AddOperationEntry(const char *name, OpenROBO_MessageFunction_t func)
+{
+  int res = OpenROBO_Return_Error;
+  OpenROBO_dispatchTable_t *table;
+  if (!OpenROBO_dispatch.initialized) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_Mutex_lock(&OpenROBO_dispatch.mutex);
+  table = OpenROBO_Dispatch_copy(OpenROBO_dispatch.table, (OpenROBO_dispatch.table != NULL ? OpenROBO_dispatch.table->size : 0) + 1);
+  if (table != NULL) {
+    res = OpenROBO_Dispatch_put(table, name, func, 1);
+    if (res == OpenROBO_Return_Success) {
+      OpenROBO_Dispatch_publish(table);
+    } else {
+      OpenROBO_free(table);
+    }
+  }
+  OpenROBO_Mutex_unlock(&OpenROBO_dispatch.mutex);
+  return res;
+}
+
+/*
+   Read/Write Messageを処理して返答をsへ送る
+   メインスレッドとReadWritePoolのworkerから呼ばれるので、返答先の接続と返答の送信元(sourceID)は呼び出し側が渡す
+   Writeの場合はvalue(OpenROBO_ReadWriteMemory_makeValue()で作った値)の参照を引き取る
+   Readでversionが0でない場合は、値がそれより新しいときだけ値を返す
+   seqは元のメッセージの"#seq"で、返答に付ける
+   返答先に接続していなければ(メインスレッドからは接続しない)、返答だけを捨ててOpenROBO_Return_Successを返す
+*/
+static int OpenROBO_ReadWrite_serve(int type, const char *subject, const char *originalSourceID, OpenROBO_ReadWriteMemory_Value_t *value, unsigned int version, uint32_t seq, OpenROBO_sockList_t *s, const char *sourceID)
+{
+  int res;
+  char returnMessageBuffer[1024];
+  OpenROBO_MessageBuilder_t returnMessage;
+
+  if (type == OpenROBO_MessageType_Read) {
+    char suffixBuffer[32];
+    OpenROBO_MessageBuilder_t suffix;
+    OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+    OpenROBO_Message_setSeq(&suffix, seq);
+    value = OpenROBO_ReadWriteMemory_acquire(subject);
+    if (s == NULL) { //not connected
+      DBGPRINTF("warning: drop return message of \"%s\" for <%s> (not connected)\n", subject, originalSourceID);
+      res = OpenROBO_Return_Success;
+    } else if (value != NULL && (version == 0 || OpenROBO_ReadWriteMemory_isNewer(value->version, version))) {
+      // 返答は値が持っているので、共有したまま送る
+      res = OpenROBO_Socket_sendMeasuredTo(s, value->frame, value->size, value->hasBinary, suffix.size > 0 ? suffix.p : NULL, suffix.size, 0);
+    } else {
+      // 値がない、または呼び出し側が持っている値から変わっていない
+      OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+      OpenROBO_Message_MakeReturnMessage(&returnMessage, subject);
+      OpenROBO_Message_SetReturnValue(&returnMessage, OpenROBO_Return_NotUpdated);
+      if (value != NULL) {
+        int currentVersion = (int)value->version;
+        OpenROBO_Message_SetParam_int(&returnMessage, OpenROBO_Message_paramName_version, &currentVersion);
+      }
+      res = OpenROBO_Socket_sendMessageTo(s, returnMessage.p, suffix.size > 0 ? suffix.p : NULL);
+      OpenROBO_MessageBuilder_Term(&returnMessage);
+    }
+    if (res != OpenROBO_Return_Success) {
+      // Writeと同じく、送れなかった返答は捨てる(切断は次の受信で検知する)
+      DBGPRINTF("warning: failed to send return message of \"%s\" to <%s>\n", subject, originalSourceID);
+      res = OpenROBO_Return_Success;
+    }
+    OpenROBO_MessageBuilder_Term(&suffix);
+    OpenROBO_ReadWriteMemory_release(value);
+  } else {
+    char additionalMessageBuffer[1024];
+    OpenROBO_MessageBuilder_t additionalMessage;
+    res = OpenROBO_ReadWriteMemory_put(subject, value);
+    res = res < 0 ? OpenROBO_Return_Error : OpenROBO_Return_Success;
+    OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+    OpenROBO_Message_MakeReturnMessage(&returnMessage, subject);
+    OpenROBO_Message_SetReturnValue(&returnMessage, res);
+    OpenROBO_MessageBuilder_InitWithBuffer(&additionalMessage, additionalMessageBuffer, sizeof(additionalMessageBuffer));
+    if (s == NULL) { //not connected
+      DBGPRINTF("warning: drop return message of \"%s\" for <%s> (not connected)\n", subject, originalSourceID);
+    } else if (OpenROBO_Message_makeSystemReturnInfo(&additionalMessage, sourceID, originalSourceID, subject, seq) == OpenROBO_Return_Success) {
+      OpenROBO_Socket_sendMessageTo(s, returnMessage.p, additionalMessage.p);
+    }
+    OpenROBO_MessageBuilder_Term(&additionalMessage);
+    OpenROBO_MessageBuilder_Term(&returnMessage);
+  }
+
+  return res;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_ReadWritePool
+
+   Read/Write Messageを処理するスレッド。
+   メインスレッドは返答先の接続を決めてジョブをキューに入れるだけにし、
+   ReadWriteMemoryの読み書きと返答の送信はworkerが並行して行う。
+   キューはworkerごとに持ち、ジョブはkeyのhashで決まるworkerに入れるので、同じkeyのRead/Writeは受信した順に処理される。
+   メインスレッドで処理するもの(バッチなど)は、キューに残っているジョブが終わってから処理する。
+   ジョブが参照している接続は、メインスレッドが削除しても最後のジョブが終わるまで解放しない
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_ReadWritePool_job {
+  OpenROBO_sockList_t *s;
+  int type;
+  char subject[OPENROBO_FUNCTION_NAME_SIZE];
+  char originalSourceID[OPENROBO_THREAD_ID_SIZE];
+  OpenROBO_ReadWriteMemory_Value_t *value; // Writeの値
+  unsigned int version; // Readの条件
+  uint32_t seq;         // 返答に付ける"#seq"
+  struct _OpenROBO_ReadWritePool_job *next;
+} OpenROBO_ReadWritePool_job_t;
+
+/*
+   1つのworkerのキュー(poolのmutexで保護)
+*/
+typedef struct {
+  OpenROBO_Cond_t cond;
+  OpenROBO_ReadWritePool_job_t *head;
+  OpenROBO_ReadWritePool_job_t *tail;
+  struct _OpenROBO_ReadWritePool *pool;
+} OpenROBO_ReadWritePool_queue_t;
+
+typedef struct _OpenROBO_ReadWritePool {
+  OpenROBO_Mutex_t mutex;
+  OpenROBO_Cond_t cond;                 // pendingが0になったことを知らせる
+  int initialized;
+  size_t maxWorkers;
+  size_t workers;
+  char sourceID[OPENROBO_THREAD_ID_SIZE]; // 返答の送信元(メインスレッドのthreadID)
+  OpenROBO_ReadWritePool_queue_t *queues; // workerごとのキュー(maxWorkers個)
+  size_t pending;                       // キューに入ってから処理し終えるまでのジョブの数
+} OpenROBO_ReadWritePool_t;
+
+static OpenROBO_ReadWritePool_t OpenROBO_ReadWritePool = {
+  OpenROBO_Mutex_t(), OpenROBO_Cond_t(), 0, OPENROBO_READWRITE_WORKERS, 0, "", NULL, 0
+};
+
+int OpenROBO_Thread_SetReadWriteWorkers(size_t workers)
+{
+  OpenROBO_ReadWritePool_t *pool = &OpenROBO_ReadWritePool;
+  if (!OpenROBO_isMainThread || pool->initialized) {
+    return OpenROBO_Return_Error;
+  }
+  pool->maxWorkers = workers;
+  return OpenROBO_Return_Success;
+}
+
+/*
+   削除する接続をジョブが参照していれば、解放を最後のジョブに任せる
+*/
+static int OpenROBO_ReadWritePool_deferDelete(OpenROBO_sockList_t *s)
+{
+  OpenROBO_ReadWritePool_t *pool = &OpenROBO_ReadWritePool;
+  int deferred;
+  if (!pool->initialized || !OpenROBO_isMainThread) {
+    return 0;
+  }
+  OpenROBO_Mutex_lock(&pool->mutex);
+  deferred = s->refs > 0;
+  if (deferred) {
+    s->deleted = 1;
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  return deferred;
+}
+
+static void OpenROBO_ReadWritePool_release(OpenROBO_ReadWritePool_t *pool, OpenROBO_sockList_t *s)
+{
+  int dispose;
+  OpenROBO_Mutex_lock(&pool->mutex);
+  s->refs--;
+  dispose = s->refs == 0 && s->deleted;
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  if (dispose) {
+    OpenROBO_sockList_dispose(s);
+  }
+}
+
+static OpenROBO_ReadWritePool_job_t* OpenROBO_ReadWritePool_take(OpenROBO_ReadWritePool_queue_t *queue)
+{
+  OpenROBO_ReadWritePool_t *pool = queue->pool;
+  OpenROBO_ReadWritePool_job_t *job;
+  OpenROBO_Mutex_lock(&pool->mutex);
+  while (queue->head == NULL) {
+    OpenROBO_Cond_wait(&queue->cond, &pool->mutex);
+  }
+  job = queue->head;
+  queue->head = job->next;
+  if (queue->head == NULL) {
+    queue->tail = NULL;
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+  return job;
+}
+
+static void OpenROBO_ReadWritePool_done(OpenROBO_ReadWritePool_t *pool)
+{
+  OpenROBO_Mutex_lock(&pool->mutex);
+  if (--pool->pending == 0) {
+    OpenROBO_Cond_broadcast(&pool->cond);
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+}
+
+/*
+   キューに入れたジョブが全て終わるまで待つ(メインスレッドでRead/Writeを処理する前に呼び、受信した順を守る)
+*/
+static void OpenROBO_ReadWritePool_drain(OpenROBO_ReadWritePool_t *pool)
+{
+  if (pool->workers == 0) {
+    return;
+  }
+  OpenROBO_Mutex_lock(&pool->mutex);
+  while (pool->pending > 0) {
+    OpenROBO_Cond_wait(&pool->cond, &pool->mutex);
+  }
+  OpenROBO_Mutex_unlock(&pool->mutex);
+}
+
+/* Worker wrapper function. */
+#if defined(_OPENROBO_WIN32_)
+static DWORD WINAPI OpenROBO_ReadWritePool_worker(LPVOID aArg)
+#elif defined(_OPENROBO_POSIX_)
+static void * OpenROBO_ReadWritePool_worker(void * aArg)
+#endif
+{
+  OpenROBO_ReadWritePool_queue_t *queue = (OpenROBO_ReadWritePool_queue_t *)aArg;
+  OpenROBO_ReadWritePool_t *pool = queue->pool;
+  OpenROBO_ReadWritePool_job_t *job;
+
+  while ((job = OpenROBO_ReadWritePool_take(queue)) != NULL) {
+    OpenROBO_sockList_t *carrier = job->s->carrier;
+    OpenROBO_ReadWrite_serve(job->type, job->subject, job->originalSourceID, job->value, job->version, job->seq, job->s, pool->sourceID);
+
+    OpenROBO_ReadWritePool_release(pool, job->s);
+    if (carrier != NULL) {
+      OpenROBO_ReadWritePool_release(pool, carrier);
+    }
+    OpenROBO_free(job);
+    OpenROBO_ReadWritePool_done(pool);
+  }
+
+#if defined(_OPENROBO_WIN32_)
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+static void OpenROBO_ReadWritePool_init(OpenROBO_ReadWritePool_t *pool)
+{
+  if (pool->initialized || pool->maxWorkers == 0) {
+    return;
+  }
+  pool->queues = (OpenROBO_ReadWritePool_queue_t *)OpenROBO_malloc(sizeof(OpenROBO_ReadWritePool_queue_t) * pool->maxWorkers);
+  if (pool->queues == NULL) {
+    DBGABORT();
+    return;
+  }
+  OpenROBO_Mutex_init(&pool->mutex);
+  OpenROBO_Cond_init(&pool->cond);
+  strcpy(pool->sourceID, OpenROBO_threadID);
+  pool->initialized = 1;
+
+  while (pool->workers < pool->maxWorkers) {
+    OpenROBO_ReadWritePool_queue_t *queue = &pool->queues[pool->workers];
+    OpenROBO_Cond_init(&queue->cond);
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->pool = pool;
+    if (OpenROBO_Thread_createDetached(OpenROBO_ReadWritePool_worker, queue) != OpenROBO_Return_Success) {
+      break;
+    }
+    pool->workers++;
+  }
+}
+
+static int OpenROBO_ReadWritePool_submit(OpenROBO_ReadWritePool_t *pool, int type, const char *subject, const char *originalSourceID, OpenROBO_ReadWriteMemory_Value_t *value, unsigned int version, uint32_t seq, OpenROBO_sockList_t *s)
+{
+  OpenROBO_ReadWritePool_queue_t *queue;
+  OpenROBO_ReadWritePool_job_t *job = (OpenROBO_ReadWritePool_job_t *)OpenROBO_malloc(sizeof(OpenROBO_ReadWritePool_job_t));
+  if (job == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  job->s = s;
+  job->type = type;
+  strcpy(job->subject, subject);
+  strcpy(job->originalSourceID, originalSourceID);
+  job->value = value;
+  job->version = version;
+  job->seq = seq;
+  job->next = NULL;
+  // 同じkeyのジョブは同じworkerに入れ、受信した順に処理させる
+  queue = &pool->queues[OpenROBO_ReadWriteMemory_hash(subject) % pool->workers];
+
+  OpenROBO_Mutex_lock(&pool->mutex);
+  s->refs++;
+  if (s->carrier != NULL) {
+    s->carrier->refs++;
+  }
+  if (queue->tail == NULL) {
+    queue->head = job;
+  } else {
+    queue->tail->next = job;
+  }
+  queue->tail = job;
+  pool->pending++;
+  OpenROBO_Cond_signal(&queue->cond);
+  OpenROBO_Mutex_unlock(&pool->mutex);
+
+  return OpenROBO_Return_Success;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Subscription
+
+   Subscribe Messageで登録された購読。メインスレッドだけが触る。
+   Write Messageで値が書き込まれるたびに、パターンに一致する購読者へRead Messageへの返答と同じ値を
+   "#push"(購読のパターン)を付けて送る。購読者は"#push"付きのメッセージを返答と区別して接続ごとの待ち行列に入れる。
+   間隔が指定されていれば、間隔内に書き込まれた値はkeyごとに最新のものだけを保留し、
+   OpenROBO_Poller_wait()が間隔の経過後にまとめて送る。
+   購読者はthreadIDで持ち、その接続が削除されるか別のthreadIDに付け直されたら購読を消す
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_Subscription_pending {
+  char key[OPENROBO_FUNCTION_NAME_SIZE];
+  OpenROBO_ReadWriteMemory_Value_t *value;
+  struct _OpenROBO_Subscription_pending *next;
+} OpenROBO_Subscription_pending_t;
+
+typedef struct _OpenROBO_Subscription {
+  char subscriberID[OPENROBO_THREAD_ID_SIZE];
+  char pattern[OPENROBO_FUNCTION_NAME_SIZE];
+  size_t prefixSize;  // 前方一致の長さ(完全一致の場合はSIZE_MAX)
+  double interval;    // [sec]
+  double lastSent;
+  OpenROBO_Subscription_pending_t *pending;
+  struct _OpenROBO_Subscription *next;
+} OpenROBO_Subscription_t;
+
+static OpenROBO_Subscription_t *OpenROBO_subscriptions = NULL;
+
+static int OpenROBO_Subscription_match(const OpenROBO_Subscription_t *sub, const char *key)
+{
+  if (sub->prefixSize == SIZE_MAX) {
+    return strcmp(sub->pattern, key) == 0;
+  }
+  return strncmp(sub->pattern, key, sub->prefixSize) == 0;
+}
+
+static void OpenROBO_Subscription_clearPending(OpenROBO_Subscription_t *sub)
+{
+  while (sub->pending != NULL) {
+    OpenROBO_Subscription_pending_t *p = sub->pending;
+    sub->pending = p->next;
+    OpenROBO_ReadWriteMemory_release(p->value);
+    OpenROBO_free(p);
+  }
+}
+
+/*
+   *linkが指している購読を外して解放する
+*/
+static void OpenROBO_Subscription_remove(OpenROBO_Subscription_t **link)
+{
+  OpenROBO_Subscription_t *sub = *link;
+  *link = sub->next;
+  OpenROBO_Subscription_clearPending(sub);
+  OpenROBO_free(sub);
+}
+
+static void OpenROBO_Subscription_dropSubscriber(const char *subscriberID)
+{
+  OpenROBO_Subscription_t **link = &OpenROBO_subscriptions;
+  if (!OpenROBO_isMainThread) {
+    return;
+  }
+  while (*link != NULL) {
+    if (strcmp((*link)->subscriberID, subscriberID) == 0) {
+      OpenROBO_Subscription_remove(link);
+    } else {
+      link = &(*link)->next;
+    }
+  }
+}
+
+/*
+   @retval OpenROBO_Return_Disconnected 購読者が接続していない
+*/
+static int OpenROBO_Subscription_send(OpenROBO_Subscription_t *sub, OpenROBO_ReadWriteMemory_Value_t *value, double now)
+{
+  char suffixBuffer[OPENROBO_FUNCTION_NAME_SIZE + 32];
+  OpenROBO_MessageBuilder_t suffix;
+  int res;
+  OpenROBO_sockList_t *s = OpenROBO_sockList_findByID(sub->subscriberID);
+  if (s == NULL) {
+    return OpenROBO_Return_Disconnected;
+  }
+  sub->lastSent = now;
+  OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+  res = OpenROBO_Message_SetParam_string(&suffix, OpenROBO_Message_paramName_push, sub->pattern);
+  if (res == OpenROBO_Return_Success) {
+    res = OpenROBO_Socket_sendMeasuredTo(s, value->frame, value->size, value->hasBinary, suffix.p, suffix.size, 0);
+  }
+  OpenROBO_MessageBuilder_Term(&suffix);
+  return res;
+}
+
+/*
+   keyの値を保留する(同じkeyの保留は新しい値で置き換える)
+*/
+static int OpenROBO_Subscription_setPending(OpenROBO_Subscription_t *sub, const char *key, OpenROBO_ReadWriteMemory_Value_t *value)
+{
+  OpenROBO_Subscription_pending_t *p;
+  for (p = sub->pending; p != NULL; p = p->next) {
+    if (strcmp(p->key, key) == 0) {
+      break;
+    }
+  }
+  if (p == NULL) {
+    p = (OpenROBO_Subscription_pending_t *)OpenROBO_malloc(sizeof(OpenROBO_Subscription_pending_t));
+    if (p == NULL) {
+      return OpenROBO_Return_Error;
+    }
+    strcpy(p->key, key);
+    p->value = NULL;
+    p->next = sub->pending;
+    sub->pending = p;
+  }
+  OpenROBO_Atomic_increment(&value->refs);
+  OpenROBO_ReadWriteMemory_release(p->value);
+  p->value = value;
+  return OpenROBO_Return_Success;
+}
+
+/*
+   keyに書き込まれた値を購読者へ送る
+*/
+static void OpenROBO_Subscription_publish(const char *key, OpenROBO_ReadWriteMemory_Value_t *value)
+{
+  OpenROBO_Subscription_t **link = &OpenROBO_subscriptions;
+  double now;
+  if (*link == NULL) {
+    return;
+  }
+  now = OpenROBO_getMonotonicTime();
+  while (*link != NULL) {
+    OpenROBO_Subscription_t *sub = *link;
+    int res = OpenROBO_Return_Success;
+    if (OpenROBO_Subscription_match(sub, key)) {
+      if (sub->pending == NULL && now - sub->lastSent >= sub->interval) {
+        res = OpenROBO_Subscription_send(sub, value, now);
+      } else {
+        res = OpenROBO_Subscription_setPending(sub, key, value);
+      }
+    }
+    if (res == OpenROBO_Return_Disconnected) {
+      OpenROBO_Subscription_remove(link);
+    } else {
+      link = &sub->next;
+    }
+  }
+}
+
+/*
+   間隔が経過した購読の保留している値を送る
+
+   @return 次に保留を送る時刻までの時間[msec](保留がなければ-1)
+*/
+static int OpenROBO_Subscription_flush(void)
+{
+  OpenROBO_Subscription_t **link = &OpenROBO_subscriptions;
+  double now, wait = -1.0;
+  if (*link == NULL) {
+    return -1;
+  }
+  now = OpenROBO_getMonotonicTime();
+  while (*link != NULL) {
+    OpenROBO_Subscription_t *sub = *link;
+    int res = OpenROBO_Return_Success;
+    if (sub->pending != NULL) {
+      double due = sub->lastSent + sub->interval;
+      if (now >= due) {
+        OpenROBO_Subscription_pending_t *p;
+        for (p = sub->pending; p != NULL && res != OpenROBO_Return_Disconnected; p = p->next) {
+          res = OpenROBO_Subscription_send(sub, p->value, now);
+        }
+        OpenROBO_Subscription_clearPending(sub);
+      } else if (wait < 0 || due - now < wait) {
+        wait = due - now;
+      }
+    }
+    if (res == OpenROBO_Return_Disconnected) {
+      OpenROBO_Subscription_remove(link);
+    } else {
+      link = &sub->next;
+    }
+  }
+
+  return wait < 0 ? -1 : (int)(wait * 1000.0) + 1;
+}
+
+/*
+   Subscribe Messageを処理する
+   返答の後に、完全一致の購読で値が既に書き込まれていればその値を送る
+*/
+static int OpenROBO_Subscription_subscribe(const OpenROBO_MessageView_t* view)
+{
+  int res = OpenROBO_Return_Success;
+  int intervalMsec = 0;
+  char pattern[OPENROBO_FUNCTION_NAME_SIZE];
+  char subscriberID[OPENROBO_THREAD_ID_SIZE];
+  char returnMessageBuffer[1024];
+  char additionalMessageBuffer[1024];
+  OpenROBO_MessageBuilder_t returnMessage, additionalMessage;
+  OpenROBO_Subscription_t **link, *sub = NULL;
+  OpenROBO_sockList_t *s;
+
+  if (OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_sourceID, subscriberID, sizeof(subscriberID)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_subject, pattern, sizeof(pattern)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_MessageView_GetParam_int(view, OpenROBO_Message_paramName_interval, &intervalMsec);
+
+  for (link = &OpenROBO_subscriptions; *link != NULL; link = &(*link)->next) {
+    if (strcmp((*link)->subscriberID, subscriberID) == 0 && strcmp((*link)->pattern, pattern) == 0) {
+      break;
+    }
+  }
+  if (intervalMsec < 0) {
+    if (*link != NULL) {
+      OpenROBO_Subscription_remove(link);
+    }
+  } else {
+    sub = *link;
+    if (sub == NULL) {
+      size_t patternSize = strlen(pattern);
+      sub = (OpenROBO_Subscription_t *)OpenROBO_malloc(sizeof(OpenROBO_Subscription_t));
+      if (sub == NULL) {
+        res = OpenROBO_Return_Error;
+      } else {
+        strcpy(sub->subscriberID, subscriberID);
+        strcpy(sub->pattern, pattern);
+        sub->prefixSize = patternSize > 0 && pattern[patternSize-1] == '*' ? patternSize - 1 : SIZE_MAX;
+        sub->lastSent = 0.0;
+        sub->pending = NULL;
+        sub->next = NULL;
+        *link = sub;
+      }
+    }
+    if (sub != NULL) {
+      sub->interval = (double)intervalMsec / 1000.0;
+    }
+  }
+
+  s = OpenROBO_sockList_findByID(subscriberID);
+  if (s == NULL) { //not connected
+    return res;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+  OpenROBO_MessageBuilder_InitWithBuffer(&additionalMessage, additionalMessageBuffer, sizeof(additionalMessageBuffer));
+  OpenROBO_Message_MakeReturnMessage(&returnMessage, pattern);
+  OpenROBO_Message_SetReturnValue(&returnMessage, res);
+  if (OpenROBO_Message_makeSystemReturnInfo(&additionalMessage, OpenROBO_threadID, subscriberID, pattern, OpenROBO_MessageView_getSeq(view)) == OpenROBO_Return_Success) {
+    OpenROBO_Socket_sendMessageTo(s, returnMessage.p, additionalMessage.p);
+  }
+  OpenROBO_MessageBuilder_Term(&additionalMessage);
+  OpenROBO_MessageBuilder_Term(&returnMessage);
+
+  if (sub != NULL && sub->prefixSize == SIZE_MAX) {
+    OpenROBO_ReadWriteMemory_Value_t *value = OpenROBO_ReadWriteMemory_acquire(pattern);
+    if (value != NULL) {
+      OpenROBO_Subscription_send(sub, value, OpenROBO_getMonotonicTime());
+      OpenROBO_ReadWriteMemory_release(value);
+    }
+  }
+
+  return res;
+}
+
+/*
+   バッチのRead/Write Messageの1つの値
+*/
+typedef struct {
+  char key[OPENROBO_FUNCTION_NAME_SIZE];
+  size_t begin;
+  size_t end;
+  unsigned int version;
+} OpenROBO_ReadWrite_batchItem_t;
+
+/*
+   "#subject"を複数含むRead/Write Messageをメインスレッドで処理する
+   Readは全ての値を同時に取り出し(途中のWriteが混ざらない)、1つのReturn Messageにまとめて返す
+   Writeは全ての値を同時に格納し、返答は最初のsubjectで1つだけ返す
+   最初の区間はOpenROBO_ReadWrite_dispatch()で辿ったもの(firstSubjectとfirstEnd)を使い、2つ目の区間から辿る
+*/
+static int OpenROBO_ReadWrite_serveBatch(const OpenROBO_MessageView_t* view, const char *originalSourceID, const OpenROBO_MessageViewEntry_t *firstSubject, size_t firstEnd)
+{
+  const char *message = view->message;
+  size_t size = view->size, pos, begin, end, n = 0, capacity = 0, i;
+  OpenROBO_ReadWrite_batchItem_t *items = NULL;
+  const char **keys;
+  unsigned int *hashes;
+  OpenROBO_ReadWriteMemory_Value_t **values, **published = NULL;
+  OpenROBO_MessageViewEntry_t subject, entry;
+  OpenROBO_sockList_t *s;
+  void *block;
+  int res = OpenROBO_Return_Success;
+
+  // 送り元と送り先は値に含めない
+  size = OpenROBO_Message_measureWithoutRoute(message, size);
+
+  subject = *firstSubject;
+  end = firstEnd < size ? firstEnd : size;
+  pos = end;
+  do {
+    OpenROBO_ReadWrite_batchItem_t *item;
+    if (n == capacity) {
+      OpenROBO_ReadWrite_batchItem_t *grown;
+      capacity = capacity > 0 ? capacity * 2 : 16;
+      grown = (OpenROBO_ReadWrite_batchItem_t *)OpenROBO_realloc(items, sizeof(OpenROBO_ReadWrite_batchItem_t) * capacity);
+      if (grown == NULL) {
+        DBGABORT();
+        OpenROBO_free(items);
+        return OpenROBO_Return_Error;
+      }
+      items = grown;
+    }
+    item = &items[n];
+    if (subject.valueSize >= sizeof(item->key)) {
+      OpenROBO_free(items);
+      return OpenROBO_Return_Error;
+    }
+    memcpy(item->key, &message[subject.valueOffset], subject.valueSize);
+    item->key[subject.valueSize] = '\0';
+    item->begin = subject.valueOffset + subject.valueSize;
+    item->end = end;
+    item->version = 0;
+    if (view->type == OpenROBO_MessageType_Read &&
+        OpenROBO_Message_findParamWithin(message, subject.valueOffset + subject.valueSize, end, OpenROBO_Message_paramName_version, &entry) == OpenROBO_Return_Success) {
+      int version = 0;
+      OpenROBO_Message_decodeInts(message, &entry, &version, 1);
+      item->version = (unsigned int)version;
+    }
+    n++;
+  } while (OpenROBO_Message_nextSection(message, size, &pos, &subject, &begin, &end));
+
+  // ポインタの配列を先に置き、hashesを後ろに置く
+  block = OpenROBO_malloc(n * (sizeof(const char *) + sizeof(OpenROBO_ReadWriteMemory_Value_t *) * 2 + sizeof(unsigned int)));
+  if (block == NULL) {
+    DBGABORT();
+    OpenROBO_free(items);
+    return OpenROBO_Return_Error;
+  }
+  keys = (const char **)block;
+  values = (OpenROBO_ReadWriteMemory_Value_t **)&keys[n];
+  published = &values[n];
+  hashes = (unsigned int *)&published[n];
+  for (i = 0; i < n; i++) {
+    keys[i] = items[i].key;
+  }
+
+  s = OpenROBO_sockList_findByID(originalSourceID);
+  if (view->type == OpenROBO_MessageType_Read) {
+    OpenROBO_MessageBuilder_t returnMessage;
+    size_t returnSize = strlen(OpenROBO_MessageHeader_Return);
+    int hasBinary = 0;
+
+    OpenROBO_ReadWriteMemory_acquireAll(keys, n, hashes, values);
+    for (i = 0; i < n; i++) {
+      returnSize += values[i] != NULL ? values[i]->size : strlen(items[i].key) + 64;
+    }
+    OpenROBO_MessageBuilder_Init(&returnMessage, returnSize + 1);
+    OpenROBO_MessageBuilder_append(&returnMessage, OpenROBO_MessageHeader_Return, strlen(OpenROBO_MessageHeader_Return));
+    for (i = 0; i < n; i++) {
+      OpenROBO_ReadWriteMemory_Value_t *value = values[i];
+      if (value != NULL && (items[i].version == 0 || OpenROBO_ReadWriteMemory_isNewer(value->version, items[i].version))) {
+        // 格納された返答からヘッダを除いた部分がそのまま1つの区間になる
+        size_t headerSize = strlen(OpenROBO_MessageHeader_Return);
+        OpenROBO_MessageBuilder_append(&returnMessage, &value->frame[headerSize], value->size - headerSize);
+        hasBinary |= value->hasBinary;
+      } else {
+        OpenROBO_Message_SetSubject(&returnMessage, items[i].key);
+        OpenROBO_Message_SetReturnValue(&returnMessage, OpenROBO_Return_NotUpdated);
+        if (value != NULL) {
+          int currentVersion = (int)value->version;
+          OpenROBO_Message_SetParam_int(&returnMessage, OpenROBO_Message_paramName_version, &currentVersion);
+        }
+      }
+    }
+    if (s == NULL) { //not connected
+      DBGPRINTF("warning: drop return message of \"%s\" for <%s> (not connected)\n", items[0].key, originalSourceID);
+      res = OpenROBO_Return_Success;
+    } else {
+      char suffixBuffer[32];
+      OpenROBO_MessageBuilder_t suffix;
+      OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+      OpenROBO_Message_setSeq(&suffix, OpenROBO_MessageView_getSeq(view));
+      if (OpenROBO_Socket_sendMeasuredTo(s, returnMessage.p, returnMessage.size, hasBinary, suffix.size > 0 ? suffix.p : NULL, suffix.size, 0) != OpenROBO_Return_Success) {
+        DBGPRINTF("warning: failed to send return message of \"%s\" to <%s>\n", items[0].key, originalSourceID);
+      }
+      res = OpenROBO_Return_Success;
+      OpenROBO_MessageBuilder_Term(&suffix);
+    }
+    OpenROBO_MessageBuilder_Term(&returnMessage);
+    for (i = 0; i < n; i++) {
+      OpenROBO_ReadWriteMemory_release(values[i]);
+    }
+  } else {
+    char returnMessageBuffer[1024], additionalMessageBuffer[1024];
+    OpenROBO_MessageBuilder_t returnMessage, additionalMessage;
+
+    for (i = 0; i < n; i++) {
+      // 区間の"#subject"より後ろが、1つの値のWrite Messageのパラメータと同じ形式になる
+      values[i] = OpenROBO_ReadWriteMemory_makeValueFrom(keys[i], &message[items[i].begin], items[i].end - items[i].begin);
+      published[i] = NULL;
+      if (values[i] != NULL && OpenROBO_subscriptions != NULL) {
+        published[i] = values[i];
+        OpenROBO_Atomic_increment(&published[i]->refs);
+      }
+    }
+    res = OpenROBO_ReadWriteMemory_putAll(keys, n, hashes, values) > 0 ? OpenROBO_Return_Error : OpenROBO_Return_Success;
+    OpenROBO_MessageBuilder_InitWithBuffer(&returnMessage, returnMessageBuffer, sizeof(returnMessageBuffer));
+    OpenROBO_Message_MakeReturnMessage(&returnMessage, items[0].key);
+    OpenROBO_Message_SetReturnValue(&returnMessage, res);
+    OpenROBO_MessageBuilder_InitWithBuffer(&additionalMessage, additionalMessageBuffer, sizeof(additionalMessageBuffer));
+    if (s == NULL) { //not connected
+      DBGPRINTF("warning: drop return message of \"%s\" for <%s> (not connected)\n", items[0].key, originalSourceID);
+    } else if (OpenROBO_Message_makeSystemReturnInfo(&additionalMessage, OpenROBO_threadID, originalSourceID, items[0].key, OpenROBO_MessageView_getSeq(view)) == OpenROBO_Return_Success) {
+      OpenROBO_Socket_sendMessageTo(s, returnMessage.p, additionalMessage.p);
+    }
+    OpenROBO_MessageBuilder_Term(&additionalMessage);
+    OpenROBO_MessageBuilder_Term(&returnMessage);
+    for (i = 0; i < n; i++) {
+      if (published[i] != NULL) {
+        OpenROBO_Subscription_publish(keys[i], published[i]);
+        OpenROBO_ReadWriteMemory_release(published[i]);
+      }
+    }
+  }
+
+  OpenROBO_free(block);
+  OpenROBO_free(items);
+  return res;
+}
+
+/*
+   Read/Write Messageの返答先を決め、ReadWritePoolのworkerがあれば渡し、なければメインスレッドで処理する
+   書き込まれた値は購読者へも送る(workerに渡した場合は格納より先に送ることがあるが、送る値は同じもの)
+*/
+static int OpenROBO_ReadWrite_dispatch(const OpenROBO_MessageView_t* view)
+{
+  char subject[OPENROBO_FUNCTION_NAME_SIZE];
+  char originalSourceID[OPENROBO_THREAD_ID_SIZE];
+  OpenROBO_ReadWriteMemory_Value_t *value = NULL, *published = NULL;
+  OpenROBO_MessageViewEntry_t firstSubject;
+  size_t pos, begin, end;
+  int version = 0;
+  OpenROBO_sockList_t *s;
+  int res = OpenROBO_Return_Error;
+  if (OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_sourceID, originalSourceID, sizeof(originalSourceID)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_MessageView_CopyString(view, OpenROBO_Message_paramName_subject, subject, sizeof(subject)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  // 最初の"#subject"の区間を1回だけ辿り、区間がメッセージの終わりより前で切れていれば(次の"#subject"があれば)バッチ
+  pos = view->subject >= 0 ? view->entries[view->subject].nameOffset - 1 : 0;
+  if (!OpenROBO_Message_nextSection(view->message, view->size, &pos, &firstSubject, &begin, &end)) {
+    return OpenROBO_Return_Error;
+  }
+  if (end < view->size) {
+    OpenROBO_ReadWritePool_drain(&OpenROBO_ReadWritePool);
+    return OpenROBO_ReadWrite_serveBatch(view, originalSourceID, &firstSubject, end);
+  }
+  if (view->type == OpenROBO_MessageType_Write) {
+    value = OpenROBO_ReadWriteMemory_makeValue(subject, view->message);
+    if (value != NULL && OpenROBO_subscriptions != NULL) {
+      published = value;
+      OpenROBO_Atomic_increment(&published->refs);
+    }
+  } else {
+    OpenROBO_MessageView_GetParam_int(view, OpenROBO_Message_paramName_version, &version);
+  }
+  s = OpenROBO_sockList_findByID(originalSourceID);
+  if (s != NULL && OpenROBO_ReadWritePool.workers > 0) {
+    res = OpenROBO_ReadWritePool_submit(&OpenROBO_ReadWritePool, view->type, subject, originalSourceID, value, (unsigned int)version, OpenROBO_MessageView_getSeq(view), s);
+  }
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_ReadWritePool_drain(&OpenROBO_ReadWritePool);
+    res = OpenROBO_ReadWrite_serve(view->type, subject, originalSourceID, value, (unsigned int)version, OpenROBO_MessageView_getSeq(view), s, OpenROBO_threadID);
+  }
+  if (published != NULL) {
+    OpenROBO_Subscription_publish(subject, published);
+    OpenROBO_ReadWriteMemory_release(published);
+  }
+  return res;
+}
+
+int OpenROBO_Main(OpenROBO_MessageFunctionEntry_t operationEntry[])
+{
+  char *message;
+  OpenROBO_MessageView_t view;
+  if (OpenROBO_Dispatch_addTable(operationEntry) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  if (OpenROBO_OperationPool.maxWorkers > 0) {
+    OpenROBO_OperationPool_init(&OpenROBO_OperationPool);
+  }
+  OpenROBO_ReadWritePool_init(&OpenROBO_ReadWritePool);
+  while (1) {
+    int res;
+    char functionName[OPENROBO_FUNCTION_NAME_SIZE];
+    res = OpenROBO_Socket_ReceiveMessage(&message);
+    if (res != OpenROBO_Return_Success) {
+      if (res == OpenROBO_Return_Disconnected) {
+        DBGPRINTF("Disconnected <%s>\n", message);
+      }
+      return res;
+    }
+
+    // 宛先のSIDが自身でなければ本体を読まずに捨てる
+    if (OpenROBO_receivedRoute.destinationSID != OPENROBO_SID_NONE && OpenROBO_receivedRoute.destinationSID != OpenROBO_subsystemTable.infos[0].sid) {
+      OpenROBO_subsystemTable_info_t *source = OpenROBO_findSubsystemInfoBySID(OpenROBO_receivedRoute.sourceSID);
+      DBGPRINTF("error: misrouted message from <%s> to SID %d\n", source != NULL ? source->id : "", OpenROBO_receivedRoute.destinationSID);
+      continue;
+    }
+
+    // routing headerがあれば本体を先頭から辿らずに振り分ける
+    if (OpenROBO_receivedRoute.type < 0 || OpenROBO_MessageView_parseRoute(&view, message, &OpenROBO_receivedRoute) != OpenROBO_Return_Success) {
+      OpenROBO_MessageView_Parse(&view, message);
+    }
+
+    switch (view.type) {
+      case OpenROBO_MessageType_Start:
+      {
+        OpenROBO_MessageFunction_t func = NULL;
+        const char *subject;
+        size_t subjectSize;
+        if (OpenROBO_MessageView_GetSubject(&view, &subject, &subjectSize) == OpenROBO_Return_Success) {
+          func = OpenROBO_Dispatch_find(subject, subjectSize);
+        }
+        if (func == NULL) {
+          functionName[0] = '\0';
+          OpenROBO_MessageView_CopyString(&view, OpenROBO_Message_paramName_subject, functionName, sizeof(functionName));
+          DBGPRINTF("error: not found \"%s\" at start thread / message:[%s]\n", functionName, message);
+          res = OpenROBO_Return_Error;
+        } else {
+          res = OpenROBO_Thread_createOperationThread(func, &view);
+        }
+        if (res == OpenROBO_Return_Success) {
+          res = OpenROBO_JoinThread_JoinQueue(&view);
+        }
+        break;
+      }
+      case OpenROBO_MessageType_Return:
+      {
+        res = OpenROBO_JoinThread_storeThreadReturnMessage(&view);
+        break;
+      }
+      case OpenROBO_MessageType_Wait:
+      {
+        res = OpenROBO_JoinThread_JoinQueue(&view);
+        break;
+      }
+      case OpenROBO_MessageType_Stop:
+      {
+        res = OpenROBO_sendExitThreadSignal(&view);
+        break;
+      }
+      case OpenROBO_MessageType_Read:
+      case OpenROBO_MessageType_Write:
+      {
+        res = OpenROBO_ReadWrite_dispatch(&view);
+        break;
+      }
+      case OpenROBO_MessageType_Subscribe:
+      {
+        res = OpenROBO_Subscription_subscribe(&view);
+        break;
+      }
+      case OpenROBO_MessageType_Bind:
+      {
+        char threadID[OPENROBO_THREAD_ID_SIZE];
+        res = OpenROBO_MessageView_CopyString(&view, OpenROBO_Message_paramName_sourceID, threadID, sizeof(threadID));
+        if (res == OpenROBO_Return_Success) {
+          OpenROBO_sockList_bindID(OpenROBO_receivedSocket, threadID);
+        }
+        break;
+      }
+    }
+    if (res == OpenROBO_Return_Error) {
+      DBGABORT();
+      return res;
+    }
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+static int OpenROBO_Socket_createAcceptSocket(uint16_t *_port)
+{
+  uint16_t port = OPENROBO_DEFAULT_ACCEPT_PORT;
+  int res;
+  res = SocketCom_Create(&OpenROBO_acceptSocket);
+  if (res != SOCKETCOM_SUCCESS) {
+    return OpenROBO_Return_Error;
+  }
+  res = SocketCom_SetReuseaddr(&OpenROBO_acceptSocket);
+  if (res != SOCKETCOM_SUCCESS) {
+    return res;
+  }
+  while (1) {
+    res = SocketCom_Listen(&OpenROBO_acceptSocket, port);
+    if (res == SOCKETCOM_SUCCESS) {
+      break;
+    }
+    if (res != SOCKETCOM_ERROR_BIND) {
+      return OpenROBO_Return_Error;
+    }
+    port++;
+    if (port == OPENROBO_DEFAULT_ACCEPT_PORT) {
+      return OpenROBO_Return_Error;
+    }
+    if (port == 0) {
+      port++;
+    }
+  }
+  *_port = port;
+  OpenROBO_Unix_listen(port);
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Socket_MakeConnection(const char *ip, uint16_t port)
+{
+  int res;
+  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
+  if (s == NULL) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+
+  SocketCom *sock = &s->sock;
+  OpenROBO_sockList_bindID(s, OpenROBO_SubsystemName_TASKPLANNER);
+
+  if (!OpenROBO_isMainThread) {
+    return OpenROBO_Return_Error;
+  }
+
+
+#ifndef  OPENROBO_NDEBUG
+  const char progressIndicator[] = {'-', '\\', '|', '/'};
+  int progressCount = 0;
+#endif
+  SocketCom_SetAddr(sock, ip, port);
+  while (1) {
+    res = SocketCom_Create(sock);
+    if (res != SOCKETCOM_SUCCESS) {
+      return OpenROBO_Return_Error;
+    }
+
+    res = SocketCom_ConnectWithTimeout(sock, OPENROBO_MAKECONNECTION_TIMEOUT_MSEC);
+    if (res == SOCKETCOM_SUCCESS) {
+      break;
+    }
+
+    SocketCom_Dispose(sock);
+
+#ifndef OPENROBO_NDEBUG
+    DBGPRINTF("retry to connect [%c]\r", progressIndicator[progressCount]);
+    DBGFLUSH();
+    progressCount++;
+    if (progressCount >= (sizeof(progressIndicator)/sizeof(progressIndicator[0]))) {
+      progressCount = 0;
+    }
+#endif
+  }
+
+  DBGPRINTF("Connected to (%s:%d)\n", ip, port);
+  OpenROBO_sockList_registerSocket(s);
+
+  res = OpenROBO_Poller_add(s);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_sockList_delete(s);
+    return res;
+  }
+
+  res = OpenROBO_Socket_sendSelfInfo(sock);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_sockList_deleteBySocketCom(sock);
+    return res;
+  }
+
+  res = OpenROBO_Socket_recvConnectionInfos(sock);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_sockList_deleteBySocketCom(sock);
+    return res;
+  }
+
+  size_t n;
+  for (n = 0; n < OpenROBO_subsystemTable.infosSize; n++) {
+    OpenROBO_subsystemTable_info_t *info;
+    info = &OpenROBO_subsystemTable.infos[n];
+    if (strcmp(info->id, OpenROBO_SubsystemName_TASKPLANNER) == 0) {
+      strcpy(info->ip, ip);
+      s->framing = OpenROBO_negotiateFraming(info->capabilities);
+      s->paramEncoding = OpenROBO_negotiateParamEncoding(info);
+      OpenROBO_sockList_negotiateRouting(s, info);
+      break;
+    }
+  }
+  if (n >= OpenROBO_subsystemTable.infosSize) {
+    return OpenROBO_Return_Error;
+  }
+
+  // TaskPlannerが同じホストにあれば以降は共有メモリで送受信する
+  if (OpenROBO_hasCapability(&OpenROBO_subsystemTable.infos[n], OPENROBO_CAPABILITY_SHM)) {
+    res = OpenROBO_Shm_offer(sock, &s->shm);
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_sockList_deleteBySocketCom(sock);
+      return res;
+    }
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Socket_AcceptConnection(uint16_t port, const char* const ids[])
+{
+  int res;
+
+  if (!OpenROBO_isMainThread) {
+    return OpenROBO_Return_Error;
+  }
+
+  SocketCom acceptSock = SOCKETCOM_INITIALIZER;
+  res = SocketCom_Create(&acceptSock);
+  if (res != SOCKETCOM_SUCCESS) {
+    return OpenROBO_Return_Error;
+  }
+  res = SocketCom_SetReuseaddr(&acceptSock);
+  if (res != SOCKETCOM_SUCCESS) {
+    return res;
+  }
+  res = SocketCom_Listen(&acceptSock, port);
+  if (res != SOCKETCOM_SUCCESS) {
+    SocketCom_Dispose(&acceptSock);
+    return OpenROBO_Return_Error;
+  }
+
+  OpenROBO_setSubsystemSID(&OpenROBO_subsystemTable.infos[0], 0);
+  while (!OpenROBO_hasSubsystemInfos(ids)) {
+    size_t n = OpenROBO_subsystemTable.infosSize;
+    OpenROBO_subsystemTable_info_t *info;
+    SocketCom *sock;
+    if (n >= OPENROBO_AGENTS_COMMECTION_MAX) {
+      DBGABORT();
+      SocketCom_Dispose(&acceptSock);
+      return OpenROBO_Return_Error;
+    }
+    info = &OpenROBO_subsystemTable.infos[n];
+    OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
+    if (s == NULL) {
+      DBGABORT();
+      return OpenROBO_Return_Error;
+    }
+    sock = &s->sock;
+
+    res = SocketCom_Accept(&acceptSock, sock);
+    if (res != SOCKETCOM_SUCCESS) {
+      SocketCom_Dispose(&acceptSock);
+      return OpenROBO_Return_Error;
+    }
+    OpenROBO_sockList_registerSocket(s);
+    res = OpenROBO_Poller_add(s);
+    if (res != OpenROBO_Return_Success) {
+      SocketCom_Dispose(&acceptSock);
+      return res;
+    }
+
+    res = OpenROBO_Socket_recvSelfInfo(sock, info);
+    if (res != OpenROBO_Return_Success) {
+      if (res == OpenROBO_Return_Disconnected) {
+        continue; //retry to accept
+      }
+      DBGABORT();
+      SocketCom_Dispose(&acceptSock);
+      return OpenROBO_Return_Error;
+    }
+    if (OpenROBO_hasSubsystemInfo(info->id)) {
+      DBGPRINTF("Error: Double Connection <%s>@%s\n", info->id, info->ip);
+      DBGABORT();
+      return OpenROBO_Return_Error;
+    }
+    OpenROBO_sockList_bindID(s, info->id);
+    s->framing = OpenROBO_negotiateFraming(info->capabilities);
+    s->paramEncoding = OpenROBO_negotiateParamEncoding(info);
+    OpenROBO_setSubsystemSID(info, (uint16_t)n);
+    OpenROBO_sockList_negotiateRouting(s, info);
+    DBGPRINTF("Got info: <%s>(%s:%d) SID=%d\n", info->id, info->ip, info->port, info->sid);
+
+    OpenROBO_subsystemTable.infosSize++;
+  }
+
+  DBGPRINTF("Completed to Get ALL Connection Information\n");
+
+  for (size_t i = 0; i < OpenROBO_sockList.size; i++) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList.items[i];
+    SocketCom *sock = &s->sock;
+
+    res = OpenROBO_Socket_sendConnectionInfos(sock, OpenROBO_findSubsystemInfoByThreadID(s->id));
+    if (res == OpenROBO_Return_Success && OpenROBO_hasCapability(OpenROBO_findSubsystemInfoByThreadID(s->id), OPENROBO_CAPABILITY_SHM)) {
+      res = OpenROBO_Shm_accept(sock, &s->shm);
+    }
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_sockList_deleteAll();
+      DBGABORT();
+      return OpenROBO_Return_Error;
+    }
+  }
+
+  SocketCom_Dispose(&acceptSock);
+
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Socket_SetParamEncoding(const char* subsystemID, int encoding)
+{
+  size_t i;
+  OpenROBO_subsystemTable_info_t *info = OpenROBO_findSubsystemInfoByThreadID(subsystemID);
+  if (info == NULL) {
+    return OpenROBO_Return_NoValue;
+  }
+  info->forceTextParam = encoding == OpenROBO_ParamEncoding_Text;
+
+  // 既に接続しているsocketにも反映する
+  for (i = 0; i < OpenROBO_sockList.size; i++) {
+    OpenROBO_sockList_t *p = OpenROBO_sockList.items[i];
+    if (OpenROBO_findSubsystemInfoByThreadID(p->id) == info) {
+      p->paramEncoding = OpenROBO_negotiateParamEncoding(info);
+    }
+  }
+
+  return OpenROBO_Return_Success;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Channel
+
+   接続した側のchannel。
+   同じプロセスのスレッドは相手のエージェントごとにcarrierを共有し、スレッドごとにchannelを開く。
+   carrierから受信するスレッドは1つだけで、読んだframeをchannel IDで振り分けてそのchannelのキューに入れる。
+   自分宛てのメッセージを待っているスレッドのうち、他に受信しているスレッドがなければそのスレッドが受信する。
+   OpenROBO_Asyncで複数の接続をまとめて待っているスレッドには、channelに入れたときにwakeFdで知らせる。
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_channelItem {
+  struct _OpenROBO_channelItem *next;
+  size_t size; // 0は終了要求
+  char message[1];
+} OpenROBO_channelItem_t;
+
+typedef struct _OpenROBO_channel {
+  uint32_t id;
+  struct _OpenROBO_carrier *carrier;
+  OpenROBO_channelItem_t *head;
+  OpenROBO_channelItem_t *tail;
+  int wakeFd; // OpenROBO_Asyncで待っているスレッドのeventfd(待っていなければ-1)
+  struct _OpenROBO_channel *next;
+} OpenROBO_channel_t;
+
+typedef struct _OpenROBO_carrier {
+  char peerID[OPENROBO_SUBSYSTEM_ID_SIZE];
+  SocketCom sock;
+  OpenROBO_shm_t *shm;
+  OpenROBO_Mutex_t sendMutex;
+  OpenROBO_Mutex_t mutex; // channels, reading, disconnected, 各channelのキュー
+  OpenROBO_Cond_t cond;
+  int reading;
+  int disconnected;
+  uint32_t nextChannelID;
+  size_t channelsSize;
+  OpenROBO_channel_t *channels;
+  struct _OpenROBO_carrier *next;
+} OpenROBO_carrier_t;
+
+static OpenROBO_Mutex_t OpenROBO_carriersMutex;
+static OpenROBO_carrier_t *OpenROBO_carriers = NULL;
+
+static void OpenROBO_Channel_startup(void)
+{
+  static int initialized = 0;
+  if (initialized) {
+    return;
+  }
+  OpenROBO_Mutex_init(&OpenROBO_carriersMutex);
+  initialized = 1;
+}
+
+/*
+   channelを待っているスレッドに知らせる(carrier->mutexを取ってから呼ぶ)
+*/
+static void OpenROBO_Channel_wake(OpenROBO_channel_t* ch)
+{
+#if OPENROBO_ASYNC_POLL_ENABLE
+  uint64_t one = 1;
+  ssize_t n;
+  if (ch->wakeFd < 0) {
+    return;
+  }
+  do {
+    n = write(ch->wakeFd, &one, sizeof(one));
+  } while (n < 0 && errno == EINTR);
+#else
+  (void)ch;
+#endif
+}
+
+static OpenROBO_carrier_t* OpenROBO_Carrier_connect(const OpenROBO_subsystemTable_info_t* peer)
+{
+  int res;
+  char firstMessage[OPENROBO_SUBSYSTEM_ID_SIZE+1];
+  OpenROBO_carrier_t *carrier = (OpenROBO_carrier_t *)OpenROBO_malloc(sizeof(OpenROBO_carrier_t));
+  if (carrier == NULL) {
+    return NULL;
+  }
+
+  SocketCom_Init(&carrier->sock);
+  res = OpenROBO_Socket_connectPeer(&carrier->sock, peer);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_free(carrier);
+    return NULL;
+  }
+  firstMessage[0] = (char)OPENROBO_FRAME_MAGIC_CARRIER;
+  strcpy(&firstMessage[1], OpenROBO_selfSubsystemName);
+  res = SocketCom_Send(&carrier->sock, firstMessage, strlen(firstMessage)+1);
+  if (res != SOCKETCOM_SUCCESS) {
+    SocketCom_Dispose(&carrier->sock);
+    OpenROBO_free(carrier);
+    return NULL;
+  }
+  carrier->shm = NULL;
+  if (OpenROBO_hasCapability(peer, OPENROBO_CAPABILITY_SHM)) {
+    res = OpenROBO_Shm_offer(&carrier->sock, &carrier->shm);
+    if (res != OpenROBO_Return_Success) {
+      SocketCom_Dispose(&carrier->sock);
+      OpenROBO_free(carrier);
+      return NULL;
+    }
+  }
+
+  strcpy(carrier->peerID, peer->id);
+  OpenROBO_Mutex_init(&carrier->sendMutex);
+  OpenROBO_Mutex_init(&carrier->mutex);
+  OpenROBO_Cond_init(&carrier->cond);
+  carrier->reading = 0;
+  carrier->disconnected = 0;
+  carrier->nextChannelID = 0;
+  carrier->channelsSize = 0;
+  carrier->channels = NULL;
+  carrier->next = NULL;
+
+  return carrier;
+}
+
+static void OpenROBO_Carrier_dispose(OpenROBO_carrier_t* carrier)
+{
+  SocketCom_Dispose(&carrier->sock);
+  OpenROBO_Shm_close(carrier->shm);
+#if defined(_OPENROBO_WIN32_)
+  DeleteCriticalSection(&carrier->sendMutex);
+  DeleteCriticalSection(&carrier->mutex);
+#else
+  pthread_mutex_destroy(&carrier->sendMutex);
+  pthread_mutex_destroy(&carrier->mutex);
+  pthread_cond_destroy(&carrier->cond);
+#endif
+  OpenROBO_free(carrier);
+}
+
+/*
+   carrierの受信をやめて、待っているスレッドに知らせる(carrier->mutexを取ってから呼ぶ)
+   OpenROBO_Asyncで待っているスレッドは受信するスレッドがいなくなったことも知る必要があるので、全てのchannelに知らせる
+*/
+static void OpenROBO_Carrier_release(OpenROBO_carrier_t* carrier)
+{
+  OpenROBO_channel_t *ch;
+  carrier->reading = 0;
+  for (ch = carrier->channels; ch != NULL; ch = ch->next) {
+    OpenROBO_Channel_wake(ch);
+  }
+  OpenROBO_Cond_broadcast(&carrier->cond);
+}
+
+/*
+   carrierからframeを1つ受信してchannelに振り分ける(carrier->mutexを取ってから呼ぶ)
+   受信している間はmutexを放す
+*/
+static int OpenROBO_Carrier_pump(OpenROBO_carrier_t* carrier)
+{
+  int res;
+  size_t size;
+  uint8_t flags = 0;
+  uint32_t channelID = 0;
+  OpenROBO_channelItem_t *item = NULL;
+  OpenROBO_channel_t *ch;
+
+  carrier->reading = 1;
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  res = OpenROBO_Socket_recvFrameHeader(&carrier->sock, carrier->shm, &size, &flags, &channelID, NULL);
+  if (res == OpenROBO_Return_Success && !(flags & OPENROBO_FRAME_FLAG_CHANNEL)) {
+    res = OpenROBO_Return_Error;
+  }
+  if (res == OpenROBO_Return_Success) {
+    if (flags & OPENROBO_FRAME_FLAG_STOP) {
+      size = 0;
+    } else if (size == 0) {
+      res = OpenROBO_Return_Error;
+    }
+  }
+  if (res == OpenROBO_Return_Success) {
+    item = (OpenROBO_channelItem_t *)OpenROBO_malloc(offsetof(OpenROBO_channelItem_t, message) + (size > 0 ? size : 1));
+    if (item == NULL) {
+      res = OpenROBO_Return_Error;
+    } else {
+      item->next = NULL;
+      item->size = size;
+      if (size > 0) {
+        res = OpenROBO_Socket_recvBody(&carrier->sock, carrier->shm, item->message, size);
+      }
+    }
+  }
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_free(item);
+    carrier->disconnected = 1;
+  } else {
+    for (ch = carrier->channels; ch != NULL; ch = ch->next) {
+      if (ch->id == channelID) {
+        break;
+      }
+    }
+    if (ch == NULL) { // 既に閉じたchannel
+      OpenROBO_free(item);
+    } else {
+      if (ch->tail == NULL) {
+        ch->head = item;
+      } else {
+        ch->tail->next = item;
+      }
+      ch->tail = item;
+    }
+  }
+  OpenROBO_Carrier_release(carrier);
+
+  return res;
+}
+
+/*
+   受信の期限があれば、carrierにframeが届くまで期限まで待つ(carrier->mutexを取ってから呼ぶ)
+   待つ間はmutexを放し、readingを立てて他のスレッドには受信させない
+   @retval OpenROBO_Return_Timeout 期限までに届かなかった(他のスレッドが受信を引き継ぐ)
+*/
+static int OpenROBO_Carrier_waitRecvable(OpenROBO_carrier_t* carrier)
+{
+  int res;
+  if (OpenROBO_Socket_recvDeadline <= 0.0) {
+    return OpenROBO_Return_Success;
+  }
+  carrier->reading = 1;
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+  res = OpenROBO_Socket_waitRecvable(&carrier->sock, carrier->shm);
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  if (res == OpenROBO_Return_Timeout) {
+    OpenROBO_Carrier_release(carrier);
+    return res;
+  }
+  carrier->reading = 0;
+  return OpenROBO_Return_Success;
+}
+
+static OpenROBO_channelItem_t* OpenROBO_Channel_pop(OpenROBO_channel_t* ch)
+{
+  OpenROBO_channelItem_t *item = ch->head;
+  if (item != NULL) {
+    ch->head = item->next;
+    if (ch->head == NULL) {
+      ch->tail = NULL;
+    }
+  }
+  return item;
+}
+
+/*
+   キューの先頭にある終了要求を取り除く(carrier->mutexを取ってから呼ぶ)
+   @retval 1 終了要求があった
+*/
+static int OpenROBO_Channel_popStops(OpenROBO_channel_t* ch)
+{
+  int stopped = 0;
+  while (ch->head != NULL && ch->head->size == 0) {
+    OpenROBO_free(OpenROBO_Channel_pop(ch));
+    OpenROBO_Thread_workingFlag = 0;
+    stopped = 1;
+  }
+  return stopped;
+}
+
+static OpenROBO_channel_t* OpenROBO_Channel_open(const OpenROBO_subsystemTable_info_t* peer)
+{
+  int res;
+  size_t carriersSize = 0;
+  OpenROBO_carrier_t *carrier = NULL, *p;
+  OpenROBO_channel_t *ch = (OpenROBO_channel_t *)OpenROBO_malloc(sizeof(OpenROBO_channel_t));
+  if (ch == NULL) {
+    return NULL;
+  }
+  ch->head = NULL;
+  ch->tail = NULL;
+  ch->wakeFd = -1;
+
+  // channelの一番少ないcarrierを使う(OPENROBO_CHANNEL_CONNECTIONS_PER_PEERまでは空いていなければ増やす)
+  OpenROBO_Mutex_lock(&OpenROBO_carriersMutex);
+  for (p = OpenROBO_carriers; p != NULL; p = p->next) {
+    if (p->disconnected || strcmp(p->peerID, peer->id) != 0) {
+      continue;
+    }
+    carriersSize++;
+    if (carrier == NULL || p->channelsSize < carrier->channelsSize) {
+      carrier = p;
+    }
+  }
+  if (carrier == NULL || (carrier->channelsSize > 0 && carriersSize < OPENROBO_CHANNEL_CONNECTIONS_PER_PEER)) {
+    p = OpenROBO_Carrier_connect(peer);
+    if (p != NULL) {
+      p->next = OpenROBO_carriers;
+      OpenROBO_carriers = p;
+      carrier = p;
+    }
+  }
+  if (carrier == NULL) {
+    OpenROBO_Mutex_unlock(&OpenROBO_carriersMutex);
+    OpenROBO_free(ch);
+    return NULL;
+  }
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  ch->id = carrier->nextChannelID++;
+  ch->carrier = carrier;
+  ch->next = carrier->channels;
+  carrier->channels = ch;
+  carrier->channelsSize++;
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+  OpenROBO_Mutex_unlock(&OpenROBO_carriersMutex);
+
+  OpenROBO_Mutex_lock(&carrier->sendMutex);
+  res = OpenROBO_Socket_sendControlFrame(&carrier->sock, carrier->shm, OPENROBO_FRAME_FLAG_OPEN, ch->id, OpenROBO_threadID);
+  OpenROBO_Mutex_unlock(&carrier->sendMutex);
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_Channel_close(ch);
+    return NULL;
+  }
+
+  return ch;
+}
+
+static void OpenROBO_Channel_close(OpenROBO_channel_t* ch)
+{
+  OpenROBO_carrier_t *carrier = ch->carrier;
+  OpenROBO_channel_t **pch;
+  OpenROBO_carrier_t **pcarrier;
+  OpenROBO_channelItem_t *item;
+  int dispose;
+
+  OpenROBO_Mutex_lock(&carrier->sendMutex);
+  if (!carrier->disconnected) {
+    OpenROBO_Socket_sendControlFrame(&carrier->sock, carrier->shm, OPENROBO_FRAME_FLAG_CLOSE, ch->id, NULL);
+  }
+  OpenROBO_Mutex_unlock(&carrier->sendMutex);
+
+  OpenROBO_Mutex_lock(&OpenROBO_carriersMutex);
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  for (pch = &carrier->channels; *pch != NULL; pch = &(*pch)->next) {
+    if (*pch == ch) {
+      *pch = ch->next;
+      break;
+    }
+  }
+  carrier->channelsSize--;
+  dispose = carrier->disconnected && carrier->channelsSize == 0;
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+  if (dispose) {
+    for (pcarrier = &OpenROBO_carriers; *pcarrier != NULL; pcarrier = &(*pcarrier)->next) {
+      if (*pcarrier == carrier) {
+        *pcarrier = carrier->next;
+        break;
+      }
+    }
+  }
+  OpenROBO_Mutex_unlock(&OpenROBO_carriersMutex);
+
+  while ((item = OpenROBO_Channel_pop(ch)) != NULL) {
+    OpenROBO_free(item);
+  }
+  OpenROBO_free(ch);
+  if (dispose) {
+    OpenROBO_Carrier_dispose(carrier);
+  }
+}
+
+static SocketCom* OpenROBO_Channel_getSocket(OpenROBO_channel_t* ch, OpenROBO_Mutex_t** sendMutex, uint32_t* channelID, OpenROBO_shm_t** shm)
+{
+  *sendMutex = &ch->carrier->sendMutex;
+  *channelID = ch->id;
+  *shm = ch->carrier->shm;
+  return &ch->carrier->sock;
+}
+
+static int OpenROBO_Channel_hasPending(OpenROBO_channel_t* ch)
+{
+  int pending;
+  OpenROBO_Mutex_lock(&ch->carrier->mutex);
+  pending = ch->head != NULL;
+  OpenROBO_Mutex_unlock(&ch->carrier->mutex);
+  return pending;
+}
+
+/*
+   channelのメッセージを受信する(メッセージの前にある終了要求はOpenROBO_Thread_workingFlagを落として読み飛ばす)
+*/
+static int OpenROBO_Channel_recv(OpenROBO_channel_t* ch, char **message)
+{
+  int res;
+  OpenROBO_carrier_t *carrier = ch->carrier;
+  OpenROBO_channelItem_t *item;
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  while (1) {
+    OpenROBO_Channel_popStops(ch);
+    if (ch->head != NULL) {
+      break;
+    }
+    if (carrier->disconnected) {
+      OpenROBO_Mutex_unlock(&carrier->mutex);
+      return OpenROBO_Return_Disconnected;
+    }
+    if (!carrier->reading) {
+      res = OpenROBO_Carrier_waitRecvable(carrier);
+      if (res == OpenROBO_Return_Success) {
+        OpenROBO_Carrier_pump(carrier);
+      }
+    } else {
+      res = OpenROBO_Cond_waitUntil(&carrier->cond, &carrier->mutex, OpenROBO_Socket_recvDeadline);
+    }
+    if (res == OpenROBO_Return_Timeout) {
+      OpenROBO_Mutex_unlock(&carrier->mutex);
+      return res;
+    }
+  }
+  item = OpenROBO_Channel_pop(ch);
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  res = OpenROBO_Socket_reserveCommonBuffer(item->size);
+  if (res == OpenROBO_Return_Success) {
+    memcpy(OpenROBO_Message_commonBuffer.p, item->message, item->size);
+    *message = OpenROBO_Message_commonBuffer.p;
+  }
+  OpenROBO_free(item);
+
+  return res;
+}
+
+/*
+   carrierに受信できるデータがあるか(carrier->mutexを取り、他に受信しているスレッドがないときに呼ぶ)
+   共有メモリの場合は溜まったdoorbellも読み捨てる
+*/
+static int OpenROBO_Carrier_isRecvable(OpenROBO_carrier_t* carrier)
+{
+  if (carrier->shm != NULL) {
+    return OpenROBO_Shm_poll(carrier->shm, &carrier->sock) != OpenROBO_Return_NotUpdated;
+  }
+  return SocketCom_IsRecvable(&carrier->sock);
+}
+
+/*
+   channelに届いているメッセージを待たずに取り出す(itemは呼び出し元が解放する)
+   他に受信しているスレッドがなく、carrierに受信できるデータがあればここで受信して振り分ける
+   @retval OpenROBO_Return_NotUpdated まだ届いていない
+*/
+static int OpenROBO_Channel_tryRecv(OpenROBO_channel_t* ch, OpenROBO_channelItem_t** item)
+{
+  int res = OpenROBO_Return_NotUpdated;
+  OpenROBO_carrier_t *carrier = ch->carrier;
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  while (1) {
+    OpenROBO_Channel_popStops(ch);
+    if (ch->head != NULL) {
+      *item = OpenROBO_Channel_pop(ch);
+      res = OpenROBO_Return_Success;
+      break;
+    }
+    if (carrier->disconnected) {
+      res = OpenROBO_Return_Disconnected;
+      break;
+    }
+    if (carrier->reading || !OpenROBO_Carrier_isRecvable(carrier)) {
+      break;
+    }
+    OpenROBO_Carrier_pump(carrier);
+  }
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  return res;
+}
+
+/*
+   OpenROBO_Asyncで待つ間、channelに入ったメッセージをwakeFdで知らせるようにする(-1で止める)
+   @param[out] sock 他に受信しているスレッドがなければcarrierのsocket(呼び出し元が受信可能になるのを待つ)、いればNULL
+   @retval 1 待たずに取り出せる(既にメッセージがある、または切断した)
+*/
+static int OpenROBO_Channel_watch(OpenROBO_channel_t* ch, int wakeFd, SocketCom** sock)
+{
+  int ready;
+  OpenROBO_carrier_t *carrier = ch->carrier;
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  ch->wakeFd = wakeFd;
+  ready = ch->head != NULL || carrier->disconnected;
+  if (sock != NULL) {
+    *sock = NULL;
+    if (!carrier->reading) {
+      *sock = &carrier->sock;
+      if (carrier->shm != NULL && OpenROBO_Shm_rearm(carrier->shm)) {
+        ready = 1;
+      }
+    }
+  }
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  return ready;
+}
+
+static int OpenROBO_Channel_checkWorking(OpenROBO_channel_t* ch)
+{
+  OpenROBO_carrier_t *carrier = ch->carrier;
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  while (!carrier->reading && !carrier->disconnected && (carrier->shm != NULL ? OpenROBO_Shm_pending(carrier->shm) > 0 : SocketCom_IsRecvable(&carrier->sock))) {
+    OpenROBO_Carrier_pump(carrier);
+  }
+  OpenROBO_Channel_popStops(ch);
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  return OpenROBO_Thread_workingFlag;
+}
+
+static int OpenROBO_Channel_waitForStop(OpenROBO_channel_t* ch)
+{
+  int res = OpenROBO_Return_Success;
+  OpenROBO_carrier_t *carrier = ch->carrier;
+
+  OpenROBO_Mutex_lock(&carrier->mutex);
+  while (1) {
+    if (OpenROBO_Channel_popStops(ch)) {
+      break;
+    }
+    if (ch->head != NULL || carrier->disconnected) { // unknown condition / fatal error
+      DBGABORT();
+      OpenROBO_Thread_workingFlag = 0;
+      res = OpenROBO_Return_Error;
+      break;
+    }
+    if (!carrier->reading) {
+      res = OpenROBO_Carrier_waitRecvable(carrier);
+      if (res == OpenROBO_Return_Success) {
+        OpenROBO_Carrier_pump(carrier);
+      }
+    } else {
+      res = OpenROBO_Cond_waitUntil(&carrier->cond, &carrier->mutex, OpenROBO_Socket_recvDeadline);
+    }
+    if (res == OpenROBO_Return_Timeout) {
+      break;
+    }
+  }
+  OpenROBO_Mutex_unlock(&carrier->mutex);
+
+  return res;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Async
+
+   オペレーションスレッドから返答を待たずにCommand Messageを送り、返答はhandleで受け取る。
+   handleはスレッドごとの一覧に送った順に並べ、届いた返答は同じ送り先で"#seq"が一致するhandleに渡す。
+   返答に"#seq"がなければ(OPENROBO_CAPABILITY_SEQを持たない相手)、同じ送り先でsubjectが一致する一番古い未完了のhandleに渡す。
+   Return Messageでないもの、どのhandleとも一致しない返答は読み捨てる。
+   待つときは未完了のhandleの送り先の接続をまとめて1回のpoll()で待つ。
+   channelのcarrierを他のスレッドが受信している間は、そのスレッドがchannelに入れたときにwakeFd(eventfd)で知らされる。
+   OPENROBO_ASYNC_POLL_ENABLEでない環境ではOPENROBO_ASYNC_SLICE_MSECごとに確かめ直す。
+   返答が届く前に解放されたhandleは、後から届く返答を読み捨てるために届くまで一覧に残す。
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+typedef struct _OpenROBO_asyncCommand {
+  struct _OpenROBO_asyncCommand *next;
+  uint32_t destinationHandle; // 送り先のhandle(OpenROBO_Intern)
+  uint32_t seq;               // 送ったCommand Messageの"#seq"(0は付けていない)
+  char subject[OPENROBO_FUNCTION_NAME_SIZE];
+  int result;                 // 返答が届くまではOpenROBO_Return_NotUpdated
+  int released;
+  void *block;                // 返答を持っているメモリ(channelの項目または複製)
+  char *message;
+} OpenROBO_asyncCommand_t;
+
+static _Thread_local OpenROBO_asyncCommand_t *OpenROBO_asyncHead = NULL;
+static _Thread_local OpenROBO_asyncCommand_t *OpenROBO_asyncTail = NULL;
+#if OPENROBO_ASYNC_POLL_ENABLE
+static _Thread_local int OpenROBO_asyncWakeFd = -1;
+#endif
+
+static void OpenROBO_Async_free(OpenROBO_asyncCommand_t *cmd)
+{
+  OpenROBO_asyncCommand_t **p, *prev = NULL;
+  for (p = &OpenROBO_asyncHead; *p != NULL; prev = *p, p = &(*p)->next) {
+    if (*p == cmd) {
+      *p = cmd->next;
+      if (OpenROBO_asyncTail == cmd) {
+        OpenROBO_asyncTail = prev;
+      }
+      break;
+    }
+  }
+  OpenROBO_Intern_release(cmd->destinationHandle);
+  OpenROBO_free(cmd->block);
+  OpenROBO_free(cmd);
+}
+
+/*
+   スレッドの全てのhandleを解放する(オペレーション関数の終了時に呼ぶ)
+*/
+static void OpenROBO_Async_releaseAll(void)
+{
+  while (OpenROBO_asyncHead != NULL) {
+    OpenROBO_Async_free(OpenROBO_asyncHead);
+  }
+}
+
+static void OpenROBO_Async_term(void)
+{
+  OpenROBO_Async_releaseAll();
+#if OPENROBO_ASYNC_POLL_ENABLE
+  if (OpenROBO_asyncWakeFd >= 0) {
+    close(OpenROBO_asyncWakeFd);
+    OpenROBO_asyncWakeFd = -1;
+  }
+#endif
+}
+
+/*
+   返答を待っているhandleをresultで終える(返答が届く前に接続が切れた場合など)
+*/
+static void OpenROBO_Async_fail(uint32_t destinationHandle, int result)
+{
+  OpenROBO_asyncCommand_t *cmd, *next;
+  for (cmd = OpenROBO_asyncHead; cmd != NULL; cmd = next) {
+    next = cmd->next;
+    if (cmd->result != OpenROBO_Return_NotUpdated || cmd->destinationHandle != destinationHandle) {
+      continue;
+    }
+    cmd->result = result;
+    if (cmd->released) {
+      OpenROBO_Async_free(cmd);
+    }
+  }
+}
+
+/*
+   sから届いた返答をhandleに渡す(blockは渡した先で解放する)
+*/
+static void OpenROBO_Async_complete(OpenROBO_sockList_t *s, void *block, char *message)
+{
+  OpenROBO_asyncCommand_t *cmd, *found = NULL;
+  OpenROBO_MessageView_t view;
+  const char *subject = NULL;
+  size_t subjectSize = 0;
+  uint32_t seq = 0;
+
+  if (OpenROBO_MessageView_Parse(&view, message) == OpenROBO_Return_Success && view.type == OpenROBO_MessageType_Return) {
+    seq = OpenROBO_MessageView_getSeq(&view);
+    if (OpenROBO_MessageView_GetSubject(&view, &subject, &subjectSize) != OpenROBO_Return_Success) {
+      subject = NULL;
+    }
+  }
+  // "#seq"を返す相手から"#seq"のない返答が届いても、どのhandleへの返答でもない
+  for (cmd = OpenROBO_asyncHead; subject != NULL && (seq != 0 || !s->seqEnabled) && cmd != NULL; cmd = cmd->next) {
+    if (cmd->result != OpenROBO_Return_NotUpdated || cmd->destinationHandle != s->handle) {
+      continue;
+    }
+    if (seq != 0) {
+      // 解放済み・期限切れのhandleへの返答も"#seq"で見分ける
+      if (cmd->seq == seq) {
+        found = cmd;
+        break;
+      }
+      continue;
+    }
+    if (strlen(cmd->subject) == subjectSize && memcmp(cmd->subject, subject, subjectSize) == 0) {
+      found = cmd;
+      break;
+    }
+  }
+  if (found == NULL) {
+    DBGPRINTF("warning: unexpected return message from <%s>\n", s->id);
+    OpenROBO_free(block);
+    return;
+  }
+
+  found->result = OpenROBO_Return_Success;
+  found->block = block;
+  found->message = message;
+  if (found->released) {
+    OpenROBO_Async_free(found);
+  }
+}
+
+/*
+   sに届いている返答を待たずに全て受け取る(購読の値はsの待ち行列に入れる)
+   @retval OpenROBO_Return_NotUpdated 全て受け取った
+   @retval それ以外 受信に失敗した(待っているhandleはその結果で終わる)
+*/
+static int OpenROBO_Async_drain(OpenROBO_sockList_t *s)
+{
+  int res;
+  void *block = NULL;
+  char *message = NULL;
+
+  while (1) {
+    if (s->channel != NULL) {
+      OpenROBO_channelItem_t *item = NULL;
+      res = OpenROBO_Channel_tryRecv(s->channel, &item);
+      if (res == OpenROBO_Return_Success) {
+        block = item;
+        message = item->message;
+      }
+    } else {
+      if (s->shm != NULL) {
+        res = OpenROBO_Shm_poll(s->shm, &s->sock);
+      } else {
+        res = SocketCom_IsRecvable(&s->sock) ? OpenROBO_Return_Success : OpenROBO_Return_NotUpdated;
+      }
+      if (res == OpenROBO_Return_Success) {
+        res = OpenROBO_Socket_recvMessage(s, &message);
+      }
+      if (res == OpenROBO_Return_Success) {
+        // 共通バッファは次の受信で上書きされるので複製する
+        size_t size = OpenROBO_Message_measure(message, SIZE_MAX, NULL) + 1;
+        block = OpenROBO_malloc(size);
+        if (block == NULL) {
+          res = OpenROBO_Return_Error;
+        } else {
+          memcpy(block, message, size);
+          message = (char *)block;
+        }
+      }
+    }
+    if (res == OpenROBO_Return_NotUpdated) {
+      return res;
+    }
+    if (res != OpenROBO_Return_Success) {
+      OpenROBO_Async_fail(s->handle, res);
+      return res;
+    }
+    if (OpenROBO_Socket_queuePush(s, message)) {
+      OpenROBO_free(block);
+      continue;
+    }
+    OpenROBO_Socket_receivedReturn(s);
+    OpenROBO_Async_complete(s, block, message);
+  }
+}
+
+/*
+   handlesのうち返答を待っているものの送り先の接続を重複なくconnsに集める
+*/
+static size_t OpenROBO_Async_collect(const OpenROBO_AsyncHandle_t handles[], size_t n, OpenROBO_sockList_t **conns)
+{
+  size_t i, j, connsSize = 0;
+  for (i = 0; i < n; i++) {
+    OpenROBO_sockList_t *s;
+    if (handles[i] == NULL || handles[i]->result != OpenROBO_Return_NotUpdated) {
+      continue;
+    }
+    s = OpenROBO_sockList_findByHandle(handles[i]->destinationHandle);
+    if (s == NULL) {
+      OpenROBO_Async_fail(handles[i]->destinationHandle, OpenROBO_Return_NonConnection);
+      continue;
+    }
+    for (j = 0; j < connsSize && conns[j] != s; j++) {
+    }
+    if (j == connsSize) {
+      conns[connsSize++] = s;
+    }
+  }
+  return connsSize;
+}
+
+/*
+   @retval 1 WaitAny(all=0)ではいずれか、WaitAll(all=1)では全てのhandleが終わった
+*/
+static int OpenROBO_Async_isDone(const OpenROBO_AsyncHandle_t handles[], size_t n, int all, size_t *index)
+{
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (handles[i] == NULL) {
+      continue;
+    }
+    if (handles[i]->result == OpenROBO_Return_NotUpdated) {
+      if (all) {
+        return 0;
+      }
+    } else if (!all) {
+      if (index != NULL) {
+        *index = i;
+      }
+      return 1;
+    }
+  }
+  return all;
+}
+
+/*
+   connsのいずれかに受信できるデータが届くまで最大waitMsec[msec]待つ(負の値は無期限)
+   @param[in] fds connsSize+1個分の作業領域
+*/
+static void OpenROBO_Async_block(OpenROBO_sockList_t **conns, size_t connsSize, int waitMsec, void *fds)
+{
+#if OPENROBO_ASYNC_POLL_ENABLE
+  struct pollfd *pfds = (struct pollfd *)fds;
+  size_t i;
+  nfds_t nfds = 0;
+  int n, ready = 0, busy = 0;
+
+  if (OpenROBO_asyncWakeFd < 0) {
+    OpenROBO_asyncWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  }
+  for (i = 0; i < connsSize; i++) {
+    SocketCom *sock;
+    if (conns[i]->channel != NULL) {
+      ready |= OpenROBO_Channel_watch(conns[i]->channel, OpenROBO_asyncWakeFd, &sock);
+      busy |= sock == NULL;
+    } else {
+      sock = &conns[i]->sock;
+      ready |= conns[i]->shm != NULL && OpenROBO_Shm_rearm(conns[i]->shm);
+    }
+    if (sock != NULL) {
+      pfds[nfds].fd = OpenROBO_SocketCom_getDescriptor(sock);
+      pfds[nfds].events = POLLIN;
+      nfds++;
+    }
+  }
+  if (OpenROBO_asyncWakeFd >= 0) {
+    pfds[nfds].fd = OpenROBO_asyncWakeFd;
+    pfds[nfds].events = POLLIN;
+    nfds++;
+  } else if (busy && (waitMsec < 0 || waitMsec > OPENROBO_ASYNC_SLICE_MSEC)) {
+    // eventfdが使えなければ他のスレッドが受信しているcarrierは短い間隔で確かめ直す
+    waitMsec = OPENROBO_ASYNC_SLICE_MSEC;
+  }
+
+  if (!ready) {
+    do {
+      n = poll(pfds, nfds, waitMsec);
+    } while (n < 0 && errno == EINTR);
+  }
+
+  if (OpenROBO_asyncWakeFd >= 0) {
+    uint64_t count;
+    while (read(OpenROBO_asyncWakeFd, &count, sizeof(count)) < 0 && errno == EINTR) {
+    }
+  }
+  for (i = 0; i < connsSize; i++) {
+    if (conns[i]->channel != NULL) {
+      OpenROBO_Channel_watch(conns[i]->channel, -1, NULL);
+    }
+  }
+#else
+  (void)conns;
+  (void)connsSize;
+  (void)fds;
+  if (waitMsec < 0 || waitMsec > OPENROBO_ASYNC_SLICE_MSEC) {
+    waitMsec = OPENROBO_ASYNC_SLICE_MSEC;
+  }
+#if defined(_OPENROBO_WIN32_)
+  Sleep((DWORD)waitMsec);
+#else
+  usleep((useconds_t)waitMsec * 1000);
+#endif
+#endif
+}
+
+static int OpenROBO_Async_wait(const OpenROBO_AsyncHandle_t handles[], size_t n, int all, int timeoutMsec, size_t *index)
+{
+  int res = OpenROBO_Return_Success;
+  double deadline = OpenROBO_getMonotonicTime() + (double)timeoutMsec / 1000.0;
+  OpenROBO_sockList_t **conns;
+  void *fds;
+  size_t connsSize, i;
+
+  if (OpenROBO_isMainThread || handles == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  conns = (OpenROBO_sockList_t **)OpenROBO_malloc(sizeof(OpenROBO_sockList_t *)*(n + 1));
+#if OPENROBO_ASYNC_POLL_ENABLE
+  fds = OpenROBO_malloc(sizeof(struct pollfd)*(n + 1));
+#else
+  fds = OpenROBO_malloc(1);
+#endif
+  if (conns == NULL || fds == NULL) {
+    OpenROBO_free(conns);
+    OpenROBO_free(fds);
+    return OpenROBO_Return_Error;
+  }
+
+  while (1) {
+    int waitMsec = -1;
+    connsSize = OpenROBO_Async_collect(handles, n, conns);
+    for (i = 0; i < connsSize; i++) {
+      OpenROBO_Async_drain(conns[i]);
+    }
+    if (OpenROBO_Async_isDone(handles, n, all, index)) {
+      break;
+    }
+    if (connsSize == 0) { // 待つhandleがない
+      res = OpenROBO_Return_Error;
+      break;
+    }
+    if (timeoutMsec >= 0) {
+      double rest = deadline - OpenROBO_getMonotonicTime();
+      if (rest <= 0.0) {
+        res = OpenROBO_Return_Timeout;
+        break;
+      }
+      waitMsec = (int)(rest * 1000.0) + 1;
+    }
+    OpenROBO_Async_block(conns, connsSize, waitMsec, fds);
+  }
+
+  OpenROBO_free(conns);
+  OpenROBO_free(fds);
+  return res;
+}
+
+/*
+   Command Messageを送る前にhandleを作る(送れた場合にOpenROBO_Async_commit()で一覧に入れる)
+*/
+static OpenROBO_asyncCommand_t* OpenROBO_Async_new(const char* destinationID, const char* subject)
+{
+  OpenROBO_asyncCommand_t *cmd;
+
+  if (OpenROBO_isMainThread || destinationID == NULL) {
+    return NULL;
+  }
+  cmd = (OpenROBO_asyncCommand_t *)OpenROBO_malloc(sizeof(OpenROBO_asyncCommand_t));
+  if (cmd == NULL) {
+    return NULL;
+  }
+  cmd->next = NULL;
+  cmd->destinationHandle = OpenROBO_Intern_add(destinationID, strlen(destinationID));
+  cmd->seq = 0;
+  cmd->result = OpenROBO_Return_NotUpdated;
+  cmd->released = 0;
+  cmd->block = NULL;
+  cmd->message = NULL;
+  strncpy(cmd->subject, subject, sizeof(cmd->subject) - 1);
+  cmd->subject[sizeof(cmd->subject) - 1] = '\0';
+  if (cmd->destinationHandle == OPENROBO_HANDLE_NONE) {
+    OpenROBO_free(cmd);
+    return NULL;
+  }
+  return cmd;
+}
+
+static OpenROBO_asyncCommand_t* OpenROBO_Async_create(const char* destinationID, const char* message)
+{
+  char subject[OPENROBO_FUNCTION_NAME_SIZE] = "";
+  OpenROBO_MessageView_t view;
+
+  if (OpenROBO_MessageView_Parse(&view, message) == OpenROBO_Return_Success) {
+    OpenROBO_MessageView_CopyString(&view, OpenROBO_Message_paramName_subject, subject, sizeof(subject));
+  }
+  return OpenROBO_Async_new(destinationID, subject);
+}
+
+static int OpenROBO_Async_commit(OpenROBO_asyncCommand_t *cmd, int res, OpenROBO_AsyncHandle_t *handle)
+{
+  if (res != OpenROBO_Return_Success) {
+    OpenROBO_Async_free(cmd);
+    return res;
+  }
+  if (OpenROBO_asyncTail == NULL) {
+    OpenROBO_asyncHead = cmd;
+  } else {
+    OpenROBO_asyncTail->next = cmd;
+  }
+  OpenROBO_asyncTail = cmd;
+  *handle = cmd;
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Socket_SendCommandMessageAsync(const char* destinationID, char* message, OpenROBO_AsyncHandle_t *handle)
+{
+  OpenROBO_asyncCommand_t *cmd;
+  if (handle == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  *handle = NULL;
+  cmd = OpenROBO_Async_create(destinationID, message);
+  if (cmd == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Async_commit(cmd, OpenROBO_Socket_sendCommandMessage(destinationID, message, &cmd->seq), handle);
+}
+
+int OpenROBO_Socket_SendCommandMessageAsync(const char* destinationID, OpenROBO_MessageBuilder_t *builder, OpenROBO_AsyncHandle_t *handle)
+{
+  OpenROBO_asyncCommand_t *cmd;
+  if (handle == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  *handle = NULL;
+  cmd = OpenROBO_Async_create(destinationID, builder->p);
+  if (cmd == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Async_commit(cmd, OpenROBO_Socket_sendCommandMessage(destinationID, builder, &cmd->seq), handle);
+}
+
+int OpenROBO_Async_TryGet(OpenROBO_AsyncHandle_t handle, char **message)
+{
+  if (OpenROBO_isMainThread || handle == NULL || handle->released) {
+    return OpenROBO_Return_Error;
+  }
+  if (handle->result == OpenROBO_Return_NotUpdated) {
+    OpenROBO_sockList_t *s = OpenROBO_sockList_findByHandle(handle->destinationHandle);
+    if (s == NULL) {
+      OpenROBO_Async_fail(handle->destinationHandle, OpenROBO_Return_NonConnection);
+    } else {
+      OpenROBO_Async_drain(s);
+    }
+  }
+  if (handle->result == OpenROBO_Return_Success && message != NULL) {
+    *message = handle->message;
+  }
+  return handle->result;
+}
+
+int OpenROBO_Async_WaitAny(const OpenROBO_AsyncHandle_t handles[], size_t n, int timeoutMsec, size_t *index)
+{
+  return OpenROBO_Async_wait(handles, n, 0, timeoutMsec, index);
+}
+
+int OpenROBO_Async_WaitAll(const OpenROBO_AsyncHandle_t handles[], size_t n, int timeoutMsec)
+{
+  return OpenROBO_Async_wait(handles, n, 1, timeoutMsec, NULL);
+}
+
+void OpenROBO_Async_Release(OpenROBO_AsyncHandle_t handle)
+{
+  if (handle == NULL || handle->released) {
+    return;
+  }
+  if (handle->result == OpenROBO_Return_NotUpdated) {
+    handle->released = 1;
+    return;
+  }
+  OpenROBO_Async_free(handle);
+}
+
+/*
+   長さを測り終えた共通部分に送り先ごとの#src、#dst、#seqを後ろに付けて送り、handleを作る
+*/
+static int OpenROBO_Async_sendMeasured(const char* destinationID, const char* message, size_t messageSize, int hasBinary, const char* subject, OpenROBO_AsyncHandle_t *handle)
+{
+  char suffixBuffer[OPENROBO_THREAD_ID_SIZE*2 + 32];
+  OpenROBO_MessageBuilder_t suffix;
+  OpenROBO_asyncCommand_t *cmd;
+  OpenROBO_sockList_t *s;
+  int res;
+
+  *handle = NULL;
+  s = OpenROBO_sockList_findByID(destinationID);
+  if (s == NULL) {
+    s = OpenROBO_sockList_connect(destinationID);
+    if (s == NULL) {
+      return OpenROBO_Return_NonConnection;
+    }
+  }
+  cmd = OpenROBO_Async_new(destinationID, subject);
+  if (cmd == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&suffix, suffixBuffer, sizeof(suffixBuffer));
+  if (OpenROBO_Message_setSourceID(&suffix, OpenROBO_threadID) != OpenROBO_Return_Success ||
+      OpenROBO_Message_setDestinationID(&suffix, destinationID) != OpenROBO_Return_Success) {
+    res = OpenROBO_Return_Error;
+  } else {
+    cmd->seq = OpenROBO_Socket_nextSeq(s, &suffix);
+    res = OpenROBO_Socket_sendMeasuredTo(s, message, messageSize, hasBinary, suffix.p, suffix.size, 0);
+    if (res == OpenROBO_Return_Success) {
+      OpenROBO_Socket_sentCommand(s);
+    }
+  }
+  OpenROBO_MessageBuilder_Term(&suffix);
+  return OpenROBO_Async_commit(cmd, res, handle);
+}
+
+/*
+   OpenROBO_Socket_FanOutStart()の送り先ごとの状態
+*/
+enum {
+  OpenROBO_fanOut_Done,   // returnValuesが決まった
+  OpenROBO_fanOut_Start,  // Start Messageの返答を待っている
+  OpenROBO_fanOut_Wait    // Wait Messageの返答を待っている
+};
+
+int OpenROBO_Socket_FanOutStart(const char *const destinationIDs[], size_t n, OpenROBO_MessageBuilder_t *builder, OpenROBO_JoinMode_t mode, int timeoutMsec, int returnValues[], size_t *index)
+{
+  int res = OpenROBO_Return_Success;
+  double deadline = OpenROBO_getMonotonicTime() + (double)timeoutMsec / 1000.0;
+  char subject[OPENROBO_FUNCTION_NAME_SIZE] = "";
+  char waitBuffer[OPENROBO_FUNCTION_NAME_SIZE + 64];
+  OpenROBO_MessageBuilder_t wait;
+  OpenROBO_MessageView_t view;
+  OpenROBO_AsyncHandle_t *handles;
+  unsigned char *states;
+  size_t messageSize, waitSize, found = n, i;
+  int hasBinary = 0;
+
+  if (index != NULL) {
+    *index = n;
+  }
+  if (OpenROBO_isMainThread || destinationIDs == NULL || n == 0 || builder == NULL || builder->p == NULL || returnValues == NULL ||
+      OpenROBO_Message_GetMessageType(builder->p) != OpenROBO_MessageType_Start ||
+      OpenROBO_MessageView_Parse(&view, builder->p) != OpenROBO_Return_Success ||
+      OpenROBO_MessageView_CopyString(&view, OpenROBO_Message_paramName_subject, subject, sizeof(subject)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  handles = (OpenROBO_AsyncHandle_t *)OpenROBO_malloc(sizeof(OpenROBO_AsyncHandle_t)*n);
+  states = (unsigned char *)OpenROBO_malloc(n);
+  OpenROBO_MessageBuilder_InitWithBuffer(&wait, waitBuffer, sizeof(waitBuffer));
+  if (handles == NULL || states == NULL || OpenROBO_Message_MakeWaitMessage(&wait, subject) != OpenROBO_Return_Success) {
+    OpenROBO_free(handles);
+    OpenROBO_free(states);
+    OpenROBO_MessageBuilder_Term(&wait);
+    return OpenROBO_Return_Error;
+  }
+
+  // 共通部分は1回だけ測り、送り先ごとには#srcと#dstだけを作る
+  messageSize = OpenROBO_Message_measure(builder->p, SIZE_MAX, &hasBinary);
+  waitSize = OpenROBO_Message_measure(wait.p, SIZE_MAX, NULL);
+  for (i = 0; i < n; i++) {
+    returnValues[i] = OpenROBO_Async_sendMeasured(destinationIDs[i], builder->p, messageSize, hasBinary, subject, &handles[i]);
+    states[i] = returnValues[i] == OpenROBO_Return_Success ? OpenROBO_fanOut_Start : OpenROBO_fanOut_Done;
+    if (returnValues[i] == OpenROBO_Return_Success) {
+      returnValues[i] = OpenROBO_Return_NotUpdated;
+    } else if (mode == OpenROBO_JoinMode_FirstError && found == n) {
+      found = i;
+    }
+  }
+
+  while (1) {
+    int pending = 0, waitMsec = -1;
+    for (i = 0; i < n; i++) {
+      int value;
+      if (states[i] == OpenROBO_fanOut_Done || handles[i]->result == OpenROBO_Return_NotUpdated) {
+        pending |= states[i] != OpenROBO_fanOut_Done;
+        continue;
+      }
+      value = handles[i]->result;
+      if (value == OpenROBO_Return_Success) {
+        value = OpenROBO_Return_Error;
+        OpenROBO_Message_GetReturnValue(handles[i]->message, &value);
+      }
+      OpenROBO_Async_Release(handles[i]);
+      handles[i] = NULL;
+      if (states[i] == OpenROBO_fanOut_Start && value == OpenROBO_Return_Success) {
+        // 受け付けられたらWait Messageを送る
+        value = OpenROBO_Async_sendMeasured(destinationIDs[i], wait.p, waitSize, 0, subject, &handles[i]);
+        if (value == OpenROBO_Return_Success) {
+          states[i] = OpenROBO_fanOut_Wait;
+          pending = 1;
+          continue;
+        }
+      } else if (states[i] == OpenROBO_fanOut_Wait && mode == OpenROBO_JoinMode_Any && found == n) {
+        found = i;
+      }
+      if (value != OpenROBO_Return_Success && mode == OpenROBO_JoinMode_FirstError && found == n) {
+        found = i;
+      }
+      returnValues[i] = value;
+      states[i] = OpenROBO_fanOut_Done;
+    }
+    if (found != n) {
+      break;
+    }
+    if (!pending) {
+      if (mode == OpenROBO_JoinMode_Any) { // どのロボット動作関数も返答しなかった
+        res = OpenROBO_Return_Error;
+      }
+      break;
+    }
+    if (timeoutMsec >= 0) {
+      double rest = deadline - OpenROBO_getMonotonicTime();
+      if (rest <= 0.0) {
+        res = OpenROBO_Return_Timeout;
+        break;
+      }
+      waitMsec = (int)(rest * 1000.0) + 1;
+    }
+    // 返答を待っている全ての送り先を1回の待ちでまとめて待つ
+    res = OpenROBO_Async_wait(handles, n, 0, waitMsec, NULL);
+    if (res == OpenROBO_Return_Timeout) {
+      res = OpenROBO_Return_Success;
+    } else if (res != OpenROBO_Return_Success) {
+      break;
+    }
+  }
+
+  // 待ち終えなかった送り先の返答は後から届いても読み捨てる
+  for (i = 0; i < n; i++) {
+    if (states[i] != OpenROBO_fanOut_Done) {
+      OpenROBO_Async_Release(handles[i]);
+    }
+  }
+  if (index != NULL) {
+    *index = found;
+  }
+  OpenROBO_free(handles);
+  OpenROBO_free(states);
+  OpenROBO_MessageBuilder_Term(&wait);
+  return res;
+}
+
+int OpenROBO_Socket_FanOutStart(const char *const destinationIDs[], size_t n, char *message, OpenROBO_JoinMode_t mode, int timeoutMsec, int returnValues[], size_t *index)
+{
+  OpenROBO_MessageBuilder_t builder;
+  if (message == NULL) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  return OpenROBO_Socket_FanOutStart(destinationIDs, n, &builder, mode, timeoutMsec, returnValues, index);
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_Message
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+int OpenROBO_CreateMessage(char* message, const char* funcName, const char* destionationID);
+
+void OpenROBO_Message_GetParam(const char *MessageParameter,const char *vname,...)
+{
+  char *cp,tmp[1000]={0},type[1],*len,*len2;
+  const char *ssp = NULL;
+  double *dp;
+  int *ip,n,i,ci;
+  va_list val;
+  len = (char*)OpenROBO_malloc(strlen(MessageParameter));
+  len2 = (char*)OpenROBO_malloc(strlen(MessageParameter));
+  sprintf(tmp,";%s=",vname);//-- ;変数名=　というフォーマットに合わせて検索
+  ssp = strstr(MessageParameter,tmp);//-- 検索結果のポインタをセット
+
+  if(ssp == NULL){
+    DBGPRINTF("GetPram(): not found \"%s\" in [%s]\n", vname, MessageParameter);
+    assert(ssp != NULL);
+    //		getchar();
+    return;
+  }
+
+  sscanf(ssp,"%[^=]=(%c%d),%[^;]",tmp,&type[0],&n,len);//-- 検索結果を分解して変数型(type)と数(n)、値(len)を読み取る
+  va_start(val,vname);//-- 可変引数のポインタをaにセット
+  if (OpenROBO_Message_binaryElementSize(type[0]) > 0) {
+    // binaryのパラメータは値に'\0'や';'を含むので、文字列としてではなく要素数分の長さで読む
+    OpenROBO_MessageViewEntry_t entry;
+    size_t pos = ssp - MessageParameter;
+    if (OpenROBO_Message_nextParam(MessageParameter, &pos, &entry)) {
+      switch (type[0]) {
+        case 'D':
+          OpenROBO_Message_decodeDoubles(MessageParameter, &entry, va_arg(val, double*), entry.count);
+          break;
+        case 'I':
+          OpenROBO_Message_decodeInts(MessageParameter, &entry, va_arg(val, int*), entry.count);
+          break;
+        case 'B':
+          OpenROBO_Message_decodeBytes(MessageParameter, &entry, va_arg(val, unsigned char*), entry.count);
+          break;
+      }
+    }
+    type[0] = '\0';
+  }
+  switch(type[0]){
+    case 'i':
+      //-- もし、変数のタイプがint型ならint型のポインタに引数ポインタをセット
+      ip = va_arg(val,int*);
+      for(i = 0;i < n;i++){
+        sscanf(len,"%d,%s",(ip + i),len2);
+        strcpy(len,len2);
+      }
+      break;
+    case 'd':
+      dp = va_arg(val,double*);
+      for(i = 0;i < n;i++){
+        sscanf(len,"%lf,%s",(dp + i),len2);
+        strcpy(len,len2);
+      }
+      break;
+    case 'c':
+      cp = va_arg(val,char*);
+      ci = va_arg(val,int);
+      for(i = 0;i < n;i++){
+        sscanf(len,"%[^,],%s",(cp + i*ci),len2);
+        strcpy(len,len2);
+      }
+      break;
+    case 's':
+      cp = va_arg(val,char*);
+      sscanf(len,"%[^,],%s",cp,len2);
+      break;
+    case 'b': {
+                unsigned char* ret;
+                int tmp;
+                ret = va_arg(val, unsigned char*);
+                for (i = 0; i < n; i++) {
+                  sscanf(len, "%x,%s", &tmp, len2);
+                  ret[i] = tmp;
+                  strcpy(len, len2);
+                }
+                break;
+              }
+  }
+  va_end(val);
+  OpenROBO_free((void*)len);
+  OpenROBO_free((void*)len2);
+}
+
+/*
+   binaryのパラメータ("(D16)"など型が大文字)の要素1つ分のサイズ。textのパラメータは0
+*/
+static size_t OpenROBO_Message_binaryElementSize(char type)
+{
+  switch (type) {
+    case 'D':
+      return sizeof(double);
+    case 'I':
+      return sizeof(int32_t);
+    case 'B':
+      return sizeof(uint8_t);
+  }
+  return 0;
+}
+
+/*
+   ";name=(tn),value"の形式のパラメータを1つ読み、posを次のパラメータの先頭(';'または'\0')へ進める
+   ヘッダ("Start;"など)やパラメータの形式になっていない部分は読み飛ばす
+   binaryのパラメータは値を個数分読み飛ばす。sizeを超える場合は読まずに0を返す
+
+   @retval 1 パラメータを読んだ
+   @retval 0 メッセージの終わり
+*/
+static int OpenROBO_Message_nextParamWithin(const char *message, size_t size, size_t *pos, OpenROBO_MessageViewEntry_t *entry)
+{
+  const char *p = &message[*pos];
+
+  while (*p != '\0') {
+    const char *name, *q;
+    uint32_t count = 0;
+    size_t elementSize;
+
+    if (*p != ';') {
+      p++;
+      continue;
+    }
+    name = p + 1;
+    q = name;
+    while (*q != '=' && *q != ';' && *q != '\0') {
+      q++;
+    }
+    if (*q != '=' || q == name || q[1] != '(' || q[2] == '\0') {
+      p = q;
+      continue;
+    }
+    entry->nameOffset = (uint32_t)(name - message);
+    entry->nameSize = (uint32_t)(q - name);
+    entry->type = q[2];
+    q += 3;
+    while (*q >= '0' && *q <= '9') {
+      count = count * 10 + (*q - '0');
+      q++;
+    }
+    if (*q != ')') {
+      p = q;
+      continue;
+    }
+    q++;
+    if (*q == ',') {
+      q++;
+    }
+    entry->count = count;
+    entry->valueOffset = (uint32_t)(q - message);
+    elementSize = OpenROBO_Message_binaryElementSize(entry->type);
+    if (elementSize > 0) {
+      size_t valueSize = elementSize * count;
+      if (size - entry->valueOffset < valueSize) {
+        *pos = p - message;
+        return 0;
+      }
+      q += valueSize;
+    } else {
+      while (*q != ';' && *q != '\0') {
+        q++;
+      }
+    }
+    entry->valueSize = (uint32_t)(q - message) - entry->valueOffset;
 
-  OpenROBO_free((void*)subject);
+    *pos = q - message;
+    return 1;
+  }
 
-  return res;
+  *pos = p - message;
+  return 0;
 }
 
-int OpenROBO_Main(OpenROBO_MessageFunctionEntry_t operationEntry[])
+static int OpenROBO_Message_nextParam(const char *message, size_t *pos, OpenROBO_MessageViewEntry_t *entry)
 {
-  char *message;
-  while (1) {
-    int res;
-    const char *functionName;
-    res = OpenROBO_Socket_ReceiveMessage(&message);
-    if (res != OpenROBO_Return_Success) {
-      if (res == OpenROBO_Return_Disconnected) {
-        DBGPRINTF("Disconnected <%s>\n", message);
-      }
-      return res;
-    }
+  return OpenROBO_Message_nextParamWithin(message, SIZE_MAX, pos, entry);
+}
 
-    switch (OpenROBO_Message_GetMessageType(message)) {
-      case OpenROBO_MessageType_Start:
-      {
-        OpenROBO_MessageFunctionEntry_t *entry;
-        OpenROBO_Message_GetSubject(message, &functionName);
-        entry = OpenROBO_MessageFunctionEntry_Find(operationEntry, functionName);
-        if (entry == NULL) {
-          DBGPRINTF("error: not found \"%s\" at start thread / message:[%s]\n", functionName, message);
-          OpenROBO_free((void*)functionName);
-          res = OpenROBO_Return_Error;
-        } else {
-          OpenROBO_free((void*)functionName);
-          res = OpenROBO_Thread_CreateOperationThread(entry->func, message);
-        }
-        if (res == OpenROBO_Return_Success) {
-          res = OpenROBO_JoinThread_JoinQueue(message);
-        }
-        break;
-      }
-      case OpenROBO_MessageType_Return:
-      {
-        res = OpenROBO_JoinThread_storeThreadReturnMessage(message);
-        break;
-      }
-      case OpenROBO_MessageType_Wait:
-      {
-        res = OpenROBO_JoinThread_JoinQueue(message);
-        break;
-      }
-      case OpenROBO_MessageType_Stop:
-      {
-        res = OpenROBO_sendExitThreadSignal(message);
-        break;
-      }
-      case OpenROBO_MessageType_Read:
-      {
-        res = OpenROBO_ReturnForReadMessage(message);
-        break;
-      }
-      case OpenROBO_MessageType_Write:
-      {
-        res = OpenROBO_StoreWriteMessage(message);
-        break;
-      }
-    }
-    if (res == OpenROBO_Return_Error) {
-      DBGABORT();
-      return res;
+/*
+   パラメータを辿ってメッセージの終端'\0'の位置を求める
+   binaryのパラメータを含む場合はhasBinaryに1を入れる
+*/
+static size_t OpenROBO_Message_measure(const char *message, size_t size, int *hasBinary)
+{
+  size_t pos = 0;
+  OpenROBO_MessageViewEntry_t entry;
+  int binary = 0;
+  while (OpenROBO_Message_nextParamWithin(message, size, &pos, &entry)) {
+    if (OpenROBO_Message_binaryElementSize(entry.type) > 0) {
+      binary = 1;
     }
   }
+  if (hasBinary != NULL) {
+    *hasBinary = binary;
+  }
+  return pos;
+}
 
-  return OpenROBO_Return_Success;
+size_t OpenROBO_Message_GetSize(const char *message)
+{
+  return OpenROBO_Message_measure(message, SIZE_MAX, NULL);
 }
 
-static int OpenROBO_Socket_createAcceptSocket(uint16_t *_port)
+/*
+   little endianで並んだ値をホストの形式でコピーする
+*/
+static void OpenROBO_Message_copyLittleEndian(void *dst, const void *src, size_t elementSize, size_t n)
 {
-  uint16_t port = OPENROBO_DEFAULT_ACCEPT_PORT;
-  int res;
-  res = SocketCom_Create(&OpenROBO_acceptSocket);
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
-  }
-  res = SocketCom_SetReuseaddr(&OpenROBO_acceptSocket);
-  if (res != SOCKETCOM_SUCCESS) {
-    return res;
-  }
-  while (1) {
-    res = SocketCom_Listen(&OpenROBO_acceptSocket, port);
-    if (res == SOCKETCOM_SUCCESS) {
-      break;
+#if defined(OPENROBO_BIG_ENDIAN_HOST)
+  size_t i, j;
+  const uint8_t *s = (const uint8_t *)src;
+  uint8_t *d = (uint8_t *)dst;
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < elementSize; j++) {
+      d[i*elementSize + j] = s[i*elementSize + elementSize - 1 - j];
     }
-    if (res != SOCKETCOM_ERROR_BIND) {
-      return OpenROBO_Return_Error;
+  }
+#else
+  memcpy(dst, src, elementSize * n);
+#endif
+}
+
+/*
+   binaryのパラメータをtextのパラメータに直したメッセージを作る(OpenROBO_free()で解放する)
+   binaryに対応していない相手へ送る際に使う
+*/
+static char* OpenROBO_Message_toText(const char *message, size_t size, size_t *textSize)
+{
+  size_t pos = 0, copied = 0, capacity = size + 1;
+  OpenROBO_MessageViewEntry_t entry;
+  char *text, *p;
+
+  while (OpenROBO_Message_nextParamWithin(message, size, &pos, &entry)) {
+    switch (entry.type) {
+      case 'D': capacity += (size_t)entry.count * 26; break; // ",%.17g"
+      case 'I': capacity += (size_t)entry.count * 12; break;
+      case 'B': capacity += (size_t)entry.count * 3; break;
     }
-    port++;
-    if (port == OPENROBO_DEFAULT_ACCEPT_PORT) {
-      return OpenROBO_Return_Error;
+  }
+  text = (char *)OpenROBO_malloc(capacity);
+  if (text == NULL) {
+    DBGABORT();
+    return NULL;
+  }
+
+  p = text;
+  pos = 0;
+  while (OpenROBO_Message_nextParamWithin(message, size, &pos, &entry)) {
+    size_t typeOffset = entry.nameOffset + entry.nameSize + 2;
+    const char *value = &message[entry.valueOffset];
+    uint32_t i;
+    if (OpenROBO_Message_binaryElementSize(entry.type) == 0) {
+      continue;
     }
-    if (port == 0) {
-      port++;
+    memcpy(p, &message[copied], typeOffset - copied);
+    p += typeOffset - copied;
+    *p++ = (char)(entry.type - 'A' + 'a');
+    memcpy(p, &message[typeOffset+1], entry.valueOffset - (typeOffset+1));
+    p += entry.valueOffset - (typeOffset+1);
+    for (i = 0; i < entry.count; i++) {
+      const char *separator = i == 0 ? "" : ",";
+      if (entry.type == 'D') {
+        double d;
+        OpenROBO_Message_copyLittleEndian(&d, &value[i*sizeof(double)], sizeof(double), 1);
+        p += sprintf(p, "%s%.17g", separator, d);
+      } else if (entry.type == 'I') {
+        int32_t v;
+        OpenROBO_Message_copyLittleEndian(&v, &value[i*sizeof(int32_t)], sizeof(int32_t), 1);
+        p += sprintf(p, "%s%d", separator, (int)v);
+      } else {
+        p += sprintf(p, "%s%02x", separator, (uint8_t)value[i]);
+      }
     }
+    copied = entry.valueOffset + entry.valueSize;
   }
-  *_port = port;
+  memcpy(p, &message[copied], size - copied);
+  p += size - copied;
+  *p = '\0';
 
-  return OpenROBO_Return_Success;
+  *textSize = p - text;
+  return text;
 }
 
-int OpenROBO_Socket_MakeConnection(const char *ip, uint16_t port)
+static int OpenROBO_Message_compareName(const char *message, const OpenROBO_MessageViewEntry_t *entry, const char *name, size_t nameSize)
 {
-  int res;
-  OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
-  if (s == NULL) {
-    DBGABORT();
-    return OpenROBO_Return_Error;
+  size_t n = entry->nameSize < nameSize ? entry->nameSize : nameSize;
+  int res = memcmp(&message[entry->nameOffset], name, n);
+  if (res != 0) {
+    return res;
   }
+  if (entry->nameSize == nameSize) {
+    return 0;
+  }
+  return entry->nameSize < nameSize ? -1 : 1;
+}
 
-  SocketCom *sock = &s->sock;
-  strcpy(s->id, OpenROBO_SubsystemName_TASKPLANNER);
-
-  if (!OpenROBO_isMainThread) {
-    return OpenROBO_Return_Error;
+/*
+   索引を作らずにメッセージの先頭からパラメータを探す
+*/
+static int OpenROBO_Message_findParam(const char *message, size_t pos, const char *name, OpenROBO_MessageViewEntry_t *entry)
+{
+  size_t nameSize = strlen(name);
+  while (OpenROBO_Message_nextParam(message, &pos, entry)) {
+    if (OpenROBO_Message_compareName(message, entry, name, nameSize) == 0) {
+      return OpenROBO_Return_Success;
+    }
   }
+  return OpenROBO_Return_NoValue;
+}
 
+/*
+   "#subject"から次の"#subject"の手前(なければsizeの位置)までを1つの区間として、posから次の区間を探す
+   見つかった場合は[*begin, *end)に区間(先頭は';')、subjectにその"#subject"を入れ、posを区間の終わりへ進める
+   複数の値をまとめたRead/Write Message(バッチ)とその返答で使う
 
-#ifndef  OPENROBO_NDEBUG
-  const char progressIndicator[] = {'-', '\\', '|', '/'};
-  int progressCount = 0;
-#endif
-  SocketCom_SetAddr(sock, ip, port);
-  while (1) {
-    res = SocketCom_Create(sock);
-    if (res != SOCKETCOM_SUCCESS) {
-      return OpenROBO_Return_Error;
+   @retval 1 区間を見つけた
+   @retval 0 メッセージの終わり
+*/
+static int OpenROBO_Message_nextSection(const char *message, size_t size, size_t *pos, OpenROBO_MessageViewEntry_t *subject, size_t *begin, size_t *end)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  size_t nameSize = strlen(OpenROBO_Message_paramName_subject);
+  size_t p = *pos;
+
+  do {
+    if (p >= size || !OpenROBO_Message_nextParamWithin(message, size, &p, subject) || subject->nameOffset > size) {
+      *pos = size;
+      return 0;
     }
+  } while (OpenROBO_Message_compareName(message, subject, OpenROBO_Message_paramName_subject, nameSize) != 0);
 
-    res = SocketCom_ConnectWithTimeout(sock, OPENROBO_MAKECONNECTION_TIMEOUT_MSEC);
-    if (res == SOCKETCOM_SUCCESS) {
+  *begin = subject->nameOffset - 1;
+  *end = size;
+  while (p < size && OpenROBO_Message_nextParamWithin(message, size, &p, &entry)) {
+    if (entry.nameOffset > size) {
       break;
     }
-
-    SocketCom_Dispose(sock);
-
-#ifndef OPENROBO_NDEBUG
-    DBGPRINTF("retry to connect [%c]\r", progressIndicator[progressCount]);
-    DBGFLUSH();
-    progressCount++;
-    if (progressCount >= (sizeof(progressIndicator)/sizeof(progressIndicator[0]))) {
-      progressCount = 0;
+    if (OpenROBO_Message_compareName(message, &entry, OpenROBO_Message_paramName_subject, nameSize) == 0) {
+      *end = entry.nameOffset - 1;
+      break;
     }
-#endif
   }
+  *pos = *end;
+  return 1;
+}
 
-  DBGPRINTF("Connected to (%s:%d)\n", ip, port);
-
-  res = OpenROBO_Socket_sendSelfInfo(sock);
-  if (res != OpenROBO_Return_Success) {
-    OpenROBO_sockList_deleteBySocketCom(sock);
-    return res;
+/*
+   区間[pos, end)の中からパラメータを探す
+*/
+static int OpenROBO_Message_findParamWithin(const char *message, size_t pos, size_t end, const char *name, OpenROBO_MessageViewEntry_t *entry)
+{
+  size_t nameSize = strlen(name);
+  while (pos < end && OpenROBO_Message_nextParamWithin(message, end, &pos, entry) && entry->nameOffset < end) {
+    if (OpenROBO_Message_compareName(message, entry, name, nameSize) == 0) {
+      return OpenROBO_Return_Success;
+    }
   }
+  return OpenROBO_Return_NoValue;
+}
 
-  res = OpenROBO_Socket_recvConnectionInfos(sock);
-  if (res != OpenROBO_Return_Success) {
-    OpenROBO_sockList_deleteBySocketCom(sock);
-    return res;
+/*
+   "#subject"を2つ以上含む(バッチの)メッセージか
+*/
+static int OpenROBO_Message_isBatch(const char *message)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  if (OpenROBO_Message_findParam(message, 0, OpenROBO_Message_paramName_subject, &entry) != OpenROBO_Return_Success) {
+    return 0;
   }
+  return OpenROBO_Message_findParam(message, entry.valueOffset + entry.valueSize, OpenROBO_Message_paramName_subject, &entry) == OpenROBO_Return_Success;
+}
 
-  size_t n;
-  for (n = 0; n < OpenROBO_subsystemTable.infosSize; n++) {
-    OpenROBO_subsystemTable_info_t *info;
-    info = &OpenROBO_subsystemTable.infos[n];
-    if (strcmp(info->id, OpenROBO_SubsystemName_TASKPLANNER) == 0) {
-      strcpy(info->ip, ip);
-      break;
+static unsigned int OpenROBO_Message_decodeInts(const char *message, const OpenROBO_MessageViewEntry_t *entry, int *values, unsigned int n)
+{
+  unsigned int i;
+  const char *p = &message[entry->valueOffset];
+  char *end;
+  if (n > entry->count) {
+    n = entry->count;
+  }
+  if (entry->type == 'I') {
+    if (sizeof(int) == sizeof(int32_t)) {
+      OpenROBO_Message_copyLittleEndian(values, p, sizeof(int32_t), n);
+      return n;
+    }
+    for (i = 0; i < n; i++) {
+      int32_t v;
+      OpenROBO_Message_copyLittleEndian(&v, &p[i*sizeof(int32_t)], sizeof(int32_t), 1);
+      values[i] = (int)v;
     }
+    return n;
   }
-  if (n >= OpenROBO_subsystemTable.infosSize) {
-    return OpenROBO_Return_Error;
+  if (entry->type == 'D') {
+    for (i = 0; i < n; i++) {
+      double d;
+      OpenROBO_Message_copyLittleEndian(&d, &p[i*sizeof(double)], sizeof(double), 1);
+      values[i] = (int)d;
+    }
+    return n;
   }
-
-  return OpenROBO_Return_Success;
+  for (i = 0; i < n; i++) {
+    values[i] = (int)strtol(p, &end, 10);
+    if (*end != ',') {
+      return i + 1;
+    }
+    p = end + 1;
+  }
+  return n;
 }
 
-int OpenROBO_Socket_AcceptConnection(uint16_t port, const char* const ids[])
+static unsigned int OpenROBO_Message_decodeDoubles(const char *message, const OpenROBO_MessageViewEntry_t *entry, double *values, unsigned int n)
 {
-  int res;
-
-  if (!OpenROBO_isMainThread) {
-    return OpenROBO_Return_Error;
+  unsigned int i;
+  const char *p = &message[entry->valueOffset];
+  char *end;
+  if (n > entry->count) {
+    n = entry->count;
   }
-
-  SocketCom acceptSock = SOCKETCOM_INITIALIZER;
-  res = SocketCom_Create(&acceptSock);
-  if (res != SOCKETCOM_SUCCESS) {
-    return OpenROBO_Return_Error;
+  if (entry->type == 'D') {
+    OpenROBO_Message_copyLittleEndian(values, p, sizeof(double), n);
+    return n;
   }
-  res = SocketCom_SetReuseaddr(&acceptSock);
-  if (res != SOCKETCOM_SUCCESS) {
-    return res;
+  if (entry->type == 'I') {
+    for (i = 0; i < n; i++) {
+      int32_t v;
+      OpenROBO_Message_copyLittleEndian(&v, &p[i*sizeof(int32_t)], sizeof(int32_t), 1);
+      values[i] = (double)v;
+    }
+    return n;
   }
-  res = SocketCom_Listen(&acceptSock, port);
-  if (res != SOCKETCOM_SUCCESS) {
-    SocketCom_Dispose(&acceptSock);
-    return OpenROBO_Return_Error;
+  for (i = 0; i < n; i++) {
+    values[i] = strtod(p, &end);
+    if (*end != ',') {
+      return i + 1;
+    }
+    p = end + 1;
   }
+  return n;
+}
 
-  while (!OpenROBO_hasSubsystemInfos(ids)) {
-    size_t n = OpenROBO_subsystemTable.infosSize;
-    OpenROBO_subsystemTable_info_t *info = &OpenROBO_subsystemTable.infos[n];
-    SocketCom *sock;
-    OpenROBO_sockList_t *s = OpenROBO_sockList_createNew();
-    if (s == NULL) {
-      DBGABORT();
-      return OpenROBO_Return_Error;
+static unsigned int OpenROBO_Message_decodeBytes(const char *message, const OpenROBO_MessageViewEntry_t *entry, unsigned char *values, unsigned int n)
+{
+  unsigned int i;
+  const char *p = &message[entry->valueOffset];
+  char *end;
+  if (n > entry->count) {
+    n = entry->count;
+  }
+  if (entry->type == 'B') {
+    memcpy(values, p, n);
+    return n;
+  }
+  for (i = 0; i < n; i++) {
+    values[i] = (unsigned char)strtoul(p, &end, 16);
+    if (*end != ',') {
+      return i + 1;
     }
-    sock = &s->sock;
+    p = end + 1;
+  }
+  return n;
+}
 
-    res = SocketCom_Accept(&acceptSock, sock);
-    if (res != SOCKETCOM_SUCCESS) {
-      SocketCom_Dispose(&acceptSock);
-      return OpenROBO_Return_Error;
+int OpenROBO_MessageView_Parse(OpenROBO_MessageView_t *view, const char *message)
+{
+  size_t pos = 0;
+  size_t last = 0;
+  OpenROBO_MessageViewEntry_t entry;
+
+  view->message = message;
+  view->type = OpenROBO_Message_GetMessageType(message);
+  view->subject = -1;
+  view->sourceID = -1;
+  view->destinationID = -1;
+  view->returnValue = -1;
+  view->entriesSize = 0;
+  view->truncatedOffset = 0;
+
+  while (OpenROBO_Message_nextParam(message, &pos, &entry)) {
+    size_t n = view->entriesSize;
+    size_t i;
+
+    if (n >= OPENROBO_MESSAGE_VIEW_ENTRY_MAX) {
+      // 索引に入らなかった分はOpenROBO_MessageView_Find()で走査する
+      if (view->truncatedOffset == 0) {
+        view->truncatedOffset = last;
+      }
+      continue;
+    }
+    last = pos;
+    view->entries[n] = entry;
+
+    if (message[entry.nameOffset] == '#') {
+      int *wellKnown = NULL;
+      const char *name = &message[entry.nameOffset];
+      if (entry.nameSize == 8 && memcmp(name, OpenROBO_Message_paramName_subject, 8) == 0) {
+        wellKnown = &view->subject;
+      } else if (entry.nameSize == 4 && memcmp(name, OpenROBO_Message_paramName_sourceID, 4) == 0) {
+        wellKnown = &view->sourceID;
+      } else if (entry.nameSize == 4 && memcmp(name, OpenROBO_Message_paramName_destinationID, 4) == 0) {
+        wellKnown = &view->destinationID;
+      } else if (entry.nameSize == 7 && memcmp(name, OpenROBO_Message_paramName_return, 7) == 0) {
+        wellKnown = &view->returnValue;
+      }
+      if (wellKnown != NULL && *wellKnown < 0) {
+        *wellKnown = (int)n;
+      }
     }
 
-    res = OpenROBO_Socket_recvSelfInfo(sock, info);
-    if (res != OpenROBO_Return_Success) {
-      if (res == OpenROBO_Return_Disconnected) {
-        continue; //retry to accept
+    // 名前順(同名は出現順)に並べる
+    for (i = n; i > 0; i--) {
+      const OpenROBO_MessageViewEntry_t *e = &view->entries[view->order[i-1]];
+      if (OpenROBO_Message_compareName(message, e, &message[entry.nameOffset], entry.nameSize) <= 0) {
+        break;
       }
-      DBGABORT();
-      SocketCom_Dispose(&acceptSock);
-      return OpenROBO_Return_Error;
+      view->order[i] = view->order[i-1];
     }
-    if (OpenROBO_hasSubsystemInfo(info->id)) {
-      DBGPRINTF("Error: Double Connection <%s>@%s\n", info->id, info->ip);
-      DBGABORT();
-      return OpenROBO_Return_Error;
+    view->order[i] = (OpenROBO_MessageViewIndex_t)n;
+    view->entriesSize++;
+  }
+  view->size = pos;
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   routing headerの位置から"#subject", "#src", "#dst"だけを読んで索引を作る
+   それ以外のパラメータはOpenROBO_MessageView_Find()で先頭から走査する
+   パラメータを読む種類のメッセージ(Read/Writeなど)や位置が合わない場合はOpenROBO_Return_NotUpdatedを返す
+*/
+static int OpenROBO_MessageView_parseRoute(OpenROBO_MessageView_t *view, const char *message, const OpenROBO_route_t *route)
+{
+  int *wellKnowns[OPENROBO_FRAME_ROUTE_FIELDS] = {&view->subject, &view->sourceID, &view->destinationID};
+  int field;
+
+  switch (route->type) {
+    case OpenROBO_MessageType_Start:
+    case OpenROBO_MessageType_Stop:
+    case OpenROBO_MessageType_Wait:
+    case OpenROBO_MessageType_Return:
+    case OpenROBO_MessageType_Bind:
+      break;
+    default:
+      return OpenROBO_Return_NotUpdated;
+  }
+
+  view->message = message;
+  view->size = route->size - 1;
+  view->type = route->type;
+  view->subject = -1;
+  view->sourceID = -1;
+  view->destinationID = -1;
+  view->returnValue = -1;
+  view->entriesSize = 0;
+  view->truncatedOffset = 1; // 先頭はヘッダなので1から辿っても全体を走査するのと同じ
+
+  for (field = 0; field < OPENROBO_FRAME_ROUTE_FIELDS; field++) {
+    OpenROBO_MessageViewEntry_t entry;
+    size_t pos = route->offset[field];
+    size_t n = view->entriesSize;
+    size_t i;
+
+    if (route->offset[field] == OPENROBO_FRAME_ROUTE_NONE) {
+      continue;
+    }
+    if (!OpenROBO_Message_nextParamWithin(message, view->size, &pos, &entry) ||
+        entry.nameOffset != route->offset[field] + 1 || OpenROBO_Route_field(message, &entry) != field) {
+      return OpenROBO_Return_NotUpdated;
+    }
+    view->entries[n] = entry;
+    *wellKnowns[field] = (int)n;
+
+    for (i = n; i > 0; i--) {
+      const OpenROBO_MessageViewEntry_t *e = &view->entries[view->order[i-1]];
+      if (OpenROBO_Message_compareName(message, e, &message[entry.nameOffset], entry.nameSize) <= 0) {
+        break;
+      }
+      view->order[i] = view->order[i-1];
     }
-    strcpy(s->id, info->id);
-    DBGPRINTF("Got info: <%s>(%s:%d)\n", info->id, info->ip, info->port);
-
-    OpenROBO_subsystemTable.infosSize++;
+    view->order[i] = (OpenROBO_MessageViewIndex_t)n;
+    view->entriesSize++;
   }
 
-  DBGPRINTF("Completed to Get ALL Connection Information\n");
-
-  for (OpenROBO_sockList_t *s = OpenROBO_sockList; s != NULL; s = s->next) {
-    SocketCom *sock = &s->sock;
+  return OpenROBO_Return_Success;
+}
 
-    res = OpenROBO_Socket_sendConnectionInfos(sock);
-    if (res != OpenROBO_Return_Success) {
-      OpenROBO_sockList_deleteAll();
-      DBGABORT();
-      return OpenROBO_Return_Error;
+int OpenROBO_MessageView_Find(const OpenROBO_MessageView_t *view, const char *name, OpenROBO_MessageViewEntry_t *entry)
+{
+  size_t nameSize = strlen(name);
+  size_t lo = 0;
+  size_t hi = view->entriesSize;
+
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (OpenROBO_Message_compareName(view->message, &view->entries[view->order[mid]], name, nameSize) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
   }
+  if (lo < view->entriesSize && OpenROBO_Message_compareName(view->message, &view->entries[view->order[lo]], name, nameSize) == 0) {
+    *entry = view->entries[view->order[lo]];
+    return OpenROBO_Return_Success;
+  }
 
-  SocketCom_Dispose(&acceptSock);
+  if (view->truncatedOffset != 0) {
+    return OpenROBO_Message_findParam(view->message, view->truncatedOffset, name, entry);
+  }
+  return OpenROBO_Return_NoValue;
+}
 
+static int OpenROBO_MessageView_getWellKnown(const OpenROBO_MessageView_t *view, int index, const char **str, size_t *size)
+{
+  const OpenROBO_MessageViewEntry_t *entry;
+  if (index < 0) {
+    *str = NULL;
+    *size = 0;
+    return OpenROBO_Return_NoValue;
+  }
+  entry = &view->entries[index];
+  *str = &view->message[entry->valueOffset];
+  *size = entry->valueSize;
   return OpenROBO_Return_Success;
 }
 
-/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+int OpenROBO_MessageView_GetString(const OpenROBO_MessageView_t *view, const char *name, const char **str, size_t *size)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  int res = OpenROBO_MessageView_Find(view, name, &entry);
+  if (res != OpenROBO_Return_Success) {
+    *str = NULL;
+    *size = 0;
+    return res;
+  }
+  *str = &view->message[entry.valueOffset];
+  *size = entry.valueSize;
+  return OpenROBO_Return_Success;
+}
 
-   OpenROBO_Message
+int OpenROBO_MessageView_CopyString(const OpenROBO_MessageView_t *view, const char *name, char *str, size_t strSize)
+{
+  const char *p;
+  size_t size;
+  int res = OpenROBO_MessageView_GetString(view, name, &p, &size);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  if (size >= strSize) {
+    return OpenROBO_Return_BufferOver;
+  }
+  memcpy(str, p, size);
+  str[size] = '\0';
+  return OpenROBO_Return_Success;
+}
 
-   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+int OpenROBO_MessageView_GetSourceID(const OpenROBO_MessageView_t *view, const char **sourceID, size_t *size)
+{
+  return OpenROBO_MessageView_getWellKnown(view, view->sourceID, sourceID, size);
+}
 
-static const char * const OpenROBO_Message_paramName_sourceID = "#src";
-static const char * const OpenROBO_Message_paramName_destinationID = "#dst";
-static const char * const OpenROBO_Message_paramName_subject = "#subject";
-static const char * const OpenROBO_Message_paramName_return = "#return";
-static const char * const OpenROBO_Message_paramName_time = "#time";
+int OpenROBO_MessageView_GetDestinationID(const OpenROBO_MessageView_t *view, const char **destinationID, size_t *size)
+{
+  return OpenROBO_MessageView_getWellKnown(view, view->destinationID, destinationID, size);
+}
 
-int OpenROBO_CreateMessage(char* message, const char* funcName, const char* destionationID);
+int OpenROBO_MessageView_GetSubject(const OpenROBO_MessageView_t *view, const char **subject, size_t *size)
+{
+  return OpenROBO_MessageView_getWellKnown(view, view->subject, subject, size);
+}
 
-void OpenROBO_Message_GetParam(const char *MessageParameter,const char *vname,...)
+int OpenROBO_MessageView_GetParam_TMatrix(const OpenROBO_MessageView_t *view, const char *name, double TMatrix[4][4])
 {
-  char *cp,tmp[1000]={0},type[1],*len,*len2;
-  const char *ssp = NULL;
-  double *dp;
-  int *ip,n,i,ci;
-  va_list val;
-  len = (char*)OpenROBO_malloc(strlen(MessageParameter));
-  len2 = (char*)OpenROBO_malloc(strlen(MessageParameter));
-  sprintf(tmp,";%s=",vname);//-- ;変数名=　というフォーマットに合わせて検索
-  ssp = strstr(MessageParameter,tmp);//-- 検索結果のポインタをセット
+  return OpenROBO_MessageView_GetParam_doubleArray(view, name, &TMatrix[0][0], 16);
+}
 
-  if(ssp == NULL){
-    DBGPRINTF("GetPram(): not found \"%s\" in [%s]\n", vname, MessageParameter);
-    assert(ssp != NULL);
-    //		getchar();
-    return;
-  }
+int OpenROBO_MessageView_GetParam_double(const OpenROBO_MessageView_t *view, const char *name, double *value)
+{
+  return OpenROBO_MessageView_GetParam_doubleArray(view, name, value, 1);
+}
 
-  sscanf(ssp,"%[^=]=(%c%d),%[^;]",tmp,&type[0],&n,len);//-- 検索結果を分解して変数型(type)と数(n)、値(len)を読み取る
-  va_start(val,vname);//-- 可変引数のポインタをaにセット
-  switch(type[0]){
-    case 'i':
-      //-- もし、変数のタイプがint型ならint型のポインタに引数ポインタをセット
-      ip = va_arg(val,int*);
-      for(i = 0;i < n;i++){
-        sscanf(len,"%d,%s",(ip + i),len2);
-        strcpy(len,len2);
-      }
-      break;
-    case 'd':
-      dp = va_arg(val,double*);
-      for(i = 0;i < n;i++){
-        sscanf(len,"%lf,%s",(dp + i),len2);
-        strcpy(len,len2);
-      }
-      break;
-    case 'c':
-      cp = va_arg(val,char*);
-      ci = va_arg(val,int);
-      for(i = 0;i < n;i++){
-        sscanf(len,"%[^,],%s",(cp + i*ci),len2);
-        strcpy(len,len2);
-      }
-      break;
-    case 's':
-      cp = va_arg(val,char*);
-      sscanf(len,"%[^,],%s",cp,len2);
-      break;
-    case 'b': {
-                unsigned char* ret;
-                int tmp;
-                ret = va_arg(val, unsigned char*);
-                for (i = 0; i < n; i++) {
-                  sscanf(len, "%x,%s", &tmp, len2);
-                  ret[i] = tmp;
-                  strcpy(len, len2);
-                }
-                break;
-              }
+int OpenROBO_MessageView_GetParam_doubleArray(const OpenROBO_MessageView_t *view, const char *name, double *values, unsigned int n)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  int res = OpenROBO_MessageView_Find(view, name, &entry);
+  if (res != OpenROBO_Return_Success) {
+    return res;
   }
-  va_end(val);
-  OpenROBO_free((void*)len);
-  OpenROBO_free((void*)len2);
+  OpenROBO_Message_decodeDoubles(view->message, &entry, values, n);
+  return OpenROBO_Return_Success;
 }
 
-int OpenROBO_Message_HasParam(const char* message, const char* name)
+int OpenROBO_MessageView_GetParam_int(const OpenROBO_MessageView_t *view, const char *name, int *value)
 {
-  const char* p = message;
-  size_t name_len = strlen(name);
+  return OpenROBO_MessageView_GetParam_intArray(view, name, value, 1);
+}
 
-  while (1) {
-    p = strstr(p, name);
-    if (p == NULL) {
-      return 0;
-    }
-    p += name_len;
-    if (p[0] == '=') {
-      break;
-    }
+int OpenROBO_MessageView_GetParam_intArray(const OpenROBO_MessageView_t *view, const char *name, int *values, unsigned int n)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  int res = OpenROBO_MessageView_Find(view, name, &entry);
+  if (res != OpenROBO_Return_Success) {
+    return res;
   }
+  OpenROBO_Message_decodeInts(view->message, &entry, values, n);
+  return OpenROBO_Return_Success;
+}
 
-  return 1;
+int OpenROBO_MessageView_GetParam_byteArray(const OpenROBO_MessageView_t *view, const char *name, unsigned char *values, unsigned int n)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  int res = OpenROBO_MessageView_Find(view, name, &entry);
+  if (res != OpenROBO_Return_Success) {
+    return res;
+  }
+  OpenROBO_Message_decodeBytes(view->message, &entry, values, n);
+  return OpenROBO_Return_Success;
 }
 
-void OpenROBO_Message_GetParam_string(const char *message, const char *name, const char **str)
+int OpenROBO_MessageView_GetReturnValue(const OpenROBO_MessageView_t *view, int *value)
 {
-  const char* end;
-  const char* p = message;
-  size_t name_len = strlen(name);
+  if (view->returnValue < 0) {
+    return OpenROBO_Return_NoValue;
+  }
+  OpenROBO_Message_decodeInts(view->message, &view->entries[view->returnValue], value, 1);
+  return OpenROBO_Return_Success;
+}
 
-  while (1) {
-    p = strstr(p, name);
-    if (p == NULL) {
-      DBGPRINTF("error: not found param [%s]\n", name);
-      DBGPRINTF("       message [%s]\n", message);
-      DBGPRINTF("       %s\n", OpenROBO_isMainThread ? "MainThread" : "OtherThread");
-      DBGABORT();
-      *str = NULL;
-      return;
-    }
-    p += name_len;
-    if (p[0] == '=') {
-      break;
-    }
+int OpenROBO_Message_HasParam(const char* message, const char* name)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  return OpenROBO_Message_findParam(message, 0, name, &entry) == OpenROBO_Return_Success;
+}
+
+/*
+   パラメータが見つからない場合は従来のOpenROBO_Message_GetParam()と同様にエラーを表示する
+*/
+static int OpenROBO_Message_findParamOrAbort(const char *message, const char *name, OpenROBO_MessageViewEntry_t *entry)
+{
+  if (OpenROBO_Message_findParam(message, 0, name, entry) != OpenROBO_Return_Success) {
+    DBGPRINTF("error: not found param [%s]\n", name);
+    DBGPRINTF("       message [%s]\n", message);
+    DBGPRINTF("       %s\n", OpenROBO_isMainThread ? "MainThread" : "OtherThread");
+    DBGABORT();
+    return OpenROBO_Return_NoValue;
   }
-  p += 1;
+  return OpenROBO_Return_Success;
+}
+
+void OpenROBO_Message_GetParam_string(const char *message, const char *name, const char **str)
+{
+  OpenROBO_MessageViewEntry_t entry;
 
-  if (strncmp(p, "(s1),", 5) != 0) {
-    assert(strncmp(p, "(s1),", 5) == 0);
+  if (OpenROBO_Message_findParamOrAbort(message, name, &entry) != OpenROBO_Return_Success) {
     *str = NULL;
     return;
   }
-  p += 5;
 
-  end = strchr(p, ';');
-  if (end == NULL) {
-    end = strchr(p, '\0');
+  if (entry.type != 's' || entry.count != 1) {
+    assert(entry.type == 's' && entry.count == 1);
+    *str = NULL;
+    return;
   }
 
   char *_str;
-  _str = (char *)OpenROBO_malloc(end - p + 1);
+  _str = (char *)OpenROBO_malloc(entry.valueSize + 1);
   if (_str == NULL) {
     *str = NULL;
     assert(_str != NULL);
     return;
   }
 
-  strncpy(_str, p, end - p);
-  _str[end-p] = '\0';
+  memcpy(_str, &message[entry.valueOffset], entry.valueSize);
+  _str[entry.valueSize] = '\0';
 
   *str = _str;
 }
@@ -1876,32 +9269,41 @@ void OpenROBO_Message_GetSubject(const char* message, const char** subject)
 
 void OpenROBO_Message_GetParam_TMatrix(const char *message, const char *name, double TMatrix[4][4])
 {
-  OpenROBO_Message_GetParam(message, name, TMatrix);
+  OpenROBO_Message_GetParam_doubleArray(message, name, &TMatrix[0][0], 16);
 }
 
 void OpenROBO_Message_GetParam_double(const char *message, const char *name, double *value)
 {
-  OpenROBO_Message_GetParam(message, name, value);
+  OpenROBO_Message_GetParam_doubleArray(message, name, value, 1);
 }
 
 void OpenROBO_Message_GetParam_doubleArray(const char *message,const char *name, double *values, unsigned int n)
 {
-  OpenROBO_Message_GetParam(message, name, values);
+  OpenROBO_MessageViewEntry_t entry;
+  if (OpenROBO_Message_findParamOrAbort(message, name, &entry) == OpenROBO_Return_Success) {
+    OpenROBO_Message_decodeDoubles(message, &entry, values, n);
+  }
 }
 
 void OpenROBO_Message_GetParam_int(const char *message, const char *name, int *value)
 {
-  OpenROBO_Message_GetParam(message, name, value);
+  OpenROBO_Message_GetParam_intArray(message, name, value, 1);
 }
 
 void OpenROBO_Message_GetParam_intArray(const char *message,const char *name, int *values, unsigned int n)
 {
-  OpenROBO_Message_GetParam(message, name, values);
+  OpenROBO_MessageViewEntry_t entry;
+  if (OpenROBO_Message_findParamOrAbort(message, name, &entry) == OpenROBO_Return_Success) {
+    OpenROBO_Message_decodeInts(message, &entry, values, n);
+  }
 }
 
 void OpenROBO_Message_GetParam_byteArray(const char *message,const char *name, unsigned char *values, unsigned int n)
 {
-  OpenROBO_Message_GetParam(message, name, values);
+  OpenROBO_MessageViewEntry_t entry;
+  if (OpenROBO_Message_findParamOrAbort(message, name, &entry) == OpenROBO_Return_Success) {
+    OpenROBO_Message_decodeBytes(message, &entry, values, n);
+  }
 }
 
 void OpenROBO_Message_GetReturnValue(const char *message, int *value)
@@ -1914,85 +9316,335 @@ void OpenROBO_Message_GetTime(const char* message, double* time)
   OpenROBO_Message_GetParam_double(message, OpenROBO_Message_paramName_time, time);
 }
 
+void OpenROBO_Message_GetVersion(const char* message, unsigned int* version)
+{
+  int value = 0;
+  OpenROBO_Message_GetParam_int(message, OpenROBO_Message_paramName_version, &value);
+  *version = (unsigned int)value;
+}
+
+void OpenROBO_Message_SetParamEncoding(int encoding)
+{
+  OpenROBO_Message_paramEncoding = encoding;
+}
+
+int OpenROBO_Message_GetParamEncoding(void)
+{
+  return OpenROBO_Message_paramEncoding;
+}
+
+/* _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/
+
+   OpenROBO_MessageBuilder
+
+   _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
+
+int OpenROBO_MessageBuilder_Init(OpenROBO_MessageBuilder_t *builder, size_t capacity)
+{
+  builder->p = NULL;
+  builder->size = 0;
+  builder->capacity = 0;
+  builder->owned = 0;
+  return OpenROBO_MessageBuilder_Reserve(builder, capacity);
+}
+
+void OpenROBO_MessageBuilder_InitWithBuffer(OpenROBO_MessageBuilder_t *builder, char *buffer, size_t bufferSize)
+{
+  builder->p = buffer;
+  builder->size = 0;
+  builder->capacity = bufferSize;
+  builder->owned = 0;
+  if (bufferSize > 0) {
+    buffer[0] = '\0';
+  }
+}
+
+void OpenROBO_MessageBuilder_Term(OpenROBO_MessageBuilder_t *builder)
+{
+  if (builder->owned) {
+    OpenROBO_free(builder->p);
+  }
+  builder->p = NULL;
+  builder->size = 0;
+  builder->capacity = 0;
+  builder->owned = 0;
+}
+
+void OpenROBO_MessageBuilder_Clear(OpenROBO_MessageBuilder_t *builder)
+{
+  builder->size = 0;
+  if (builder->p != NULL) {
+    builder->p[0] = '\0';
+  }
+}
+
+int OpenROBO_MessageBuilder_Reserve(OpenROBO_MessageBuilder_t *builder, size_t size)
+{
+  size_t capacity;
+  char *p;
+
+  if (size < builder->capacity) {
+    return OpenROBO_Return_Success;
+  }
+  if (size == SIZE_MAX) {
+    return OpenROBO_Return_BufferOver;
+  }
+
+  capacity = builder->capacity > 0 ? builder->capacity : OPENROBO_MESSAGE_BUILDER_DEFAULT_SIZE;
+  while (capacity <= size) {
+    if (capacity > SIZE_MAX / 2) {
+      capacity = size + 1;
+      break;
+    }
+    capacity *= 2;
+  }
+
+  if (builder->owned) {
+    p = (char *)OpenROBO_realloc(builder->p, capacity);
+  } else {
+    // 渡されたバッファからヒープへ移る
+    p = (char *)OpenROBO_malloc(capacity);
+    if (p != NULL) {
+      if (builder->p != NULL) {
+        memcpy(p, builder->p, builder->size);
+      }
+      p[builder->size] = '\0';
+    }
+  }
+  if (p == NULL) {
+    DBGABORT();
+    return OpenROBO_Return_Error;
+  }
+  builder->p = p;
+  builder->capacity = capacity;
+  builder->owned = 1;
+
+  return OpenROBO_Return_Success;
+}
+
+/*
+   char*のメッセージをbuilderとして扱う
+   バッファのサイズは分からないので拡張はしない(従来通り呼び出し側で十分なサイズを確保しておく)
+*/
+static void OpenROBO_MessageBuilder_wrap(OpenROBO_MessageBuilder_t *builder, char *message)
+{
+  builder->p = message;
+  builder->size = OpenROBO_Message_measure(message, SIZE_MAX, NULL);
+  builder->capacity = SIZE_MAX;
+  builder->owned = 0;
+}
+
+/*
+   OpenROBO_MessageBuilder_wrap()で包んだchar*のメッセージか
+*/
+static int OpenROBO_MessageBuilder_isWrapped(const OpenROBO_MessageBuilder_t *builder)
+{
+  return !builder->owned && builder->capacity == SIZE_MAX;
+}
+
+static int OpenROBO_MessageBuilder_append(OpenROBO_MessageBuilder_t *builder, const void *data, size_t size)
+{
+  if (OpenROBO_MessageBuilder_Reserve(builder, builder->size + size) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  memcpy(&builder->p[builder->size], data, size);
+  builder->size += size;
+  builder->p[builder->size] = '\0';
+  return OpenROBO_Return_Success;
+}
+
+/*
+   末尾へ書式付きで追記する。収まらなかった場合は拡張して書き直す
+*/
+static int OpenROBO_MessageBuilder_printf(OpenROBO_MessageBuilder_t *builder, const char *format, ...)
+{
+  va_list val;
+  int n;
+  size_t room;
+
+  while (1) {
+    room = builder->capacity - builder->size;
+    if (room > INT_MAX) {
+      room = INT_MAX;
+    }
+    va_start(val, format);
+    n = vsnprintf(room > 0 ? &builder->p[builder->size] : NULL, room, format, val);
+    va_end(val);
+    if (n < 0) {
+      break;
+    }
+    if ((size_t)n < room) {
+      builder->size += n;
+      return OpenROBO_Return_Success;
+    }
+    if (OpenROBO_MessageBuilder_Reserve(builder, builder->size + n) != OpenROBO_Return_Success) {
+      break;
+    }
+  }
+
+  if (builder->size < builder->capacity) {
+    builder->p[builder->size] = '\0';
+  }
+  return OpenROBO_Return_Error;
+}
+
+/*
+   ";name=(Tn),"に続けて値をlittle endianのまま書き込む
+*/
+static int OpenROBO_MessageBuilder_putBinaryParam(OpenROBO_MessageBuilder_t *builder, const char *vname, char type, const void *values, size_t elementSize, int n)
+{
+  size_t valueSize = elementSize * n;
+  if (OpenROBO_MessageBuilder_Reserve(builder, builder->size + strlen(vname) + 16 + valueSize) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  OpenROBO_MessageBuilder_printf(builder, ";%s=(%c%d),", vname, type, n);
+  OpenROBO_Message_copyLittleEndian(&builder->p[builder->size], values, elementSize, n);
+  builder->size += valueSize;
+  builder->p[builder->size] = '\0';
+  return OpenROBO_Return_Success;
+}
+
 /**
- * パラメータからメッセージを生成し、それを第1引数で渡したメッセージに追記する
+ * パラメータからメッセージを生成し、それをbuilderのメッセージに追記する
  * (内部コードからメッセージに変換)
  *
- * @param[out] MessageParameter 生成したメッセージが追記されるメッセージ
+ * @param[out] builder 生成したメッセージが追記されるbuilder
  * @param[in] type メッセージの種類(intなら"i", doubleなら"d"など)
  * @param[in] size パラメータの値のサイズ(例:intならsizeof(int)を引数として渡す)
  */
-static void OpenROBO_Message_SetParam(char *MessageParameter,const char *type,const int size,const char *vname,...)
+static int OpenROBO_MessageBuilder_setParam(OpenROBO_MessageBuilder_t *builder,const char *type,const int size,const char *vname,...)
 {
   const char *cp;
-  char tmp[1000] = "";
   const int *ip;
   int i,ci,n;
   const double *dp;
+  int res = OpenROBO_Return_Success;
+  // char*のメッセージ(長さをstrlen()で扱われる)には'\0'を含むbinaryのパラメータを書かない
+  int binary = OPENROBO_BINARY_PARAM_ENABLE && OpenROBO_Message_paramEncoding == OpenROBO_ParamEncoding_Binary && !OpenROBO_MessageBuilder_isWrapped(builder);
   va_list val;
-  sprintf(tmp,";%s=(%c",vname,type[0]);
-  strcat(MessageParameter,tmp);
+
   va_start(val,vname);//可変引数のポインタをaにセット
   switch(type[0]){
     case 'i':
       //もし、変数のタイプがint型ならint型のポインタに引数ポインタをセット
       ip = va_arg(val,const int*);
       n = size/sizeof(int);
-      sprintf(tmp,"%d)",n);
-      strcat(MessageParameter,tmp);
-      for(i = 0;i < n;i++){
-        sprintf(tmp,",%d",*(ip + i));
-        strcat(MessageParameter,tmp);
+      if (binary && n > 1 && sizeof(int) == sizeof(int32_t)) {
+        res = OpenROBO_MessageBuilder_putBinaryParam(builder, vname, 'I', ip, sizeof(int32_t), n);
+        break;
+      }
+      res = OpenROBO_MessageBuilder_printf(builder,";%s=(i%d)",vname,n);
+      for(i = 0;i < n && res == OpenROBO_Return_Success;i++){
+        res = OpenROBO_MessageBuilder_printf(builder,",%d",*(ip + i));
       }
       break;
     case 'd':
       dp = va_arg(val,const double*);
       n = size/sizeof(double);
-      sprintf(tmp,"%d)",n);
-      strcat(MessageParameter,tmp);
-      for(i = 0;i < n;i++){
-        sprintf(tmp,",%lf",*(dp + i));
-        strcat(MessageParameter,tmp);
+      if (binary && n > 0) {
+        res = OpenROBO_MessageBuilder_putBinaryParam(builder, vname, 'D', dp, sizeof(double), n);
+        break;
+      }
+      res = OpenROBO_MessageBuilder_printf(builder,";%s=(d%d)",vname,n);
+      for(i = 0;i < n && res == OpenROBO_Return_Success;i++){
+        // 読み戻して同じ値になる桁数で書く
+        res = OpenROBO_MessageBuilder_printf(builder,",%.17g",*(dp + i));
       }
       break;
     case 'c':
       cp = va_arg(val,const char*);
       ci = va_arg(val,int);
       n = size/ci;
-      sprintf(tmp,"%d)",n);
-      strcat(MessageParameter,tmp);
-      for(i = 0;i < n;i++){
-        sprintf(tmp,",%s",(cp + ci*i));
-        strcat(MessageParameter,tmp);
+      res = OpenROBO_MessageBuilder_printf(builder,";%s=(c%d)",vname,n);
+      for(i = 0;i < n && res == OpenROBO_Return_Success;i++){
+        res = OpenROBO_MessageBuilder_printf(builder,",%s",(cp + ci*i));
       }
       break;
     case 's':
       cp = va_arg(val,const char*);
       n = 1;
-      sprintf(tmp,"%d)",n);
-      strcat(MessageParameter,tmp);
-      sprintf(tmp,",%s",cp);
-      strcat(MessageParameter,tmp);
+      res = OpenROBO_MessageBuilder_printf(builder,";%s=(s%d),%s",vname,n,cp);
       break;
     case 'b': {
-                const unsigned char* p;
-                p = va_arg(val, const unsigned char*);
+                const unsigned char* bp;
+                bp = va_arg(val, const unsigned char*);
                 n = size/sizeof(unsigned char);
-                sprintf(tmp, "%d)", n);
-                strcat(MessageParameter, tmp);
-                for(i = 0;i < n;i++){
-                  sprintf(tmp, ",%02x", p[i]);
-                  strcat(MessageParameter, tmp);
+                if (binary && n > 0) {
+                  res = OpenROBO_MessageBuilder_putBinaryParam(builder, vname, 'B', bp, sizeof(uint8_t), n);
+                  break;
+                }
+                res = OpenROBO_MessageBuilder_printf(builder, ";%s=(b%d)", vname, n);
+                for(i = 0;i < n && res == OpenROBO_Return_Success;i++){
+                  res = OpenROBO_MessageBuilder_printf(builder, ",%02x", bp[i]);
                 }
                 break;
               }
   }
   va_end(val);
+
+  return res;
+}
+
+int OpenROBO_Message_SetParam_string(OpenROBO_MessageBuilder_t *builder, const char *name, const char *str)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"s",sizeof(char),name,str);
+}
+
+int OpenROBO_Message_SetSubject(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_Message_SetParam_string(builder, OpenROBO_Message_paramName_subject, subject);
+}
+
+static int OpenROBO_Message_setSourceID(OpenROBO_MessageBuilder_t *builder, const char* sourceID)
+{
+  return OpenROBO_Message_SetParam_string(builder, OpenROBO_Message_paramName_sourceID, sourceID);
+}
+
+static int OpenROBO_Message_setDestinationID(OpenROBO_MessageBuilder_t *builder, const char* destinationID)
+{
+  return OpenROBO_Message_SetParam_string(builder, OpenROBO_Message_paramName_destinationID, destinationID);
+}
+
+int OpenROBO_Message_SetParam_TMatrix(OpenROBO_MessageBuilder_t *builder, const char *name, const double TMatrix[4][4])
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"d",sizeof(double[4][4]),name,TMatrix);
+}
+
+int OpenROBO_Message_SetParam_double(OpenROBO_MessageBuilder_t *builder, const char *name, const double *value)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"d",sizeof(double),name,value);
+}
+
+int OpenROBO_Message_SetParam_doubleArray(OpenROBO_MessageBuilder_t *builder, const char *name, const double *values, unsigned int n)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"d",sizeof(double)*n,name,values);
+}
+
+int OpenROBO_Message_SetParam_int(OpenROBO_MessageBuilder_t *builder, const char *name, const int *value)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"i",sizeof(int),name,value);
+}
+
+int OpenROBO_Message_SetParam_intArray(OpenROBO_MessageBuilder_t *builder, const char *name, const int *values, unsigned int n)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"i",sizeof(int)*n,name,values);
+}
+
+int OpenROBO_Message_SetParam_byteArray(OpenROBO_MessageBuilder_t *builder, const char *name, const unsigned char *values, unsigned int n)
+{
+  return OpenROBO_MessageBuilder_setParam(builder,"b",sizeof(unsigned char)*n,name,values);
+}
+
+int OpenROBO_Message_SetReturnValue(OpenROBO_MessageBuilder_t *builder, int value)
+{
+  return OpenROBO_Message_SetParam_int(builder, OpenROBO_Message_paramName_return, &value);
 }
 
 void OpenROBO_Message_SetParam_string(char *message, const char *name, const char *str)
 {
-  OpenROBO_Message_SetParam(message,"s",sizeof(char),name,str);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_string(&builder, name, str);
 }
 
 void OpenROBO_Message_SetSubject(char* message, const char* subject)
@@ -2017,32 +9669,44 @@ static void OpenROBO_Message_setDestinationID(char* message, const char* destina
 
 void OpenROBO_Message_SetParam_TMatrix(char *message, const char *name, const double TMatrix[4][4])
 {
-  OpenROBO_Message_SetParam(message,"d",sizeof(double[4][4]),name,TMatrix);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_TMatrix(&builder, name, TMatrix);
 }
 
 void OpenROBO_Message_SetParam_double(char *message, const char *name, const double *value)
 {
-  OpenROBO_Message_SetParam(message,"d",sizeof(double),name,value);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_double(&builder, name, value);
 }
 
 void OpenROBO_Message_SetParam_doubleArray(char *message,const char *name,const double *values, unsigned int n)
 {
-  OpenROBO_Message_SetParam(message,"d",sizeof(double)*n,name,values);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_doubleArray(&builder, name, values, n);
 }
 
 void OpenROBO_Message_SetParam_int(char *message, const char *name, const int *value)
 {
-  OpenROBO_Message_SetParam(message,"i",sizeof(int),name,value);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_int(&builder, name, value);
 }
 
 void OpenROBO_Message_SetParam_intArray(char *message,const char *name,const int *values, unsigned int n)
 {
-  OpenROBO_Message_SetParam(message,"i",sizeof(int)*n,name,values);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_intArray(&builder, name, values, n);
 }
 
 void OpenROBO_Message_SetParam_byteArray(char *message,const char *name,const unsigned char *values, unsigned int n)
 {
-  OpenROBO_Message_SetParam(message,"b",sizeof(unsigned char)*n,name,values);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_wrap(&builder, message);
+  OpenROBO_Message_SetParam_byteArray(&builder, name, values, n);
 }
 
 void OpenROBO_Message_SetReturnValue(char *message, int value)
@@ -2076,10 +9740,20 @@ int OpenROBO_Message_buffer_realloc(struct _OpenROBO_Message_buffer* buf, size_t
   return OpenROBO_Return_Success;
 }
 
+static int OpenROBO_MessageBuilder_makeMessage(OpenROBO_MessageBuilder_t *builder, const char* header, const char* subject)
+{
+  OpenROBO_MessageBuilder_Clear(builder);
+  if (OpenROBO_MessageBuilder_append(builder, header, strlen(header)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Message_SetSubject(builder, subject);
+}
+
 static void OpenROBO_Message_makeMessage(char *message, const char* header, const char* subject)
 {
-  strcpy(message, header);
-  OpenROBO_Message_SetSubject(message, subject);
+  OpenROBO_MessageBuilder_t builder;
+  OpenROBO_MessageBuilder_InitWithBuffer(&builder, message, SIZE_MAX);
+  OpenROBO_MessageBuilder_makeMessage(&builder, header, subject);
 }
 
 void OpenROBO_Message_MakeOperationMessage(char *message, const char* subject)
@@ -2112,9 +9786,129 @@ void OpenROBO_Message_MakeWriteMessage(char *message, const char* subject)
   OpenROBO_Message_makeMessage(message, OpenROBO_MessageHeader_Write, subject);
 }
 
+void OpenROBO_Message_MakeReadIfNewerMessage(char *message, const char* subject, unsigned int version)
+{
+  int versionParam = (int)version;
+  OpenROBO_Message_makeMessage(message, OpenROBO_MessageHeader_Read, subject);
+  OpenROBO_Message_SetParam_int(message, OpenROBO_Message_paramName_version, &versionParam);
+}
+
+void OpenROBO_Message_MakeSubscribeMessage(char *message, const char* subject, int intervalMsec)
+{
+  OpenROBO_Message_makeMessage(message, OpenROBO_MessageHeader_Subscribe, subject);
+  OpenROBO_Message_SetParam_int(message, OpenROBO_Message_paramName_interval, &intervalMsec);
+}
+
+int OpenROBO_Message_MakeOperationMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Start, subject);
+}
+
+int OpenROBO_Message_MakeWaitMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Wait, subject);
+}
+
+int OpenROBO_Message_MakeStopMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Stop, subject);
+}
+
+int OpenROBO_Message_MakeReturnMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Return, subject);
+}
+
+int OpenROBO_Message_MakeReadMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Read, subject);
+}
+
+int OpenROBO_Message_MakeWriteMessage(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Write, subject);
+}
+
+int OpenROBO_Message_MakeReadIfNewerMessage(OpenROBO_MessageBuilder_t *builder, const char* subject, unsigned int version)
+{
+  int versionParam = (int)version;
+  if (OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Read, subject) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Message_SetParam_int(builder, OpenROBO_Message_paramName_version, &versionParam);
+}
+
+int OpenROBO_Message_MakeSubscribeMessage(OpenROBO_MessageBuilder_t *builder, const char* subject, int intervalMsec)
+{
+  if (OpenROBO_MessageBuilder_makeMessage(builder, OpenROBO_MessageHeader_Subscribe, subject) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  return OpenROBO_Message_SetParam_int(builder, OpenROBO_Message_paramName_interval, &intervalMsec);
+}
+
+int OpenROBO_Message_MakeBatchReadMessage(OpenROBO_MessageBuilder_t *builder, const char* const subjects[], const unsigned int versions[], size_t n)
+{
+  size_t i;
+  OpenROBO_MessageBuilder_Clear(builder);
+  if (n == 0 || OpenROBO_MessageBuilder_append(builder, OpenROBO_MessageHeader_Read, strlen(OpenROBO_MessageHeader_Read)) != OpenROBO_Return_Success) {
+    return OpenROBO_Return_Error;
+  }
+  for (i = 0; i < n; i++) {
+    if (OpenROBO_Message_AppendBatchSubject(builder, subjects[i]) != OpenROBO_Return_Success) {
+      return OpenROBO_Return_Error;
+    }
+    if (versions != NULL && versions[i] != 0) {
+      int versionParam = (int)versions[i];
+      if (OpenROBO_Message_SetParam_int(builder, OpenROBO_Message_paramName_version, &versionParam) != OpenROBO_Return_Success) {
+        return OpenROBO_Return_Error;
+      }
+    }
+  }
+  return OpenROBO_Return_Success;
+}
+
+int OpenROBO_Message_AppendBatchSubject(OpenROBO_MessageBuilder_t *builder, const char* subject)
+{
+  return OpenROBO_Message_SetSubject(builder, subject);
+}
+
+int OpenROBO_Message_GetBatchEntry(const char *message, const char *subject, OpenROBO_MessageBuilder_t *entry)
+{
+  size_t subjectSize = strlen(subject);
+  size_t pos = strlen(OpenROBO_MessageHeader_Return), begin, end;
+  OpenROBO_MessageViewEntry_t subjectEntry;
+
+  if (OpenROBO_Message_GetMessageType(message) != OpenROBO_MessageType_Return) {
+    return OpenROBO_Return_Error;
+  }
+  // 目的の区間より後ろは辿らない
+  while (OpenROBO_Message_nextSection(message, SIZE_MAX, &pos, &subjectEntry, &begin, &end)) {
+    OpenROBO_MessageViewEntry_t returnEntry;
+    int value = OpenROBO_Return_Error;
+    if (subjectEntry.valueSize != subjectSize || memcmp(&message[subjectEntry.valueOffset], subject, subjectSize) != 0) {
+      continue;
+    }
+    if (end == SIZE_MAX) {
+      end = begin + OpenROBO_Message_measure(&message[begin], SIZE_MAX, NULL);
+    }
+    OpenROBO_MessageBuilder_Clear(entry);
+    if (OpenROBO_MessageBuilder_append(entry, OpenROBO_MessageHeader_Return, strlen(OpenROBO_MessageHeader_Return)) != OpenROBO_Return_Success ||
+        OpenROBO_MessageBuilder_append(entry, &message[begin], end - begin) != OpenROBO_Return_Success) {
+      return OpenROBO_Return_Error;
+    }
+    if (OpenROBO_Message_findParamWithin(message, subjectEntry.valueOffset + subjectEntry.valueSize, end, OpenROBO_Message_paramName_return, &returnEntry) == OpenROBO_Return_Success) {
+      OpenROBO_Message_decodeInts(message, &returnEntry, &value, 1);
+    }
+    return value;
+  }
+  return OpenROBO_Return_NoValue;
+}
+
 int OpenROBO_Message_GetMessageType(const char *message)
 {
-    if (message[0] == OpenROBO_MessageHeader_Start[0]) {
+    if (message[0] == OpenROBO_MessageHeader_Subscribe[0] && message[1] == OpenROBO_MessageHeader_Subscribe[1]) {
+      return OpenROBO_MessageType_Subscribe;
+    } else if (message[0] == OpenROBO_MessageHeader_Start[0]) {
       return OpenROBO_MessageType_Start;
     } else if (message[0] == OpenROBO_MessageHeader_Return[0]) {
       return OpenROBO_MessageType_Return;
@@ -2126,6 +9920,8 @@ int OpenROBO_Message_GetMessageType(const char *message)
       return OpenROBO_MessageType_Read;
     } else if (message[0] == OpenROBO_MessageHeader_Write[0]) {
       return OpenROBO_MessageType_Write;
+    } else if (message[0] == OpenROBO_MessageHeader_Bind[0]) {
+      return OpenROBO_MessageType_Bind;
     }
 
     return -1;
@@ -2135,108 +9931,393 @@ int OpenROBO_Message_GetMessageType(const char *message)
    OpenROBO_ReadWrite
 
    Thanks for Hatada's Home Page (http://home.a00.itscom.net/hatada/c-tips/hash01.html)
+
+   複数のスレッドから読み書きできるように、keyのhashでOPENROBO_READWRITEMEMORY_SHARDS個のshardに分け、
+   shardごとにreader-writer lockを持つ。読み込み同士は並行し、書き込みは同じshardだけを止める。
+   値はRead Messageへの返答をそのまま持つ参照カウント付きの書き換えないバッファで、
+   書き込みはポインタの差し替え、読み込みは参照を増やしてそのまま送る
    _/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/_/ */
 
 typedef struct {
-  char key[OPENROBO_SUBSYSTEM_ID_SIZE+32+2];
-  const char *message;
+  char key[OPENROBO_FUNCTION_NAME_SIZE]; // keyはsubjectなので関数名と同じ長さまで
+  OpenROBO_ReadWriteMemory_Value_t *value;
 } OpenROBO_ReadWriteMemory_Data_t;
 
-OpenROBO_ReadWriteMemory_Data_t *OpenROBO_ReadWriteMemory_hashTable;
-int OpenROBO_ReadWriteMemory_hashSize;
-int OpenROBO_ReadWriteMemory_entries;
+typedef struct {
+  OpenROBO_RWLock_t lock;
+  OpenROBO_ReadWriteMemory_Data_t *hashTable;
+  int hashSize;
+  int entries;
+} OpenROBO_ReadWriteMemory_Shard_t;
 
-int OpenROBO_ReadWriteMemory_init(int size)
+static OpenROBO_ReadWriteMemory_Shard_t OpenROBO_ReadWriteMemory_shards[OPENROBO_READWRITEMEMORY_SHARDS];
+
+static OpenROBO_ReadWriteMemory_Data_t* OpenROBO_ReadWriteMemory_allocTable(int size)
 {
   int i;
-  OpenROBO_ReadWriteMemory_hashSize = size;
-  OpenROBO_ReadWriteMemory_hashTable = (OpenROBO_ReadWriteMemory_Data_t*)OpenROBO_malloc(sizeof(OpenROBO_ReadWriteMemory_Data_t) * OpenROBO_ReadWriteMemory_hashSize);
-  if (OpenROBO_ReadWriteMemory_hashTable == NULL) {
-    return OpenROBO_Return_Error;
+  OpenROBO_ReadWriteMemory_Data_t *table = (OpenROBO_ReadWriteMemory_Data_t*)OpenROBO_malloc(sizeof(OpenROBO_ReadWriteMemory_Data_t) * size);
+  if (table == NULL) {
+    return NULL;
   }
 
   // init
   for (i = 0; i < size; i++) {
-    OpenROBO_ReadWriteMemory_hashTable[i].key[0] = '\0';
+    table[i].key[0] = '\0';
+    table[i].value = NULL;
   }
 
-  OpenROBO_ReadWriteMemory_entries = 0;
+  return table;
+}
+
+int OpenROBO_ReadWriteMemory_init(int size)
+{
+  int i;
+  size /= OPENROBO_READWRITEMEMORY_SHARDS;
+  if (size < 8) {
+    size = 8;
+  }
+  for (i = 0; i < OPENROBO_READWRITEMEMORY_SHARDS; i++) {
+    OpenROBO_ReadWriteMemory_Shard_t *shard = &OpenROBO_ReadWriteMemory_shards[i];
+    shard->hashTable = OpenROBO_ReadWriteMemory_allocTable(size);
+    if (shard->hashTable == NULL) {
+      return OpenROBO_Return_Error;
+    }
+    OpenROBO_RWLock_init(&shard->lock);
+    shard->hashSize = size;
+    shard->entries = 0;
+  }
 
   return OpenROBO_Return_Success;
 }
 
-void OpenROBO_ReadWriteMemory_realloc(int newSize)
+static unsigned int OpenROBO_ReadWriteMemory_hash(const char *key)
+{
+    unsigned int n, h = 0;
+    for (n = 0; key[n] != '\0'; n++) {
+        h = h * 137 + (key[n]&0xff);
+    }
+    return h;
+}
+
+/*
+   keyの位置、なければ空いている位置を返す(shardのlockを取ってから呼ぶ)
+*/
+static int OpenROBO_ReadWriteMemory_find(const OpenROBO_ReadWriteMemory_Shard_t *shard, const char *key, unsigned int h)
+{
+  int n;
+  for (n = 0; n < shard->hashSize; n++) {
+    int ix = (int)((h / OPENROBO_READWRITEMEMORY_SHARDS + n) % shard->hashSize);
+    if (shard->hashTable[ix].key[0] == '\0' || strcmp(shard->hashTable[ix].key, key) == 0) {
+      return ix;
+    }
+  }
+  return -1;
+}
+
+/*
+   shardの表を大きくする(shardの書き込みlockを取ってから呼ぶ)
+*/
+static void OpenROBO_ReadWriteMemory_realloc(OpenROBO_ReadWriteMemory_Shard_t *shard, int newSize)
 {
-    DBGPRINTF("OpenROBO_ReadWriteMemory_realloc: %d -> %d [%d]\n", OpenROBO_ReadWriteMemory_hashSize, newSize, OpenROBO_ReadWriteMemory_entries);
-    OpenROBO_ReadWriteMemory_Data_t *oldTable = OpenROBO_ReadWriteMemory_hashTable;
-    int oldSize = OpenROBO_ReadWriteMemory_hashSize;
-    OpenROBO_ReadWriteMemory_init(newSize);
+    OpenROBO_ReadWriteMemory_Data_t *oldTable = shard->hashTable;
+    int oldSize = shard->hashSize;
     int n;
+    DBGPRINTF("OpenROBO_ReadWriteMemory_realloc: %d -> %d [%d]\n", oldSize, newSize, shard->entries);
+    shard->hashTable = OpenROBO_ReadWriteMemory_allocTable(newSize);
+    if (shard->hashTable == NULL) {
+        shard->hashTable = oldTable;
+        return;
+    }
+    shard->hashSize = newSize;
     for (n = 0; n < oldSize; n++) {
         if (oldTable[n].key[0] != '\0') {
-            OpenROBO_ReadWriteMemory_put(oldTable[n].key, oldTable[n].message);
+            int ix = OpenROBO_ReadWriteMemory_find(shard, oldTable[n].key, OpenROBO_ReadWriteMemory_hash(oldTable[n].key));
+            shard->hashTable[ix] = oldTable[n];
         }
     }
-    free(oldTable);
+    OpenROBO_free(oldTable);
 }
 
-int OpenROBO_ReadWriteMemory_hash(const char *key)
+/*
+   値のversionは書き込みの順に振る。makeValue()はメインスレッドだけが呼ぶ
+*/
+static unsigned int OpenROBO_ReadWriteMemory_lastVersion = 0;
+
+/*
+   versionがthanより後に書き込まれたものか(桁あふれしても差で比べる)
+*/
+static int OpenROBO_ReadWriteMemory_isNewer(unsigned int version, unsigned int than)
 {
-    int n, h = 0;
-    for (n = 0; key[n] != '\0'; n++) {
-        h = (h * 137 + (key[n]&0xff)) % OpenROBO_ReadWriteMemory_hashSize;
-    }
-    return h;
+  return (int)(version - than) > 0;
 }
 
-int OpenROBO_ReadWriteMemory_put(const char *key, const char *message)
+/*
+   Write Messageのパラメータ(paramsからparamsSize)から値を作る(受信したメッセージからのコピーはここでの1回だけ)
+*/
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_makeValueFrom(const char *key, const char *params, size_t paramsSize)
 {
-  double time = (double)clock()/(double)CLOCKS_PER_SEC;
-  int n, h = OpenROBO_ReadWriteMemory_hash(key);
-  char *new_message = (char *)OpenROBO_malloc(strlen(message)+sizeof(char)*32);
-  if (new_message == NULL) {
+  double time = OpenROBO_getMonotonicTime();
+  unsigned int version = ++OpenROBO_ReadWriteMemory_lastVersion;
+  int versionParam;
+  char prefixBuffer[OPENROBO_FUNCTION_NAME_SIZE+64];
+  OpenROBO_MessageBuilder_t prefix, frame;
+  OpenROBO_ReadWriteMemory_Value_t *value;
+  size_t capacity;
+
+  OpenROBO_MessageBuilder_InitWithBuffer(&prefix, prefixBuffer, sizeof(prefixBuffer));
+  if (OpenROBO_Message_MakeReturnMessage(&prefix, key) != OpenROBO_Return_Success ||
+      OpenROBO_Message_SetReturnValue(&prefix, OpenROBO_Return_Success) != OpenROBO_Return_Success) {
+    OpenROBO_MessageBuilder_Term(&prefix);
+    return NULL;
+  }
+
+  capacity = prefix.size + paramsSize + sizeof(char)*64;
+  value = (OpenROBO_ReadWriteMemory_Value_t *)OpenROBO_malloc(offsetof(OpenROBO_ReadWriteMemory_Value_t, frame) + capacity);
+  if (value == NULL) {
     DBGPRINTF("Error: OpenROBO_malloc");
     DBGABORT();
+    OpenROBO_MessageBuilder_Term(&prefix);
+    return NULL;
+  }
+  OpenROBO_MessageBuilder_InitWithBuffer(&frame, value->frame, capacity);
+  OpenROBO_MessageBuilder_append(&frame, prefix.p, prefix.size);
+  OpenROBO_MessageBuilder_append(&frame, params, paramsSize);
+  if (version == 0) {
+    version = ++OpenROBO_ReadWriteMemory_lastVersion;
+  }
+  versionParam = (int)version;
+  OpenROBO_Message_SetParam_double(&frame, OpenROBO_Message_paramName_time, &time);
+  OpenROBO_Message_SetParam_int(&frame, OpenROBO_Message_paramName_version, &versionParam);
+  OpenROBO_MessageBuilder_Term(&prefix);
+  if (frame.owned) { // capacityに収まらなかった
+    OpenROBO_MessageBuilder_Term(&frame);
+    OpenROBO_free(value);
+    return NULL;
+  }
+
+  value->refs = 1;
+  value->version = version;
+  value->time = time;
+  value->size = OpenROBO_Message_measure(value->frame, SIZE_MAX, &value->hasBinary);
+  return value;
+}
+
+/*
+   メッセージの長さ(size)から、末尾に付いた送り元と送り先("#src","#dst")を除いた長さを返す
+*/
+static size_t OpenROBO_Message_measureWithoutRoute(const char *message, size_t size)
+{
+  OpenROBO_MessageViewEntry_t entry;
+  if (OpenROBO_Message_findParam(message, 0, OpenROBO_Message_paramName_sourceID, &entry) == OpenROBO_Return_Success && entry.nameOffset - 1 < size) {
+    size = entry.nameOffset - 1;
+  }
+  if (OpenROBO_Message_findParam(message, 0, OpenROBO_Message_paramName_destinationID, &entry) == OpenROBO_Return_Success && entry.nameOffset - 1 < size) {
+    size = entry.nameOffset - 1;
+  }
+  return size;
+}
+
+/*
+   1つの値のWrite Messageから値を作る
+   "#subject"より後ろから送り元と送り先の前までをパラメータとし、バッチのWriteと同じ形の返答にする
+*/
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_makeValue(const char *key, const char *message)
+{
+  OpenROBO_MessageViewEntry_t subject;
+  size_t begin, end;
+  if (OpenROBO_Message_findParam(message, strlen(OpenROBO_MessageHeader_Write), OpenROBO_Message_paramName_subject, &subject) != OpenROBO_Return_Success) {
+    return NULL;
+  }
+  begin = subject.valueOffset + subject.valueSize;
+  end = OpenROBO_Message_measureWithoutRoute(message, OpenROBO_Message_measure(message, SIZE_MAX, NULL));
+  if (end < begin) {
+    end = begin;
+  }
+  return OpenROBO_ReadWriteMemory_makeValueFrom(key, &message[begin], end - begin);
+}
+
+static void OpenROBO_ReadWriteMemory_release(OpenROBO_ReadWriteMemory_Value_t *value)
+{
+  if (value != NULL && OpenROBO_Atomic_decrement(&value->refs) == 0) {
+    OpenROBO_free(value);
+  }
+}
+
+/*
+   書き込みロックを取ったshardでkeyの値をvalueに差し替える(valueの参照は表に移る)
+   ReadWritePoolのworkerが前後して格納する場合に備え、既に新しいversionの値があれば差し替えない
+   外した値(差し替えなかった場合はvalue)を*releasedに入れるので、ロックを外してから解放する
+*/
+static int OpenROBO_ReadWriteMemory_store(OpenROBO_ReadWriteMemory_Shard_t *shard, const char *key, unsigned int h, OpenROBO_ReadWriteMemory_Value_t *value, OpenROBO_ReadWriteMemory_Value_t **released)
+{
+  int ix;
+  *released = NULL;
+  if (strlen(key) >= sizeof(shard->hashTable[0].key)) {
+    *released = value;
+    DBGPRINTF("Error: OpenROBO_ReadWriteMemory key too long");
+    return -1;
+  }
+  ix = OpenROBO_ReadWriteMemory_find(shard, key, h);
+  if (ix < 0) {
+    *released = value;
+    DBGPRINTF("Error: OpenROBO_ReadWriteMemory_hash Table Full");
+    DBGABORT();
     return -1;
   }
-  strcpy(new_message, &message[sizeof(OpenROBO_MessageHeader_Write)]);
-  OpenROBO_Message_setTime(new_message, time);
+  if (shard->hashTable[ix].key[0] == '\0') {
+    // new entry
+    strcpy(shard->hashTable[ix].key, key);
+    shard->hashTable[ix].value = value;
+    shard->entries++;
+    if (shard->entries * 3 > shard->hashSize * 2) {
+      OpenROBO_ReadWriteMemory_realloc(shard, shard->hashSize * 3 / 2);
+    }
+  } else {
+    // exist, update
+    *released = shard->hashTable[ix].value;
+    if (OpenROBO_ReadWriteMemory_isNewer(value->version, (*released)->version)) {
+      shard->hashTable[ix].value = value;
+    } else {
+      *released = value;
+    }
+  }
+  return ix;
+}
 
-  for (n = 0; n < OpenROBO_ReadWriteMemory_hashSize; n++) {
-    int ix = (h + n) % OpenROBO_ReadWriteMemory_hashSize;
-    if (OpenROBO_ReadWriteMemory_hashTable[ix].key[0] == '\0') {
-      // new entry
-      strcpy(OpenROBO_ReadWriteMemory_hashTable[ix].key, key);
-      OpenROBO_ReadWriteMemory_hashTable[ix].message = new_message;
-      OpenROBO_ReadWriteMemory_entries++;
-      if (OpenROBO_ReadWriteMemory_entries * 3 > OpenROBO_ReadWriteMemory_hashSize * 2) {
-        OpenROBO_ReadWriteMemory_realloc(OpenROBO_ReadWriteMemory_hashSize * 3 / 2);
-      }
-      return ix;
-    } else if (strcmp(OpenROBO_ReadWriteMemory_hashTable[ix].key, key) == 0) {
-      // exist, update
-      OpenROBO_free((void *)OpenROBO_ReadWriteMemory_hashTable[ix].message);
-      OpenROBO_ReadWriteMemory_hashTable[ix].message = new_message;
-      return ix;
+/*
+   keyの値をvalueに差し替える(valueの参照は表に移る)
+*/
+static int OpenROBO_ReadWriteMemory_put(const char *key, OpenROBO_ReadWriteMemory_Value_t *value)
+{
+  unsigned int h = OpenROBO_ReadWriteMemory_hash(key);
+  OpenROBO_ReadWriteMemory_Shard_t *shard = &OpenROBO_ReadWriteMemory_shards[h % OPENROBO_READWRITEMEMORY_SHARDS];
+  OpenROBO_ReadWriteMemory_Value_t *released;
+  int ix;
+
+  if (value == NULL) {
+    return -1;
+  }
+
+  OpenROBO_RWLock_writeLock(&shard->lock);
+  ix = OpenROBO_ReadWriteMemory_store(shard, key, h, value, &released);
+  OpenROBO_RWLock_writeUnlock(&shard->lock);
+
+  OpenROBO_ReadWriteMemory_release(released);
+  return ix;
+}
+
+/*
+   読み込みロックを取ったshardからkeyの値の参照を返す
+*/
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_lookup(const OpenROBO_ReadWriteMemory_Shard_t *shard, const char *key, unsigned int h)
+{
+  OpenROBO_ReadWriteMemory_Value_t *value = NULL;
+  int ix = OpenROBO_ReadWriteMemory_find(shard, key, h);
+  if (ix >= 0 && shard->hashTable[ix].key[0] != '\0') {
+    // found
+    value = shard->hashTable[ix].value;
+    OpenROBO_Atomic_increment(&value->refs);
+  }
+  return value;
+}
+
+/*
+   keyの値の参照を返す(使い終わったらOpenROBO_ReadWriteMemory_release()を呼ぶ)
+   まだ書き込まれていない場合はNULLを返す
+*/
+static OpenROBO_ReadWriteMemory_Value_t* OpenROBO_ReadWriteMemory_acquire(const char *key)
+{
+  unsigned int h = OpenROBO_ReadWriteMemory_hash(key);
+  OpenROBO_ReadWriteMemory_Shard_t *shard = &OpenROBO_ReadWriteMemory_shards[h % OPENROBO_READWRITEMEMORY_SHARDS];
+  OpenROBO_ReadWriteMemory_Value_t *value;
+
+  OpenROBO_RWLock_readLock(&shard->lock);
+  value = OpenROBO_ReadWriteMemory_lookup(shard, key, h);
+  OpenROBO_RWLock_readUnlock(&shard->lock);
+
+  return value;
+}
+
+/*
+   複数のkeyをまとめて読み書きする際は、関係するshardのロックをすべて番号の順に取ってから触る。
+   まとめて書き込まれた値は、まとめて読むと揃って見える
+*/
+static void OpenROBO_ReadWriteMemory_lockShards(const char *const keys[], size_t n, unsigned int hashes[], int write)
+{
+  char used[OPENROBO_READWRITEMEMORY_SHARDS];
+  size_t i;
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < n; i++) {
+    hashes[i] = OpenROBO_ReadWriteMemory_hash(keys[i]);
+    used[hashes[i] % OPENROBO_READWRITEMEMORY_SHARDS] = 1;
+  }
+  for (i = 0; i < OPENROBO_READWRITEMEMORY_SHARDS; i++) {
+    if (!used[i]) {
+      continue;
+    }
+    if (write) {
+      OpenROBO_RWLock_writeLock(&OpenROBO_ReadWriteMemory_shards[i].lock);
+    } else {
+      OpenROBO_RWLock_readLock(&OpenROBO_ReadWriteMemory_shards[i].lock);
     }
   }
-  DBGPRINTF("Error: OpenROBO_ReadWriteMemory_hash Table Full");
-  DBGABORT();
-  return -1;
 }
 
-const char *OpenROBO_ReadWriteMemory_get(const char *key)
+static void OpenROBO_ReadWriteMemory_unlockShards(const unsigned int hashes[], size_t n, int write)
 {
-  int n, h = OpenROBO_ReadWriteMemory_hash(key);
-  for (n = 0; n < OpenROBO_ReadWriteMemory_hashSize; n++) {
-    int ix = (h + n) % OpenROBO_ReadWriteMemory_hashSize;
-    if (OpenROBO_ReadWriteMemory_hashTable[ix].key[0] == '\0') {
-      // not exist
-      return NULL;
-    } else if (strcmp(OpenROBO_ReadWriteMemory_hashTable[ix].key, key) == 0) {
-      // found
-      return OpenROBO_ReadWriteMemory_hashTable[ix].message;
+  char used[OPENROBO_READWRITEMEMORY_SHARDS];
+  size_t i;
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < n; i++) {
+    used[hashes[i] % OPENROBO_READWRITEMEMORY_SHARDS] = 1;
+  }
+  for (i = OPENROBO_READWRITEMEMORY_SHARDS; i > 0; i--) {
+    if (!used[i-1]) {
+      continue;
+    }
+    if (write) {
+      OpenROBO_RWLock_writeUnlock(&OpenROBO_ReadWriteMemory_shards[i-1].lock);
+    } else {
+      OpenROBO_RWLock_readUnlock(&OpenROBO_ReadWriteMemory_shards[i-1].lock);
     }
   }
-  return NULL;
+}
+
+/*
+   keysの値の参照をまとめてvaluesに返す(書き込まれていないkeyはNULL)
+   hashesはn個の作業領域
+*/
+static void OpenROBO_ReadWriteMemory_acquireAll(const char *const keys[], size_t n, unsigned int hashes[], OpenROBO_ReadWriteMemory_Value_t *values[])
+{
+  size_t i;
+  OpenROBO_ReadWriteMemory_lockShards(keys, n, hashes, 0);
+  for (i = 0; i < n; i++) {
+    values[i] = OpenROBO_ReadWriteMemory_lookup(&OpenROBO_ReadWriteMemory_shards[hashes[i] % OPENROBO_READWRITEMEMORY_SHARDS], keys[i], hashes[i]);
+  }
+  OpenROBO_ReadWriteMemory_unlockShards(hashes, n, 0);
+}
+
+/*
+   keysの値をまとめてvaluesに差し替える(valuesの参照は表に移る。NULLのkeyは書き込まない)
+
+   @return 書き込めなかったkeyの数
+*/
+static int OpenROBO_ReadWriteMemory_putAll(const char *const keys[], size_t n, unsigned int hashes[], OpenROBO_ReadWriteMemory_Value_t *values[])
+{
+  size_t i;
+  int failed = 0;
+  OpenROBO_ReadWriteMemory_lockShards(keys, n, hashes, 1);
+  for (i = 0; i < n; i++) {
+    if (values[i] == NULL ||
+        OpenROBO_ReadWriteMemory_store(&OpenROBO_ReadWriteMemory_shards[hashes[i] % OPENROBO_READWRITEMEMORY_SHARDS], keys[i], hashes[i], values[i], &values[i]) < 0) {
+      failed++;
+    }
+  }
+  OpenROBO_ReadWriteMemory_unlockShards(hashes, n, 1);
+  // 外した値を解放する
+  for (i = 0; i < n; i++) {
+    OpenROBO_ReadWriteMemory_release(values[i]);
+    values[i] = NULL;
+  }
+  return failed;
 }